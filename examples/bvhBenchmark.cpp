@@ -0,0 +1,731 @@
+#include <Math/Math.h>
+#include <Math/HAccelerate>
+#include <Math/CompactGrid.h>
+#include <Math/GraphicUtils/TriangleMesh.h>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <tuple>
+
+using namespace MathLib;
+
+double ElapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// clustered soup: dense props of small triangles sitting on a coarse ground plane, plus long thin debris
+MeshTool::TriangleMesh<uint32_t> MakeClusteredSoup(const uint32_t propCount, const uint32_t trianglesPerProp)
+{
+    std::mt19937 random(17);
+    std::uniform_real_distribution<HReal> unit(0, 1);
+    std::normal_distribution<HReal> normal(0, 1);
+    std::vector<HVector3> vertices;
+    std::vector<uint32_t> indices;
+    auto addTriangle = [&](const HVector3 &a, const HVector3 &b, const HVector3 &c)
+    {
+        const uint32_t first = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(a);
+        vertices.push_back(b);
+        vertices.push_back(c);
+        indices.insert(indices.end(), {first, first + 1, first + 2});
+    };
+
+    const uint32_t groundCells = 64;
+    const HReal cell = 1000.f / groundCells;
+    for (uint32_t y = 0; y < groundCells; y++)
+        for (uint32_t x = 0; x < groundCells; x++)
+        {
+            const HVector3 corner(x * cell, y * cell, 0);
+            addTriangle(corner, corner + HVector3(cell, 0, 0), corner + HVector3(cell, cell, 0));
+            addTriangle(corner, corner + HVector3(cell, cell, 0), corner + HVector3(0, cell, 0));
+        }
+    for (uint32_t prop = 0; prop < propCount; prop++)
+    {
+        const HVector3 center(unit(random) * 1000, unit(random) * 1000, 5 + unit(random) * 20);
+        const HReal size = 2 + unit(random) * 8;
+        for (uint32_t i = 0; i < trianglesPerProp; i++)
+        {
+            const HVector3 p = center + HVector3(normal(random), normal(random), normal(random)) * size;
+            addTriangle(p, p + HVector3(normal(random), normal(random), normal(random)) * 0.3f,
+                        p + HVector3(normal(random), normal(random), normal(random)) * 0.3f);
+        }
+    }
+    for (uint32_t i = 0; i < propCount * 4; i++)
+    {
+        const HVector3 p(unit(random) * 1000, unit(random) * 1000, unit(random) * 30);
+        addTriangle(p, p + HVector3(normal(random), normal(random), 0) * 60, p + HVector3(0, 0, 0.2f));
+    }
+    return MeshTool::TriangleMesh<uint32_t>(vertices, indices);
+}
+
+bool RayHitsBox(const HVector3 &origin, const HVector3 &inverseDirection, const HAABBox3D &box, const HReal tMax, HReal &tEntry)
+{
+    const HVector3 t0 = (box.min() - origin).cwiseProduct(inverseDirection);
+    const HVector3 t1 = (box.max() - origin).cwiseProduct(inverseDirection);
+    tEntry = std::max(t0.cwiseMin(t1).maxCoeff(), HReal(0));
+    return tEntry <= std::min(t0.cwiseMax(t1).minCoeff(), tMax);
+}
+
+struct QueryStats
+{
+    double mMs = 0;
+    uint64_t mNodes = 0;
+    uint64_t mPrimitives = 0;
+    uint64_t mHits = 0;
+};
+
+// closest primitive box along every ray, nearer child first
+QueryStats TraceRays(const std::vector<TreeNode<HAABBox3D>> &nodes, const std::vector<HAABBox3D> &boxes,
+                     const std::vector<HVector3> &origins, const std::vector<HVector3> &directions)
+{
+    QueryStats stats;
+    std::vector<uint32_t> stack;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < origins.size(); r++)
+    {
+        const HVector3 inverseDirection = directions[r].cwiseInverse();
+        HReal closest = H_REAL_MAX, tEntry;
+        stack.assign(1, 0u);
+        while (!stack.empty())
+        {
+            const TreeNode<HAABBox3D> &node = nodes[stack.back()];
+            stack.pop_back();
+            stats.mNodes++;
+            if (!RayHitsBox(origins[r], inverseDirection, node.m_bbox, closest, tEntry))
+                continue;
+            if (node.IsLeaf())
+            {
+                for (uint32_t i = node.m_Index; i < node.m_End; i++)
+                {
+                    stats.mPrimitives++;
+                    if (RayHitsBox(origins[r], inverseDirection, boxes[i], closest, tEntry))
+                        closest = tEntry;
+                }
+                continue;
+            }
+            HReal leftEntry, rightEntry;
+            const bool left = RayHitsBox(origins[r], inverseDirection, nodes[node.m_Index].m_bbox, closest, leftEntry);
+            const bool right = RayHitsBox(origins[r], inverseDirection, nodes[node.m_Index + 1].m_bbox, closest, rightEntry);
+            if (left && right)
+            {
+                stack.push_back(leftEntry < rightEntry ? node.m_Index + 1 : node.m_Index);
+                stack.push_back(leftEntry < rightEntry ? node.m_Index : node.m_Index + 1);
+            }
+            else if (left || right)
+                stack.push_back(left ? node.m_Index : node.m_Index + 1);
+        }
+        stats.mHits += closest < H_REAL_MAX;
+    }
+    stats.mMs = ElapsedMs(start);
+    return stats;
+}
+
+QueryStats QueryBoxes(const std::vector<TreeNode<HAABBox3D>> &nodes, const std::vector<HAABBox3D> &boxes, const std::vector<HAABBox3D> &queries)
+{
+    QueryStats stats;
+    std::vector<uint32_t> stack;
+    const auto start = std::chrono::steady_clock::now();
+    for (const HAABBox3D &query : queries)
+    {
+        stack.assign(1, 0u);
+        while (!stack.empty())
+        {
+            const TreeNode<HAABBox3D> &node = nodes[stack.back()];
+            stack.pop_back();
+            stats.mNodes++;
+            if (!node.m_bbox.intersects(query))
+                continue;
+            if (!node.IsLeaf())
+            {
+                stack.push_back(node.m_Index);
+                stack.push_back(node.m_Index + 1);
+                continue;
+            }
+            for (uint32_t i = node.m_Index; i < node.m_End; i++)
+            {
+                stats.mPrimitives++;
+                stats.mHits += boxes[i].intersects(query);
+            }
+        }
+    }
+    stats.mMs = ElapsedMs(start);
+    return stats;
+}
+
+template <class BuildFunction>
+void BenchmarkBuilder(const char *name, const std::vector<HAABBox3D> &meshBoxes, const BuildFunction &build,
+                      const std::vector<HVector3> &origins, const std::vector<HVector3> &directions, const std::vector<HAABBox3D> &queries)
+{
+    std::vector<HAABBox3D> boxes = meshBoxes;
+    std::vector<TreeNode<HAABBox3D>> nodes;
+    const auto start = std::chrono::steady_clock::now();
+    build(boxes, nodes);
+    const double buildMs = ElapsedMs(start);
+
+    const TreeUtils::TreeQuality quality = TreeUtils::EvaluateTree(nodes);
+    printf("%s: build %.1f ms | SAH cost %.1f | %u nodes (%.2f MB), %u leaves, depth max %u avg %.1f | leaf sizes",
+           name, buildMs, quality.mSAHCost, quality.mNodeCount, double(nodes.size() * sizeof(TreeNode<HAABBox3D>)) / (1024.0 * 1024.0),
+           quality.mLeafCount, quality.mMaxDepth, quality.mAverageLeafDepth);
+    uint32_t largeLeaves = 0;
+    for (size_t size = 1; size < quality.mLeafSizeHistogram.size(); size++)
+    {
+        if (size > 8)
+            largeLeaves += quality.mLeafSizeHistogram[size];
+        else if (quality.mLeafSizeHistogram[size] > 0)
+            printf(" %zu:%u", size, quality.mLeafSizeHistogram[size]);
+    }
+    printf(largeLeaves > 0 ? " >8:%u (largest %zu)\n" : "\n", largeLeaves, quality.mLeafSizeHistogram.size() - 1);
+
+    const QueryStats rays = TraceRays(nodes, boxes, origins, directions);
+    const QueryStats overlaps = QueryBoxes(nodes, boxes, queries);
+    printf("    %zu rays %.1f ms (%.1f nodes, %.1f prims per ray, %llu hits) | %zu box queries %.1f ms (%.1f nodes, %.1f prims per query, %llu overlaps)\n",
+           origins.size(), rays.mMs, double(rays.mNodes) / origins.size(), double(rays.mPrimitives) / origins.size(),
+           static_cast<unsigned long long>(rays.mHits), queries.size(), overlaps.mMs, double(overlaps.mNodes) / queries.size(),
+           double(overlaps.mPrimitives) / queries.size(), static_cast<unsigned long long>(overlaps.mHits));
+}
+
+// the same queries through TreeUtils on TreeNode and through the compact layouts flattened from that tree
+template <class RayCast, class Overlaps>
+void BenchmarkLayout(const char *name, const size_t bytes, const std::vector<HVector3> &origins, const std::vector<HVector3> &directions,
+                     const std::vector<HAABBox3D> &queries, const RayCast &rayCast, const Overlaps &overlaps)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t hits = 0;
+    for (size_t r = 0; r < origins.size(); r++)
+        hits += rayCast(origins[r], directions[r]);
+    const double rayMs = ElapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    uint64_t found = 0;
+    for (const HAABBox3D &query : queries)
+        found += overlaps(query);
+    const double queryMs = ElapsedMs(start);
+    printf("  %-14s %7.2f MB | %zu rays %6.1f ms (%5.2f Mrays/s, %llu hits) | %zu box queries %6.1f ms (%llu overlaps)\n", name,
+           bytes / (1024.0 * 1024.0), origins.size(), rayMs, origins.size() / (rayMs * 1e3), static_cast<unsigned long long>(hits),
+           queries.size(), queryMs, static_cast<unsigned long long>(found));
+}
+
+void BenchmarkLayouts(const std::vector<HAABBox3D> &meshBoxes, const std::vector<HVector3> &origins, const std::vector<HVector3> &directions,
+                      const std::vector<HAABBox3D> &queries)
+{
+    std::vector<HAABBox3D> boxes = meshBoxes;
+    std::vector<TreeNode<HAABBox3D>> nodes;
+    TreeUtils::Builder::BuildSAHBVH(boxes, nodes);
+    const CompactBVH3D compact(nodes);
+    const QuantizedBVH3D quantized(nodes);
+    printf("node layouts of the binned SAH tree, %zu nodes\n", nodes.size());
+
+    // closest primitive box along the ray, the same primitive test for every layout
+    struct BoxHit
+    {
+        const std::vector<HAABBox3D> &mBoxes;
+        HVector3 mOrigin, mInverseDirection;
+        bool operator()(uint32_t slot, HReal tMax, HReal &t) const
+        {
+            return RayHitsBox(mOrigin, mInverseDirection, mBoxes[slot], tMax, t);
+        }
+    };
+    BenchmarkLayout(
+        "TreeNode", nodes.size() * sizeof(TreeNode<HAABBox3D>), origins, directions, queries,
+        [&](const HVector3 &origin, const HVector3 &direction)
+        {
+            RayHit hit;
+            return TreeUtils::RayCastClosest(nodes, origin, direction, hit, H_REAL_MAX, BoxHit{boxes, origin, direction.cwiseInverse()});
+        },
+        [&](const HAABBox3D &query)
+        {
+            uint32_t count = 0;
+            TreeUtils::QueryOverlaps(nodes, boxes, query, [&](uint32_t)
+                                     { count++; });
+            return count;
+        });
+    BenchmarkLayout(
+        "CompactNode", compact.GetMemorySize(), origins, directions, queries,
+        [&](const HVector3 &origin, const HVector3 &direction)
+        {
+            RayHit hit;
+            return compact.RayCastClosest(origin, direction, hit, H_REAL_MAX, BoxHit{boxes, origin, direction.cwiseInverse()});
+        },
+        [&](const HAABBox3D &query)
+        {
+            uint32_t count = 0;
+            compact.QueryOverlaps(boxes, query, [&](uint32_t)
+                                  { count++; });
+            return count;
+        });
+    BenchmarkLayout(
+        "QuantizedNode", quantized.GetMemorySize(), origins, directions, queries,
+        [&](const HVector3 &origin, const HVector3 &direction)
+        {
+            RayHit hit;
+            return quantized.RayCastClosest(origin, direction, hit, H_REAL_MAX, BoxHit{boxes, origin, direction.cwiseInverse()});
+        },
+        [&](const HAABBox3D &query)
+        {
+            uint32_t count = 0;
+            quantized.QueryOverlaps(boxes, query, [&](uint32_t)
+                                    { count++; });
+            return count;
+        });
+}
+
+// binary TreeNode walk against the 4 and 8 wide trees collapsed from it; the 8 wide kernel is AVX only in AVX builds
+void BenchmarkWide(const std::vector<HAABBox3D> &meshBoxes, const std::vector<HVector3> &origins, const std::vector<HVector3> &directions,
+                   const std::vector<HAABBox3D> &queries)
+{
+#ifdef H_WIDE_BVH_AVX
+    printf("wide trees, AVX kernels\n");
+#else
+    printf("wide trees, SSE kernels\n");
+#endif
+    for (const uint32_t maxLeafSize : {1u, 4u})
+    {
+        SAHBuildSettings settings;
+        settings.mMaxLeafSize = maxLeafSize;
+        std::vector<HAABBox3D> boxes = meshBoxes;
+        std::vector<TreeNode<HAABBox3D>> nodes;
+        TreeUtils::Builder::BuildSAHBVH(boxes, nodes, settings);
+        const auto start = std::chrono::steady_clock::now();
+        const WideBVH<HAABBox3D, 4> wide4(nodes);
+        const double collapseMs = ElapsedMs(start);
+        const WideBVH<HAABBox3D, 8> wide8(nodes);
+        printf(" binned SAH leaf %u: %zu binary nodes, %zu 4 wide nodes (collapse %.1f ms), %zu 8 wide nodes\n", maxLeafSize, nodes.size(),
+               wide4.GetNodes().size(), collapseMs, wide8.GetNodes().size());
+
+        auto boxHit = [&](const HVector3 &origin, const HVector3 &direction)
+        {
+            const HVector3 inverseDirection = direction.cwiseInverse();
+            return [&boxes, origin, inverseDirection](uint32_t slot, HReal tMax, HReal &t)
+            { return RayHitsBox(origin, inverseDirection, boxes[slot], tMax, t); };
+        };
+        auto countOverlaps = [](uint32_t &count)
+        {
+            return [&count](uint32_t)
+            { count++; };
+        };
+        BenchmarkLayout(
+            "binary", nodes.size() * sizeof(TreeNode<HAABBox3D>), origins, directions, queries,
+            [&](const HVector3 &origin, const HVector3 &direction)
+            {
+                RayHit hit;
+                return TreeUtils::RayCastClosest(nodes, origin, direction, hit, H_REAL_MAX, boxHit(origin, direction));
+            },
+            [&](const HAABBox3D &query)
+            {
+                uint32_t count = 0;
+                TreeUtils::QueryOverlaps(nodes, boxes, query, countOverlaps(count));
+                return count;
+            });
+        BenchmarkLayout(
+            "4 wide", wide4.GetMemorySize(), origins, directions, queries,
+            [&](const HVector3 &origin, const HVector3 &direction)
+            {
+                RayHit hit;
+                return wide4.RayCastClosest(origin, direction, hit, H_REAL_MAX, boxHit(origin, direction));
+            },
+            [&](const HAABBox3D &query)
+            {
+                uint32_t count = 0;
+                wide4.QueryOverlaps(boxes, query, countOverlaps(count));
+                return count;
+            });
+        BenchmarkLayout(
+            "8 wide", wide8.GetMemorySize(), origins, directions, queries,
+            [&](const HVector3 &origin, const HVector3 &direction)
+            {
+                RayHit hit;
+                return wide8.RayCastClosest(origin, direction, hit, H_REAL_MAX, boxHit(origin, direction));
+            },
+            [&](const HAABBox3D &query)
+            {
+                uint32_t count = 0;
+                wide8.QueryOverlaps(boxes, query, countOverlaps(count));
+                return count;
+            });
+    }
+}
+
+// build time of every builder on the calling thread only and with the parallel build
+void BenchmarkParallelBuild(const std::vector<HAABBox3D> &meshBoxes)
+{
+    printf("parallel build of %zu boxes, %u threads\n", meshBoxes.size(), Parallel::GetMaxConcurrency());
+    typedef std::function<void(std::vector<HAABBox3D> &, std::vector<TreeNode<HAABBox3D>> &, const Parallel::ExecutionPolicy &)> Builder;
+    const std::pair<const char *, Builder> builders[] = {
+        {"BuildBVH    ", [](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes, const Parallel::ExecutionPolicy &policy)
+         { TreeUtils::Builder::BuildBVH(boxes, nodes, nullptr, policy); }},
+        {"BuildAABBTree", [](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes, const Parallel::ExecutionPolicy &policy)
+         { TreeUtils::Builder::BuildAABBTree(boxes, nodes, nullptr, policy); }},
+        {"BuildKDTree ", [](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes, const Parallel::ExecutionPolicy &policy)
+         { TreeUtils::Builder::BuildKDTree(boxes, nodes, nullptr, policy); }},
+        {"BuildSAHBVH ", [](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes, const Parallel::ExecutionPolicy &policy)
+         { TreeUtils::Builder::BuildSAHBVH(boxes, nodes, SAHBuildSettings(), nullptr, policy); }},
+        {"BuildLBVH   ", [](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes, const Parallel::ExecutionPolicy &policy)
+         { TreeUtils::Builder::BuildLBVH(boxes, nodes, LBVHBuildSettings(), nullptr, policy); }}};
+    for (const auto &builder : builders)
+    {
+        double ms[2];
+        uint32_t nodeCount[2];
+        const Parallel::ExecutionPolicy policies[2] = {Parallel::ExecutionPolicy::Serial(), Parallel::ExecutionPolicy()};
+        for (int p = 0; p < 2; p++)
+        {
+            std::vector<HAABBox3D> boxes = meshBoxes;
+            std::vector<TreeNode<HAABBox3D>> nodes;
+            const auto start = std::chrono::steady_clock::now();
+            builder.second(boxes, nodes, policies[p]);
+            ms[p] = ElapsedMs(start);
+            nodeCount[p] = static_cast<uint32_t>(nodes.size());
+        }
+        printf("  %s serial %8.1f ms | parallel %8.1f ms | speedup %.2fx | %u / %u nodes\n", builder.first, ms[0], ms[1], ms[0] / ms[1],
+               nodeCount[0], nodeCount[1]);
+    }
+}
+
+// boxes swinging around their rest position; every box has its own phase, so the tree quality decays under refitting
+void AnimateBoxes(const std::vector<HAABBox3D> &restBoxes, const uint32_t frame, std::vector<HAABBox3D> &boxes)
+{
+    boxes.resize(restBoxes.size());
+    Parallel::ParallelFor<uint32_t>(0, uint32_t(restBoxes.size()), [&](uint32_t i)
+                                    {
+        const HReal phase = HReal(frame) * 0.01f + HReal(i % 97) * 0.3f;
+        const HVector3 offset(std::sin(phase), std::cos(phase * 1.3f), std::sin(phase * 0.7f) * 0.2f);
+        boxes[i] = restBoxes[i];
+        boxes[i].translate(offset * 40.f); });
+}
+
+// refitting against rebuilding every frame of an animation, and incremental insert/remove against rebuilding
+void BenchmarkDynamic(const std::vector<HAABBox3D> &restBoxes, const std::vector<HVector3> &origins, const std::vector<HVector3> &directions)
+{
+    const uint32_t frameCount = 1000;
+    const std::vector<HVector3> frameOrigins(origins.begin(), origins.begin() + 10000);
+    const std::vector<HVector3> frameDirections(directions.begin(), directions.begin() + 10000);
+    printf("dynamic scene of %zu boxes over %u frames, %zu rays every 100 frames\n", restBoxes.size(), frameCount, frameOrigins.size());
+    const std::pair<const char *, AcceleratorType> modes[] = {{"refit SAH BVH  ", AcceleratorType::eSAHBVH},
+                                                               {"rebuild SAH BVH", AcceleratorType::eSAHBVH},
+                                                               {"rebuild LBVH   ", AcceleratorType::eLBVH}};
+    std::vector<HAABBox3D> boxes;
+    for (uint32_t mode = 0; mode < 3; mode++)
+    {
+        Accelerator3D accelerator;
+        accelerator.SetType(modes[mode].second);
+        AnimateBoxes(restBoxes, 0, boxes);
+        accelerator.Build(boxes);
+        double updateMs = 0, rayMs = 0;
+        HReal lastCost = 0;
+        for (uint32_t frame = 1; frame <= frameCount; frame++)
+        {
+            AnimateBoxes(restBoxes, frame, boxes);
+            const auto start = std::chrono::steady_clock::now();
+            if (mode == 0)
+                accelerator.Refit(boxes);
+            else
+                accelerator.Build(boxes);
+            updateMs += ElapsedMs(start);
+            if (frame % 100 == 0)
+            {
+                rayMs += TraceRays(accelerator.GetTree(), accelerator.GetBoxes(), frameOrigins, frameDirections).mMs;
+                lastCost = TreeUtils::EvaluateTree(accelerator.GetTree()).mSAHCost;
+            }
+        }
+        printf("  %s update %7.3f ms/frame | rays %7.2f ms per 10k | SAH cost at the last frame %.1f\n", modes[mode].first,
+               updateMs / frameCount, rayMs / (frameCount / 100), lastCost);
+    }
+
+    // a tenth of the boxes leave and come back somewhere else every frame
+    std::mt19937 random(3);
+    std::uniform_int_distribution<uint32_t> pick(0, uint32_t(restBoxes.size() - 1));
+    std::uniform_real_distribution<HReal> unit(0, 1);
+    Accelerator3D accelerator;
+    accelerator.SetType(AcceleratorType::eSAHBVH);
+    accelerator.Build(restBoxes);
+    std::vector<HAABBox3D> current = restBoxes;
+    const uint32_t churnFrames = 100, churnPerFrame = uint32_t(restBoxes.size() / 10);
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < churnFrames; frame++)
+        for (uint32_t i = 0; i < churnPerFrame; i++)
+        {
+            const uint32_t index = pick(random);
+            accelerator.Remove(index);
+            current[index].translate(HVector3(unit(random) - 0.5f, unit(random) - 0.5f, 0) * 200.f);
+            accelerator.Insert(current[index]);
+        }
+    const double churnMs = ElapsedMs(start);
+    const HReal churnCost = TreeUtils::EvaluateTree(accelerator.GetTree()).mSAHCost;
+    const auto rebuildStart = std::chrono::steady_clock::now();
+    accelerator.SetType(AcceleratorType::eSAHBVH);
+    printf("  insert/remove %u boxes per frame %7.3f ms/frame (%.2f us per pair), SAH cost %.1f | one rebuild %.3f ms, SAH cost %.1f\n",
+           churnPerFrame, churnMs / churnFrames, churnMs * 1000 / (double(churnFrames) * churnPerFrame), churnCost, ElapsedMs(rebuildStart),
+           TreeUtils::EvaluateTree(accelerator.GetTree()).mSAHCost);
+}
+
+// rolling terrain over [0, size]^2 on the x/y grid, z up, two triangles per cell
+void MakeTerrain(const uint32_t size, std::vector<HVector3> &vertices, std::vector<TriangleIndex<uint32_t>> &triangles)
+{
+    for (uint32_t y = 0; y <= size; y++)
+        for (uint32_t x = 0; x <= size; x++)
+        {
+            const HReal height = 20 * std::sin(0.021f * x) * std::cos(0.017f * y) + 4 * std::sin(0.13f * x + 0.07f * y) + std::cos(0.9f * y);
+            vertices.emplace_back(HReal(x), HReal(y), height);
+        }
+    for (uint32_t y = 0; y < size; y++)
+        for (uint32_t x = 0; x < size; x++)
+        {
+            const uint32_t corner = y * (size + 1) + x;
+            triangles.emplace_back(corner, corner + 1, corner + size + 2);
+            triangles.emplace_back(corner, corner + size + 2, corner + size + 1);
+        }
+}
+
+// one ray at a time against the ray packets of a batch, on a terrain: shadow rays towards the sun from every vertex,
+// camera rays across the terrain, and scattered rays as the case packets do not suit
+void BenchmarkRayBatches()
+{
+    std::vector<HVector3> vertices;
+    std::vector<TriangleIndex<uint32_t>> triangles;
+    MakeTerrain(512, vertices, triangles);
+    auto start = std::chrono::steady_clock::now();
+    const TriangleBVH bvh(vertices, triangles);
+    printf("ray batches on a %zu triangle terrain, %u rays per packet, %u threads (build %.1f ms)\n", triangles.size(), RAY_PACKET_WIDTH,
+           Parallel::GetMaxConcurrency(), ElapsedMs(start));
+
+    std::vector<HVector3> shadowOrigins(vertices.size()), shadowDirections(vertices.size(), HVector3(0.6f, 0.3f, 0.5f).normalized());
+    for (size_t i = 0; i < vertices.size(); i++)
+        shadowOrigins[i] = vertices[i] + HVector3(0, 0, 0.01f);
+
+    const uint32_t width = 1024, height = 768;
+    const HVector3 eye(-40, -40, 60), forward = HVector3(1, 1, -0.35f).normalized();
+    const HVector3 right = forward.cross(HVector3(0, 0, 1)).normalized(), up = right.cross(forward);
+    std::vector<HVector3> cameraOrigins(size_t(width) * height, eye), cameraDirections(size_t(width) * height);
+    for (uint32_t y = 0; y < height; y++)
+        for (uint32_t x = 0; x < width; x++)
+            cameraDirections[size_t(y) * width + x] = forward + right * ((x + 0.5f) / width - 0.5f) + up * (((y + 0.5f) / height - 0.5f) * height / width);
+
+    std::mt19937 random(29);
+    std::uniform_real_distribution<HReal> unit(0, 1);
+    std::normal_distribution<HReal> normal(0, 1);
+    std::vector<HVector3> scatteredOrigins(500000), scatteredDirections(500000);
+    for (size_t i = 0; i < scatteredOrigins.size(); i++)
+    {
+        scatteredOrigins[i] = HVector3(unit(random) * 512, unit(random) * 512, 30 + unit(random) * 10);
+        scatteredDirections[i] = HVector3(normal(random), normal(random), -std::abs(normal(random)));
+    }
+
+    auto run = [&](const char *name, const std::vector<HVector3> &origins, const std::vector<HVector3> &directions, const bool anyHit)
+    {
+        const uint32_t count = static_cast<uint32_t>(origins.size());
+        std::vector<uint8_t> single(count);
+        start = std::chrono::steady_clock::now();
+        Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+                                        {
+            RayHit hit;
+            single[i] = anyHit ? bvh.RayCastAny(origins[i], directions[i]) : bvh.RayCastClosest(origins[i], directions[i], hit); });
+        const double singleMs = ElapsedMs(start);
+        std::vector<uint8_t> batched;
+        std::vector<RayHit> hits;
+        start = std::chrono::steady_clock::now();
+        if (anyHit)
+            bvh.RayCastAny(origins, directions, batched);
+        else
+            bvh.RayCastClosest(origins, directions, hits);
+        const double batchMs = ElapsedMs(start);
+        uint64_t singleHits = 0, batchHits = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            singleHits += single[i];
+            batchHits += anyHit ? batched[i] : hits[i].mIndex != UINT_MAX;
+        }
+        printf("  %-18s %7u rays | single %7.1f ms (%5.2f Mrays/s) | packets %7.1f ms (%5.2f Mrays/s) | %.2fx | %llu / %llu hits\n", name,
+               count, singleMs, count / (singleMs * 1e3), batchMs, count / (batchMs * 1e3), singleMs / batchMs,
+               static_cast<unsigned long long>(singleHits), static_cast<unsigned long long>(batchHits));
+    };
+    run("shadow rays (any)", shadowOrigins, shadowDirections, true);
+    run("camera (closest)", cameraOrigins, cameraDirections, false);
+    run("scattered (closest)", scatteredOrigins, scatteredDirections, false);
+}
+
+// point KD-tree on a clustered point cloud: build serial and parallel, k-NN and radius queries one by one and batched,
+// against the counting-sort CompactGrid3D with its cell size at the radius
+void BenchmarkPointKDTree(const uint32_t pointCount)
+{
+    std::mt19937 random(31);
+    std::uniform_real_distribution<HReal> unit(0, 1);
+    std::normal_distribution<HReal> normal(0, 1);
+    std::vector<HVector3> clusters(64);
+    for (HVector3 &cluster : clusters)
+        cluster = HVector3(unit(random), unit(random), unit(random)) * 1000.f;
+    std::vector<HVector3> points(pointCount);
+    for (uint32_t i = 0; i < pointCount; i++)
+        points[i] = i % 4 == 0 ? HVector3(HVector3(unit(random), unit(random), unit(random)) * 1000.f)
+                               : HVector3(clusters[i % clusters.size()] + HVector3(normal(random), normal(random), normal(random)) * 20.f);
+    std::vector<HVector3> centers(200000);
+    for (size_t i = 0; i < centers.size(); i++)
+        centers[i] = points[(i * 7919) % pointCount] + HVector3(normal(random), normal(random), normal(random));
+    const uint32_t k = 8;
+    const HReal radius = 1.5f;
+    printf("point KD-tree on %u points, %zu queries (k = %u, radius %.1f), %u threads\n", pointCount, centers.size(), k, radius,
+           Parallel::GetMaxConcurrency());
+
+    PointKDTree3D tree;
+    auto start = std::chrono::steady_clock::now();
+    tree.Build(points, Parallel::ExecutionPolicy::Serial());
+    const double serialMs = ElapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    tree.Build(points);
+    const double buildMs = ElapsedMs(start);
+    const double treeMB = double(tree.GetNodes().size() * sizeof(PointKDNode) + tree.Size() * (sizeof(HVector3) + sizeof(uint32_t))) / (1024.0 * 1024.0);
+    CompactGrid3D grid(radius * 4);
+    start = std::chrono::steady_clock::now();
+    grid.Build(points);
+    const double gridMs = ElapsedMs(start);
+    printf("  build: KD-tree %.1f ms (serial %.1f ms, %.1f MB, %zu nodes) | CompactGrid3D %.1f ms (%u cells)\n", buildMs, serialMs, treeMB,
+           tree.GetNodes().size(), gridMs, grid.GetCellCount());
+
+    std::vector<std::pair<HReal, uint32_t>> nearest;
+    uint64_t treeFound = 0, gridFound = 0;
+    start = std::chrono::steady_clock::now();
+    for (const HVector3 &center : centers)
+        treeFound += tree.KNearest(center, k, nearest);
+    const double treeKnnMs = ElapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    for (const HVector3 &center : centers)
+        gridFound += grid.KNearest(center, k, nearest);
+    const double gridKnnMs = ElapsedMs(start);
+    std::vector<uint32_t> indices;
+    start = std::chrono::steady_clock::now();
+    tree.KNearest(centers, k, indices);
+    const double batchKnnMs = ElapsedMs(start);
+    printf("  %u-NN:   KD-tree %7.1f ms | batched %7.1f ms | CompactGrid3D %7.1f ms | %llu / %llu neighbours\n", k, treeKnnMs, batchKnnMs,
+           gridKnnMs, static_cast<unsigned long long>(treeFound), static_cast<unsigned long long>(gridFound));
+
+    treeFound = gridFound = 0;
+    start = std::chrono::steady_clock::now();
+    for (const HVector3 &center : centers)
+        tree.FindRadius(center, radius, [&](uint32_t)
+                        { treeFound++; });
+    const double treeRadiusMs = ElapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    for (const HVector3 &center : centers)
+        grid.FindRadius(center, radius, [&](uint32_t)
+                        { gridFound++; });
+    const double gridRadiusMs = ElapsedMs(start);
+    std::vector<uint32_t> offsets;
+    start = std::chrono::steady_clock::now();
+    tree.FindRadius(centers, radius, offsets, indices);
+    const double batchRadiusMs = ElapsedMs(start);
+    printf("  radius: KD-tree %7.1f ms | batched %7.1f ms | CompactGrid3D %7.1f ms | %llu / %llu points\n", treeRadiusMs, batchRadiusMs,
+           gridRadiusMs, static_cast<unsigned long long>(treeFound), static_cast<unsigned long long>(gridFound));
+}
+
+// broad phase of a mesh self-intersection test: BVH self query serial and parallel, the all-pairs loop on a subset
+void BenchmarkSelfIntersection(MeshTool::TriangleMesh<uint32_t> &mesh)
+{
+    const std::vector<HAABBox3D> &meshBoxes = mesh.GetBoundingBoxes();
+    printf("self intersection of %zu triangles, %u threads\n", meshBoxes.size(), Parallel::GetMaxConcurrency());
+    std::vector<HAABBox3D> boxes = meshBoxes;
+    std::vector<TreeNode<HAABBox3D>> nodes;
+    TreeUtils::Builder::BuildSAHBVH(boxes, nodes);
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    const Parallel::ExecutionPolicy policies[2] = {Parallel::ExecutionPolicy::Serial(), Parallel::ExecutionPolicy()};
+    double ms[2];
+    for (int p = 0; p < 2; p++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        TreeUtils::FindOverlappingPairs(nodes, boxes, pairs, policies[p]);
+        ms[p] = ElapsedMs(start);
+    }
+    printf("  BVH self pairs serial %8.1f ms | parallel %8.1f ms | %zu box pairs\n", ms[0], ms[1], pairs.size());
+    auto start = std::chrono::steady_clock::now();
+    mesh.FindSelfIntersections(pairs);
+    printf("  FindSelfIntersections (build, broad and narrow phase) %8.1f ms | %zu crossing triangle pairs\n", ElapsedMs(start), pairs.size());
+
+    // the quadratic loop only on a subset, it would take hours on the whole mesh
+    const uint32_t subset = 8000;
+    start = std::chrono::steady_clock::now();
+    uint64_t bruteForcePairs = 0;
+    for (uint32_t i = 0; i < subset; i++)
+        for (uint32_t j = i + 1; j < subset; j++)
+            bruteForcePairs += meshBoxes[i].intersects(meshBoxes[j]);
+    const double bruteForceMs = ElapsedMs(start);
+    std::vector<HAABBox3D> subsetBoxes(meshBoxes.begin(), meshBoxes.begin() + subset);
+    start = std::chrono::steady_clock::now();
+    TreeUtils::Builder::BuildSAHBVH(subsetBoxes, nodes);
+    TreeUtils::FindOverlappingPairs(nodes, subsetBoxes, pairs);
+    printf("  first %u triangles: all pairs %8.1f ms | BVH build + self pairs %8.1f ms | %llu / %zu box pairs\n", subset, bruteForceMs,
+           ElapsedMs(start), static_cast<unsigned long long>(bruteForcePairs), pairs.size());
+}
+
+int main()
+{
+    MeshTool::TriangleMesh<uint32_t> mesh = MakeClusteredSoup(400, 500);
+    const std::vector<HAABBox3D> &meshBoxes = mesh.GetBoundingBoxes();
+    printf("%zu triangles\n", meshBoxes.size());
+
+    std::mt19937 random(5);
+    std::uniform_real_distribution<HReal> unit(0, 1);
+    std::normal_distribution<HReal> normal(0, 1);
+    const uint32_t rayCount = 100000;
+    std::vector<HVector3> origins(rayCount), directions(rayCount);
+    for (uint32_t i = 0; i < rayCount; i++)
+    {
+        origins[i] = HVector3(unit(random) * 1000, unit(random) * 1000, 40 + unit(random) * 20);
+        directions[i] = HVector3(normal(random), normal(random), -std::abs(normal(random))).normalized();
+    }
+    std::vector<HAABBox3D> queries(rayCount);
+    for (HAABBox3D &query : queries)
+    {
+        const HVector3 center(unit(random) * 1000, unit(random) * 1000, unit(random) * 30);
+        query = HAABBox3D(center - HVector3::Constant(3), center + HVector3::Constant(3));
+    }
+
+    BenchmarkBuilder("midpoint BuildBVH      ", meshBoxes, [](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes)
+                     { TreeUtils::Builder::BuildBVH(boxes, nodes); }, origins, directions, queries);
+    // (max leaf size, traversal cost): a dearer traversal trades depth for fuller leaves
+    const std::pair<uint32_t, HReal> configurations[] = {{1, 1.f}, {4, 1.f}, {8, 1.f}, {8, 4.f}};
+    for (const auto &configuration : configurations)
+    {
+        SAHBuildSettings settings;
+        settings.mMaxLeafSize = configuration.first;
+        settings.mTraversalCost = configuration.second;
+        char name[64];
+        snprintf(name, sizeof(name), "binned SAH leaf %u Ct %.0f", configuration.first, configuration.second);
+        BenchmarkBuilder(name, meshBoxes, [&](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes)
+                         { TreeUtils::Builder::BuildSAHBVH(boxes, nodes, settings); }, origins, directions, queries);
+    }
+    // (wide Morton codes, treelet passes): the linear builder trades tree quality for build speed, treelets win part of it back
+    const std::pair<bool, uint32_t> linearConfigurations[] = {{false, 0}, {true, 0}, {false, 1}, {false, 3}};
+    for (const auto &configuration : linearConfigurations)
+    {
+        LBVHBuildSettings settings;
+        settings.mWideMortonCodes = configuration.first;
+        settings.mTreeletPasses = configuration.second;
+        char name[64];
+        snprintf(name, sizeof(name), "LBVH %d bit, %u treelet passes", configuration.first ? 63 : 30, configuration.second);
+        BenchmarkBuilder(name, meshBoxes, [&](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes)
+                         { TreeUtils::Builder::BuildLBVH(boxes, nodes, settings); }, origins, directions, queries);
+    }
+    // (max depth, min size, looseness): the loose octree on the same boxes, a shallow or coarse tree keeps more boxes per node
+    const std::tuple<uint32_t, uint32_t, HReal> looseConfigurations[] = {{10, 4, 2.f}, {10, 1, 2.f}, {6, 4, 2.f}, {10, 16, 2.f}, {10, 4, 1.5f}};
+    for (const auto &configuration : looseConfigurations)
+    {
+        LooseTreeBuildSettings settings;
+        settings.mMaxDepth = std::get<0>(configuration);
+        settings.mMinSize = std::get<1>(configuration);
+        settings.mLooseness = std::get<2>(configuration);
+        char name[64];
+        snprintf(name, sizeof(name), "octree depth %u, min %u, loose %.1f", settings.mMaxDepth, settings.mMinSize, settings.mLooseness);
+        BenchmarkBuilder(name, meshBoxes, [&](std::vector<HAABBox3D> &boxes, std::vector<TreeNode<HAABBox3D>> &nodes)
+                         { TreeUtils::Builder::BuildOctTree(boxes, nodes, settings); }, origins, directions, queries);
+    }
+
+    BenchmarkLayouts(meshBoxes, origins, directions, queries);
+    BenchmarkWide(meshBoxes, origins, directions, queries);
+    BenchmarkRayBatches();
+    BenchmarkPointKDTree(4000000);
+    BenchmarkSelfIntersection(mesh);
+
+    MeshTool::TriangleMesh<uint32_t> dynamicMesh = MakeClusteredSoup(40, 500);
+    BenchmarkDynamic(dynamicMesh.GetBoundingBoxes(), origins, directions);
+
+    MeshTool::TriangleMesh<uint32_t> largeMesh = MakeClusteredSoup(4000, 500);
+    BenchmarkParallelBuild(largeMesh.GetBoundingBoxes());
+    return 0;
+}
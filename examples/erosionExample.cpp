@@ -114,7 +114,7 @@ HReal RandomHReal(const HReal min = 0.f, const HReal max = 1.f)
 
 void Raining(Array2D<HReal> &water)
 {
-    Array2D<HReal>::ArrayUpdateFn fn = [&](uint32_t x, uint32_t y) -> HReal
+    auto fn = [&](uint32_t x, uint32_t y) -> HReal
         {
             HReal drop = 0.f;
             if (RandomHReal() < rainingRate)
@@ -134,7 +134,7 @@ void Erosion(const Array2D<HReal>& preHeight, const Array2D<HReal>& preSediment,
              const uint32_t &width, const uint32_t &height,
              Array2D<HReal> &heightMap, Array2D<HReal> &sediment)
 {
-    Array2DF::ArrayUpdateFn heightUpdateFn = [&](uint32_t x, uint32_t y) -> HReal
+    auto heightUpdateFn = [&](uint32_t x, uint32_t y) -> HReal
         {
             const HVector3& n = normal(x, y);
             const HReal cosAlpha = n[1];
@@ -155,7 +155,7 @@ void Erosion(const Array2D<HReal>& preHeight, const Array2D<HReal>& preSediment,
             }
         };
 
-    Array2DF::ArrayUpdateFn sedimentUpdateFn = [&](uint32_t x, uint32_t y) -> HReal
+    auto sedimentUpdateFn = [&](uint32_t x, uint32_t y) -> HReal
         {
             const HVector3& n = normal(x, y);
             const HReal cosAlpha = n[1];
@@ -184,7 +184,7 @@ void Erosion(const Array2D<HReal>& preHeight, const Array2D<HReal>& preSediment,
 
 void Advect(const Array2D2F& velocity, const Array2DF& preSediment, Array2DF& sediment)
 {
-    Array2DF::ArrayUpdateFn updateFn = [&](size_t x, size_t y)-> HReal
+    auto updateFn = [&](size_t x, size_t y)-> HReal
         {
             const HVector2& v = velocity(x, y);
             const HVector2 pos((HReal)x - v[0] * dt, (HReal)y - v[1] * dt);
@@ -204,7 +204,7 @@ void Advect(const Array2D2F& velocity, const Array2DF& preSediment, Array2DF& se
 
 void Evaporate(Array2D<HReal> &water)
 {
-    Array2DF::ArrayUpdateFn fn = [&](size_t x, size_t y)-> HReal
+    auto fn = [&](size_t x, size_t y)-> HReal
         {
             return std::max(0.f, water(x, y) - evapRate * dt);
         };
@@ -0,0 +1,327 @@
+#include <Math/Math.h>
+#include <Math/MathUtils.h>
+#include <Math/HashTable.h>
+#include <Math/HashGrid.h>
+#include <Math/CompactGrid.h>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+
+using namespace MathLib;
+
+// HashTable as it was before the flat table, kept here as the baseline
+template <class Key, class DataType, class HasherFunction = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+class LegacyHashTable
+{
+public:
+    LegacyHashTable(unsigned int expectedSize = 64) : m_HashTable(expectedSize) {}
+
+    void Insert(const Key &key, const DataType &data)
+    {
+        auto it = m_HashTable.find(key);
+        if (it == m_HashTable.end())
+        {
+            m_HashTable[key] = std::vector<DataType>();
+            m_HashTable[key].push_back(data);
+        }
+        else
+        {
+            it->second.push_back(data);
+        }
+    }
+
+    void Erase(const Key &key, const DataType &data)
+    {
+        auto it = m_HashTable.find(key);
+        if (it != m_HashTable.end())
+        {
+            auto &vec = it->second;
+            auto vecIt = std::find(vec.begin(), vec.end(), data);
+            if (vecIt != vec.end())
+                vec.erase(vecIt);
+        }
+    }
+
+    void Clear() { m_HashTable.clear(); }
+
+    bool GetFirstData(const Key &key, DataType &data) const
+    {
+        auto it = m_HashTable.find(key);
+        if (it != m_HashTable.end() && it->second.size() > 0)
+        {
+            data = it->second[0];
+            return true;
+        }
+        return false;
+    }
+
+    bool GetAllData(const Key &key, std::vector<DataType> &data) const
+    {
+        auto it = m_HashTable.find(key);
+        if (it != m_HashTable.end())
+        {
+            data = it->second;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::unordered_map<Key, std::vector<DataType>, HasherFunction, KeyEqual> m_HashTable;
+};
+
+// the XOR-combined std::hash maps a 100^3 block of cells onto 128 values, which degenerates both tables,
+// so both sides use the same prime-multiply hash here
+struct CellHasher
+{
+    std::size_t operator()(const HVector3UI &v) const
+    {
+        return (size_t(v[0]) * 73856093u) ^ (size_t(v[1]) * 19349663u) ^ (size_t(v[2]) * 83492791u);
+    }
+};
+
+double ElapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <class Table>
+void BenchmarkTable(const char *name, const std::vector<HVector3UI> &keys)
+{
+    const uint32_t count = static_cast<uint32_t>(keys.size());
+    Table table(1024);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++)
+        table.Insert(keys[i], i);
+    const double insertMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    uint64_t checksum = 0;
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (table.GetFirstData(keys[i], first))
+            checksum += first;
+    }
+    std::vector<uint32_t> bucket;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (table.GetAllData(keys[i], bucket))
+            checksum += bucket.size();
+    }
+    const double queryMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++)
+        table.Erase(keys[i], i);
+    const double eraseMs = ElapsedMs(start);
+
+    // per-frame pattern: Clear() then insert everything again
+    table.Clear();
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++)
+        table.Insert(keys[i], i);
+    table.Clear();
+    for (uint32_t i = 0; i < count; i++)
+        table.Insert(keys[i], i);
+    const double rebuildMs = ElapsedMs(start) / 2;
+
+    printf("  %-16s insert %8.2f ms | query %8.2f ms | erase %8.2f ms | clear+insert %8.2f ms (checksum %llu)\n",
+           name, insertMs, queryMs, eraseMs, rebuildMs, static_cast<unsigned long long>(checksum));
+}
+
+// particle neighbour search: copying box query vs in-place radius visitor vs k nearest
+void BenchmarkNeighborQueries(const uint32_t count)
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<HReal> coordinate(0, 100);
+    std::vector<HVector3> points(count);
+    HashGrid3D<uint32_t> grid(1.f, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        points[i] = HVector3(coordinate(random), coordinate(random), coordinate(random));
+        grid.AddPoint(points[i], i);
+    }
+    auto positionOf = [&](uint32_t i) -> const HVector3 &
+    { return points[i]; };
+
+    const uint32_t queryCount = 100000;
+    const HReal radius = 2.f;
+    uint64_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint32_t> candidates;
+    for (uint32_t q = 0; q < queryCount; q++)
+    {
+        grid.FindBox(points[q] - HVector3::Constant(radius), points[q] + HVector3::Constant(radius), candidates);
+        for (const uint32_t i : candidates)
+            found += (points[i] - points[q]).squaredNorm() <= radius * radius;
+    }
+    const double boxMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t q = 0; q < queryCount; q++)
+        grid.FindRadius(points[q], radius, positionOf, [&](uint32_t)
+                        { found++; });
+    const double radiusMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<std::pair<HReal, uint32_t>> nearest;
+    for (uint32_t q = 0; q < queryCount; q++)
+        found += grid.KNearest(points[q], 16, positionOf, nearest);
+    const double nearestMs = ElapsedMs(start);
+
+    printf("%u radius-%.0f queries on %u points: FindBox into reused vector %.2f ms | FindRadius visitor %.2f ms | KNearest(16) %.2f ms (%llu)\n",
+           queryCount, radius, count, boxMs, radiusMs, nearestMs, static_cast<unsigned long long>(found));
+}
+
+// per-frame rebuild of a particle grid: HashGrid3D Clear()+AddPoint vs CompactGrid3D counting sort
+void BenchmarkGridRebuild(const uint32_t count)
+{
+    std::mt19937 random(9);
+    std::uniform_real_distribution<HReal> coordinate(0, 100);
+    std::vector<HVector3> points(count);
+    for (HVector3 &point : points)
+        point = HVector3(coordinate(random), coordinate(random), coordinate(random));
+
+    HashGrid3D<uint32_t> hashGrid(1.f, count);
+    CompactGrid3D compactGrid(1.f);
+    auto rebuildHash = [&]()
+    {
+        hashGrid.Clear();
+        for (uint32_t i = 0; i < count; i++)
+            hashGrid.AddPoint(points[i], i);
+    };
+    rebuildHash();
+    compactGrid.Build(points);
+
+    const uint32_t repeat = 5;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < repeat; r++)
+        rebuildHash();
+    const double hashMs = ElapsedMs(start) / repeat;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < repeat; r++)
+        compactGrid.Build(points);
+    const double compactMs = ElapsedMs(start) / repeat;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < repeat; r++)
+        compactGrid.Build(points, Parallel::ExecutionPolicy::Serial());
+    const double compactSerialMs = ElapsedMs(start) / repeat;
+
+    auto positionOf = [&](uint32_t i) -> const HVector3 &
+    { return points[i]; };
+    const uint32_t queryCount = 100000;
+    uint64_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t q = 0; q < queryCount; q++)
+        hashGrid.FindRadius(points[q], 2.f, positionOf, [&](uint32_t)
+                            { found++; });
+    const double hashQueryMs = ElapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t q = 0; q < queryCount; q++)
+        compactGrid.FindRadius(points[q], 2.f, [&](uint32_t)
+                               { found++; });
+    const double compactQueryMs = ElapsedMs(start);
+
+    printf("Rebuild %u points: HashGrid3D Clear+AddPoint %.2f ms | CompactGrid3D Build %.2f ms (serial %.2f ms, %u threads)\n",
+           count, hashMs, compactMs, compactSerialMs, Parallel::GetMaxConcurrency());
+    printf("%u radius queries: HashGrid3D %.2f ms | CompactGrid3D %.2f ms (%llu)\n", queryCount, hashQueryMs, compactQueryMs,
+           static_cast<unsigned long long>(found));
+}
+
+// grid key layouts on a world centred at the origin: the old unsigned vector key (positions shifted to be positive)
+// against the packed signed 64 bit keys
+template <class Grid>
+void BenchmarkGridKey(const char *name, Grid &grid, const std::vector<HVector3> &points)
+{
+    const uint32_t count = static_cast<uint32_t>(points.size());
+    grid.Clear();
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++)
+        grid.AddPoint(points[i], i);
+    const double insertMs = ElapsedMs(start);
+
+    uint64_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++)
+        found += grid.FindPoint(points[i]).Size();
+    const double pointMs = ElapsedMs(start);
+
+    auto positionOf = [&](uint32_t i) -> const HVector3 &
+    { return points[i]; };
+    start = std::chrono::steady_clock::now();
+    for (uint32_t q = 0; q < 100000; q++)
+        grid.FindRadius(points[q], 2.f, positionOf, [&](uint32_t)
+                        { found++; });
+    const double radiusMs = ElapsedMs(start);
+    printf("  %-22s insert %8.2f ms | FindPoint %8.2f ms | 100k FindRadius %8.2f ms (%llu)\n", name, insertMs, pointMs, radiusMs,
+           static_cast<unsigned long long>(found));
+}
+
+// the grid as it was before signed keys: unsigned HVector3UI cells, only valid for positive positions
+class VectorKeyGrid3D
+{
+public:
+    explicit VectorKeyGrid3D(uint32_t expectedSize) : m_Grid(expectedSize) {}
+    void Clear() { m_Grid.Clear(); }
+    void AddPoint(const HVector3 &position, uint32_t data) { m_Grid.Insert(VectorRound3(position), data); }
+    DataSpan<uint32_t> FindPoint(const HVector3 &position) const { return m_Grid.Find(VectorRound3(position)); }
+    template <class PositionFunction, class Visitor>
+    void FindRadius(const HVector3 &center, HReal radius, const PositionFunction &positionOf, const Visitor &visitor) const
+    {
+        const HVector3UI minIndex = VectorRound3((center - HVector3::Constant(radius)).cwiseMax(0));
+        const HVector3UI maxIndex = VectorRound3((center + HVector3::Constant(radius)).cwiseMax(0));
+        for (uint32_t k = minIndex[2]; k <= maxIndex[2]; k++)
+            for (uint32_t j = minIndex[1]; j <= maxIndex[1]; j++)
+                for (uint32_t i = minIndex[0]; i <= maxIndex[0]; i++)
+                    for (const uint32_t data : m_Grid.Find(HVector3UI(i, j, k)))
+                        if ((positionOf(data) - center).squaredNorm() <= radius * radius)
+                            visitor(data);
+    }
+
+private:
+    HashTable<HVector3UI, uint32_t> m_Grid;
+};
+
+void BenchmarkGridKeys(const uint32_t count)
+{
+    std::mt19937 random(13);
+    std::uniform_real_distribution<HReal> coordinate(-50, 50);
+    std::vector<HVector3> points(count), shifted(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        points[i] = HVector3(coordinate(random), coordinate(random), coordinate(random));
+        shifted[i] = points[i] + HVector3::Constant(60);
+    }
+    printf("%u points in [-50, 50]^3, 1 unit cells\n", count);
+    VectorKeyGrid3D vectorGrid(count);
+    BenchmarkGridKey("HVector3UI key (shifted)", vectorGrid, shifted);
+    HashGrid3D<uint32_t, PackedGridKey3D> packedGrid(1.f, count);
+    BenchmarkGridKey("PackedGridKey3D", packedGrid, points);
+    HashGrid3D<uint32_t, MortonGridKey3D> mortonGrid(1.f, count);
+    BenchmarkGridKey("MortonGridKey3D", mortonGrid, points);
+}
+
+int main()
+{
+    const uint32_t count = 1000000;
+    std::mt19937 random(42);
+
+    // uniform particles: about 1 point per cell, and a dense block where cells hold ~8 points
+    const HReal densities[] = {100.f, 50.f};
+    for (const HReal extent : densities)
+    {
+        std::uniform_real_distribution<HReal> coordinate(0, extent);
+        std::vector<HVector3UI> keys(count);
+        for (uint32_t i = 0; i < count; i++)
+            keys[i] = VectorRound3(HVector3(coordinate(random), coordinate(random), coordinate(random)));
+        printf("%u points in a %.0f^3 cell volume\n", count, extent);
+        BenchmarkTable<LegacyHashTable<HVector3UI, uint32_t, CellHasher>>("unordered_map", keys);
+        BenchmarkTable<HashTable<HVector3UI, uint32_t, CellHasher>>("flat HashTable", keys);
+    }
+    BenchmarkNeighborQueries(count);
+    BenchmarkGridRebuild(count);
+    BenchmarkGridKeys(count);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <Math/Math.h>
+#include <Math/MathUtils.h>
+#include <Math/HasherFunction.h>
+#include <Math/HashTable.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+
+using namespace MathLib;
+
+// the component-wise XOR hash HasherFunction.h used before, as the baseline
+struct XorHasher
+{
+    std::size_t operator()(const HVector3UI &v) const
+    {
+        return std::hash<unsigned int>()(v(0)) ^ std::hash<unsigned int>()(v(1)) ^ std::hash<unsigned int>()(v(2));
+    }
+};
+
+struct Distribution
+{
+    std::string mName;
+    std::vector<HVector3UI> mKeys;
+};
+
+double ElapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<Distribution> MakeDistributions(const uint32_t count)
+{
+    std::mt19937 random(42);
+    std::uniform_real_distribution<HReal> unit(0, 1);
+    std::normal_distribution<HReal> normal(0, 1);
+    std::vector<Distribution> distributions(4);
+
+    // gas filling a 100^3 cell box
+    distributions[0].mName = "uniform box";
+    for (uint32_t i = 0; i < count; i++)
+        distributions[0].mKeys.push_back(VectorRound3(HVector3(unit(random), unit(random), unit(random)) * 100));
+
+    // free surface: particles on a sphere shell of radius 150 cells
+    distributions[1].mName = "sphere shell";
+    for (uint32_t i = 0; i < count; i++)
+    {
+        HVector3 direction(normal(random), normal(random), normal(random));
+        distributions[1].mKeys.push_back(VectorRound3(direction.normalized() * (150 + unit(random) * 2) + HVector3::Constant(200)));
+    }
+
+    // dam break: a regular lattice, two particles per cell along each axis
+    distributions[2].mName = "lattice block";
+    for (uint32_t x = 0; distributions[2].mKeys.size() < count; x++)
+        for (uint32_t y = 0; y < 100; y++)
+            for (uint32_t z = 0; z < 50; z++)
+                distributions[2].mKeys.push_back(VectorRound3(HVector3(x, y, z) * 0.5f));
+
+    // symmetric sheet on the x == y diagonal plane, the worst case for XOR
+    distributions[3].mName = "diagonal sheet";
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const HReal t = unit(random) * 300;
+        distributions[3].mKeys.push_back(VectorRound3(HVector3(t, t, unit(random) * 300)));
+    }
+    for (Distribution &distribution : distributions)
+        distribution.mKeys.resize(count);
+    return distributions;
+}
+
+template <class Hasher>
+void BenchmarkHasher(const char *name, const std::vector<HVector3UI> &keys, const std::vector<HVector3UI> &uniqueKeys)
+{
+    const Hasher hasher;
+
+    // full width collisions between distinct cells
+    std::vector<uint64_t> hashes(uniqueKeys.size());
+    for (size_t i = 0; i < uniqueKeys.size(); i++)
+        hashes[i] = hasher(uniqueKeys[i]);
+    std::sort(hashes.begin(), hashes.end());
+    const size_t distinctHashes = std::unique(hashes.begin(), hashes.end()) - hashes.begin();
+
+    // bucket quality when only the low bits are used, as a power of two chained table would
+    size_t bucketCount = 1;
+    while (bucketCount < uniqueKeys.size() * 2)
+        bucketCount *= 2;
+    std::vector<uint32_t> buckets(bucketCount, 0);
+    for (const HVector3UI &key : uniqueKeys)
+        buckets[hasher(key) & (bucketCount - 1)]++;
+    uint64_t probes = 0;
+    uint32_t maxBucket = 0;
+    for (const uint32_t bucket : buckets)
+    {
+        probes += uint64_t(bucket) * (bucket + 1) / 2;
+        maxBucket = std::max(maxBucket, bucket);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t checksum = 0;
+    const uint32_t repeat = 10;
+    for (uint32_t r = 0; r < repeat; r++)
+        for (const HVector3UI &key : keys)
+            checksum += hasher(key);
+    const double hashNs = ElapsedMs(start) * 1e6 / (double(keys.size()) * repeat);
+
+    HashTable<HVector3UI, uint32_t, Hasher> table(1024);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < keys.size(); i++)
+        table.Insert(keys[i], i);
+    const double insertMs = ElapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    uint32_t first = 0;
+    for (const HVector3UI &key : keys)
+        if (table.GetFirstData(key, first))
+            checksum += first;
+    const double queryMs = ElapsedMs(start);
+
+    printf("  %-9s collisions %8zu | low-bit probes %6.2f max bucket %6u | %5.2f ns/hash | HashTable insert %8.2f ms query %8.2f ms (%llu)\n",
+           name, uniqueKeys.size() - distinctHashes, double(probes) / uniqueKeys.size(), maxBucket, hashNs, insertMs, queryMs,
+           static_cast<unsigned long long>(checksum & 0xFFFF));
+}
+
+int main()
+{
+    const uint32_t count = 1000000;
+    for (const Distribution &distribution : MakeDistributions(count))
+    {
+        std::vector<HVector3UI> uniqueKeys = distribution.mKeys;
+        auto less = [](const HVector3UI &a, const HVector3UI &b)
+        { return std::lexicographical_compare(a.data(), a.data() + 3, b.data(), b.data() + 3); };
+        std::sort(uniqueKeys.begin(), uniqueKeys.end(), less);
+        uniqueKeys.erase(std::unique(uniqueKeys.begin(), uniqueKeys.end()), uniqueKeys.end());
+        printf("%s: %u particles, %zu cells\n", distribution.mName.c_str(), count, uniqueKeys.size());
+
+        // the XOR hash sends the diagonal sheet into a handful of buckets, skip the quadratic table build there
+        if (distribution.mName != "diagonal sheet")
+            BenchmarkHasher<XorHasher>("xor", distribution.mKeys, uniqueKeys);
+        BenchmarkHasher<TeschnerHasher<HVector3UI>>("teschner", distribution.mKeys, uniqueKeys);
+        BenchmarkHasher<MortonHasher<HVector3UI>>("morton", distribution.mKeys, uniqueKeys);
+        BenchmarkHasher<WyHasher<HVector3UI>>("wyhash", distribution.mKeys, uniqueKeys);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <Math/Math.h>
+#include <Math/Array2D.h>
+#include <Math/Parallel.h>
+#include <Math/GraphicUtils/Noise/PerlinNoise.h>
+#include <Math/Procedural/HydraulicErosion.h>
+#include <chrono>
+
+using namespace MathLib;
+
+template <class Function>
+double MeasureMs(const Function &func, const uint32_t repeat = 5)
+{
+    double best = std::numeric_limits<double>::max();
+    for (uint32_t i = 0; i < repeat; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+void BenchmarkArray2DUpdate(const uint32_t size)
+{
+    Array2D<HReal> array(size, size);
+
+    const Array2D<HReal>::ArrayUpdateFn erasedFn = [](uint32_t x, uint32_t y) -> HReal
+    { return std::sin(HReal(x) * 0.01f) * std::cos(HReal(y) * 0.01f); };
+    auto lambdaFn = [](uint32_t x, uint32_t y) -> HReal
+    { return std::sin(HReal(x) * 0.01f) * std::cos(HReal(y) * 0.01f); };
+
+    const double erasedMs = MeasureMs([&]()
+                                      { array.ExecuteUpdate(erasedFn); });
+    const double lambdaMs = MeasureMs([&]()
+                                      { array.ExecuteUpdate(lambdaFn); });
+
+    std::vector<HReal> data(size * size, 0);
+    const Parallel::ParallelFunction<uint32_t> erasedForFn = [&](uint32_t i)
+    { data[i] = std::sqrt(HReal(i)); };
+    const double erasedForMs = MeasureMs([&]()
+                                         { Parallel::ParallelFor<uint32_t>(0, size * size, erasedForFn); });
+    const double lambdaForMs = MeasureMs([&]()
+                                         { Parallel::ParallelFor<uint32_t>(0, size * size, [&](uint32_t i)
+                                                                           { data[i] = std::sqrt(HReal(i)); }); });
+
+    printf("Array2D %ux%u ExecuteUpdate: std::function %.2f ms, lambda %.2f ms (x%.2f)\n",
+           size, size, erasedMs, lambdaMs, erasedMs / lambdaMs);
+    printf("ParallelFor %u elements: std::function %.2f ms, lambda %.2f ms (x%.2f)\n",
+           size * size, erasedForMs, lambdaForMs, erasedForMs / lambdaForMs);
+}
+
+void BenchmarkGridScaling()
+{
+    NoiseTool::PerlinNoise::NoiseParams params = {4, 8.f, 1.f, 42};
+    NoiseTool::PerlinNoise noise;
+    noise.Reset(params);
+
+    const uint32_t maxThreads = Parallel::GetMaxConcurrency();
+    const Parallel::Partitioner partitioners[] = {Parallel::Partitioner::eAuto, Parallel::Partitioner::eStatic, Parallel::Partitioner::eAffinity};
+    const char *partitionerNames[] = {"auto", "static", "affinity"};
+    for (uint32_t size = 256; size <= 8192; size *= 2)
+    {
+        Array2D<HReal> array(size, size);
+        auto noiseFn = [&](uint32_t x, uint32_t y) -> HReal
+        { return noise.Get(HVector2(HReal(x) / size, HReal(y) / size)); };
+        const uint32_t repeat = size >= 4096 ? 1 : 3;
+        const double serialMs = MeasureMs([&]()
+                                          { array.ExecuteUpdate(noiseFn, Parallel::ExecutionPolicy::Serial()); }, repeat);
+        printf("Perlin grid %ux%u: serial %.2f ms\n", size, size, serialMs);
+        for (uint32_t p = 0; p < 3; p++)
+        {
+            printf("  %-8s", partitionerNames[p]);
+            for (uint32_t threads = 1;; threads = std::min(threads * 2, maxThreads))
+            {
+                Parallel::ExecutionPolicy policy(partitioners[p], threads);
+                const double ms = MeasureMs([&]()
+                                            { array.ExecuteUpdate(noiseFn, policy); }, repeat);
+                printf(" | %2u threads %8.2f ms x%5.2f (%.2f per core)", threads, ms, serialMs / ms, serialMs / ms / threads);
+                if (threads == maxThreads)
+                    break;
+            }
+            printf("\n");
+        }
+    }
+}
+
+// Build both ParallelBenchmark (TBB) and ParallelBenchmarkThreadPool (std::thread pool) and compare these lines
+void BenchmarkBackendWorkloads()
+{
+#if defined(PARALLEL_BACKEND_THREAD_POOL)
+    const char *backend = "thread pool";
+#elif defined(PARALLEL_BACKEND_TBB)
+    const char *backend = "tbb";
+#else
+    const char *backend = "serial";
+#endif
+    printf("Backend: %s, %u threads\n", backend, Parallel::GetMaxConcurrency());
+
+    NoiseTool::PerlinNoise::NoiseParams noiseParams = {4, 8.f, 1.f, 42};
+    NoiseTool::PerlinNoise noise;
+    noise.Reset(noiseParams);
+    Array2D<HReal> heightMap;
+    const double noiseMs = MeasureMs([&]()
+                                     { heightMap = noise.Get(2048, 2048); });
+    printf("  Perlin noise 2048x2048: %.2f ms\n", noiseMs);
+
+    Procedural::HydraulicErosion::Params erosionParams;
+    const double brushMs = MeasureMs([&]()
+                                     { Procedural::HydraulicErosion erosion(heightMap, erosionParams); }, 3);
+    printf("  Erosion brush init 2048x2048: %.2f ms\n", brushMs);
+
+    Procedural::HydraulicErosion erosion(heightMap, erosionParams);
+    const double erodeMs = MeasureMs([&]()
+                                     { erosion.Erode(200000); }, 3);
+    printf("  Hydraulic erosion 200000 droplets: %.2f ms\n", erodeMs);
+}
+
+int main()
+{
+    BenchmarkBackendWorkloads();
+    BenchmarkArray2DUpdate(4096);
+    BenchmarkGridScaling();
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include <Math/Math.h>
+#include <Math/HSolver>
+#include <array>
+#include <chrono>
+
+using namespace MathLib;
+using namespace MathLib::SolverTool;
+
+double ElapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 5-point (2D) or 7-point (3D) Laplacian with Dirichlet borders on an n^dim grid, row major
+HSparseMatrixRowMajor MakeLaplacian(const int n, const int dim)
+{
+    const int rows = dim == 2 ? n * n : n * n * n;
+    HSparseMatrixRowMajor matrix(rows, rows);
+    matrix.reserve(Eigen::VectorXi::Constant(rows, 2 * dim + 1));
+    for (int row = 0; row < rows; row++)
+    {
+        const int coordinate[3] = {row % n, row / n % n, row / (n * n)};
+        int stride = 1;
+        for (int axis = 0; axis < dim; axis++, stride *= n)
+            if (coordinate[axis] > 0)
+                matrix.insert(row, row - stride) = -1.f;
+        matrix.insert(row, row) = HReal(2 * dim);
+        stride = 1;
+        for (int axis = 0; axis < dim; axis++, stride *= n)
+            if (coordinate[axis] + 1 < n)
+                matrix.insert(row, row + stride) = -1.f;
+    }
+    matrix.makeCompressed();
+    return matrix;
+}
+
+// the same operator without a matrix, rows in parallel
+LinearOperator MakeStencil(const int n, const int dim)
+{
+    const int rows = dim == 2 ? n * n : n * n * n;
+    return LinearOperator(
+        rows, [n, dim, rows](const HVectorX &x, HVectorX &y)
+        { Parallel::ParallelFor<int>(0, rows, [&](int row)
+                                     {
+            const int coordinate[3] = {row % n, row / n % n, row / (n * n)};
+            HReal sum = HReal(2 * dim) * x[row];
+            int stride = 1;
+            for (int axis = 0; axis < dim; axis++, stride *= n)
+            {
+                if (coordinate[axis] > 0)
+                    sum -= x[row - stride];
+                if (coordinate[axis] + 1 < n)
+                    sum -= x[row + stride];
+            }
+            y[row] = sum; }); },
+        [dim, rows](HVectorX &diagonal)
+        { diagonal.setConstant(rows, HReal(2 * dim)); });
+}
+
+template <class Operator>
+void RunSolve(const char *name, const Operator &op, const HVectorX &b, const double memoryMB, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy(),
+              PreconditionerTool::Preconditioner *preconditioner = nullptr)
+{
+    ConjugateGradientSolver<Operator> solver(op, policy);
+    solver.SetTolerance(1e-5f);
+    if (preconditioner)
+        solver.SetPreconditioner(preconditioner);
+    HVectorX x;
+    const auto start = std::chrono::steady_clock::now();
+    const int status = solver.Solve(x, b);
+    const double ms = ElapsedMs(start);
+    printf("    %-24s %8.2f MB | %5u iterations %9.1f ms (%7.3f ms per iteration) | residual %.1e%s\n", name, memoryMB, solver.GetIterations(), ms,
+           ms / std::max(solver.GetIterations(), 1u), solver.GetResidual(), status == 0 ? "" : " (not converged)");
+}
+
+// y = A x alone, the bytes one product moves: matrix and both vectors for CSR, only the vectors without a matrix
+template <class Stencil>
+void BenchmarkProducts(const HSparseMatrixRowMajor &matrix, const LinearOperator &lambdaStencil, const Stencil &stencil, const HVectorX &x)
+{
+    const double vectorMB = 2.0 * double(x.size()) * sizeof(HReal) / (1024.0 * 1024.0);
+    const double matrixMB = (double(matrix.nonZeros()) * (sizeof(HReal) + sizeof(int)) + double(matrix.rows() + 1) * sizeof(int)) / (1024.0 * 1024.0);
+    const int repeats = std::max(1, int(20000000 / x.size()));
+    HVectorX y(x.size());
+    auto timeProduct = [&](const char *name, const double trafficMB, const auto &multiply)
+    {
+        multiply();
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+            multiply();
+        const double ms = ElapsedMs(start) / repeats;
+        printf("    product %-16s %8.3f ms %8.1f GB/s\n", name, ms, trafficMB / 1024.0 / (ms / 1000.0));
+    };
+    timeProduct("sparse", matrixMB + vectorMB, [&]()
+                { SparseMultiply(matrix, x, y); });
+    timeProduct("lambda", vectorMB, [&]()
+                { lambdaStencil.Multiply(x, y, Parallel::ExecutionPolicy()); });
+    timeProduct("stencil", vectorMB, [&]()
+                { stencil.Multiply(x, y); });
+}
+
+void BenchmarkLaplacian(const int n, const int dim)
+{
+    const int rows = dim == 2 ? n * n : n * n * n;
+    printf("%dD Laplacian %d^%d, %d unknowns, %u threads\n", dim, n, dim, rows, Parallel::GetMaxConcurrency());
+    HVectorX b(rows);
+    for (int i = 0; i < rows; i++)
+        b[i] = std::sin(HReal(i) * 0.37f) + 0.5f;
+
+    auto start = std::chrono::steady_clock::now();
+    const HSparseMatrixRowMajor rowMajor = MakeLaplacian(n, dim);
+    const double assemblyMs = ElapsedMs(start);
+    const double sparseMB = (double(rowMajor.nonZeros()) * (sizeof(HReal) + sizeof(int)) + double(rows + 1) * sizeof(int)) / (1024.0 * 1024.0);
+    printf("    assembly %.1f ms, %lld non-zeros\n", assemblyMs, static_cast<long long>(rowMajor.nonZeros()));
+    RunSolve("sparse row major", rowMajor, b, sparseMB);
+    if (rows <= 256 * 256)
+        RunSolve("sparse row major serial", rowMajor, b, sparseMB, Parallel::ExecutionPolicy::Serial());
+    const HSparseMatrixColMajor colMajor = rowMajor;
+    RunSolve("sparse col major", colMajor, b, sparseMB);
+    const LinearOperator lambdaStencil = MakeStencil(n, dim);
+    RunSolve("matrix-free lambda", lambdaStencil, b, 0.0);
+    if (dim == 2)
+    {
+        const LaplacianOperator2D stencil({uint32_t(n), uint32_t(n)});
+        RunSolve("stencil operator", stencil, b, 0.0);
+        BenchmarkProducts(rowMajor, lambdaStencil, stencil, b);
+    }
+    else
+    {
+        const LaplacianOperator3D stencil({uint32_t(n), uint32_t(n), uint32_t(n)});
+        RunSolve("stencil operator", stencil, b, 0.0);
+        BenchmarkProducts(rowMajor, lambdaStencil, stencil, b);
+    }
+    // the dense matrix only fits the smallest grids
+    if (rows <= 64 * 64)
+    {
+        const HMatrixX dense = HMatrixX(rowMajor);
+        RunSolve("dense", dense, b, double(rows) * rows * sizeof(HReal) / (1024.0 * 1024.0));
+    }
+}
+
+// Jacobi against incomplete Cholesky and multigrid on the same grid; setup is the one-off factorization or hierarchy
+template <int Dim>
+void BenchmarkPreconditioners(const int n)
+{
+    std::array<uint32_t, Dim> extents;
+    extents.fill(uint32_t(n));
+    const LaplacianOperator<Dim> stencil(extents);
+    const int rows = int(stencil.Rows());
+    printf("%dD preconditioners %d^%d, %d unknowns\n", Dim, n, Dim, rows);
+    HVectorX b(rows);
+    for (int i = 0; i < rows; i++)
+        b[i] = std::sin(HReal(i) * 0.37f) + 0.5f;
+    const HSparseMatrixRowMajor matrix = MakeLaplacian(n, Dim);
+
+    RunSolve("jacobi", stencil, b, 0.0);
+    for (const HReal modification : {0.f, 0.97f})
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto *cholesky = new PreconditionerTool::IncompleteCholeskyPreconditioner(matrix, modification);
+        printf("    setup %.1f ms\n", ElapsedMs(start));
+        RunSolve(modification == 0 ? "IC(0)" : "MIC(0)", stencil, b, 0.0, Parallel::ExecutionPolicy(), cholesky);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto *multigrid = new PreconditionerTool::MultigridPreconditioner<Dim>(stencil);
+    printf("    setup %.1f ms, %u levels\n", ElapsedMs(start), multigrid->GetLevelCount());
+    RunSolve("multigrid", stencil, b, 0.0, Parallel::ExecutionPolicy(), multigrid);
+}
+
+// many right-hand sides on one system: factorizing per solve, factorizing once, and the batched parallel solve
+void BenchmarkRightHandSides(const int n, const int count)
+{
+    const HSparseMatrixColMajor matrix = MakeLaplacian(n, 2);
+    const int rows = int(matrix.rows());
+    printf("direct solves %d^2, %d unknowns, %d right-hand sides\n", n, rows, count);
+    HMatrixX b(rows, count), x;
+    for (int column = 0; column < count; column++)
+        for (int i = 0; i < rows; i++)
+            b(i, column) = std::sin(HReal(i + column) * 0.37f) + 0.5f;
+
+    auto start = std::chrono::steady_clock::now();
+    HVectorX single;
+    for (int column = 0; column < std::min(count, 16); column++)
+    {
+        Eigen::SimplicialLDLT<HSparseMatrixColMajor> fresh(matrix);
+        single = fresh.solve(b.col(column));
+    }
+    printf("    factorize per solve    %9.2f ms per right-hand side\n", ElapsedMs(start) / std::min(count, 16));
+
+    SimpleLinearSolver solver;
+    start = std::chrono::steady_clock::now();
+    solver.Analyze(matrix);
+    const double analyzeMs = ElapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    solver.Factorize();
+    printf("    analyze %.2f ms, factorize %.2f ms\n", analyzeMs, ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    for (int column = 0; column < count; column++)
+        solver.Solve(single, b.col(column));
+    printf("    cached, one by one     %9.2f ms per right-hand side\n", ElapsedMs(start) / count);
+    start = std::chrono::steady_clock::now();
+    solver.Solve(x, b, Parallel::ExecutionPolicy::Serial());
+    printf("    cached, block serial   %9.2f ms per right-hand side\n", ElapsedMs(start) / count);
+    start = std::chrono::steady_clock::now();
+    solver.Solve(x, b);
+    printf("    cached, block parallel %9.2f ms per right-hand side, %u threads\n", ElapsedMs(start) / count, Parallel::GetMaxConcurrency());
+}
+
+int main()
+{
+    for (const int n : {64, 128, 256})
+        BenchmarkRightHandSides(n, 256);
+    for (const int n : {128, 256, 512, 1024})
+        BenchmarkPreconditioners<2>(n);
+    for (const int n : {32, 64, 128})
+        BenchmarkPreconditioners<3>(n);
+    for (const int n : {64, 128, 256, 512, 1024})
+        BenchmarkLaplacian(n, 2);
+    for (const int n : {16, 32, 64, 128})
+        BenchmarkLaplacian(n, 3);
+    return 0;
+}
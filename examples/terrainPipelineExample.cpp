@@ -0,0 +1,77 @@
+#include <Math/Math.h>
+#include <Math/Array2D.h>
+#include <Math/TaskGraph.h>
+#include <Math/Visual/ImageUtils.h>
+#include <Math/GraphicUtils/Noise/PerlinNoise.h>
+#include <Math/Procedural/HydraulicErosion.h>
+#include <chrono>
+#include <string>
+
+using namespace MathLib;
+
+const uint32_t TILE_COUNT = 8;
+const uint32_t TILE_SIZE = 512;
+const uint32_t EROSION_ITERATIONS = 50000;
+
+Array2D<HReal> GenerateTile(const uint32_t tile)
+{
+    NoiseTool::PerlinNoise::NoiseParams params = {6, 4.f, 1.f, 1337 + tile};
+    NoiseTool::PerlinNoise noise;
+    noise.Reset(params);
+    return noise.Get(TILE_SIZE, TILE_SIZE);
+}
+
+Array2D<HReal> ErodeTile(const Array2D<HReal> &heightMap)
+{
+    Procedural::HydraulicErosion::Params params;
+    Procedural::HydraulicErosion erosion(heightMap, params);
+    erosion.Erode(EROSION_ITERATIONS);
+    return erosion.Result();
+}
+
+bool SaveTile(const uint32_t tile, const Array2D<HReal> &heightMap)
+{
+    HReal min, max;
+    return ImageUtils::SaveImage("tile_" + std::to_string(tile) + ".png", heightMap, &max, &min);
+}
+
+double ElapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    // stage by stage: every stage is parallel inside, but a tile never overlaps with another stage
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Array2D<HReal>> tiles(TILE_COUNT);
+    for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+        tiles[tile] = GenerateTile(tile);
+    for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+        tiles[tile] = ErodeTile(tiles[tile]);
+    for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+        SaveTile(tile, tiles[tile]);
+    printf("Sequential stages: %.2f ms\n", ElapsedMs(start));
+
+    // pipelined: each tile is a noise -> erosion -> save chain, independent chains and stages run concurrently
+    start = std::chrono::steady_clock::now();
+    std::vector<Parallel::Future<bool>> saved;
+    for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+    {
+        saved.push_back(Parallel::Async([tile]()
+                                        { return GenerateTile(tile); })
+                            .Then([](Array2D<HReal> &heightMap)
+                                  { return ErodeTile(heightMap); })
+                            .Then([tile](Array2D<HReal> &heightMap)
+                                  { return SaveTile(tile, heightMap); }));
+    }
+    Parallel::WhenAll(saved).Wait();
+    printf("Pipelined tiles: %.2f ms\n", ElapsedMs(start));
+
+    for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+    {
+        if (!saved[tile].Get())
+            printf("Failed to save tile %u\n", tile);
+    }
+    return 0;
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include <Math/Math.h>
+#include <cmath>
+#include <limits>
+#include <vector>
 
 namespace MathLib
 {
@@ -37,23 +40,155 @@ namespace MathLib
         eAABB,
         eKDTree,
         eQuadTree,
-        eOctTree
+        eOctTree,
+        eSAHBVH,
+        eLBVH
     };
 
+    // Parameters of the binned Surface Area Heuristic BVH builder (TreeUtils::Builder::BuildSAHBVH).
+    // The costs only matter relative to each other: a split is kept when
+    // mTraversalCost + mIntersectionCost * (A(left) * N(left) + A(right) * N(right)) / A(parent) beats
+    // mIntersectionCost * N(parent), so a higher traversal cost gives larger, shallower leaves.
+    struct SAHBuildSettings
+    {
+        uint32_t mMaxLeafSize = 4;
+        uint32_t mBinCount = 16;
+        HReal mTraversalCost = 1.f;
+        HReal mIntersectionCost = 1.f;
+    };
+
+    // Parameters of the linear (Morton code) BVH builder (TreeUtils::Builder::BuildLBVH).
+    // mWideMortonCodes quantizes the centroids to 21 bits per axis (63 bit codes) instead of 10 (30 bit codes), which
+    // separates dense clusters better at twice the sort passes. mTreeletPasses > 0 runs TreeUtils::OptimizeTreelets
+    // that often afterwards, with treelets of up to mTreeletSize subtrees and the SAH costs below.
+    struct LBVHBuildSettings
+    {
+        bool mWideMortonCodes = false;
+        uint32_t mTreeletPasses = 0;
+        uint32_t mTreeletSize = 7;
+        HReal mTraversalCost = 1.f;
+        HReal mIntersectionCost = 1.f;
+    };
+
+    // Parameters of the loose quadtree and octree builders (TreeUtils::Builder::BuildQuadTree, BuildOctTree).
+    // A node is split until it holds at most mMinSize boxes or sits mMaxDepth levels below the root (a level halves the
+    // cell along every axis). A box sinks into the child cell holding its center while it fits mLooseness times that cell;
+    // 1 keeps every box with an extent at the node, 2 is the classic loose octree.
+    struct LooseTreeBuildSettings
+    {
+        uint32_t mMaxDepth = 10;
+        uint32_t mMinSize = 4;
+        HReal mLooseness = 2.f;
+    };
+
+    // Surface area of a 3D box, perimeter of a 2D box: the probability measure the SAH uses for a random ray hitting it.
     template <class BBox>
-    inline BBox MergeBoxes(const std::vector<BBox> &bBoxes, const size_t start = 0, size_t end = UINT_MAX)
+    inline HReal SurfaceArea(const BBox &box)
+    {
+        if (box.isEmpty())
+            return 0;
+        const auto sizes = box.sizes();
+        if constexpr (BBox::AmbientDimAtCompileTime == 2)
+            return 2 * (sizes[0] + sizes[1]);
+        else
+            return 2 * (sizes[0] * sizes[1] + sizes[1] * sizes[2] + sizes[2] * sizes[0]);
+    }
+
+    // Below this many boxes the merge stays serial; tree builders call MergeBoxes on every small node.
+    const size_t PARALLEL_MERGE_BOXES_THRESHOLD = 4096;
+
+    // Parallel tree builders split nodes of at least this many boxes with parallel passes and build both children as
+    // separate tasks; smaller subtrees are built serially, each into its own node array, and copied in afterwards.
+    const uint32_t PARALLEL_BUILD_THRESHOLD = 4096;
+
+    template <class BBox>
+    inline BBox MergeBoxes(const std::vector<BBox> &bBoxes, const size_t start = 0, size_t end = UINT_MAX,
+                           const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
     {
         if (end == UINT_MAX)
             end = bBoxes.size();
         BBox newBox;
         newBox.setEmpty();
-        for (size_t i = start; i < end; i++)
+        if (policy.mSerial || end - start < PARALLEL_MERGE_BOXES_THRESHOLD)
         {
-            newBox.extend(bBoxes[i]);
+            for (size_t i = start; i < end; i++)
+            {
+                newBox.extend(bBoxes[i]);
+            }
+            return newBox;
         }
-        return newBox;
+        return Parallel::ParallelReduce<size_t>(
+            start, end, newBox, [&](size_t i, BBox &box)
+            { box.extend(bBoxes[i]); },
+            [](const BBox &a, const BBox &b)
+            { return a.merged(b); });
     }
+    // Inline capacity of the traversal stacks of the tree queries. A depth-first walk keeps at most one pending sibling
+    // per level, so only trees deeper than this (degenerate inputs, far beyond what the builders produce) spill.
+    const uint32_t TRAVERSAL_STACK_SIZE = 256;
+
+    // Stack with inline storage for the tree queries, so a query on a normal tree never touches the heap. Entries
+    // beyond Capacity go to a vector instead of overflowing; while it is in use the top of the stack lives there.
+    template <class T, uint32_t Capacity = TRAVERSAL_STACK_SIZE>
+    class FixedStack
+    {
+    public:
+        void Push(const T &value)
+        {
+            if (m_Size < Capacity)
+                m_Data[m_Size++] = value;
+            else
+                m_Overflow.push_back(value);
+        }
+
+        T Pop()
+        {
+            if (m_Overflow.empty())
+                return m_Data[--m_Size];
+            T value = m_Overflow.back();
+            m_Overflow.pop_back();
+            return value;
+        }
+
+        bool Empty() const
+        {
+            return m_Size == 0;
+        }
+
+    private:
+        T m_Data[Capacity];
+        uint32_t m_Size = 0;
+        std::vector<T> m_Overflow;
+    };
 
+    // Result of a ray cast: the hit primitive and the ray parameter of the hit, origin + mT * direction.
+    struct RayHit
+    {
+        uint32_t mIndex = UINT_MAX;
+        HReal mT = H_REAL_MAX;
+    };
 
+    namespace _Private
+    {
+        // closest float not above / not below value, so bounds stored in float still enclose the HReal ones; values beyond
+        // the float range, where the cast is undefined, clamp to the largest float or go to infinity
+        inline float FloatBelow(const HReal value)
+        {
+            const float limit = std::numeric_limits<float>::max();
+            if (value < -limit)
+                return -std::numeric_limits<float>::infinity();
+            const float rounded = value > limit ? limit : static_cast<float>(value);
+            return rounded > value ? std::nextafter(rounded, -std::numeric_limits<float>::infinity()) : rounded;
+        }
+
+        inline float FloatAbove(const HReal value)
+        {
+            const float limit = std::numeric_limits<float>::max();
+            if (value > limit)
+                return std::numeric_limits<float>::infinity();
+            const float rounded = value < -limit ? -limit : static_cast<float>(value);
+            return rounded < value ? std::nextafter(rounded, std::numeric_limits<float>::infinity()) : rounded;
+        }
+    }
 
 }; // namespace MathLib
\ No newline at end of file
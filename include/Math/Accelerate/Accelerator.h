@@ -1,13 +1,25 @@
 #pragma once
 #include <Math/Accelerate/AccelerateCommon.h>
 #include <Math/Accelerate/TreeUtils.h>
+#include <Math/Accelerate/WideBVH.h>
 namespace MathLib
 {
+    /// <summary>
+    /// Bounding volume hierarchy over a set of boxes with the queries on top. Build() keeps a copy of the boxes in tree
+    /// order; every query reports indices into the boxes passed to Build(). The primitive callables of the query overloads
+    /// get those indices too, for exact tests against the objects inside the boxes.
+    /// For moving objects Refit() updates the bounds without touching the topology, and Insert()/Remove() add and drop
+    /// single boxes in the style of a dynamic AABB tree: a new box is paired with the sibling that grows the tree least
+    /// and the nodes above it are refitted and rotated. Insert() hands out the indices freed by Remove() again.
+    /// Overlap, point and ray queries walk a WideBVH collapsed from the tree by Build() and kept up by Refit(). Insert()
+    /// and Remove() drop it, and those queries walk the binary tree until the next Refit() or Build() collapses it again.
+    /// </summary>
     template <class BBox>
     class Accelerator
     {
     private:
         typedef std::vector<TreeNode<BBox>> Tree;
+        typedef typename BBox::VectorType Vector;
 
     public:
         Accelerator()
@@ -21,63 +33,550 @@ namespace MathLib
 
         void SetType(AcceleratorType type)
         {
-            _ASSERT(typeid(BBox) == typeid(HAABBox2D) && type != AcceleratorType::eOctTree);
-            _ASSERT(typeid(BBox) == typeid(HAABBox3D) && type != AcceleratorType::eQuadTree);
+            assert(!(BBox::AmbientDimAtCompileTime == 2 && type == AcceleratorType::eOctTree));
+            assert(!(BBox::AmbientDimAtCompileTime == 3 && type == AcceleratorType::eQuadTree));
             m_Type = type;
+            // rebuild the live boxes; indices freed by Remove stay free
             std::vector<BBox> bBoxes;
-            TreeUtils::FindOutAllBoxes(m_Tree, bBoxes);
+            std::vector<uint32_t> indices;
+            for (uint32_t index = 0; index < m_SlotOfIndex.size(); index++)
+            {
+                if (m_SlotOfIndex[index] == UINT_MAX)
+                    continue;
+                bBoxes.push_back(m_BBoxes[m_SlotOfIndex[index]]);
+                indices.push_back(index);
+            }
+            const uint32_t indexCount = static_cast<uint32_t>(m_SlotOfIndex.size());
+            std::vector<uint32_t> freeIndices = m_FreeIndices;
             Build(bBoxes);
+            for (uint32_t &index : m_PrimitiveIndices)
+                index = indices[index];
+            m_SlotOfIndex.assign(indexCount, UINT_MAX);
+            for (uint32_t slot = 0; slot < m_PrimitiveIndices.size(); slot++)
+                m_SlotOfIndex[m_PrimitiveIndices[slot]] = slot;
+            m_FreeIndices.swap(freeIndices);
         }
 
-        void Build(std::vector<BBox> &bBoxes)
+        void Build(const std::vector<BBox> &bBoxes)
         {
+            m_BBoxes = bBoxes;
+            _BuildTree();
+            m_SlotOfIndex.resize(m_BBoxes.size());
+            for (uint32_t slot = 0; slot < m_BBoxes.size(); slot++)
+                m_SlotOfIndex[m_PrimitiveIndices[slot]] = slot;
+            m_FreeIndices.clear();
+            m_FreeSlots.clear();
+            m_FreePairs.clear();
+            m_WideTree.Collapse(m_Tree);
+            TreeUtils::ComputeParents(m_Tree, m_Parents);
+            m_LeafOfSlot.resize(m_BBoxes.size());
+            Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(m_Tree.size()), [&](uint32_t node)
+                                            {
+                if (m_Tree[node].IsLeaf())
+                    for (uint32_t slot = m_Tree[node].m_Index; slot < m_Tree[node].m_End; slot++)
+                        m_LeafOfSlot[slot] = node; });
+        }
+
+        /// <summary>
+        /// Moves every box to bBoxes[index], indexed like Build() (entries of removed indices are ignored), and refits the
+        /// node bounds bottom-up in parallel, O(n) against the O(n log n) of a rebuild. The tree keeps its topology, so
+        /// queries slow down as the boxes drift from where they were built; rebuild with SetType() once that matters.
+        /// </summary>
+        void Refit(const std::vector<BBox> &bBoxes, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+        {
+            assert(bBoxes.size() >= m_SlotOfIndex.size());
+            Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(m_BBoxes.size()), [&](uint32_t slot)
+                                            {
+                if (m_PrimitiveIndices[slot] != UINT_MAX)
+                    m_BBoxes[slot] = bBoxes[m_PrimitiveIndices[slot]]; },
+                                            policy);
+            TreeUtils::Refit(m_Tree, m_Parents, m_BBoxes, policy);
+            if (m_WideTree.Empty())
+                m_WideTree.Collapse(m_Tree);
+            else
+                m_WideTree.Refit(m_Tree, policy);
+        }
+
+        // adds one box and returns its index
+        uint32_t Insert(const BBox &bBox)
+        {
+            m_WideTree.Clear();
+            uint32_t index = static_cast<uint32_t>(m_SlotOfIndex.size());
+            if (!m_FreeIndices.empty())
+            {
+                index = m_FreeIndices.back();
+                m_FreeIndices.pop_back();
+            }
+            else
+                m_SlotOfIndex.push_back(UINT_MAX);
+            uint32_t slot = static_cast<uint32_t>(m_BBoxes.size());
+            if (!m_FreeSlots.empty())
+            {
+                slot = m_FreeSlots.back();
+                m_FreeSlots.pop_back();
+            }
+            else
+            {
+                m_BBoxes.emplace_back();
+                m_PrimitiveIndices.push_back(UINT_MAX);
+                m_LeafOfSlot.push_back(UINT_MAX);
+            }
+            m_BBoxes[slot] = bBox;
+            m_PrimitiveIndices[slot] = index;
+            m_SlotOfIndex[index] = slot;
+
+            const TreeNode<BBox> leaf(bBox, slot, slot + 1);
+            if (m_Tree.empty())
+            {
+                m_Tree.push_back(leaf);
+                m_Parents.assign(1, UINT_MAX);
+                m_LeafOfSlot[slot] = 0;
+                return index;
+            }
+            // the sibling keeps its place in the tree and becomes the parent of itself and the new leaf
+            const uint32_t sibling = _FindSibling(bBox);
+            const uint32_t pair = _AllocatePair();
+            const TreeNode<BBox> siblingNode = m_Tree[sibling];
+            _PlaceNode(pair, siblingNode);
+            _PlaceNode(pair + 1, leaf);
+            _PlaceNode(sibling, TreeNode<BBox>(siblingNode.m_bbox.merged(bBox), pair));
+            _RefitAndRotate(m_Parents[sibling]);
+            return index;
+        }
+
+        // drops the box of index, which Insert() may hand out again
+        void Remove(const uint32_t index)
+        {
+            assert(index < m_SlotOfIndex.size() && m_SlotOfIndex[index] != UINT_MAX);
+            m_WideTree.Clear();
+            const uint32_t slot = m_SlotOfIndex[index];
+            const uint32_t leaf = m_LeafOfSlot[slot];
+            m_SlotOfIndex[index] = UINT_MAX;
+            m_FreeIndices.push_back(index);
+            TreeNode<BBox> &leafNode = m_Tree[leaf];
+            if (leafNode.m_End - leafNode.m_Index > 1)
+            {
+                // keep the leaf range contiguous: its last box takes the freed slot
+                const uint32_t last = leafNode.m_End - 1;
+                if (slot != last)
+                {
+                    m_BBoxes[slot] = m_BBoxes[last];
+                    m_PrimitiveIndices[slot] = m_PrimitiveIndices[last];
+                    m_SlotOfIndex[m_PrimitiveIndices[slot]] = slot;
+                }
+                m_PrimitiveIndices[last] = UINT_MAX;
+                m_FreeSlots.push_back(last);
+                leafNode.m_End--;
+                leafNode.m_bbox = MergeBoxes(m_BBoxes, leafNode.m_Index, leafNode.m_End);
+                _RefitAndRotate(m_Parents[leaf]);
+                return;
+            }
+            m_PrimitiveIndices[slot] = UINT_MAX;
+            m_FreeSlots.push_back(slot);
+            if (leaf == 0)
+            {
+                m_Tree.clear();
+                m_Parents.clear();
+                m_FreePairs.clear();
+                return;
+            }
+            // the sibling moves up into the place of the parent
+            const uint32_t parent = m_Parents[leaf];
+            const uint32_t pair = m_Tree[parent].m_Index;
+            _PlaceNode(parent, m_Tree[leaf == pair ? pair + 1 : pair]);
+            _FreePair(pair);
+            _RefitAndRotate(m_Parents[parent]);
+        }
+
+        // leaf size, bin count and cost constants of AcceleratorType::eSAHBVH, applied on the next Build
+        void SetSAHSettings(const SAHBuildSettings &settings)
+        {
+            m_SAHSettings = settings;
+        }
+
+        const SAHBuildSettings &GetSAHSettings() const
+        {
+            return m_SAHSettings;
+        }
+
+        // Morton code width and treelet passes of AcceleratorType::eLBVH, applied on the next Build
+        void SetLBVHSettings(const LBVHBuildSettings &settings)
+        {
+            m_LBVHSettings = settings;
+        }
+
+        const LBVHBuildSettings &GetLBVHSettings() const
+        {
+            return m_LBVHSettings;
+        }
+
+        // depth, leaf size and looseness of AcceleratorType::eQuadTree and eOctTree, applied on the next Build
+        void SetLooseTreeSettings(const LooseTreeBuildSettings &settings)
+        {
+            m_LooseTreeSettings = settings;
+        }
+
+        const LooseTreeBuildSettings &GetLooseTreeSettings() const
+        {
+            return m_LooseTreeSettings;
+        }
+
+        const Tree &GetTree() const
+        {
+            return m_Tree;
+        }
+
+        // the wide tree the overlap, point and ray queries walk, empty after Insert/Remove until the next Refit or Build
+        const WideBVH<BBox> &GetWideTree() const
+        {
+            return m_WideTree;
+        }
+
+        // the boxes in tree order: the leaves of GetTree() index this array
+        const std::vector<BBox> &GetBoxes() const
+        {
+            return m_BBoxes;
+        }
+
+        // GetBoxes()[i] is the box of index GetPrimitiveIndices()[i]; UINT_MAX marks slots freed by Remove
+        const std::vector<uint32_t> &GetPrimitiveIndices() const
+        {
+            return m_PrimitiveIndices;
+        }
+
+        // visitor(index) for every box overlapping box; a bool visitor stops the query by returning false
+        template <class Visitor>
+        void QueryOverlaps(const BBox &box, const Visitor &visitor) const
+        {
+            auto visitSlot = [&](uint32_t slot)
+            { return _Private::_VisitData(visitor, m_PrimitiveIndices[slot]); };
+            if (!m_WideTree.Empty())
+                m_WideTree.QueryOverlaps(m_BBoxes, box, visitSlot);
+            else
+                TreeUtils::QueryOverlaps(m_Tree, m_BBoxes, box, visitSlot);
+        }
+
+        bool QueryOverlaps(const BBox &box, std::vector<uint32_t> &indices) const
+        {
+            indices.resize(0);
+            QueryOverlaps(box, [&](uint32_t index)
+                          { indices.push_back(index); });
+            return !indices.empty();
+        }
+
+        // visitor(index) for every box containing point, stopping like QueryOverlaps
+        template <class Visitor>
+        void QueryPoint(const Vector &point, const Visitor &visitor) const
+        {
+            auto visitSlot = [&](uint32_t slot)
+            { return _Private::_VisitData(visitor, m_PrimitiveIndices[slot]); };
+            if (!m_WideTree.Empty())
+                m_WideTree.QueryPoint(m_BBoxes, point, visitSlot);
+            else
+                TreeUtils::QueryPoint(m_Tree, m_BBoxes, point, visitSlot);
+        }
+
+        bool QueryPoint(const Vector &point, std::vector<uint32_t> &indices) const
+        {
+            indices.resize(0);
+            QueryPoint(point, [&](uint32_t index)
+                       { indices.push_back(index); });
+            return !indices.empty();
+        }
+
+        // first box along origin + t * direction with t in [0, tMax]; hit.mT is the entry point, 0 for an origin inside the box
+        bool RayCastClosest(const Vector &origin, const Vector &direction, RayHit &hit, const HReal tMax = H_REAL_MAX) const
+        {
+            const Vector inverseDirection = direction.cwiseInverse();
+            return _RayCastClosest(origin, direction, hit, tMax, [&](uint32_t slot, HReal limit, HReal &t)
+                                   { return TreeUtils::_Private::RayEntersBox(origin, inverseDirection, m_BBoxes[slot], limit, t); });
+        }
+
+        // closest hit of intersect(index, tMax, t), which returns true with t when its primitive is hit in [0, tMax]
+        template <class Intersector>
+        bool RayCastClosest(const Vector &origin, const Vector &direction, RayHit &hit, const HReal tMax, const Intersector &intersect) const
+        {
+            return _RayCastClosest(origin, direction, hit, tMax, [&](uint32_t slot, HReal limit, HReal &t)
+                                   { return intersect(m_PrimitiveIndices[slot], limit, t); });
+        }
+
+        // whether any box is hit in [0, tMax], for occlusion tests
+        bool RayCastAny(const Vector &origin, const Vector &direction, const HReal tMax = H_REAL_MAX) const
+        {
+            const Vector inverseDirection = direction.cwiseInverse();
+            return _RayCastAny(origin, direction, tMax, [&](uint32_t slot, HReal limit, HReal &t)
+                               { return TreeUtils::_Private::RayEntersBox(origin, inverseDirection, m_BBoxes[slot], limit, t); });
+        }
+
+        template <class Intersector>
+        bool RayCastAny(const Vector &origin, const Vector &direction, const HReal tMax, const Intersector &intersect) const
+        {
+            return _RayCastAny(origin, direction, tMax, [&](uint32_t slot, HReal limit, HReal &t)
+                               { return intersect(m_PrimitiveIndices[slot], limit, t); });
+        }
+
+        // box closest to point within maxDistance as (squared distance, index); boxes containing point are at distance 0
+        bool Nearest(const Vector &point, std::pair<HReal, uint32_t> &nearest, const HReal maxDistance = H_REAL_MAX) const
+        {
+            if (!TreeUtils::Nearest(m_Tree, point, nearest, maxDistance, [&](uint32_t slot)
+                                    { return m_BBoxes[slot].squaredExteriorDistance(point); }))
+                return false;
+            nearest.second = m_PrimitiveIndices[nearest.second];
+            return true;
+        }
+
+        // nearest by squaredDistance(index), which must not return less than the squared distance to the box of index
+        template <class DistanceFunction>
+        bool Nearest(const Vector &point, std::pair<HReal, uint32_t> &nearest, const HReal maxDistance, const DistanceFunction &squaredDistance) const
+        {
+            if (!TreeUtils::Nearest(m_Tree, point, nearest, maxDistance, [&](uint32_t slot)
+                                    { return squaredDistance(m_PrimitiveIndices[slot]); }))
+                return false;
+            nearest.second = m_PrimitiveIndices[nearest.second];
+            return true;
+        }
+
+        // the k boxes closest to point within maxDistance as (squared distance, index), sorted by distance
+        uint32_t KNearest(const Vector &point, const uint32_t k, std::vector<std::pair<HReal, uint32_t>> &result,
+                          const HReal maxDistance = H_REAL_MAX) const
+        {
+            TreeUtils::KNearest(m_Tree, point, k, result, maxDistance, [&](uint32_t slot)
+                                { return m_BBoxes[slot].squaredExteriorDistance(point); });
+            for (std::pair<HReal, uint32_t> &entry : result)
+                entry.second = m_PrimitiveIndices[entry.second];
+            return static_cast<uint32_t>(result.size());
+        }
+
+        template <class DistanceFunction>
+        uint32_t KNearest(const Vector &point, const uint32_t k, std::vector<std::pair<HReal, uint32_t>> &result, const HReal maxDistance,
+                          const DistanceFunction &squaredDistance) const
+        {
+            TreeUtils::KNearest(m_Tree, point, k, result, maxDistance, [&](uint32_t slot)
+                                { return squaredDistance(m_PrimitiveIndices[slot]); });
+            for (std::pair<HReal, uint32_t> &entry : result)
+                entry.second = m_PrimitiveIndices[entry.second];
+            return static_cast<uint32_t>(result.size());
+        }
+
+        // every (first, second) with first < second of overlapping boxes, sorted: the broad phase within one set of objects
+        void FindOverlappingPairs(std::vector<std::pair<uint32_t, uint32_t>> &pairs,
+                                  const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+        {
+            TreeUtils::FindOverlappingPairs(m_Tree, m_BBoxes, pairs, policy);
+            _MapPairs(m_PrimitiveIndices, m_PrimitiveIndices, true, pairs, policy);
+        }
+
+        // every (index here, index in other) of overlapping boxes, sorted: the broad phase between two sets of objects
+        void FindOverlappingPairs(const Accelerator &other, std::vector<std::pair<uint32_t, uint32_t>> &pairs,
+                                  const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+        {
+            TreeUtils::FindOverlappingPairs(m_Tree, m_BBoxes, other.m_Tree, other.m_BBoxes, pairs, policy);
+            _MapPairs(m_PrimitiveIndices, other.m_PrimitiveIndices, false, pairs, policy);
+        }
+
+    private:
+        void _BuildTree();
+
+        // ray casts by slot on the wide tree when there is one, hits mapped back to indices
+        template <class SlotIntersector>
+        bool _RayCastClosest(const Vector &origin, const Vector &direction, RayHit &hit, const HReal tMax, const SlotIntersector &intersect) const
+        {
+            const bool found = m_WideTree.Empty() ? TreeUtils::RayCastClosest(m_Tree, origin, direction, hit, tMax, intersect)
+                                                  : m_WideTree.RayCastClosest(origin, direction, hit, tMax, intersect);
+            if (found)
+                hit.mIndex = m_PrimitiveIndices[hit.mIndex];
+            return found;
+        }
+
+        template <class SlotIntersector>
+        bool _RayCastAny(const Vector &origin, const Vector &direction, const HReal tMax, const SlotIntersector &intersect) const
+        {
+            return m_WideTree.Empty() ? TreeUtils::RayCastAny(m_Tree, origin, direction, tMax, intersect)
+                                      : m_WideTree.RayCastAny(origin, direction, tMax, intersect);
+        }
+
+        // slots to indices; the slot order differs from the index order, so the pairs are sorted again
+        static void _MapPairs(const std::vector<uint32_t> &firstIndices, const std::vector<uint32_t> &secondIndices, const bool self,
+                              std::vector<std::pair<uint32_t, uint32_t>> &pairs, const Parallel::ExecutionPolicy &policy)
+        {
+            Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(pairs.size()), [&](uint32_t i)
+                                            {
+                const uint32_t first = firstIndices[pairs[i].first], second = secondIndices[pairs[i].second];
+                pairs[i] = self && second < first ? std::make_pair(second, first) : std::make_pair(first, second); },
+                                            policy);
+            std::sort(pairs.begin(), pairs.end());
+        }
+
+        // stores node at slot and points its children, or the slots of its boxes, back at it
+        void _PlaceNode(const uint32_t slot, const TreeNode<BBox> &node)
+        {
+            m_Tree[slot] = node;
+            if (node.IsLeaf())
+            {
+                for (uint32_t i = node.m_Index; i < node.m_End; i++)
+                    m_LeafOfSlot[i] = slot;
+                return;
+            }
+            m_Parents[node.m_Index] = slot;
+            m_Parents[node.m_Index + 1] = slot;
+        }
+
+        // the children of an inner node are adjacent, so nodes are allocated and freed in pairs
+        uint32_t _AllocatePair()
+        {
+            if (!m_FreePairs.empty())
+            {
+                const uint32_t pair = m_FreePairs.back();
+                m_FreePairs.pop_back();
+                return pair;
+            }
+            m_Tree.resize(m_Tree.size() + 2);
+            m_Parents.resize(m_Tree.size());
+            return static_cast<uint32_t>(m_Tree.size() - 2);
+        }
+
+        void _FreePair(const uint32_t pair)
+        {
+            // empty unreachable leaves: Refit skips them and no query reaches them
+            for (uint32_t node = pair; node < pair + 2; node++)
+            {
+                m_Tree[node] = TreeNode<BBox>(BBox(), 0u, 0u);
+                m_Parents[node] = UINT_MAX;
+            }
+            m_FreePairs.push_back(pair);
+        }
+
+        // branch and bound descent of the dynamic AABB tree: go down while the cheapest child beats pairing with this node
+        uint32_t _FindSibling(const BBox &bBox) const
+        {
+            uint32_t node = 0;
+            while (!m_Tree[node].IsLeaf())
+            {
+                const TreeNode<BBox> &inner = m_Tree[node];
+                const HReal combinedArea = SurfaceArea(inner.m_bbox.merged(bBox));
+                // a new parent here costs its area, going deeper grows this node for sure
+                const HReal pairCost = 2 * combinedArea;
+                const HReal inheritedCost = 2 * (combinedArea - SurfaceArea(inner.m_bbox));
+                HReal childCosts[2];
+                for (uint32_t i = 0; i < 2; i++)
+                {
+                    const TreeNode<BBox> &child = m_Tree[inner.m_Index + i];
+                    const HReal grownArea = SurfaceArea(child.m_bbox.merged(bBox));
+                    childCosts[i] = (child.IsLeaf() ? grownArea : grownArea - SurfaceArea(child.m_bbox)) + inheritedCost;
+                }
+                if (pairCost < childCosts[0] && pairCost < childCosts[1])
+                    break;
+                node = inner.m_Index + (childCosts[1] < childCosts[0] ? 1 : 0);
+            }
+            return node;
+        }
+
+        // refits node and its ancestors, trying at every level the rotation that shrinks a child most (Kopta et al. 2012)
+        void _RefitAndRotate(uint32_t node)
+        {
+            for (; node != UINT_MAX; node = m_Parents[node])
+            {
+                const uint32_t pair = m_Tree[node].m_Index;
+                _Rotate(pair, pair + 1);
+                _Rotate(pair + 1, pair);
+                m_Tree[node].m_bbox = m_Tree[pair].m_bbox.merged(m_Tree[pair + 1].m_bbox);
+            }
+        }
+
+        // swaps child with a child of its sibling when that makes the sibling smaller
+        void _Rotate(const uint32_t child, const uint32_t sibling)
+        {
+            const TreeNode<BBox> &siblingNode = m_Tree[sibling];
+            if (siblingNode.IsLeaf())
+                return;
+            const uint32_t grandChildren = siblingNode.m_Index;
+            const HReal area = SurfaceArea(siblingNode.m_bbox);
+            // swapping child with grandChildren + i leaves the sibling holding child and the other grandchild
+            const HReal areas[2] = {SurfaceArea(m_Tree[child].m_bbox.merged(m_Tree[grandChildren + 1].m_bbox)),
+                                    SurfaceArea(m_Tree[child].m_bbox.merged(m_Tree[grandChildren].m_bbox))};
+            const uint32_t best = areas[1] < areas[0] ? 1 : 0;
+            if (!(areas[best] < area))
+                return;
+            const TreeNode<BBox> childNode = m_Tree[child];
+            _PlaceNode(child, m_Tree[grandChildren + best]);
+            _PlaceNode(grandChildren + best, childNode);
+            m_Tree[sibling].m_bbox = m_Tree[grandChildren].m_bbox.merged(m_Tree[grandChildren + 1].m_bbox);
         }
 
     private:
         AcceleratorType m_Type;
+        SAHBuildSettings m_SAHSettings;
+        LBVHBuildSettings m_LBVHSettings;
+        LooseTreeBuildSettings m_LooseTreeSettings;
         Tree m_Tree;
+        WideBVH<BBox> m_WideTree;
+        std::vector<BBox> m_BBoxes;
+        std::vector<uint32_t> m_PrimitiveIndices;
+        // bookkeeping of Insert/Remove: slot of every index, leaf of every slot, parent of every node and the free lists
+        std::vector<uint32_t> m_SlotOfIndex;
+        std::vector<uint32_t> m_LeafOfSlot;
+        std::vector<uint32_t> m_Parents;
+        std::vector<uint32_t> m_FreeIndices;
+        std::vector<uint32_t> m_FreeSlots;
+        std::vector<uint32_t> m_FreePairs;
     };
 
     template<>
-    inline void Accelerator<HAABBox2D>::Build(std::vector<HAABBox2D>& bBoxes)
+    inline void Accelerator<HAABBox2D>::_BuildTree()
     {
         switch (m_Type)
         {
         case AcceleratorType::eBVH:
-            TreeUtils::Builder::BuildBVH(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildBVH(m_BBoxes, m_Tree, &m_PrimitiveIndices);
             break;
         case AcceleratorType::eAABB:
-            TreeUtils::Builder::BuildAABBTree(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildAABBTree(m_BBoxes, m_Tree, &m_PrimitiveIndices);
             break;
         case AcceleratorType::eKDTree:
-            TreeUtils::Builder::BuildKDTree(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildKDTree(m_BBoxes, m_Tree, &m_PrimitiveIndices);
             break;
         case AcceleratorType::eQuadTree:
-            TreeUtils::Builder::BuildQuadTree(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildQuadTree(m_BBoxes, m_Tree, m_LooseTreeSettings, &m_PrimitiveIndices);
+            break;
+        case AcceleratorType::eSAHBVH:
+            TreeUtils::Builder::BuildSAHBVH(m_BBoxes, m_Tree, m_SAHSettings, &m_PrimitiveIndices);
+            break;
+        case AcceleratorType::eLBVH:
+            TreeUtils::Builder::BuildLBVH(m_BBoxes, m_Tree, m_LBVHSettings, &m_PrimitiveIndices);
             break;
         default:
+            // eOctTree, rejected by SetType; the quadtree is its 2D counterpart
+            TreeUtils::Builder::BuildQuadTree(m_BBoxes, m_Tree, m_LooseTreeSettings, &m_PrimitiveIndices);
             break;
         }
     }
 
     template<>
-    inline void Accelerator<HAABBox3D>::Build(std::vector<HAABBox3D>& bBoxes)
+    inline void Accelerator<HAABBox3D>::_BuildTree()
     {
         switch (m_Type)
         {
         case AcceleratorType::eBVH:
-            TreeUtils::Builder::BuildBVH(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildBVH(m_BBoxes, m_Tree, &m_PrimitiveIndices);
             break;
         case AcceleratorType::eAABB:
-            TreeUtils::Builder::BuildAABBTree(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildAABBTree(m_BBoxes, m_Tree, &m_PrimitiveIndices);
             break;
         case AcceleratorType::eKDTree:
-            TreeUtils::Builder::BuildKDTree(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildKDTree(m_BBoxes, m_Tree, &m_PrimitiveIndices);
             break;
         case AcceleratorType::eOctTree:
-            TreeUtils::Builder::BuildOctTree(bBoxes, m_Tree);
+            TreeUtils::Builder::BuildOctTree(m_BBoxes, m_Tree, m_LooseTreeSettings, &m_PrimitiveIndices);
+            break;
+        case AcceleratorType::eSAHBVH:
+            TreeUtils::Builder::BuildSAHBVH(m_BBoxes, m_Tree, m_SAHSettings, &m_PrimitiveIndices);
+            break;
+        case AcceleratorType::eLBVH:
+            TreeUtils::Builder::BuildLBVH(m_BBoxes, m_Tree, m_LBVHSettings, &m_PrimitiveIndices);
             break;
         default:
+            // eQuadTree, rejected by SetType; the octree is its 3D counterpart
+            TreeUtils::Builder::BuildOctTree(m_BBoxes, m_Tree, m_LooseTreeSettings, &m_PrimitiveIndices);
             break;
         }
     }
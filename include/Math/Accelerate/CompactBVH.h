@@ -0,0 +1,414 @@
+#pragma once
+#include <Math/Accelerate/AccelerateCommon.h>
+#include <Math/Accelerate/TreeUtils.h>
+#include <cmath>
+
+namespace MathLib
+{
+    // Node formats of CompactBVH. Both keep the tree depth first: the first child of an inner node is the node right
+    // after it and only the second child needs an offset, so a descent mostly stays in the cache line already loaded.
+
+    // Full box in float whatever HReal is (rounded outwards), 32 bytes in 3D and aligned so it never straddles a
+    // cache line: two nodes per line against the 32 unaligned bytes (56 in double) of a TreeNode.
+    template <int Dim>
+    struct alignas(Dim == 3 ? 32 : 8) CompactNode
+    {
+        static constexpr bool RELATIVE_BOXES = false;
+        static constexpr uint32_t INNER_NODE = 0x80000000u;
+
+        template <class BBox>
+        void SetBox(const BBox &box, const BBox &)
+        {
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                mMin[axis] = _Private::FloatBelow(box.min()[axis]);
+                mMax[axis] = _Private::FloatAbove(box.max()[axis]);
+            }
+        }
+
+        template <class BBox>
+        BBox GetBox(const BBox &) const
+        {
+            typename BBox::VectorType min, max;
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                min[axis] = mMin[axis];
+                max[axis] = mMax[axis];
+            }
+            return BBox(min, max);
+        }
+
+        bool SetLeaf(const uint32_t first, const uint32_t count)
+        {
+            mOffset = first;
+            mCount = count;
+            return count < INNER_NODE;
+        }
+
+        void SetInner()
+        {
+            mCount = INNER_NODE;
+        }
+
+        bool SetSecondChild(const uint32_t index)
+        {
+            mOffset = index;
+            return true;
+        }
+
+        bool IsLeaf() const { return mCount < INNER_NODE; }
+        uint32_t First() const { return mOffset; }
+        uint32_t Count() const { return mCount; }
+        uint32_t SecondChild() const { return mOffset; }
+
+        float mMin[Dim];
+        // leaf: first slot, inner node: index of the second child
+        uint32_t mOffset;
+        float mMax[Dim];
+        // leaf: slot count, inner node: INNER_NODE
+        uint32_t mCount;
+    };
+
+    // Box as 16 bit fractions of the parent box, rounded outwards so every node still contains its primitives: 16 bytes
+    // in 3D, four nodes per cache line. The traversal decodes the boxes on the way down from the root box. Leaves hold
+    // at most MAX_LEAF_COUNT slots starting below MAX_FIRST_SLOT, and trees up to MAX_NODES nodes fit.
+    template <int Dim>
+    struct alignas(Dim == 3 ? 16 : 4) QuantizedNode
+    {
+        static constexpr bool RELATIVE_BOXES = true;
+        static constexpr uint32_t LEAF = 0x80000000u;
+        static constexpr uint32_t MAX_LEAF_COUNT = 127;
+        static constexpr uint32_t MAX_FIRST_SLOT = 1u << 24;
+        static constexpr uint32_t MAX_NODES = 1u << 31;
+
+        template <class BBox>
+        void SetBox(const BBox &box, const BBox &parent)
+        {
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                mMin[axis] = _QuantizeDown(box.min()[axis], parent.min()[axis], parent.max()[axis]);
+                mMax[axis] = _QuantizeUp(box.max()[axis], parent.min()[axis], parent.max()[axis]);
+            }
+        }
+
+        template <class BBox>
+        BBox GetBox(const BBox &parent) const
+        {
+            typename BBox::VectorType min, max;
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                min[axis] = _Dequantize(mMin[axis], parent.min()[axis], parent.max()[axis]);
+                max[axis] = _Dequantize(mMax[axis], parent.min()[axis], parent.max()[axis]);
+            }
+            return BBox(min, max);
+        }
+
+        bool SetLeaf(const uint32_t first, const uint32_t count)
+        {
+            mData = LEAF | (count << 24) | first;
+            return count <= MAX_LEAF_COUNT && first < MAX_FIRST_SLOT;
+        }
+
+        void SetInner()
+        {
+            mData = 0;
+        }
+
+        bool SetSecondChild(const uint32_t index)
+        {
+            mData = index;
+            return index < MAX_NODES;
+        }
+
+        bool IsLeaf() const { return (mData & LEAF) != 0; }
+        uint32_t First() const { return mData & (MAX_FIRST_SLOT - 1); }
+        uint32_t Count() const { return (mData >> 24) & MAX_LEAF_COUNT; }
+        uint32_t SecondChild() const { return mData; }
+
+        uint16_t mMin[Dim];
+        uint16_t mMax[Dim];
+        // leaf: LEAF | count << 24 | first slot, inner node: index of the second child
+        uint32_t mData;
+
+    private:
+        // exact at both ends, so a child touching the parent bounds decodes to exactly those bounds
+        static HReal _Dequantize(const uint16_t quantized, const HReal min, const HReal max)
+        {
+            const HReal t = HReal(quantized) * (HReal(1) / HReal(65535));
+            return min * (1 - t) + max * t;
+        }
+
+        static uint16_t _QuantizeDown(const HReal value, const HReal min, const HReal max)
+        {
+            const HReal scaled = max > min ? std::floor((value - min) / (max - min) * 65535) : 0;
+            uint32_t quantized = static_cast<uint32_t>(std::min(std::max(scaled, HReal(0)), HReal(65535)));
+            while (quantized > 0 && _Dequantize(static_cast<uint16_t>(quantized), min, max) > value)
+                quantized--;
+            return static_cast<uint16_t>(quantized);
+        }
+
+        static uint16_t _QuantizeUp(const HReal value, const HReal min, const HReal max)
+        {
+            const HReal scaled = max > min ? std::ceil((value - min) / (max - min) * 65535) : 65535;
+            uint32_t quantized = static_cast<uint32_t>(std::min(std::max(scaled, HReal(0)), HReal(65535)));
+            while (quantized < 65535 && _Dequantize(static_cast<uint16_t>(quantized), min, max) < value)
+                quantized++;
+            return static_cast<uint16_t>(quantized);
+        }
+    };
+
+    namespace _Private
+    {
+        // pending node of a CompactBVH walk with its ray entry parameter, and its decoded box when the node format
+        // needs it to decode the children
+        template <class BBox, bool RelativeBoxes>
+        struct CompactStackEntry
+        {
+            CompactStackEntry() {}
+            CompactStackEntry(const uint32_t node, const HReal t, const BBox &box) : mNode(node), mT(t), mBox(box) {}
+            uint32_t mNode;
+            HReal mT;
+            BBox mBox;
+        };
+
+        template <class BBox>
+        struct CompactStackEntry<BBox, false>
+        {
+            CompactStackEntry() {}
+            CompactStackEntry(const uint32_t node, const HReal t, const BBox &) : mNode(node), mT(t) {}
+            uint32_t mNode;
+            HReal mT;
+        };
+    }
+
+    /// <summary>
+    /// Read-only copy of a built tree in a compact node format, for query heavy trees that are not refit.
+    /// Flatten() takes the nodes of any TreeUtils builder (or Accelerator::GetTree()) and lays them out depth first;
+    /// the queries take the same bBoxes and report the same slots as the TreeUtils queries on the source nodes.
+    /// Node is CompactNode (32 byte float nodes) or QuantizedNode (16 byte nodes quantized against their parent).
+    /// </summary>
+    template <class BBox, class Node = CompactNode<BBox::AmbientDimAtCompileTime>>
+    class CompactBVH
+    {
+    public:
+        typedef typename BBox::VectorType VectorType;
+        typedef _Private::CompactStackEntry<BBox, Node::RELATIVE_BOXES> StackEntry;
+
+        CompactBVH() {}
+
+        explicit CompactBVH(const std::vector<TreeNode<BBox>> &nodes)
+        {
+            Flatten(nodes);
+        }
+
+        /// @brief rebuilds the compact nodes from a tree; false (and an empty tree) when the tree does not fit the node format
+        bool Flatten(const std::vector<TreeNode<BBox>> &nodes)
+        {
+            m_Nodes.clear();
+            if (nodes.empty() || nodes[0].m_bbox.isEmpty())
+                return true;
+            m_RootBox = nodes[0].m_bbox;
+            m_Nodes.reserve(nodes.size());
+
+            // pre-order walk: the first child is emitted right after its parent, the second one patches the parent offset
+            struct Entry
+            {
+                uint32_t mSource;
+                uint32_t mParent;
+                BBox mParentBox;
+            };
+            FixedStack<Entry> stack;
+            stack.Push(Entry{0u, UINT_MAX, m_RootBox});
+            while (!stack.Empty())
+            {
+                const Entry entry = stack.Pop();
+                const TreeNode<BBox> &source = nodes[entry.mSource];
+                const uint32_t index = static_cast<uint32_t>(m_Nodes.size());
+                bool fits = entry.mParent == UINT_MAX || m_Nodes[entry.mParent].SetSecondChild(index);
+                m_Nodes.emplace_back();
+                Node &node = m_Nodes.back();
+                node.SetBox(source.m_bbox, entry.mParentBox);
+                if (source.IsLeaf())
+                    fits = node.SetLeaf(source.m_Index, source.m_End - source.m_Index) && fits;
+                else
+                    node.SetInner();
+                if (!fits)
+                {
+                    m_Nodes.clear();
+                    return false;
+                }
+                if (source.IsLeaf())
+                    continue;
+                // children are encoded against the decoded box, the one the queries see
+                const BBox box = node.GetBox(entry.mParentBox);
+                stack.Push(Entry{source.m_Index + 1, index, box});
+                stack.Push(Entry{source.m_Index, UINT_MAX, box});
+            }
+            return true;
+        }
+
+        const std::vector<Node> &GetNodes() const
+        {
+            return m_Nodes;
+        }
+
+        const BBox &GetRootBox() const
+        {
+            return m_RootBox;
+        }
+
+        size_t GetMemorySize() const
+        {
+            return m_Nodes.size() * sizeof(Node);
+        }
+
+        bool Empty() const
+        {
+            return m_Nodes.empty();
+        }
+
+        /// @brief visitor(slot) for every box overlapping box; a bool visitor stops the query by returning false
+        template <class Visitor>
+        bool QueryOverlaps(const std::vector<BBox> &bBoxes, const BBox &box, const Visitor &visitor) const
+        {
+            return _VisitTree([&](const BBox &nodeBox)
+                              { return nodeBox.intersects(box); },
+                              [&](uint32_t slot)
+                              { return !bBoxes[slot].intersects(box) || MathLib::_Private::_VisitData(visitor, slot); });
+        }
+
+        /// @brief visitor(slot) for every box containing point, stopping like QueryOverlaps
+        template <class Visitor>
+        bool QueryPoint(const std::vector<BBox> &bBoxes, const VectorType &point, const Visitor &visitor) const
+        {
+            return _VisitTree([&](const BBox &nodeBox)
+                              { return nodeBox.contains(point); },
+                              [&](uint32_t slot)
+                              { return !bBoxes[slot].contains(point) || MathLib::_Private::_VisitData(visitor, slot); });
+        }
+
+        /// @brief closest primitive along origin + t * direction with t in [0, tMax], as TreeUtils::RayCastClosest
+        template <class Intersector>
+        bool RayCastClosest(const VectorType &origin, const VectorType &direction, RayHit &hit, const HReal tMax,
+                            const Intersector &intersect) const
+        {
+            return _RayTraverse(origin, direction, tMax, false, intersect, hit);
+        }
+
+        /// @brief whether any primitive is hit in [0, tMax], stopping at the first hit found
+        template <class Intersector>
+        bool RayCastAny(const VectorType &origin, const VectorType &direction, const HReal tMax, const Intersector &intersect) const
+        {
+            RayHit hit;
+            return _RayTraverse(origin, direction, tMax, true, intersect, hit);
+        }
+
+    private:
+        BBox _DecodeBox(const uint32_t node, const StackEntry &parent) const
+        {
+            if constexpr (Node::RELATIVE_BOXES)
+                return m_Nodes[node].GetBox(parent.mBox);
+            else
+                return m_Nodes[node].GetBox(m_RootBox);
+        }
+
+        // the children of a popped node are tested together, next to each other when the second child is a leaf
+        template <class NodeTest, class SlotVisitor>
+        bool _VisitTree(const NodeTest &enterNode, const SlotVisitor &visitSlot) const
+        {
+            if (m_Nodes.empty())
+                return true;
+            const BBox rootBox = m_Nodes[0].GetBox(m_RootBox);
+            if (!enterNode(rootBox))
+                return true;
+            FixedStack<StackEntry> stack;
+            stack.Push(StackEntry(0u, 0, rootBox));
+            while (!stack.Empty())
+            {
+                const StackEntry entry = stack.Pop();
+                const Node &node = m_Nodes[entry.mNode];
+                if (node.IsLeaf())
+                {
+                    for (uint32_t slot = node.First(); slot < node.First() + node.Count(); slot++)
+                        if (!visitSlot(slot))
+                            return false;
+                    continue;
+                }
+                const uint32_t first = entry.mNode + 1, second = node.SecondChild();
+                const BBox firstBox = _DecodeBox(first, entry), secondBox = _DecodeBox(second, entry);
+                if (enterNode(secondBox))
+                    stack.Push(StackEntry(second, 0, secondBox));
+                if (enterNode(firstBox))
+                    stack.Push(StackEntry(first, 0, firstBox));
+            }
+            return true;
+        }
+
+        // near-first walk like TreeUtils::RayCastClosest, skipping subtrees entered behind the closest hit so far
+        template <class Intersector>
+        bool _RayTraverse(const VectorType &origin, const VectorType &direction, const HReal tMax, const bool anyHit,
+                          const Intersector &intersect, RayHit &hit) const
+        {
+            hit = RayHit();
+            if (m_Nodes.empty())
+                return false;
+            const VectorType inverseDirection = direction.cwiseInverse();
+            HReal closest = tMax, tEntry;
+            const BBox rootBox = m_Nodes[0].GetBox(m_RootBox);
+            if (!TreeUtils::_Private::RayEntersBox(origin, inverseDirection, rootBox, closest, tEntry))
+                return false;
+            FixedStack<StackEntry> stack;
+            stack.Push(StackEntry(0u, tEntry, rootBox));
+            while (!stack.Empty())
+            {
+                const StackEntry entry = stack.Pop();
+                if (entry.mT > closest)
+                    continue;
+                const Node &node = m_Nodes[entry.mNode];
+                if (node.IsLeaf())
+                {
+                    for (uint32_t slot = node.First(); slot < node.First() + node.Count(); slot++)
+                    {
+                        HReal t;
+                        if (intersect(slot, closest, t) && t <= closest)
+                        {
+                            closest = t;
+                            hit.mIndex = slot;
+                            hit.mT = t;
+                            if (anyHit)
+                                return true;
+                        }
+                    }
+                    continue;
+                }
+                const uint32_t first = entry.mNode + 1, second = node.SecondChild();
+                const BBox firstBox = _DecodeBox(first, entry), secondBox = _DecodeBox(second, entry);
+                HReal tFirst, tSecond;
+                const bool hitFirst = TreeUtils::_Private::RayEntersBox(origin, inverseDirection, firstBox, closest, tFirst);
+                const bool hitSecond = TreeUtils::_Private::RayEntersBox(origin, inverseDirection, secondBox, closest, tSecond);
+                // the farther child goes below the nearer one, so the nearer is popped first
+                if (hitFirst && hitSecond && tSecond < tFirst)
+                {
+                    stack.Push(StackEntry(first, tFirst, firstBox));
+                    stack.Push(StackEntry(second, tSecond, secondBox));
+                    continue;
+                }
+                if (hitSecond)
+                    stack.Push(StackEntry(second, tSecond, secondBox));
+                if (hitFirst)
+                    stack.Push(StackEntry(first, tFirst, firstBox));
+            }
+            return hit.mIndex != UINT_MAX;
+        }
+
+    private:
+        std::vector<Node> m_Nodes;
+        BBox m_RootBox;
+    };
+
+    typedef CompactBVH<HAABBox2D> CompactBVH2D;
+    typedef CompactBVH<HAABBox3D> CompactBVH3D;
+    typedef CompactBVH<HAABBox2D, QuantizedNode<2>> QuantizedBVH2D;
+    typedef CompactBVH<HAABBox3D, QuantizedNode<3>> QuantizedBVH3D;
+
+}; // namespace MathLib
@@ -0,0 +1,350 @@
+#pragma once
+#include <Math/Accelerate/AccelerateCommon.h>
+#include <Math/MathUtils.h>
+#include <Math/Parallel.h>
+#include <algorithm>
+
+namespace MathLib
+{
+    // Inner node of PointKDTree: the split plane only, 8 bytes in float. Points with a coordinate below mSplit on mAxis
+    // are in the first child, points above it in the second; points on the plane can be on either side.
+    struct PointKDNode
+    {
+        HReal mSplit;
+        uint32_t mAxis;
+    };
+
+    /// <summary>
+    /// Static KD-tree over 2D/3D points for exact nearest neighbour and radius queries. Build() splits every node at the
+    /// median along the longest axis of its cell with nth_element, down to buckets of at most GetBucketSize() points, the
+    /// two halves of large nodes are built as parallel tasks. The tree is complete: node i has children 2i+1 and 2i+2,
+    /// every leaf sits at the same depth and the point range of a node follows from the point count, so inner nodes only
+    /// keep their split plane and leaves take no memory. The points are stored in leaf order, a bucket is a contiguous
+    /// run of GetPoints(). Queries report the index of a point in the array passed to Build().
+    /// </summary>
+    template <int Dim>
+    class PointKDTree
+    {
+    public:
+        typedef HVectorR<Dim> Vector;
+
+        // queries per task of the batched radius search
+        static constexpr uint32_t RADIUS_QUERY_BLOCK = 256;
+
+        PointKDTree(const uint32_t bucketSize = 8)
+            : m_BucketSize(std::max(bucketSize, 1u))
+        {
+        }
+
+        /// @brief maximum number of points in a leaf, used by the next Build()
+        void SetBucketSize(const uint32_t bucketSize)
+        {
+            m_BucketSize = std::max(bucketSize, 1u);
+        }
+
+        uint32_t GetBucketSize() const
+        {
+            return m_BucketSize;
+        }
+
+        void Build(const std::vector<Vector> &points, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+        {
+            Build(points.data(), static_cast<uint32_t>(points.size()), policy);
+        }
+
+        void Build(const Vector *points, const uint32_t count, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+        {
+            Clear();
+            if (count == 0)
+                return;
+            while ((uint64_t(count) + (uint64_t(1) << m_Levels) - 1) >> m_Levels > m_BucketSize)
+                m_Levels++;
+            m_Nodes.resize((size_t(1) << m_Levels) - 1);
+
+            // points and indices travel together through the selections, split apart once the tree is done
+            std::vector<Entry> entries(count);
+            Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+                                            { entries[i] = Entry{points[i], i}; }, policy);
+            m_Bounds = Parallel::ParallelReduce<uint32_t>(
+                0, count, HAABBox<Dim>(), [&](uint32_t i, HAABBox<Dim> &box)
+                { box.extend(points[i]); },
+                [](const HAABBox<Dim> &a, const HAABBox<Dim> &b)
+                { return a.merged(b); });
+            _BuildNode(entries, 0, 0, count, 0, m_Bounds, policy);
+
+            m_Points.resize(count);
+            m_Indices.resize(count);
+            Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t slot)
+                                            {
+                m_Points[slot] = entries[slot].mPoint;
+                m_Indices[slot] = entries[slot].mIndex; }, policy);
+        }
+
+        void Clear()
+        {
+            m_Nodes.clear();
+            m_Points.clear();
+            m_Indices.clear();
+            m_Levels = 0;
+            m_Bounds.setEmpty();
+        }
+
+        /// @brief number of points in the last build
+        uint32_t Size() const
+        {
+            return static_cast<uint32_t>(m_Points.size());
+        }
+
+        /// @brief the inner nodes in heap order, empty when the whole point set fits one bucket
+        const std::vector<PointKDNode> &GetNodes() const
+        {
+            return m_Nodes;
+        }
+
+        /// @brief point positions in leaf order
+        const std::vector<Vector> &GetPoints() const
+        {
+            return m_Points;
+        }
+
+        /// @brief original point index of every entry of GetPoints()
+        const std::vector<uint32_t> &GetIndices() const
+        {
+            return m_Indices;
+        }
+
+        const HAABBox<Dim> &GetBounds() const
+        {
+            return m_Bounds;
+        }
+
+        /// @brief the point closest to center within maxRadius as (squared distance, index)
+        bool Nearest(const Vector &center, std::pair<HReal, uint32_t> &nearest, const HReal maxRadius = H_REAL_MAX) const
+        {
+            nearest = std::make_pair(_SquaredLimit(maxRadius), UINT_MAX);
+            _Traverse(center, [&]()
+                      { return nearest.first; },
+                      [&](uint32_t slot)
+                      {
+                const HReal sqDistance = (m_Points[slot] - center).squaredNorm();
+                if (sqDistance < nearest.first || (sqDistance == nearest.first && nearest.second == UINT_MAX))
+                    nearest = std::make_pair(sqDistance, slot); });
+            if (nearest.second == UINT_MAX)
+                return false;
+            nearest.second = m_Indices[nearest.second];
+            return true;
+        }
+
+        /// @brief the k points closest to center within maxRadius as (squared distance, index), sorted by distance
+        uint32_t KNearest(const Vector &center, const uint32_t k, std::vector<std::pair<HReal, uint32_t>> &result,
+                          const HReal maxRadius = H_REAL_MAX) const
+        {
+            result.clear();
+            if (k == 0)
+                return 0;
+            const HReal sqMaxRadius = _SquaredLimit(maxRadius);
+            _Traverse(center, [&]()
+                      { return result.size() == k ? result.front().first : sqMaxRadius; },
+                      [&](uint32_t slot)
+                      {
+                const HReal sqDistance = (m_Points[slot] - center).squaredNorm();
+                if (sqDistance <= sqMaxRadius)
+                    _Private::_PushNearest(result, k, sqDistance, slot); });
+            std::sort_heap(result.begin(), result.end(), [](const std::pair<HReal, uint32_t> &a, const std::pair<HReal, uint32_t> &b)
+                           { return a.first < b.first; });
+            for (std::pair<HReal, uint32_t> &neighbour : result)
+                neighbour.second = m_Indices[neighbour.second];
+            return static_cast<uint32_t>(result.size());
+        }
+
+        /// @brief visitor(index) for the points within radius of center; a bool visitor stops on false
+        template <class Visitor>
+        void FindRadius(const Vector &center, const HReal radius, const Visitor &visitor) const
+        {
+            const HReal sqRadius = radius * radius;
+            bool stopped = false;
+            _Traverse(center, [&]()
+                      { return stopped ? HReal(-1) : sqRadius; },
+                      [&](uint32_t slot)
+                      {
+                if (stopped || (m_Points[slot] - center).squaredNorm() > sqRadius)
+                    return;
+                stopped = !_Private::_VisitData(visitor, m_Indices[slot]); });
+        }
+
+        bool FindRadius(const Vector &center, const HReal radius, std::vector<uint32_t> &data) const
+        {
+            data.resize(0);
+            FindRadius(center, radius, [&](uint32_t index)
+                       { data.push_back(index); });
+            return data.size() > 0;
+        }
+
+        /// <summary>
+        /// KNearest for every center in parallel. indices receives k entries per center, closest first, and UINT_MAX for
+        /// the entries of a center with fewer than k points within maxRadius; sqDistances, if given, the matching
+        /// squared distances (H_REAL_MAX for the missing ones).
+        /// </summary>
+        void KNearest(const std::vector<Vector> &centers, const uint32_t k, std::vector<uint32_t> &indices, std::vector<HReal> *sqDistances = nullptr,
+                      const HReal maxRadius = H_REAL_MAX, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+        {
+            const uint32_t count = static_cast<uint32_t>(centers.size());
+            indices.assign(size_t(count) * k, UINT_MAX);
+            if (sqDistances)
+                sqDistances->assign(size_t(count) * k, H_REAL_MAX);
+            Parallel::ThreadLocal<std::vector<std::pair<HReal, uint32_t>>> heaps;
+            Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t query)
+                                            {
+                std::vector<std::pair<HReal, uint32_t>> &heap = heaps.Local();
+                const uint32_t found = KNearest(centers[query], k, heap, maxRadius);
+                for (uint32_t i = 0; i < found; i++)
+                {
+                    indices[size_t(query) * k + i] = heap[i].second;
+                    if (sqDistances)
+                        (*sqDistances)[size_t(query) * k + i] = heap[i].first;
+                } }, policy);
+        }
+
+        /// <summary>
+        /// FindRadius for every center in parallel, in compressed rows: the points within radius of centers[i] are
+        /// indices[offsets[i]] to indices[offsets[i + 1]] in tree order. Blocks of RADIUS_QUERY_BLOCK queries collect their
+        /// results in a buffer of their own, the buffers are copied into place once the offsets are known.
+        /// </summary>
+        void FindRadius(const std::vector<Vector> &centers, const HReal radius, std::vector<uint32_t> &offsets, std::vector<uint32_t> &indices,
+                        const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+        {
+            const uint32_t count = static_cast<uint32_t>(centers.size());
+            const uint32_t blockCount = (count + RADIUS_QUERY_BLOCK - 1) / RADIUS_QUERY_BLOCK;
+            std::vector<uint32_t> counts(count);
+            std::vector<std::vector<uint32_t>> blocks(blockCount);
+            Parallel::ParallelFor<uint32_t>(0, blockCount, [&](uint32_t block)
+                                            {
+                const uint32_t end = std::min(count, (block + 1) * RADIUS_QUERY_BLOCK);
+                for (uint32_t query = block * RADIUS_QUERY_BLOCK; query < end; query++)
+                {
+                    const size_t first = blocks[block].size();
+                    FindRadius(centers[query], radius, [&](uint32_t index)
+                               { blocks[block].push_back(index); });
+                    counts[query] = static_cast<uint32_t>(blocks[block].size() - first);
+                } }, policy);
+            offsets.resize(size_t(count) + 1);
+            offsets[count] = Parallel::ParallelExclusiveScan<uint32_t>(
+                count, [&](uint32_t query)
+                { return counts[query]; },
+                offsets.data(), policy);
+            indices.resize(offsets[count]);
+            Parallel::ParallelFor<uint32_t>(0, blockCount, [&](uint32_t block)
+                                            { std::copy(blocks[block].begin(), blocks[block].end(), indices.begin() + offsets[block * RADIUS_QUERY_BLOCK]); }, policy);
+        }
+
+    private:
+        struct Entry
+        {
+            Vector mPoint;
+            uint32_t mIndex;
+        };
+
+        struct StackEntry
+        {
+            uint32_t mNode;
+            uint32_t mBegin;
+            uint32_t mEnd;
+            // per axis distance from the query to the cell of the subtree (for the axes split so far) and its squared norm
+            Vector mOffsets;
+            HReal mSqDistance;
+        };
+
+        static HReal _SquaredLimit(const HReal maxRadius)
+        {
+            return maxRadius < std::sqrt(H_REAL_MAX) ? maxRadius * maxRadius : H_REAL_MAX;
+        }
+
+        void _BuildNode(std::vector<Entry> &entries, const uint32_t node, const uint32_t begin, const uint32_t end, const uint32_t level,
+                        const HAABBox<Dim> &cell, const Parallel::ExecutionPolicy &policy)
+        {
+            if (level == m_Levels)
+                return;
+            Eigen::Index longest;
+            cell.sizes().maxCoeff(&longest);
+            const uint32_t axis = static_cast<uint32_t>(longest);
+            const uint32_t mid = begin + (end - begin) / 2;
+            // small buckets can leave a node without points, its plane only has to split the cell
+            HReal split = cell.center()[axis];
+            if (begin != end)
+            {
+                std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end, [axis](const Entry &a, const Entry &b)
+                                 { return a.mPoint[axis] < b.mPoint[axis]; });
+                split = entries[mid].mPoint[axis];
+            }
+            m_Nodes[node] = PointKDNode{split, axis};
+
+            HAABBox<Dim> lower = cell, upper = cell;
+            lower.max()[axis] = split;
+            upper.min()[axis] = split;
+            if (policy.mSerial || end - begin < PARALLEL_BUILD_THRESHOLD)
+            {
+                _BuildNode(entries, 2 * node + 1, begin, mid, level + 1, lower, policy);
+                _BuildNode(entries, 2 * node + 2, mid, end, level + 1, upper, policy);
+                return;
+            }
+            Parallel::ParallelInvoke([&]()
+                                     { _BuildNode(entries, 2 * node + 1, begin, mid, level + 1, lower, policy); },
+                                     [&]()
+                                     { _BuildNode(entries, 2 * node + 2, mid, end, level + 1, upper, policy); },
+                                     policy);
+        }
+
+        /// @brief depth first walk, near child first; bound() is the squared distance beyond which nothing is wanted
+        /// and visitSlot(slot) is called for every point of the leaves within it
+        template <class BoundFunction, class SlotVisitor>
+        void _Traverse(const Vector &center, const BoundFunction &bound, const SlotVisitor &visitSlot) const
+        {
+            if (m_Points.empty())
+                return;
+            // one pending far child per level
+            StackEntry stack[33];
+            uint32_t stackSize = 0;
+            stack[stackSize++] = StackEntry{0, 0, Size(), Vector::Zero(), HReal(0)};
+            const uint32_t firstLeaf = static_cast<uint32_t>(m_Nodes.size());
+            while (stackSize > 0)
+            {
+                StackEntry entry = stack[--stackSize];
+                if (entry.mSqDistance > bound())
+                    continue;
+                while (entry.mNode < firstLeaf)
+                {
+                    const PointKDNode &node = m_Nodes[entry.mNode];
+                    const uint32_t mid = entry.mBegin + (entry.mEnd - entry.mBegin) / 2;
+                    const HReal offset = center[node.mAxis] - node.mSplit;
+                    // the far child is as far as the near one except along this axis, where it starts at the plane
+                    const HReal previous = entry.mOffsets[node.mAxis];
+                    const HReal sqDistance = entry.mSqDistance + offset * offset - previous * previous;
+                    if (sqDistance <= bound())
+                    {
+                        StackEntry &far = stack[stackSize++];
+                        far = entry;
+                        far.mNode = 2 * entry.mNode + (offset < 0 ? 2 : 1);
+                        (offset < 0 ? far.mBegin : far.mEnd) = mid;
+                        far.mOffsets[node.mAxis] = offset;
+                        far.mSqDistance = sqDistance;
+                    }
+                    entry.mNode = 2 * entry.mNode + (offset < 0 ? 1 : 2);
+                    (offset < 0 ? entry.mEnd : entry.mBegin) = mid;
+                }
+                for (uint32_t slot = entry.mBegin; slot < entry.mEnd; slot++)
+                    visitSlot(slot);
+            }
+        }
+
+    private:
+        uint32_t m_BucketSize;
+        uint32_t m_Levels = 0;
+        HAABBox<Dim> m_Bounds;
+        std::vector<PointKDNode> m_Nodes;
+        std::vector<Vector> m_Points;
+        std::vector<uint32_t> m_Indices;
+    };
+
+    typedef PointKDTree<2> PointKDTree2D;
+    typedef PointKDTree<3> PointKDTree3D;
+}
@@ -1,7 +1,13 @@
 #pragma once
 #include "Math/Math.h"
 #include <Math/Accelerate/AccelerateCommon.h>
+#include <Math/HasherFunction.h>
 #include <Math/MathUtils.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
 #include <stack>
 #include <vector>
 namespace MathLib
@@ -10,8 +16,7 @@ namespace MathLib
 	{
 		namespace Builder
 		{
-			const int MAX_DEPTH = 10; // 
-			const int MIN_SIZE = 4;	  // ڵڷָǰܰСԪ
+			const uint32_t MAX_TREELET_SIZE = 8; // most subtrees OptimizeTreelets rearranges at once
 
 			template <class BBox>
 			bool IsLeft(const BBox &bBox, const uint32_t axis, const HReal &pivot)
@@ -70,150 +75,521 @@ namespace MathLib
 				}
 			};
 
-			template <class BBox>
-			inline void BuildBVH(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes)
+			namespace _Private
 			{
-				struct StackNode
+				// One subtree of a parallel build: either a split node whose children were built as two tasks,
+				// or a subtree built serially into mNodes with its root at mNodes[0].
+				template <class BBox>
+				struct BuildTask
 				{
-					StackNode(uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t depth, const BBox &bbox) : mNodeIndex(nodeIndex), mBegin(begin), mEnd(end), mDepth(depth), mKdBBox(bbox) {}
-					unsigned int mNodeIndex;
-					unsigned int mBegin;
-					unsigned int mEnd;
-					unsigned int mDepth;
-					BBox mKdBBox;
+					BBox mBox;
+					std::vector<TreeNode<BBox>> mNodes;
+					std::unique_ptr<BuildTask> mChildren[2];
 				};
 
-				std::stack<StackNode> nodesStack;
-				const unsigned int maxLeafSize = 1u;
-				const unsigned int bBoxesCount = static_cast<unsigned int>(bBoxes.size());
+				/// @brief serial top-down build of root; split(range, nodeBox, left, right) returns false to make range a leaf
+				template <class BBox, class Range, class SplitFunction>
+				inline void BuildSerial(const Range &root, std::vector<TreeNode<BBox>> &nodes, const SplitFunction &split)
 				{
-					BBox newBox;
-					newBox = MergeBoxes(bBoxes, 0, bBoxesCount);
-					nodesStack.push(StackNode(0u, 0u, bBoxesCount, 0u, newBox));
+					std::stack<std::pair<uint32_t, Range>> nodesStack;
+					nodesStack.push(std::make_pair(0u, root));
+					nodes.resize(1u);
+					Range children[2];
+					while (!nodesStack.empty())
+					{
+						const uint32_t nodeIndex = nodesStack.top().first;
+						const Range range = nodesStack.top().second;
+						nodesStack.pop();
+						BBox nodeBox;
+						if (!split(range, nodeBox, children[0], children[1]))
+						{
+							nodes[nodeIndex] = TreeNode<BBox>(nodeBox, range.mBegin, range.mEnd);
+							continue;
+						}
+						const uint32_t childIndex = uint32_t(nodes.size());
+						nodes.resize(childIndex + 2u);
+						nodes[nodeIndex] = TreeNode<BBox>(nodeBox, childIndex);
+						nodesStack.push(std::make_pair(childIndex + 1u, children[1]));
+						nodesStack.push(std::make_pair(childIndex, children[0]));
+					}
 				}
-				nodes.resize(1u);
-				while (!nodesStack.empty())
+
+				template <class BBox, class Range, class SplitFunction>
+				inline void BuildTasks(const Range &range, BuildTask<BBox> &task, const SplitFunction &split, const Parallel::ExecutionPolicy &policy)
 				{
-					StackNode &node = nodesStack.top();
-					BBox nodeBox;
-					nodeBox = MergeBoxes(bBoxes, node.mBegin, node.mEnd);
-					if (node.mEnd - node.mBegin <= maxLeafSize)
+					if (policy.mSerial || range.mEnd - range.mBegin < PARALLEL_BUILD_THRESHOLD)
 					{
-						nodes[node.mNodeIndex] = TreeNode<BBox>(nodeBox, node.mBegin, node.mEnd);
-						nodesStack.pop();
-						continue;
+						BuildSerial(range, task.mNodes, split);
+						return;
 					}
-					else
+					Range children[2];
+					if (!split(range, task.mBox, children[0], children[1]))
+					{
+						task.mNodes.assign(1u, TreeNode<BBox>(task.mBox, range.mBegin, range.mEnd));
+						return;
+					}
+					task.mChildren[0].reset(new BuildTask<BBox>());
+					task.mChildren[1].reset(new BuildTask<BBox>());
+					Parallel::ParallelInvoke([&]()
+											 { BuildTasks(children[0], *task.mChildren[0], split, policy); },
+											 [&]()
+											 { BuildTasks(children[1], *task.mChildren[1], split, policy); },
+											 policy);
+				}
+
+				/// <summary>
+				/// Top-down build shared by the BVH style builders. Ranges of at least PARALLEL_BUILD_THRESHOLD boxes are split
+				/// on the calling task and their two children are built as parallel tasks; smaller ranges are built serially into
+				/// a node array of their own. Those arrays are then copied into nodes in parallel: the split nodes come first,
+				/// every serial subtree follows as one contiguous block whose root fills the child slot reserved by its parent.
+				/// Range needs mBegin/mEnd, the output has the BuildBVH layout.
+				/// </summary>
+				template <class BBox, class Range, class SplitFunction>
+				inline void BuildTree(const Range &root, std::vector<TreeNode<BBox>> &nodes, const SplitFunction &split, const Parallel::ExecutionPolicy &policy)
+				{
+					BuildTask<BBox> rootTask;
+					BuildTasks(root, rootTask, split, policy);
+					if (!rootTask.mChildren[0])
+					{
+						nodes.swap(rootTask.mNodes);
+						return;
+					}
+
+					struct Block
 					{
-						BBox kDBox;
-						PreSplit(kDBox, nodeBox, node.mKdBBox);
-						HVectorX kDBoxMin = kDBox.min();
-						HVectorX kDBoxMax = kDBox.max();
-						HVectorX nodeBoxMin = nodeBox.min();
-						HVectorX nodeBoxMax = nodeBox.max();
-						HVectorX edge = kDBoxMax - kDBoxMin;
-						uint32_t dimNum = static_cast<uint32_t>(edge.rows());
-						uint32_t splitDim = uint32_t(std::max_element(&edge[0], &edge[0] + dimNum) - &edge[0]);
-						HReal splitPlane = (kDBoxMax[splitDim] + kDBoxMin[splitDim]) * 0.5f;
-						uint32_t splitIndex = Partition(bBoxes, node.mBegin, node.mEnd, splitDim, splitPlane);
-
-						if (splitIndex == node.mBegin || splitIndex == node.mEnd)
+						const std::vector<TreeNode<BBox>> *mNodes;
+						uint32_t mSlot;
+						uint32_t mOffset;
+					};
+					std::vector<Block> blocks;
+					std::vector<std::pair<uint32_t, TreeNode<BBox>>> splitNodes;
+					std::vector<std::pair<const BuildTask<BBox> *, uint32_t>> tasks(1u, std::make_pair(&rootTask, 0u));
+					uint32_t nodeCount = 1;
+					while (!tasks.empty())
+					{
+						const BuildTask<BBox> *task = tasks.back().first;
+						const uint32_t slot = tasks.back().second;
+						tasks.pop_back();
+						if (task->mChildren[0])
 						{
-							edge = nodeBoxMax - nodeBoxMin;
-							splitDim = uint32_t(std::max_element(&edge[0], &edge[0] + dimNum) - &edge[0]);
-							splitPlane = (nodeBoxMax[splitDim] + nodeBoxMin[splitDim]) * 0.5f;
-							splitIndex = Partition(bBoxes, node.mBegin, node.mEnd, splitDim, splitPlane);
+							splitNodes.push_back(std::make_pair(slot, TreeNode<BBox>(task->mBox, nodeCount)));
+							tasks.push_back(std::make_pair(task->mChildren[1].get(), nodeCount + 1u));
+							tasks.push_back(std::make_pair(task->mChildren[0].get(), nodeCount));
+							nodeCount += 2;
 						}
-
-						if (splitIndex == node.mBegin || splitIndex == node.mEnd)
+						else
 						{
-							edge = nodeBoxMax - nodeBoxMin;
-							splitDim = uint32_t(std::max_element(&edge[0], &edge[0] + dimNum) - &edge[0]);
-							HReal mean = 0.0f;
-							for (uint32_t i = node.mBegin; i < node.mEnd; i++)
-							{
-								mean += bBoxes[i].min()[splitDim] + bBoxes[i].max()[splitDim];
-							}
-							splitPlane = mean / HReal(node.mEnd - node.mBegin);
-							splitIndex = Partition(bBoxes, node.mBegin, node.mEnd, splitDim, splitPlane);
+							blocks.push_back({&task->mNodes, slot, nodeCount});
+							nodeCount += uint32_t(task->mNodes.size()) - 1u;
 						}
+					}
 
-						if (splitIndex == node.mBegin || splitIndex == node.mEnd)
+					nodes.resize(nodeCount);
+					for (const auto &splitNode : splitNodes)
+						nodes[splitNode.first] = splitNode.second;
+					Parallel::ParallelFor<uint32_t>(0, uint32_t(blocks.size()), [&](uint32_t b)
+													{
+						// local node i > 0 moves to mOffset + i - 1; children are never local node 0, so pairs stay adjacent
+						const Block &block = blocks[b];
+						const std::vector<TreeNode<BBox>> &local = *block.mNodes;
+						for (uint32_t i = 0; i < local.size(); i++)
 						{
-							nodes[node.mNodeIndex] = TreeNode<BBox>(nodeBox, node.mBegin, node.mEnd);
-#ifndef NDEBUG
-							if (node.mEnd - node.mBegin > 1000)
-							{
-								printf("Warning: BVH node has %d elements\n", node.mEnd - node.mBegin);
-							}
-#endif
-							nodesStack.pop();
-							continue;
-						}
+							TreeNode<BBox> node = local[i];
+							if (!node.IsLeaf())
+								node.m_Index = block.mOffset + node.m_Index - 1u;
+							nodes[i == 0 ? block.mSlot : block.mOffset + i - 1u] = node;
+						} },
+													policy);
+				}
 
-						const uint32_t childIndex = uint32_t(nodes.size());
-						nodes.resize(childIndex + 2u);
-						nodes[node.mNodeIndex] = TreeNode<BBox>(nodeBox, childIndex);
-						BBox &rightBox = node.mKdBBox;
-						rightBox.min()[splitDim] = splitPlane;
-						StackNode rightNode(childIndex + 1u, splitIndex, node.mEnd, node.mDepth + 1u, rightBox);
-						nodesStack.push(rightNode);
-
-						BBox &leftBox = node.mKdBBox;
-						leftBox.max()[splitDim] = splitPlane;
-						StackNode leftNode(childIndex, node.mBegin, splitIndex, node.mDepth + 1u, leftBox);
-						nodesStack.push(leftNode);
-					}
-					nodesStack.pop();
+				// The builders sort an index array instead of the boxes and apply the permutation once at the end,
+				// so every builder can report the original index of each box.
+				inline std::vector<uint32_t> IdentityOrder(const uint32_t count, const Parallel::ExecutionPolicy &policy)
+				{
+					std::vector<uint32_t> order(count);
+					Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+													{ order[i] = i; },
+													policy);
+					return order;
+				}
+
+				/// @brief bounds of bBoxes[order[begin, end)], a parallel reduction for large ranges
+				template <class BBox>
+				inline BBox MergeOrder(const std::vector<BBox> &bBoxes, const std::vector<uint32_t> &order, const uint32_t begin, const uint32_t end,
+									   const Parallel::ExecutionPolicy &policy)
+				{
+					BBox newBox;
+					newBox.setEmpty();
+					if (policy.mSerial || end - begin < PARALLEL_BUILD_THRESHOLD)
+					{
+						for (uint32_t i = begin; i < end; i++)
+							newBox.extend(bBoxes[order[i]]);
+						return newBox;
+					}
+					return Parallel::ParallelReduce<uint32_t>(
+						begin, end, newBox, [&](uint32_t i, BBox &box)
+						{ box.extend(bBoxes[order[i]]); },
+						[](const BBox &a, const BBox &b)
+						{ return a.merged(b); });
+				}
+
+				/// @brief partitions order[begin, end) by isFirst(index), stable and parallel for large ranges
+				template <class Predicate>
+				inline uint32_t PartitionOrderBy(std::vector<uint32_t> &order, const uint32_t begin, const uint32_t end, const Predicate &isFirst,
+												 const Parallel::ExecutionPolicy &policy)
+				{
+					if (policy.mSerial || end - begin < PARALLEL_BUILD_THRESHOLD)
+						return uint32_t(std::stable_partition(order.begin() + begin, order.begin() + end, isFirst) - order.begin());
+					return begin + Parallel::ParallelPartition<uint32_t>(order.data() + begin, end - begin, isFirst, policy);
+				}
+
+				/// @brief partitions order[begin, end) by IsLeft of its boxes, parallel for large ranges. Both paths are stable,
+				/// so the serial and the parallel build see the same order and give the same tree.
+				template <class BBox>
+				inline uint32_t PartitionOrder(std::vector<uint32_t> &order, const std::vector<BBox> &bBoxes, const uint32_t begin, const uint32_t end,
+											   const uint32_t axis, const HReal pivot, const Parallel::ExecutionPolicy &policy)
+				{
+					return PartitionOrderBy(order, begin, end, [&](const uint32_t index)
+											{ return IsLeft(bBoxes[index], axis, pivot); },
+											policy);
+				}
+
+				/// @brief reorders bBoxes to bBoxes[order[i]] and hands order out as primitiveIndices
+				template <class BBox>
+				inline void ApplyOrder(std::vector<BBox> &bBoxes, std::vector<uint32_t> &order, std::vector<uint32_t> *primitiveIndices,
+									   const Parallel::ExecutionPolicy &policy)
+				{
+					std::vector<BBox> sortedBoxes(bBoxes.size());
+					Parallel::ParallelFor<uint32_t>(0, uint32_t(bBoxes.size()), [&](uint32_t i)
+													{ sortedBoxes[i] = bBoxes[order[i]]; },
+													policy);
+					bBoxes.swap(sortedBoxes);
+					if (primitiveIndices)
+						primitiveIndices->swap(order);
 				}
 			}
 
+			/// <summary>
+			/// Midpoint BVH with one box per leaf. Nodes of at least PARALLEL_BUILD_THRESHOLD boxes are merged and partitioned
+			/// in parallel and their children are built as parallel tasks, which gives the same tree for every thread count;
+			/// pass Parallel::ExecutionPolicy::Serial() to build on the calling thread only. bBoxes is reordered to match the
+			/// leaves; primitiveIndices, if given, receives the original index of every reordered box.
+			/// </summary>
 			template <class BBox>
-			void BuildAABBTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes)
+			inline void BuildBVH(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes, std::vector<uint32_t> *primitiveIndices = nullptr,
+								 const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
 			{
-				if (bBoxes.empty())
+				nodes.clear();
+				if (primitiveIndices)
+					primitiveIndices->clear();
+				const uint32_t bBoxesCount = static_cast<uint32_t>(bBoxes.size());
+				if (bBoxesCount == 0)
 					return;
 
-				struct StackNode
+				struct Range
 				{
-					uint32_t start, end;
-					int parentIndex, childIndex;
+					uint32_t mBegin;
+					uint32_t mEnd;
+					BBox mKdBBox;
 				};
-				std::stack<StackNode> stack;
 
-				nodes.reserve(bBoxes.size() * 2); // Ԥ㹻Ŀռ
-				stack.push({0, static_cast<uint32_t>(bBoxes.size()), -1, -1});
+				const uint32_t maxLeafSize = 1u;
+				std::vector<uint32_t> order = _Private::IdentityOrder(bBoxesCount, policy);
+				auto split = [&](const Range &range, BBox &nodeBox, Range &left, Range &right) -> bool
+				{
+					nodeBox = _Private::MergeOrder(bBoxes, order, range.mBegin, range.mEnd, policy);
+					if (range.mEnd - range.mBegin <= maxLeafSize)
+						return false;
 
-				while (!stack.empty())
+					BBox kDBox;
+					PreSplit(kDBox, nodeBox, range.mKdBBox);
+					HVectorX kDBoxMin = kDBox.min();
+					HVectorX kDBoxMax = kDBox.max();
+					HVectorX nodeBoxMin = nodeBox.min();
+					HVectorX nodeBoxMax = nodeBox.max();
+					HVectorX edge = kDBoxMax - kDBoxMin;
+					uint32_t dimNum = static_cast<uint32_t>(edge.rows());
+					uint32_t splitDim = uint32_t(std::max_element(&edge[0], &edge[0] + dimNum) - &edge[0]);
+					HReal splitPlane = (kDBoxMax[splitDim] + kDBoxMin[splitDim]) * 0.5f;
+					uint32_t splitIndex = _Private::PartitionOrder(order, bBoxes, range.mBegin, range.mEnd, splitDim, splitPlane, policy);
+
+					if (splitIndex == range.mBegin || splitIndex == range.mEnd)
+					{
+						edge = nodeBoxMax - nodeBoxMin;
+						splitDim = uint32_t(std::max_element(&edge[0], &edge[0] + dimNum) - &edge[0]);
+						splitPlane = (nodeBoxMax[splitDim] + nodeBoxMin[splitDim]) * 0.5f;
+						splitIndex = _Private::PartitionOrder(order, bBoxes, range.mBegin, range.mEnd, splitDim, splitPlane, policy);
+					}
+
+					if (splitIndex == range.mBegin || splitIndex == range.mEnd)
+					{
+						edge = nodeBoxMax - nodeBoxMin;
+						splitDim = uint32_t(std::max_element(&edge[0], &edge[0] + dimNum) - &edge[0]);
+						auto twiceCenter = [&](uint32_t i)
+						{ return bBoxes[order[i]].min()[splitDim] + bBoxes[order[i]].max()[splitDim]; };
+						HReal mean = 0.0f;
+						if (policy.mSerial || range.mEnd - range.mBegin < PARALLEL_BUILD_THRESHOLD)
+						{
+							for (uint32_t i = range.mBegin; i < range.mEnd; i++)
+								mean += twiceCenter(i);
+						}
+						else
+						{
+							mean = Parallel::ParallelTransformReduce<uint32_t>(range.mBegin, range.mEnd, HReal(0), twiceCenter, std::plus<HReal>(),
+																			   Parallel::ReduceOrder::eDeterministic);
+						}
+						// mean holds min + max per box, i.e. twice the centers
+						splitPlane = mean / HReal(2 * (range.mEnd - range.mBegin));
+						splitIndex = _Private::PartitionOrder(order, bBoxes, range.mBegin, range.mEnd, splitDim, splitPlane, policy);
+					}
+
+					if (splitIndex == range.mBegin || splitIndex == range.mEnd)
+					{
+#ifndef NDEBUG
+						if (range.mEnd - range.mBegin > 1000)
+						{
+							printf("Warning: BVH node has %d elements\n", range.mEnd - range.mBegin);
+						}
+#endif
+						return false;
+					}
+
+					left = {range.mBegin, splitIndex, range.mKdBBox};
+					left.mKdBBox.max()[splitDim] = splitPlane;
+					right = {splitIndex, range.mEnd, range.mKdBBox};
+					right.mKdBBox.min()[splitDim] = splitPlane;
+					return true;
+				};
+
+				_Private::BuildTree<BBox>(Range{0u, bBoxesCount, MergeBoxes(bBoxes, 0, bBoxesCount, policy)}, nodes, split, policy);
+				_Private::ApplyOrder(bBoxes, order, primitiveIndices, policy);
+			}
+
+			/// <summary>
+			/// Binned SAH builder (Wald 2007). Every node bins the centroids of its boxes into settings.mBinCount slots
+			/// along each axis, sweeps the bins for the cheapest split by the Surface Area Heuristic and stops when a leaf of
+			/// at most settings.mMaxLeafSize boxes is cheaper than any split. The output has the BuildBVH layout: the children
+			/// of an inner node are m_Index and m_Index + 1, a leaf covers bBoxes[m_Index, m_End). bBoxes is reordered to
+			/// match the leaves; primitiveIndices, if given, receives the original index of every reordered box.
+			/// Large nodes compute their bounds and bins with parallel reductions and partition in parallel, as BuildBVH does.
+			/// </summary>
+			template <class BBox>
+			inline void BuildSAHBVH(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes,
+									const SAHBuildSettings &settings = SAHBuildSettings(), std::vector<uint32_t> *primitiveIndices = nullptr,
+									const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+			{
+				typedef Eigen::Matrix<HReal, BBox::AmbientDimAtCompileTime, 1> Vector;
+				const uint32_t MAX_BIN_COUNT = 64;
+				struct Range
+				{
+					uint32_t mBegin;
+					uint32_t mEnd;
+				};
+				struct Bounds
+				{
+					Bounds()
+					{
+						mBox.setEmpty();
+						mCentroidBox.setEmpty();
+					}
+					BBox mBox;
+					BBox mCentroidBox;
+				};
+				struct Bin
+				{
+					BBox mBox;
+					uint32_t mCount;
+				};
+				// the bins of all axes, bin b of axis a is mBins[a * MAX_BIN_COUNT + b]
+				struct BinSet
 				{
-					auto [start, end, parentIndex, childIndex] = stack.top();
-					stack.pop();
+					std::array<Bin, MAX_BIN_COUNT * BBox::AmbientDimAtCompileTime> mBins;
+				};
+
+				nodes.clear();
+				const uint32_t bBoxesCount = static_cast<uint32_t>(bBoxes.size());
+				if (primitiveIndices)
+					primitiveIndices->clear();
+				if (bBoxesCount == 0)
+					return;
+
+				const uint32_t binCount = std::min(std::max(settings.mBinCount, 2u), MAX_BIN_COUNT);
+				const uint32_t maxLeafSize = std::max(settings.mMaxLeafSize, 1u);
+				std::vector<uint32_t> order = _Private::IdentityOrder(bBoxesCount, policy);
+				std::vector<Vector> centroids(bBoxesCount);
+				Parallel::ParallelFor<uint32_t>(0, bBoxesCount, [&](uint32_t i)
+												{ centroids[i] = bBoxes[i].center(); },
+												policy);
+
+				BinSet emptyBins;
+				for (Bin &bin : emptyBins.mBins)
+				{
+					bin.mBox.setEmpty();
+					bin.mCount = 0;
+				}
+				auto mergeBins = [&](const BinSet &a, const BinSet &b)
+				{
+					BinSet merged = a;
+					for (int axis = 0; axis < BBox::AmbientDimAtCompileTime; axis++)
+						for (uint32_t i = axis * MAX_BIN_COUNT; i < axis * MAX_BIN_COUNT + binCount; i++)
+						{
+							merged.mBins[i].mBox.extend(b.mBins[i].mBox);
+							merged.mBins[i].mCount += b.mBins[i].mCount;
+						}
+					return merged;
+				};
 
-					int nodeIndex = nodes.size();
-					nodes.emplace_back(); // һ½ڵ
-					if (parentIndex != -1 && childIndex != -1)
+				auto split = [&](const Range &range, BBox &nodeBox, Range &left, Range &right) -> bool
+				{
+					const uint32_t count = range.mEnd - range.mBegin;
+					const bool parallel = !policy.mSerial && count >= PARALLEL_BUILD_THRESHOLD;
+					auto addBounds = [&](uint32_t i, Bounds &bounds)
 					{
-						// TODO: Ըʵ¸ڵӽڵϢ
+						bounds.mBox.extend(bBoxes[order[i]]);
+						bounds.mCentroidBox.extend(centroids[order[i]]);
+					};
+					Bounds bounds;
+					if (parallel)
+					{
+						bounds = Parallel::ParallelReduce<uint32_t>(range.mBegin, range.mEnd, bounds, addBounds, [](const Bounds &a, const Bounds &b)
+																	{
+							Bounds merged;
+							merged.mBox = a.mBox.merged(b.mBox);
+							merged.mCentroidBox = a.mCentroidBox.merged(b.mCentroidBox);
+							return merged; });
+					}
+					else
+					{
+						for (uint32_t i = range.mBegin; i < range.mEnd; i++)
+							addBounds(i, bounds);
 					}
+					nodeBox = bounds.mBox;
+					if (count == 1)
+						return false;
 
-					// һҶӽڵ
-					if (end - start <= 1)
+					// bin along every axis in one pass; an axis without extent lands in bin 0 and is skipped by the sweep
+					const Vector centroidMin = bounds.mCentroidBox.min();
+					const Vector centroidExtent = bounds.mCentroidBox.sizes();
+					Vector binScales;
+					for (int axis = 0; axis < BBox::AmbientDimAtCompileTime; axis++)
+						binScales[axis] = centroidExtent[axis] > 0 ? HReal(binCount) * (1 - 1e-4f) / centroidExtent[axis] : HReal(0);
+					auto binIndex = [&](const uint32_t index, const int axis)
+					{ return std::min(uint32_t((centroids[index][axis] - centroidMin[axis]) * binScales[axis]), binCount - 1); };
+					auto addBins = [&](uint32_t i, BinSet &set)
 					{
-						nodes[nodeIndex] = TreeNode<BBox>(bBoxes[start], start, end);
-						continue;
+						const uint32_t index = order[i];
+						for (int axis = 0; axis < BBox::AmbientDimAtCompileTime; axis++)
+						{
+							Bin &bin = set.mBins[axis * MAX_BIN_COUNT + binIndex(index, axis)];
+							bin.mBox.extend(bBoxes[index]);
+							bin.mCount++;
+						}
+					};
+					BinSet bins;
+					if (parallel)
+						bins = Parallel::ParallelReduce<uint32_t>(range.mBegin, range.mEnd, emptyBins, addBins, mergeBins);
+					else
+					{
+						for (int axis = 0; axis < BBox::AmbientDimAtCompileTime; axis++)
+							std::copy_n(emptyBins.mBins.begin() + axis * MAX_BIN_COUNT, binCount, bins.mBins.begin() + axis * MAX_BIN_COUNT);
+						for (uint32_t i = range.mBegin; i < range.mEnd; i++)
+							addBins(i, bins);
 					}
 
-					// аΧеİΧ
-					BBox bbox = bBoxes[start];
-					for (uint32_t i = start + 1; i < end; ++i)
+					// sweep every axis: right to left fills rightCosts, left to right then evaluates each bin boundary
+					const HReal nodeArea = std::max(SurfaceArea(nodeBox), std::numeric_limits<HReal>::min());
+					HReal bestCost = H_REAL_MAX;
+					int bestAxis = -1;
+					uint32_t bestBin = 0;
+					std::array<HReal, MAX_BIN_COUNT> rightCosts;
+					for (int axis = 0; axis < BBox::AmbientDimAtCompileTime; axis++)
 					{
-						bbox.extend(bBoxes[i].min());
-						bbox.extend(bBoxes[i].max());
+						if (!(centroidExtent[axis] > 0))
+							continue;
+						const Bin *axisBins = bins.mBins.data() + axis * MAX_BIN_COUNT;
+						BBox rightBox;
+						rightBox.setEmpty();
+						uint32_t rightCount = 0;
+						for (uint32_t b = binCount - 1; b > 0; b--)
+						{
+							rightBox.extend(axisBins[b].mBox);
+							rightCount += axisBins[b].mCount;
+							rightCosts[b] = SurfaceArea(rightBox) * HReal(rightCount);
+						}
+						BBox leftBox;
+						leftBox.setEmpty();
+						uint32_t leftCount = 0;
+						for (uint32_t b = 1; b < binCount; b++)
+						{
+							leftBox.extend(axisBins[b - 1].mBox);
+							leftCount += axisBins[b - 1].mCount;
+							if (leftCount == 0 || leftCount == count)
+								continue;
+							const HReal cost = settings.mTraversalCost +
+											   settings.mIntersectionCost * (SurfaceArea(leftBox) * HReal(leftCount) + rightCosts[b]) / nodeArea;
+							if (cost < bestCost)
+							{
+								bestCost = cost;
+								bestAxis = axis;
+								bestBin = b;
+							}
+						}
+					}
+
+					if (count <= maxLeafSize && !(bestCost < settings.mIntersectionCost * HReal(count)))
+						return false;
+
+					uint32_t splitIndex;
+					if (bestAxis >= 0)
+					{
+						auto isLeft = [&](const uint32_t index)
+						{ return binIndex(index, bestAxis) < bestBin; };
+						if (parallel)
+							splitIndex = range.mBegin + Parallel::ParallelPartition<uint32_t>(order.data() + range.mBegin, count, isLeft, policy);
+						else
+							splitIndex = uint32_t(std::stable_partition(order.begin() + range.mBegin, order.begin() + range.mEnd, isLeft) - order.begin());
 					}
-					nodes[nodeIndex].m_bbox = bbox;
+					else
+					{
+						// all centroids coincide and no plane separates them: halve the range so the leaf size still holds
+						splitIndex = range.mBegin + count / 2;
+					}
+					left = {range.mBegin, splitIndex};
+					right = {splitIndex, range.mEnd};
+					return true;
+				};
+				_Private::BuildTree<BBox>(Range{0u, bBoxesCount}, nodes, split, policy);
+				_Private::ApplyOrder(bBoxes, order, primitiveIndices, policy);
+			}
+
+			/// <summary>
+			/// Median-of-extent AABB tree with one box per leaf: splits the longest axis of each node at its center and falls
+			/// back to halving the range when every box lands on one side. Same layout and parallel scheme as BuildBVH.
+			/// </summary>
+			template <class BBox>
+			void BuildAABBTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes, std::vector<uint32_t> *primitiveIndices = nullptr,
+							   const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+			{
+				nodes.clear();
+				if (primitiveIndices)
+					primitiveIndices->clear();
+				if (bBoxes.empty())
+					return;
+				std::vector<uint32_t> order = _Private::IdentityOrder(static_cast<uint32_t>(bBoxes.size()), policy);
+
+				struct Range
+				{
+					uint32_t mBegin;
+					uint32_t mEnd;
+				};
+				auto split = [&](const Range &range, BBox &nodeBox, Range &left, Range &right) -> bool
+				{
+					nodeBox = _Private::MergeOrder(bBoxes, order, range.mBegin, range.mEnd, policy);
+					if (range.mEnd - range.mBegin <= 1)
+						return false;
 
 					// ҵ
-					auto diagonal = bbox.max() - bbox.min();
+					auto diagonal = nodeBox.max() - nodeBox.min();
 					uint32_t splitAxis = 0;
 					for (int i = 1; i < BBox::AmbientDimAtCompileTime; ++i)
 					{
@@ -222,215 +598,724 @@ namespace MathLib
 					}
 
 					// еָΧ
-					HReal split = (bbox.min()[splitAxis] + bbox.max()[splitAxis]) / 2.0f;
-
-					// ʹPartitionָ
-					uint32_t mid = Partition(bBoxes, start, end, splitAxis, split);
+					HReal splitPlane = (nodeBox.min()[splitAxis] + nodeBox.max()[splitAxis]) / 2.0f;
+					uint32_t mid = _Private::PartitionOrder(order, bBoxes, range.mBegin, range.mEnd, splitAxis, splitPlane, policy);
 
 					// Ԫضһߵ
-					if (mid == start || mid == end)
-					{
-						mid = start + (end - start) / 2;
-					}
+					if (mid == range.mBegin || mid == range.mEnd)
+						mid = range.mBegin + (range.mEnd - range.mBegin) / 2;
 
-					// 
-					stack.push({mid, end, nodeIndex, 1});
-					// 
-					stack.push({start, mid, nodeIndex, 0});
-				}
+					left = {range.mBegin, mid};
+					right = {mid, range.mEnd};
+					return true;
+				};
+				_Private::BuildTree<BBox>(Range{0u, static_cast<uint32_t>(bBoxes.size())}, nodes, split, policy);
+				_Private::ApplyOrder(bBoxes, order, primitiveIndices, policy);
 			}
 
+			/// <summary>
+			/// KD tree over the box centers with one box per leaf: the split axis cycles with the depth and every node is
+			/// split at the median box (std::nth_element), so the tree is balanced. Same layout and parallel scheme as BuildBVH.
+			/// </summary>
 			template <class BBox>
-			void BuildKDTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes)
+			void BuildKDTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes, std::vector<uint32_t> *primitiveIndices = nullptr,
+							 const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
 			{
+				nodes.clear();
+				if (primitiveIndices)
+					primitiveIndices->clear();
 				if (bBoxes.empty())
 					return;
+				std::vector<uint32_t> order = _Private::IdentityOrder(static_cast<uint32_t>(bBoxes.size()), policy);
 
-				struct StackNode
+				struct Range
 				{
-					uint32_t start;
-					uint32_t end;
-					int depth;
-					int parentIndex;
-					bool leftChild;
+					uint32_t mBegin;
+					uint32_t mEnd;
+					uint32_t mDepth;
 				};
+				auto split = [&](const Range &range, BBox &nodeBox, Range &left, Range &right) -> bool
+				{
+					nodeBox = _Private::MergeOrder(bBoxes, order, range.mBegin, range.mEnd, policy);
+					if (range.mEnd - range.mBegin <= 1)
+						return false;
 
-				std::stack<StackNode> stack;
-				stack.push({0, static_cast<uint32_t>(bBoxes.size()), 0, -1, true});
+					// Find the dimension to split on based on depth
+					const uint32_t axis = range.mDepth % BBox::AmbientDimAtCompileTime;
+					const uint32_t mid = range.mBegin + (range.mEnd - range.mBegin) / 2;
+					std::nth_element(order.begin() + range.mBegin, order.begin() + mid, order.begin() + range.mEnd,
+									 [&](const uint32_t a, const uint32_t b)
+									 {
+										 return bBoxes[a].center()[axis] < bBoxes[b].center()[axis];
+									 });
 
-				while (!stack.empty())
-				{
-					auto [start, end, depth, parentIndex, leftChild] = stack.top();
-					stack.pop();
+					left = {range.mBegin, mid, range.mDepth + 1};
+					right = {mid, range.mEnd, range.mDepth + 1};
+					return true;
+				};
+				_Private::BuildTree<BBox>(Range{0u, static_cast<uint32_t>(bBoxes.size()), 0u}, nodes, split, policy);
+				_Private::ApplyOrder(bBoxes, order, primitiveIndices, policy);
+			}
 
-					if (start >= end)
-						continue; // Invalid range
+			/// <summary>
+			/// Treelet restructuring (Karras and Aila 2013) of a tree in the BuildBVH layout. The tree is walked bottom-up and
+			/// at every inner node a treelet is grown by opening its largest treelet leaf until it holds treeletSize (3 to 8)
+			/// subtrees. Dynamic programming over all subsets of those subtrees then finds the binary tree of least SAH cost,
+			/// which replaces the treelet in place when it is cheaper. Only the inner nodes of a treelet change; leaves and the
+			/// box order stay as they are. A node is processed once both children are done, so disjoint subtrees run in parallel.
+			/// </summary>
+			template <class BBox>
+			inline void OptimizeTreelets(std::vector<TreeNode<BBox>> &nodes, const uint32_t treeletSize = 7,
+										 const SAHBuildSettings &settings = SAHBuildSettings(),
+										 const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+			{
+				const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+				const uint32_t maxLeaves = std::min(std::max(treeletSize, 3u), MAX_TREELET_SIZE);
+				// three leaves at least, otherwise there is only one possible tree
+				if (nodeCount < 5)
+					return;
 
-					int nodeIndex = nodes.size();
-					nodes.emplace_back(); // Add a new node
+				std::vector<uint32_t> parents(nodeCount, UINT_MAX);
+				std::vector<uint8_t> isLeaf(nodeCount);
+				std::unique_ptr<std::atomic<uint32_t>[]> visits(new std::atomic<uint32_t>[nodeCount]);
+				Parallel::ParallelFor<uint32_t>(0, nodeCount, [&](uint32_t i)
+												{
+					visits[i].store(0, std::memory_order_relaxed);
+					isLeaf[i] = nodes[i].IsLeaf();
+					if (!isLeaf[i])
+					{
+						parents[nodes[i].m_Index] = i;
+						parents[nodes[i].m_Index + 1] = i;
+					} },
+												policy);
+				// SAH cost of the subtree below every node, kept up to date while treelets move
+				std::vector<HReal> costs(nodeCount);
 
-					// If this is a leaf node
-					if (end - start <= 1)
+				auto restructure = [&](const uint32_t root)
+				{
+					// grow the treelet; pairs are the child slots of its inner nodes, they get reused by the new topology
+					uint32_t leaves[MAX_TREELET_SIZE];
+					uint32_t pairs[MAX_TREELET_SIZE - 1];
+					uint32_t leafCount = 2, pairCount = 1;
+					pairs[0] = nodes[root].m_Index;
+					leaves[0] = nodes[root].m_Index;
+					leaves[1] = nodes[root].m_Index + 1;
+					while (leafCount < maxLeaves)
 					{
-						nodes[nodeIndex] = TreeNode<BBox>(bBoxes[start], start);
-						if (parentIndex != -1)
+						int opened = -1;
+						HReal largestArea = -1;
+						for (uint32_t i = 0; i < leafCount; i++)
 						{
-							// Update parent's child index here if needed
+							const HReal area = SurfaceArea(nodes[leaves[i]].m_bbox);
+							if (!nodes[leaves[i]].IsLeaf() && area > largestArea)
+							{
+								largestArea = area;
+								opened = int(i);
+							}
 						}
-						continue;
+						if (opened < 0)
+							break;
+						const uint32_t children = nodes[leaves[opened]].m_Index;
+						pairs[pairCount++] = children;
+						leaves[opened] = children;
+						leaves[leafCount++] = children + 1;
 					}
+					if (leafCount < 3)
+						return;
 
-					// Find the dimension to split on based on depth
-					uint32_t axis = depth % BBox::AmbientDimAtCompileTime;
-
-					// Sort the boxes along the chosen axis
-					std::nth_element(bBoxes.begin() + start, bBoxes.begin() + (start + end) / 2, bBoxes.begin() + end,
-									 [axis](const BBox &a, const BBox &b)
-									 {
-										 return a.center()[axis] < b.center()[axis];
-									 });
-
-					uint32_t mid = start + (end - start) / 2;
+					// best tree of every subset of treelet leaves, subsets in increasing order so their parts come first
+					std::array<BBox, 1u << MAX_TREELET_SIZE> boxes;
+					std::array<HReal, 1u << MAX_TREELET_SIZE> subsetCosts;
+					std::array<uint8_t, 1u << MAX_TREELET_SIZE> splits;
+					const uint32_t fullSet = (1u << leafCount) - 1;
+					for (uint32_t i = 0; i < leafCount; i++)
+					{
+						boxes[1u << i] = nodes[leaves[i]].m_bbox;
+						subsetCosts[1u << i] = costs[leaves[i]];
+					}
+					for (uint32_t set = 3; set <= fullSet; set++)
+					{
+						const uint32_t lowest = set & (0u - set);
+						if (set == lowest)
+							continue;
+						boxes[set] = boxes[lowest].merged(boxes[set ^ lowest]);
+						// every split once: the part holding the lowest leaf goes left
+						HReal bestCost = H_REAL_MAX;
+						uint32_t bestPart = lowest;
+						for (uint32_t part = (set - 1) & set; part != 0; part = (part - 1) & set)
+						{
+							if (!(part & lowest))
+								continue;
+							const HReal cost = subsetCosts[part] + subsetCosts[set ^ part];
+							if (cost < bestCost)
+							{
+								bestCost = cost;
+								bestPart = part;
+							}
+						}
+						subsetCosts[set] = settings.mTraversalCost * SurfaceArea(boxes[set]) + bestCost;
+						splits[set] = uint8_t(bestPart);
+					}
+					if (!(subsetCosts[fullSet] < costs[root] * (1 - 1e-5f)))
+						return;
 
-					// Create the node
-					BBox bbox = bBoxes[start];
-					for (uint32_t i = start + 1; i < end; ++i)
+					TreeNode<BBox> leafNodes[MAX_TREELET_SIZE];
+					HReal leafCosts[MAX_TREELET_SIZE];
+					for (uint32_t i = 0; i < leafCount; i++)
 					{
-						bbox.extend(bBoxes[i].min());
-						bbox.extend(bBoxes[i].max());
+						leafNodes[i] = nodes[leaves[i]];
+						leafCosts[i] = costs[leaves[i]];
 					}
-					nodes[nodeIndex] = TreeNode<BBox>(bbox, mid);
+					std::pair<uint32_t, uint32_t> emitStack[2 * MAX_TREELET_SIZE];
+					uint32_t stackSize = 0, nextPair = 0;
+					emitStack[stackSize++] = std::make_pair(fullSet, root);
+					while (stackSize > 0)
+					{
+						const uint32_t set = emitStack[--stackSize].first;
+						const uint32_t slot = emitStack[stackSize].second;
+						if ((set & (set - 1)) == 0)
+						{
+							uint32_t leaf = 0;
+							while (!(set & (1u << leaf)))
+								leaf++;
+							nodes[slot] = leafNodes[leaf];
+							costs[slot] = leafCosts[leaf];
+							continue;
+						}
+						const uint32_t pair = pairs[nextPair++];
+						nodes[slot] = TreeNode<BBox>(boxes[set], pair);
+						costs[slot] = subsetCosts[set];
+						emitStack[stackSize++] = std::make_pair(uint32_t(splits[set]), pair);
+						emitStack[stackSize++] = std::make_pair(set ^ splits[set], pair + 1);
+					}
+				};
 
-					// Push children to stack
-					stack.push({mid + 1, end, depth + 1, nodeIndex, false});
-					stack.push({start, mid, depth + 1, nodeIndex, true});
-				}
+				// one walk per leaf; the second walk to reach a node processes it and carries on, the first one stops there
+				std::vector<uint32_t> leafSlots;
+				for (uint32_t i = 0; i < nodeCount; i++)
+					if (isLeaf[i])
+						leafSlots.push_back(i);
+				Parallel::ParallelFor<uint32_t>(0, uint32_t(leafSlots.size()), [&](uint32_t l)
+												{
+					const uint32_t leaf = leafSlots[l];
+					costs[leaf] = settings.mIntersectionCost * SurfaceArea(nodes[leaf].m_bbox) * HReal(nodes[leaf].m_End - nodes[leaf].m_Index);
+					for (uint32_t node = parents[leaf]; node != UINT_MAX; node = parents[node])
+					{
+						if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+							return;
+						const TreeNode<BBox> &inner = nodes[node];
+						costs[node] = settings.mTraversalCost * SurfaceArea(inner.m_bbox) + costs[inner.m_Index] + costs[inner.m_Index + 1];
+						restructure(node);
+					} },
+												policy);
 			}
 
+			/// <summary>
+			/// Linear BVH (Karras 2012) with one box per leaf, the fastest builder for scenes that are rebuilt every frame.
+			/// The box centers are quantized over their bounds to Morton codes (30 bits, 63 with settings.mWideMortonCodes)
+			/// and radix sorted. Every inner node then finds its range and split position from the sorted codes alone, so all
+			/// nodes are emitted in one parallel pass and the boxes are merged bottom-up; equal codes are ordered by index.
+			/// The children of the inner node that splits the sorted boxes after position g are nodes 2g + 1 and 2g + 2.
+			/// settings.mTreeletPasses > 0 recovers SAH quality with OptimizeTreelets. bBoxes is reordered along the
+			/// Morton curve; primitiveIndices, if given, receives the original index of every reordered box.
+			/// </summary>
 			template <class BBox>
-			void BuildQuadTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes)
+			inline void BuildLBVH(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes,
+								  const LBVHBuildSettings &settings = LBVHBuildSettings(), std::vector<uint32_t> *primitiveIndices = nullptr,
+								  const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
 			{
-				// static_assert(BBox::AmbientDimAtCompileTime == 2);
-				if (bBoxes.empty())
+				const int dimension = BBox::AmbientDimAtCompileTime;
+				nodes.clear();
+				if (primitiveIndices)
+					primitiveIndices->clear();
+				const uint32_t count = static_cast<uint32_t>(bBoxes.size());
+				if (count == 0)
 					return;
 
-				struct StackNode
-				{
-					BBox bounds;
-					uint32_t start, end;
-					int depth;
-				};
-
-				std::stack<StackNode> stack;
+				const BBox centroidBox = Parallel::ParallelReduce<uint32_t>(
+					0, count, BBox(), [&](uint32_t i, BBox &box)
+					{ box.extend(bBoxes[i].center()); },
+					[](const BBox &a, const BBox &b)
+					{ return a.merged(b); });
+				const uint32_t axisBits = settings.mWideMortonCodes ? (dimension == 2 ? 31 : 21) : (dimension == 2 ? 15 : 10);
+				const double maxCell = double((1ull << axisBits) - 1);
+				std::vector<uint64_t> codes(count);
+				std::vector<uint32_t> order = _Private::IdentityOrder(count, policy);
+				Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+												{
+					uint32_t cell[dimension];
+					for (int axis = 0; axis < dimension; axis++)
+					{
+						const double extent = double(centroidBox.max()[axis]) - double(centroidBox.min()[axis]);
+						const double t = extent > 0 ? (double(bBoxes[i].center()[axis]) - double(centroidBox.min()[axis])) / extent : 0.0;
+						cell[axis] = uint32_t(std::min(std::max(t * (maxCell + 1), 0.0), maxCell));
+					}
+					if constexpr (dimension == 2)
+						codes[i] = MortonEncode2(cell[0], cell[1]);
+					else
+						codes[i] = MortonEncode3(cell[0], cell[1], cell[2]); },
+												policy);
+				Parallel::ParallelRadixSort<uint32_t>(codes.data(), order.data(), count, dimension * axisBits, policy);
 
-				// аΧеĺϲΧУΪڵİΧ
-				BBox rootBounds = bBoxes[0];
-				for (const auto &box : bBoxes)
+				_Private::ApplyOrder(bBoxes, order, primitiveIndices, policy);
+				if (count == 1)
 				{
-					rootBounds.extend(box.min());
-					rootBounds.extend(box.max());
+					nodes.assign(1u, TreeNode<BBox>(bBoxes[0], 0u, 1u));
+					return;
 				}
 
-				// ʼջ
-				stack.push({rootBounds, 0, static_cast<uint32_t>(bBoxes.size()), 0});
-
-				while (!stack.empty())
+				// length of the common prefix of the codes at i and j, -1 outside the array
+				auto delta = [&](const int64_t i, const int64_t j) -> int
 				{
-					auto [bounds, start, end, depth] = stack.top();
-					stack.pop();
-
-					int nodeIndex = nodes.size();
-					nodes.emplace_back(bounds, start); // ½ڵ
-
-					// Ȼָֹ
-					if (depth > MAX_DEPTH || (end - start) <= MIN_SIZE)
+					if (j < 0 || j >= int64_t(count))
+						return -1;
+					const uint64_t difference = codes[i] ^ codes[j];
+					return difference != 0 ? int(CountLeadingZeros64(difference)) : 64 + int(CountLeadingZeros64(uint64_t(i ^ j)));
+				};
+				// inner node i (of count - 1) owns the child pair at splits[i]; internalSlots/leafSlots say where a node is stored
+				std::vector<uint32_t> splits(count - 1), pairOwners(count - 1), internalSlots(count - 1), leafSlots(count);
+				internalSlots[0] = 0;
+				Parallel::ParallelFor<uint32_t>(0, count - 1, [&](uint32_t node)
+												{
+					const int64_t i = node;
+					const int64_t direction = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+					// the other end of the range: exponential then binary search for the last code sharing more than deltaMin
+					const int deltaMin = delta(i, i - direction);
+					int64_t maxLength = 2;
+					while (delta(i, i + maxLength * direction) > deltaMin)
+						maxLength *= 2;
+					int64_t length = 0;
+					for (int64_t step = maxLength / 2; step >= 1; step /= 2)
 					{
-						continue;
+						if (delta(i, i + (length + step) * direction) > deltaMin)
+							length += step;
+					}
+					const int64_t j = i + length * direction;
+					// the split: the last position sharing more than the common prefix of the whole range
+					const int deltaNode = delta(i, j);
+					int64_t split = 0;
+					for (int64_t divisor = 2;; divisor *= 2)
+					{
+						const int64_t step = (length + divisor - 1) / divisor;
+						if (delta(i, i + (split + step) * direction) > deltaNode)
+							split += step;
+						if (step <= 1)
+							break;
 					}
+					const uint32_t gamma = uint32_t(i + split * direction + std::min<int64_t>(direction, 0));
+					splits[node] = gamma;
+					pairOwners[gamma] = node;
+					if (std::min(i, j) == int64_t(gamma))
+						leafSlots[gamma] = 2 * gamma + 1;
+					else
+						internalSlots[gamma] = 2 * gamma + 1;
+					if (std::max(i, j) == int64_t(gamma) + 1)
+						leafSlots[gamma + 1] = 2 * gamma + 2;
+					else
+						internalSlots[gamma + 1] = 2 * gamma + 2; },
+												policy);
 
-					// ָΧΪĸ
-					Eigen::Vector2f center = bounds.center();
-					std::array<BBox, 4> quadrants = {
-						BBox(bounds.min(), center),																		// 
-						BBox(Eigen::Vector2f(center[0], bounds.min()[1]), Eigen::Vector2f(bounds.max()[0], center[1])), // 
-						BBox(center, bounds.max()),																		// 
-						BBox(Eigen::Vector2f(bounds.min()[0], center[1]), Eigen::Vector2f(center[0], bounds.max()[1]))	// 
-					};
+				// merge the boxes bottom-up, the second child to finish builds its parent
+				nodes.resize(2 * size_t(count) - 1);
+				std::unique_ptr<std::atomic<uint32_t>[]> visits(new std::atomic<uint32_t>[count - 1]);
+				Parallel::ParallelFor<uint32_t>(0, count - 1, [&](uint32_t node)
+												{ visits[node].store(0, std::memory_order_relaxed); },
+												policy);
+				Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t leaf)
+												{
+					uint32_t slot = leafSlots[leaf];
+					nodes[slot] = TreeNode<BBox>(bBoxes[leaf], leaf, leaf + 1);
+					while (slot != 0)
+					{
+						const uint32_t owner = pairOwners[(slot - 1) / 2];
+						if (visits[owner].fetch_add(1, std::memory_order_acq_rel) == 0)
+							return;
+						const uint32_t children = 2 * splits[owner] + 1;
+						slot = internalSlots[owner];
+						nodes[slot] = TreeNode<BBox>(nodes[children].m_bbox.merged(nodes[children + 1].m_bbox), children);
+					} },
+												policy);
 
-					// Ϊÿ޴ӽڵ
-					for (int i = 0; i < 4; ++i)
+				SAHBuildSettings costs;
+				costs.mTraversalCost = settings.mTraversalCost;
+				costs.mIntersectionCost = settings.mIntersectionCost;
+				for (uint32_t pass = 0; pass < settings.mTreeletPasses; pass++)
+					OptimizeTreelets(nodes, settings.mTreeletSize, costs, policy);
+			}
+
+			namespace _Private
+			{
+				/// <summary>
+				/// Loose quadtree (2D) / octree (3D) in the BuildBVH layout, shared by BuildQuadTree and BuildOctTree. A tree
+				/// node halves its cell along every axis in turn, one binary level per axis, so its 2^Dim child cells hang below
+				/// Dim levels of binary nodes; halves without boxes get no node. A box goes to the child cell holding its center
+				/// when it fits the loose child cell, settings.mLooseness times the child cell around the same center; the boxes
+				/// too large for that stay in a leaf of their own next to the children. The root cell is the cube around all boxes.
+				/// </summary>
+				template <class BBox>
+				inline void BuildLooseTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes, const LooseTreeBuildSettings &settings,
+										   std::vector<uint32_t> *primitiveIndices, const Parallel::ExecutionPolicy &policy)
+				{
+					constexpr uint32_t Dim = BBox::AmbientDimAtCompileTime;
+					typedef typename BBox::VectorType Vector;
+					nodes.clear();
+					if (primitiveIndices)
+						primitiveIndices->clear();
+					const uint32_t bBoxesCount = static_cast<uint32_t>(bBoxes.size());
+					if (bBoxesCount == 0)
+						return;
+					std::vector<uint32_t> order = IdentityOrder(bBoxesCount, policy);
+
+					struct Range
 					{
-						stack.push({quadrants[i], start, end, depth + 1});
-					}
+						uint32_t mBegin;
+						uint32_t mEnd;
+						// cell of the tree node the range belongs to and its depth in the tree
+						BBox mCell;
+						uint32_t mDepth;
+						// 0: the large boxes are not sorted out yet, a: the cell is halved along axis a - 1 next
+						uint32_t mStep;
+						// the boxes that stay at their tree node
+						bool mLarge;
+					};
+					auto split = [&](const Range &range, BBox &nodeBox, Range &left, Range &right) -> bool
+					{
+						nodeBox = MergeOrder(bBoxes, order, range.mBegin, range.mEnd, policy);
+						if (range.mLarge)
+							return false;
+						// halving a cell that holds all boxes on one side only narrows the cell, the range stays the same
+						Range current = range;
+						while (current.mEnd - current.mBegin > settings.mMinSize && current.mDepth < settings.mMaxDepth)
+						{
+							if (current.mStep == 0)
+							{
+								const Vector limit = current.mCell.sizes() * (HReal(0.5) * (settings.mLooseness - 1));
+								const uint32_t mid = PartitionOrderBy(order, current.mBegin, current.mEnd, [&](const uint32_t index)
+																	  { return (bBoxes[index].sizes().array() <= limit.array()).all(); },
+																	  policy);
+								if (mid == current.mBegin)
+									return false;
+								current.mStep = 1;
+								if (mid == current.mEnd)
+									continue;
+								left = current;
+								left.mEnd = mid;
+								right = current;
+								right.mBegin = mid;
+								right.mLarge = true;
+								return true;
+							}
+							const uint32_t axis = current.mStep - 1;
+							const HReal pivot = current.mCell.center()[axis];
+							const uint32_t mid = PartitionOrder(order, bBoxes, current.mBegin, current.mEnd, axis, pivot, policy);
+							const bool lastAxis = current.mStep == Dim;
+							Range lower = current, upper = current;
+							lower.mEnd = mid;
+							lower.mCell.max()[axis] = pivot;
+							upper.mBegin = mid;
+							upper.mCell.min()[axis] = pivot;
+							lower.mStep = upper.mStep = lastAxis ? 0 : current.mStep + 1;
+							lower.mDepth = upper.mDepth = current.mDepth + (lastAxis ? 1 : 0);
+							if (mid != current.mBegin && mid != current.mEnd)
+							{
+								left = lower;
+								right = upper;
+								return true;
+							}
+							current = mid == current.mEnd ? lower : upper;
+						}
+						return false;
+					};
+
+					const BBox bounds = MergeBoxes(bBoxes, 0, bBoxesCount, policy);
+					const Vector halfSide = Vector::Constant(bounds.sizes().maxCoeff() * HReal(0.5));
+					const BBox rootCell(bounds.center() - halfSide, bounds.center() + halfSide);
+					BuildTree<BBox>(Range{0u, bBoxesCount, rootCell, 0u, 0u, false}, nodes, split, policy);
+					ApplyOrder(bBoxes, order, primitiveIndices, policy);
 				}
 			}
 
+			/// <summary>
+			/// Loose quadtree over 2D boxes with the depth and leaf size limits of settings, see _Private::BuildLooseTree.
+			/// The output has the BuildBVH layout, so every TreeUtils query walks it. bBoxes is reordered to match the leaves;
+			/// primitiveIndices, if given, receives the original index of every reordered box. Parallel like BuildBVH.
+			/// </summary>
 			template <class BBox>
-			void BuildOctTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes)
+			void BuildQuadTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes, const LooseTreeBuildSettings &settings = LooseTreeBuildSettings(),
+							   std::vector<uint32_t> *primitiveIndices = nullptr, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
 			{
-				// static_assert(BBox::AmbientDimAtCompileTime == 3);
-				if (bBoxes.empty())
-					return;
+				static_assert(BBox::AmbientDimAtCompileTime == 2, "BuildQuadTree takes 2D boxes, BuildOctTree 3D ones");
+				_Private::BuildLooseTree(bBoxes, nodes, settings, primitiveIndices, policy);
+			}
 
-				struct StackNode
-				{
-					HAABBox3D bounds;
-					uint32_t start, end;
-					int depth;
-				};
+			/// <summary>
+			/// Loose octree over 3D boxes, the same builder as BuildQuadTree.
+			/// </summary>
+			template <class BBox>
+			void BuildOctTree(std::vector<BBox> &bBoxes, std::vector<TreeNode<BBox>> &nodes, const LooseTreeBuildSettings &settings = LooseTreeBuildSettings(),
+							  std::vector<uint32_t> *primitiveIndices = nullptr, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+			{
+				static_assert(BBox::AmbientDimAtCompileTime == 3, "BuildOctTree takes 3D boxes, BuildQuadTree 2D ones");
+				_Private::BuildLooseTree(bBoxes, nodes, settings, primitiveIndices, policy);
+			}
+		} // namespace Builder
 
-				std::stack<StackNode> stack;
+		struct TreeQuality
+		{
+			HReal mSAHCost = 0;
+			uint32_t mNodeCount = 0;
+			uint32_t mLeafCount = 0;
+			uint32_t mMaxDepth = 0;
+			HReal mAverageLeafDepth = 0;
+			// mLeafSizeHistogram[n] = number of leaves holding n boxes
+			std::vector<uint32_t> mLeafSizeHistogram;
+		};
 
-				// аΧеĺϲΧУΪڵİΧ
-				BBox rootBounds = bBoxes[0];
-				for (const auto &box : bBoxes)
+		/// @brief SAH cost (relative to the root area), depth and leaf statistics of a tree in the BVH layout
+		template <class BBox>
+		inline TreeQuality EvaluateTree(const std::vector<TreeNode<BBox>> &nodes, const SAHBuildSettings &settings = SAHBuildSettings())
+		{
+			TreeQuality quality;
+			if (nodes.empty())
+				return quality;
+			const HReal rootArea = std::max(SurfaceArea(nodes[0].m_bbox), std::numeric_limits<HReal>::min());
+			std::stack<std::pair<uint32_t, uint32_t>> nodesStack;
+			nodesStack.push(std::make_pair(0u, 0u));
+			uint64_t leafDepthSum = 0;
+			while (!nodesStack.empty())
+			{
+				const uint32_t nodeIndex = nodesStack.top().first;
+				const uint32_t depth = nodesStack.top().second;
+				nodesStack.pop();
+				const TreeNode<BBox> &node = nodes[nodeIndex];
+				const HReal area = SurfaceArea(node.m_bbox) / rootArea;
+				quality.mNodeCount++;
+				quality.mMaxDepth = std::max(quality.mMaxDepth, depth);
+				if (node.IsLeaf())
+				{
+					const uint32_t size = node.m_End - node.m_Index;
+					quality.mSAHCost += settings.mIntersectionCost * area * HReal(size);
+					quality.mLeafCount++;
+					leafDepthSum += depth;
+					if (quality.mLeafSizeHistogram.size() <= size)
+						quality.mLeafSizeHistogram.resize(size + 1, 0);
+					quality.mLeafSizeHistogram[size]++;
+				}
+				else
 				{
-					rootBounds.extend(box.min());
-					rootBounds.extend(box.max());
+					quality.mSAHCost += settings.mTraversalCost * area;
+					nodesStack.push(std::make_pair(node.m_Index, depth + 1));
+					nodesStack.push(std::make_pair(node.m_Index + 1, depth + 1));
 				}
+			}
+			quality.mAverageLeafDepth = HReal(leafDepthSum) / HReal(std::max(quality.mLeafCount, 1u));
+			return quality;
+		}
 
-				// ʼջ
-				stack.push({rootBounds, 0, static_cast<uint32_t>(bBoxes.size()), 0});
+		namespace _Private
+		{
+			// a pair of nodes whose boxes overlap; in a self query mFirst == mSecond stands for the pairs inside one subtree
+			struct NodePair
+			{
+				uint32_t mFirst;
+				uint32_t mSecond;
+			};
 
-				while (!stack.empty())
+			// expands one node pair: push(NodePair) for the overlapping child pairs, emit(first, second) for the overlapping boxes
+			// of two leaves. The larger of two inner nodes is opened first, so both sides shrink at the same pace.
+			template <class BBox, class PushFunction, class EmitFunction>
+			inline void ExpandNodePair(const std::vector<TreeNode<BBox>> &firstNodes, const std::vector<BBox> &firstBoxes,
+									   const std::vector<TreeNode<BBox>> &secondNodes, const std::vector<BBox> &secondBoxes, const bool self,
+									   const NodePair &pair, const PushFunction &push, const EmitFunction &emit)
+			{
+				const TreeNode<BBox> &first = firstNodes[pair.mFirst];
+				const TreeNode<BBox> &second = secondNodes[pair.mSecond];
+				if (self && pair.mFirst == pair.mSecond)
+				{
+					if (first.IsLeaf())
+					{
+						for (uint32_t i = first.m_Index; i < first.m_End; i++)
+							for (uint32_t j = i + 1; j < first.m_End; j++)
+								if (firstBoxes[i].intersects(firstBoxes[j]))
+									emit(i, j);
+						return;
+					}
+					push(NodePair{first.m_Index, first.m_Index});
+					push(NodePair{first.m_Index + 1, first.m_Index + 1});
+					if (firstNodes[first.m_Index].m_bbox.intersects(firstNodes[first.m_Index + 1].m_bbox))
+						push(NodePair{first.m_Index, first.m_Index + 1});
+					return;
+				}
+				if (first.IsLeaf() && second.IsLeaf())
 				{
-					auto [bounds, start, end, depth] = stack.top();
-					stack.pop();
+					for (uint32_t i = first.m_Index; i < first.m_End; i++)
+						for (uint32_t j = second.m_Index; j < second.m_End; j++)
+							if (firstBoxes[i].intersects(secondBoxes[j]))
+								emit(i, j);
+					return;
+				}
+				if (second.IsLeaf() || (!first.IsLeaf() && SurfaceArea(first.m_bbox) >= SurfaceArea(second.m_bbox)))
+				{
+					for (uint32_t child = first.m_Index; child < first.m_Index + 2; child++)
+						if (firstNodes[child].m_bbox.intersects(second.m_bbox))
+							push(NodePair{child, pair.mSecond});
+					return;
+				}
+				for (uint32_t child = second.m_Index; child < second.m_Index + 2; child++)
+					if (secondNodes[child].m_bbox.intersects(first.m_bbox))
+						push(NodePair{pair.mFirst, child});
+			}
 
-					int nodeIndex = nodes.size();
-					nodes.emplace_back(bounds, start); // ½ڵ
+			/// <summary>
+			/// Overlapping box pairs of two trees, or of one tree with itself when self is set (then first < second).
+			/// The node pairs near the roots are expanded breadth first until there are enough to keep every thread busy,
+			/// those subtrees are walked in parallel with a FixedStack each, and the pairs go to per-thread buffers without
+			/// any lock. The buffers are concatenated, sorted and deduplicated at the end.
+			/// </summary>
+			template <class BBox>
+			inline void FindPairs(const std::vector<TreeNode<BBox>> &firstNodes, const std::vector<BBox> &firstBoxes,
+								  const std::vector<TreeNode<BBox>> &secondNodes, const std::vector<BBox> &secondBoxes, const bool self,
+								  std::vector<std::pair<uint32_t, uint32_t>> &pairs, const Parallel::ExecutionPolicy &policy)
+			{
+				pairs.clear();
+				if (firstNodes.empty() || secondNodes.empty() || !firstNodes[0].m_bbox.intersects(secondNodes[0].m_bbox))
+					return;
+				std::vector<uint64_t> keys;
+				auto emitKey = [](std::vector<uint64_t> &buffer, const uint32_t first, const uint32_t second)
+				{ buffer.push_back(uint64_t(first) << 32 | second); };
 
-					// Ȼָֹ
-					if (depth > MAX_DEPTH || (end - start) <= MIN_SIZE)
+				const uint32_t taskTarget = policy.mSerial ? 1u : 16u * Parallel::GetMaxConcurrency();
+				std::vector<NodePair> frontier(1, NodePair{0u, 0u}), next;
+				bool expanded = true;
+				while (expanded && frontier.size() < taskTarget)
+				{
+					expanded = false;
+					next.clear();
+					for (const NodePair &pair : frontier)
 					{
-						continue;
+						if (firstNodes[pair.mFirst].IsLeaf() && secondNodes[pair.mSecond].IsLeaf() && !(self && pair.mFirst == pair.mSecond))
+						{
+							next.push_back(pair);
+							continue;
+						}
+						expanded = true;
+						ExpandNodePair(firstNodes, firstBoxes, secondNodes, secondBoxes, self, pair, [&](const NodePair &child)
+									   { next.push_back(child); },
+									   [&](uint32_t first, uint32_t second)
+									   { emitKey(keys, first, second); });
 					}
+					frontier.swap(next);
+				}
 
-					// ָΧΪ˸
-					HVector3 center = bounds.center();
-					std::array<BBox, 8> octants{
-						BBox(bounds.min(), center),																					  // 
-						BBox(HVector3(center[0], bounds.min()[1], bounds.min()[2]), HVector3(bounds.max()[0], center[1], center[2])), // 
-						BBox(HVector3(bounds.min()[0], center[1], bounds.min()[2]), HVector3(center[0], bounds.max()[1], center[2])), // 
-						BBox(HVector3(center[0], center[1], bounds.min()[2]), HVector3(bounds.max()[0], bounds.max()[1], center[2])), // 
-						BBox(HVector3(bounds.min()[0], bounds.min()[1], center[2]), center),										  // ǰ
-						BBox(HVector3(center[0], bounds.min()[1], center[2]), HVector3(bounds.max()[0], center[1], bounds.max()[2])), // ǰ
-						BBox(HVector3(bounds.min()[0], center[1], center[2]), HVector3(center[0], bounds.max()[1], bounds.max()[2])), // ǰ
-						BBox(center, bounds.max())																					  // ǰ
-					};
+				Parallel::ThreadLocal<std::vector<uint64_t>> buffers;
+				Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(frontier.size()), [&](uint32_t task)
+												{
+					std::vector<uint64_t> &buffer = buffers.Local();
+					FixedStack<NodePair, 2 * TRAVERSAL_STACK_SIZE> stack;
+					stack.Push(frontier[task]);
+					while (!stack.Empty())
+						ExpandNodePair(firstNodes, firstBoxes, secondNodes, secondBoxes, self, stack.Pop(), [&](const NodePair &child)
+									   { stack.Push(child); },
+									   [&](uint32_t first, uint32_t second)
+									   { emitKey(buffer, first, second); }); },
+												policy);
 
-					// Ϊÿ޴ӽڵ
-					for (int i = 0; i < 8; ++i)
+				buffers.ForEach([&](const std::vector<uint64_t> &buffer)
+								{ keys.insert(keys.end(), buffer.begin(), buffer.end()); });
+				if (self)
+				{
+					// leaves hold sorted slot ranges, but a pair of different leaves can come in either order
+					for (uint64_t &key : keys)
 					{
-						stack.push({octants[i], start, end, depth + 1});
+						const uint64_t first = key >> 32, second = key & 0xFFFFFFFFull;
+						if (first > second)
+							key = second << 32 | first;
 					}
 				}
+				std::sort(keys.begin(), keys.end());
+				keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+				pairs.resize(keys.size());
+				Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(keys.size()), [&](uint32_t i)
+												{ pairs[i] = std::make_pair(uint32_t(keys[i] >> 32), uint32_t(keys[i])); },
+												policy);
 			}
-		} // namespace Builder
+		}
+
+		/// @brief every (first, second) of overlapping boxes, first a slot of the first tree and second of the second tree,
+		/// sorted and unique; the broad phase of collision detection between two sets of objects
+		template <class BBox>
+		inline void FindOverlappingPairs(const std::vector<TreeNode<BBox>> &firstNodes, const std::vector<BBox> &firstBoxes,
+										 const std::vector<TreeNode<BBox>> &secondNodes, const std::vector<BBox> &secondBoxes,
+										 std::vector<std::pair<uint32_t, uint32_t>> &pairs,
+										 const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+		{
+			_Private::FindPairs(firstNodes, firstBoxes, secondNodes, secondBoxes, false, pairs, policy);
+		}
+
+		/// @brief every (first, second) with first < second of overlapping boxes of one tree, sorted and unique
+		template <class BBox>
+		inline void FindOverlappingPairs(const std::vector<TreeNode<BBox>> &nodes, const std::vector<BBox> &bBoxes,
+										 std::vector<std::pair<uint32_t, uint32_t>> &pairs,
+										 const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+		{
+			_Private::FindPairs(nodes, bBoxes, nodes, bBoxes, true, pairs, policy);
+		}
+
+		/// @brief parents[i] = parent node of node i, UINT_MAX for the root and for nodes no inner node points at
+		template <class BBox>
+		inline void ComputeParents(const std::vector<TreeNode<BBox>> &nodes, std::vector<uint32_t> &parents,
+								   const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+		{
+			const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+			parents.assign(nodeCount, UINT_MAX);
+			Parallel::ParallelFor<uint32_t>(0, nodeCount, [&](uint32_t i)
+											{
+				if (!nodes[i].IsLeaf())
+				{
+					parents[nodes[i].m_Index] = i;
+					parents[nodes[i].m_Index + 1] = i;
+				} },
+											policy);
+		}
+
+		/// <summary>
+		/// Refits a tree in the BVH layout to moved boxes in O(n): every leaf takes the bounds of its bBoxes range and every
+		/// inner node the union of its children, keeping the topology. One walk per leaf climbs the parents (ComputeParents)
+		/// in parallel and the second walk to reach a node merges it, as in OptimizeTreelets. The tree quality decays as the
+		/// boxes drift from where they were at build time; rebuild once EvaluateTree reports too high a cost.
+		/// </summary>
+		template <class BBox>
+		inline void Refit(std::vector<TreeNode<BBox>> &nodes, const std::vector<uint32_t> &parents, const std::vector<BBox> &bBoxes,
+						  const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+		{
+			const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+			std::unique_ptr<std::atomic<uint32_t>[]> visits(new std::atomic<uint32_t>[nodeCount]);
+			Parallel::ParallelFor<uint32_t>(0, nodeCount, [&](uint32_t i)
+											{ visits[i].store(0, std::memory_order_relaxed); },
+											policy);
+			Parallel::ParallelFor<uint32_t>(0, nodeCount, [&](uint32_t leaf)
+											{
+				TreeNode<BBox> &leafNode = nodes[leaf];
+				if (!leafNode.IsLeaf())
+					return;
+				leafNode.m_bbox.setEmpty();
+				for (uint32_t slot = leafNode.m_Index; slot < leafNode.m_End; slot++)
+					leafNode.m_bbox.extend(bBoxes[slot]);
+				for (uint32_t node = parents[leaf]; node != UINT_MAX; node = parents[node])
+				{
+					if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+						return;
+					TreeNode<BBox> &inner = nodes[node];
+					inner.m_bbox = nodes[inner.m_Index].m_bbox.merged(nodes[inner.m_Index + 1].m_bbox);
+				} },
+											policy);
+		}
 
 		template <class BBox>
 		inline void FindOutAllBoxes(const std::vector<TreeNode<BBox>> &nodes, std::vector<BBox> &bBoxes)
 		{
+			if (nodes.empty())
+				return;
 			std::stack<uint32_t> nodesStack;
 			nodesStack.push(0u);
 			while (!nodesStack.empty())
@@ -453,31 +1338,247 @@ namespace MathLib
 			}
 		}
 
-		template <class BBox>
-		inline bool Intersect(const std::vector<TreeNode<BBox>> &nodes, const BBox &box)
+		namespace _Private
 		{
-			std::stack<uint32_t> nodesStack;
-			nodesStack.push(0u);
-			while (!nodesStack.empty())
+			// entry parameter of the ray into box within [0, tMax]; the NaNs of zero direction components fail every comparison
+			// and drop out, so axis-parallel rays need no special case
+			template <class BBox>
+			inline bool RayEntersBox(const typename BBox::VectorType &origin, const typename BBox::VectorType &inverseDirection, const BBox &box,
+									 const HReal tMax, HReal &tEntry)
 			{
-				uint32_t nodeIndex = nodesStack.top();
-				nodesStack.pop();
-				const TreeNode<BBox> &node = nodes[nodeIndex];
-				if (node.IsLeaf())
+				HReal tNear = 0, tFar = tMax;
+				for (int axis = 0; axis < BBox::AmbientDimAtCompileTime; axis++)
 				{
-					for (uint32_t i = node.m_Index; i < node.m_End; i++)
+					HReal t0 = (box.min()[axis] - origin[axis]) * inverseDirection[axis];
+					HReal t1 = (box.max()[axis] - origin[axis]) * inverseDirection[axis];
+					if (t0 > t1)
+						std::swap(t0, t1);
+					tNear = t0 > tNear ? t0 : tNear;
+					tFar = t1 < tFar ? t1 : tFar;
+				}
+				tEntry = tNear;
+				return tNear <= tFar;
+			}
+
+			// depth-first walk into the nodes accepted by enterNode, visitSlot(slot) for the boxes of the reached leaves;
+			// returns false as soon as visitSlot does
+			template <class BBox, class NodeTest, class SlotVisitor>
+			inline bool VisitTree(const std::vector<TreeNode<BBox>> &nodes, const NodeTest &enterNode, const SlotVisitor &visitSlot)
+			{
+				if (nodes.empty() || !enterNode(nodes[0].m_bbox))
+					return true;
+				FixedStack<uint32_t> stack;
+				stack.Push(0u);
+				while (!stack.Empty())
+				{
+					const TreeNode<BBox> &node = nodes[stack.Pop()];
+					if (node.IsLeaf())
 					{
-						if (node.m_bbox.intersect(box))
-							return true;
+						for (uint32_t slot = node.m_Index; slot < node.m_End; slot++)
+							if (!visitSlot(slot))
+								return false;
+						continue;
 					}
+					for (uint32_t child = node.m_Index; child < node.m_Index + 2; child++)
+						if (enterNode(nodes[child].m_bbox))
+							stack.Push(child);
 				}
-				else
+				return true;
+			}
+
+			// near-first ray walk; intersect(slot, tMax, t) tests one primitive and returns true with its t when it is hit
+			// within [0, tMax]. Subtrees entered behind the closest hit so far are skipped.
+			template <class BBox, class Intersector>
+			inline bool RayTraverse(const std::vector<TreeNode<BBox>> &nodes, const typename BBox::VectorType &origin,
+									const typename BBox::VectorType &direction, const HReal tMax, const bool anyHit, const Intersector &intersect,
+									RayHit &hit)
+			{
+				hit = RayHit();
+				if (nodes.empty())
+					return false;
+				const typename BBox::VectorType inverseDirection = direction.cwiseInverse();
+				HReal closest = tMax, tEntry;
+				if (!RayEntersBox(origin, inverseDirection, nodes[0].m_bbox, closest, tEntry))
+					return false;
+				FixedStack<std::pair<uint32_t, HReal>> stack;
+				stack.Push(std::make_pair(0u, tEntry));
+				while (!stack.Empty())
 				{
-					nodesStack.push(node.m_Index);
-					nodesStack.push(node.m_Index + 1);
+					const std::pair<uint32_t, HReal> entry = stack.Pop();
+					if (entry.second > closest)
+						continue;
+					const TreeNode<BBox> &node = nodes[entry.first];
+					if (node.IsLeaf())
+					{
+						for (uint32_t slot = node.m_Index; slot < node.m_End; slot++)
+						{
+							HReal t;
+							if (intersect(slot, closest, t) && t <= closest)
+							{
+								closest = t;
+								hit.mIndex = slot;
+								hit.mT = t;
+								if (anyHit)
+									return true;
+							}
+						}
+						continue;
+					}
+					HReal tLeft, tRight;
+					const bool left = RayEntersBox(origin, inverseDirection, nodes[node.m_Index].m_bbox, closest, tLeft);
+					const bool right = RayEntersBox(origin, inverseDirection, nodes[node.m_Index + 1].m_bbox, closest, tRight);
+					// the farther child goes below the nearer one, so the nearer is popped first
+					if (left && right && tRight < tLeft)
+					{
+						stack.Push(std::make_pair(node.m_Index, tLeft));
+						stack.Push(std::make_pair(node.m_Index + 1, tRight));
+						continue;
+					}
+					if (right)
+						stack.Push(std::make_pair(node.m_Index + 1, tRight));
+					if (left)
+						stack.Push(std::make_pair(node.m_Index, tLeft));
+				}
+				return hit.mIndex != UINT_MAX;
+			}
+
+			// near-first walk by the squared distance from point to the node boxes; nodes farther than bound() are skipped and
+			// visitSlot(slot) is called for the boxes of the reached leaves
+			template <class BBox, class Bound, class SlotVisitor>
+			inline void NearestTraverse(const std::vector<TreeNode<BBox>> &nodes, const typename BBox::VectorType &point, const Bound &bound,
+										const SlotVisitor &visitSlot)
+			{
+				if (nodes.empty())
+					return;
+				FixedStack<std::pair<uint32_t, HReal>> stack;
+				stack.Push(std::make_pair(0u, nodes[0].m_bbox.squaredExteriorDistance(point)));
+				while (!stack.Empty())
+				{
+					const std::pair<uint32_t, HReal> entry = stack.Pop();
+					if (entry.second > bound())
+						continue;
+					const TreeNode<BBox> &node = nodes[entry.first];
+					if (node.IsLeaf())
+					{
+						for (uint32_t slot = node.m_Index; slot < node.m_End; slot++)
+							visitSlot(slot);
+						continue;
+					}
+					const HReal leftDistance = nodes[node.m_Index].m_bbox.squaredExteriorDistance(point);
+					const HReal rightDistance = nodes[node.m_Index + 1].m_bbox.squaredExteriorDistance(point);
+					const bool leftFirst = leftDistance <= rightDistance;
+					const HReal limit = bound();
+					const uint32_t farChild = leftFirst ? node.m_Index + 1 : node.m_Index;
+					const HReal farDistance = leftFirst ? rightDistance : leftDistance;
+					const HReal nearDistance = leftFirst ? leftDistance : rightDistance;
+					if (farDistance <= limit)
+						stack.Push(std::make_pair(farChild, farDistance));
+					if (nearDistance <= limit)
+						stack.Push(std::make_pair(leftFirst ? node.m_Index : node.m_Index + 1, nearDistance));
 				}
 			}
-			return false;
+
+			inline HReal SquaredLimit(const HReal maxDistance)
+			{
+				return maxDistance < std::sqrt(H_REAL_MAX) ? maxDistance * maxDistance : H_REAL_MAX;
+			}
+		}
+
+		/// @brief true if box overlaps a leaf of the tree; leaves holding several boxes are tested by their bounds
+		template <class BBox>
+		inline bool Intersect(const std::vector<TreeNode<BBox>> &nodes, const BBox &box)
+		{
+			bool found = false;
+			_Private::VisitTree(nodes, [&](const BBox &nodeBox)
+								{ return nodeBox.intersects(box); },
+								[&](uint32_t)
+								{
+				found = true;
+				return false; });
+			return found;
+		}
+
+		// Tree queries. They take the nodes and the reordered bBoxes of one of the builders and report slots, indices into
+		// that bBoxes; map them through the builder's primitiveIndices to get the original indices back. Children are
+		// skipped when their bounds cannot contribute, ray and nearest queries visit the nearer child first, and the
+		// traversal stack is a FixedStack, so no query allocates unless the tree is deeper than TRAVERSAL_STACK_SIZE.
+
+		/// @brief visitor(slot) for every box overlapping box; a bool visitor stops the query by returning false,
+		/// in which case QueryOverlaps returns false as well
+		template <class BBox, class Visitor>
+		inline bool QueryOverlaps(const std::vector<TreeNode<BBox>> &nodes, const std::vector<BBox> &bBoxes, const BBox &box, const Visitor &visitor)
+		{
+			return _Private::VisitTree(nodes, [&](const BBox &nodeBox)
+									   { return nodeBox.intersects(box); },
+									   [&](uint32_t slot)
+									   { return !bBoxes[slot].intersects(box) || MathLib::_Private::_VisitData(visitor, slot); });
+		}
+
+		/// @brief visitor(slot) for every box containing point, stopping like QueryOverlaps
+		template <class BBox, class Visitor>
+		inline bool QueryPoint(const std::vector<TreeNode<BBox>> &nodes, const std::vector<BBox> &bBoxes, const typename BBox::VectorType &point,
+							   const Visitor &visitor)
+		{
+			return _Private::VisitTree(nodes, [&](const BBox &nodeBox)
+									   { return nodeBox.contains(point); },
+									   [&](uint32_t slot)
+									   { return !bBoxes[slot].contains(point) || MathLib::_Private::_VisitData(visitor, slot); });
+		}
+
+		/// @brief closest primitive along origin + t * direction with t in [0, tMax]; intersect(slot, tMax, t) tests one
+		/// primitive and returns true with t when it is hit in [0, tMax]
+		template <class BBox, class Intersector>
+		inline bool RayCastClosest(const std::vector<TreeNode<BBox>> &nodes, const typename BBox::VectorType &origin,
+								   const typename BBox::VectorType &direction, RayHit &hit, const HReal tMax, const Intersector &intersect)
+		{
+			return _Private::RayTraverse(nodes, origin, direction, tMax, false, intersect, hit);
+		}
+
+		/// @brief whether any primitive is hit in [0, tMax], stopping at the first hit found (shadow rays)
+		template <class BBox, class Intersector>
+		inline bool RayCastAny(const std::vector<TreeNode<BBox>> &nodes, const typename BBox::VectorType &origin,
+							   const typename BBox::VectorType &direction, const HReal tMax, const Intersector &intersect)
+		{
+			RayHit hit;
+			return _Private::RayTraverse(nodes, origin, direction, tMax, true, intersect, hit);
+		}
+
+		/// @brief the primitive closest to point within maxDistance as (squared distance, slot); squaredDistance(slot) measures
+		/// one primitive and must not return less than the squared distance to its box
+		template <class BBox, class DistanceFunction>
+		inline bool Nearest(const std::vector<TreeNode<BBox>> &nodes, const typename BBox::VectorType &point, std::pair<HReal, uint32_t> &nearest,
+							const HReal maxDistance, const DistanceFunction &squaredDistance)
+		{
+			nearest = std::make_pair(_Private::SquaredLimit(maxDistance), UINT_MAX);
+			_Private::NearestTraverse(nodes, point, [&]()
+									  { return nearest.first; },
+									  [&](uint32_t slot)
+									  {
+				const HReal sqDistance = squaredDistance(slot);
+				if (sqDistance < nearest.first || (sqDistance == nearest.first && nearest.second == UINT_MAX))
+					nearest = std::make_pair(sqDistance, slot); });
+			return nearest.second != UINT_MAX;
+		}
+
+		/// @brief the k primitives closest to point within maxDistance as (squared distance, slot), sorted by distance
+		template <class BBox, class DistanceFunction>
+		inline uint32_t KNearest(const std::vector<TreeNode<BBox>> &nodes, const typename BBox::VectorType &point, const uint32_t k,
+								 std::vector<std::pair<HReal, uint32_t>> &result, const HReal maxDistance, const DistanceFunction &squaredDistance)
+		{
+			result.clear();
+			if (k == 0)
+				return 0;
+			const HReal sqMaxDistance = _Private::SquaredLimit(maxDistance);
+			_Private::NearestTraverse(nodes, point, [&]()
+									  { return result.size() == k ? result.front().first : sqMaxDistance; },
+									  [&](uint32_t slot)
+									  {
+				const HReal sqDistance = squaredDistance(slot);
+				if (sqDistance <= sqMaxDistance)
+					MathLib::_Private::_PushNearest(result, k, sqDistance, slot); });
+			std::sort_heap(result.begin(), result.end(), [](const std::pair<HReal, uint32_t> &a, const std::pair<HReal, uint32_t> &b)
+						   { return a.first < b.first; });
+			return static_cast<uint32_t>(result.size());
 		}
 
 	}; // namespace TreeUtils
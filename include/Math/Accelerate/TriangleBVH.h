@@ -0,0 +1,525 @@
+#pragma once
+#include <Math/Accelerate/AccelerateCommon.h>
+#include <Math/Accelerate/CompactBVH.h>
+#include <Math/Accelerate/TreeUtils.h>
+#include <Math/Accelerate/WideBVH.h>
+#include <Math/GraphicUtils/MeshCommon.h>
+#include <Math/HasherFunction.h>
+#include <Math/Parallel.h>
+#include <numeric>
+
+namespace MathLib
+{
+    // Rays per packet of the TriangleBVH batch queries: one AVX register of floats when the build targets AVX, one SSE
+    // register otherwise.
+#ifdef H_WIDE_BVH_AVX
+    const uint32_t RAY_PACKET_WIDTH = 8;
+#else
+    const uint32_t RAY_PACKET_WIDTH = 4;
+#endif
+
+    // Triangle of a TriangleBVH in the form Moller-Trumbore reads it, float whatever HReal is: a vertex, the two edges
+    // leaving it and the index of the triangle in the mesh.
+    struct PacketTriangle
+    {
+        float mVertex[3];
+        float mEdge1[3];
+        float mEdge2[3];
+        uint32_t mIndex;
+    };
+
+    namespace _Private
+    {
+        // RAY_PACKET_WIDTH floats, one per ray of a packet. Comparisons return lane masks of the same type that only
+        // And, Select and MoveMask read. Min and Max return the second operand when either one is NaN, as the SSE/AVX
+        // instructions do.
+        struct PacketFloat
+        {
+#if defined(H_WIDE_BVH_AVX)
+            __m256 mValue;
+
+            static PacketFloat Broadcast(const float value) { return PacketFloat{_mm256_set1_ps(value)}; }
+            static PacketFloat Load(const float *values) { return PacketFloat{_mm256_loadu_ps(values)}; }
+            void Store(float *values) const { _mm256_storeu_ps(values, mValue); }
+
+            friend PacketFloat operator+(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_add_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat operator-(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_sub_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat operator*(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_mul_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat operator/(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_div_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Min(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_min_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Max(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_max_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Abs(const PacketFloat &a) { return PacketFloat{_mm256_andnot_ps(_mm256_set1_ps(-0.f), a.mValue)}; }
+            friend PacketFloat LessEqual(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_cmp_ps(a.mValue, b.mValue, _CMP_LE_OQ)}; }
+            friend PacketFloat GreaterEqual(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_cmp_ps(a.mValue, b.mValue, _CMP_GE_OQ)}; }
+            friend PacketFloat Greater(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_cmp_ps(a.mValue, b.mValue, _CMP_GT_OQ)}; }
+            friend PacketFloat And(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_and_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Select(const PacketFloat &mask, const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm256_blendv_ps(b.mValue, a.mValue, mask.mValue)}; }
+            friend uint32_t MoveMask(const PacketFloat &mask) { return static_cast<uint32_t>(_mm256_movemask_ps(mask.mValue)); }
+#elif defined(H_WIDE_BVH_SSE)
+            __m128 mValue;
+
+            static PacketFloat Broadcast(const float value) { return PacketFloat{_mm_set1_ps(value)}; }
+            static PacketFloat Load(const float *values) { return PacketFloat{_mm_loadu_ps(values)}; }
+            void Store(float *values) const { _mm_storeu_ps(values, mValue); }
+
+            friend PacketFloat operator+(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_add_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat operator-(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_sub_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat operator*(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_mul_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat operator/(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_div_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Min(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_min_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Max(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_max_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Abs(const PacketFloat &a) { return PacketFloat{_mm_andnot_ps(_mm_set1_ps(-0.f), a.mValue)}; }
+            friend PacketFloat LessEqual(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_cmple_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat GreaterEqual(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_cmpge_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Greater(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_cmpgt_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat And(const PacketFloat &a, const PacketFloat &b) { return PacketFloat{_mm_and_ps(a.mValue, b.mValue)}; }
+            friend PacketFloat Select(const PacketFloat &mask, const PacketFloat &a, const PacketFloat &b)
+            {
+                return PacketFloat{_mm_or_ps(_mm_and_ps(mask.mValue, a.mValue), _mm_andnot_ps(mask.mValue, b.mValue))};
+            }
+            friend uint32_t MoveMask(const PacketFloat &mask) { return static_cast<uint32_t>(_mm_movemask_ps(mask.mValue)); }
+#else
+            // lane masks hold 1 for set lanes and 0 for clear ones
+            float mValue[RAY_PACKET_WIDTH];
+
+            template <class Function>
+            static PacketFloat Map(const Function &function)
+            {
+                PacketFloat result;
+                for (uint32_t lane = 0; lane < RAY_PACKET_WIDTH; lane++)
+                    result.mValue[lane] = function(lane);
+                return result;
+            }
+
+            static PacketFloat Broadcast(const float value) { return Map([&](uint32_t) { return value; }); }
+            static PacketFloat Load(const float *values) { return Map([&](uint32_t lane) { return values[lane]; }); }
+            void Store(float *values) const { std::copy(mValue, mValue + RAY_PACKET_WIDTH, values); }
+
+            friend PacketFloat operator+(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return a.mValue[lane] + b.mValue[lane]; }); }
+            friend PacketFloat operator-(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return a.mValue[lane] - b.mValue[lane]; }); }
+            friend PacketFloat operator*(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return a.mValue[lane] * b.mValue[lane]; }); }
+            friend PacketFloat operator/(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return a.mValue[lane] / b.mValue[lane]; }); }
+            friend PacketFloat Min(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return a.mValue[lane] < b.mValue[lane] ? a.mValue[lane] : b.mValue[lane]; }); }
+            friend PacketFloat Max(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return a.mValue[lane] > b.mValue[lane] ? a.mValue[lane] : b.mValue[lane]; }); }
+            friend PacketFloat Abs(const PacketFloat &a) { return Map([&](uint32_t lane) { return std::abs(a.mValue[lane]); }); }
+            friend PacketFloat LessEqual(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return float(a.mValue[lane] <= b.mValue[lane]); }); }
+            friend PacketFloat GreaterEqual(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return float(a.mValue[lane] >= b.mValue[lane]); }); }
+            friend PacketFloat Greater(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return float(a.mValue[lane] > b.mValue[lane]); }); }
+            friend PacketFloat And(const PacketFloat &a, const PacketFloat &b) { return Map([&](uint32_t lane) { return a.mValue[lane] * b.mValue[lane]; }); }
+            friend PacketFloat Select(const PacketFloat &mask, const PacketFloat &a, const PacketFloat &b)
+            {
+                return Map([&](uint32_t lane) { return mask.mValue[lane] != 0 ? a.mValue[lane] : b.mValue[lane]; });
+            }
+            friend uint32_t MoveMask(const PacketFloat &mask)
+            {
+                uint32_t bits = 0;
+                for (uint32_t lane = 0; lane < RAY_PACKET_WIDTH; lane++)
+                    bits |= static_cast<uint32_t>(mask.mValue[lane] != 0) << lane;
+                return bits;
+            }
+#endif
+        };
+
+        // rays of a packet as structure of arrays; mNegative picks the slab plane met first per lane, as WideRay does
+        struct RayPacket
+        {
+            PacketFloat mOrigin[3];
+            PacketFloat mDirection[3];
+            PacketFloat mInverseDirection[3];
+            PacketFloat mNegative[3];
+        };
+
+        // the lanes entering [min, max] within [0, closest], with their entry parameters in tEntry
+        inline uint32_t PacketEntersBox(const RayPacket &packet, const float *min, const float *max, const PacketFloat &closest, PacketFloat &tEntry)
+        {
+            PacketFloat tNear = PacketFloat::Broadcast(0.f), tFar = closest;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                const PacketFloat lower = PacketFloat::Broadcast(min[axis]), upper = PacketFloat::Broadcast(max[axis]);
+                const PacketFloat nearPlane = Select(packet.mNegative[axis], upper, lower);
+                const PacketFloat farPlane = Select(packet.mNegative[axis], lower, upper);
+                // a NaN slab (ray inside a slab plane) loses both the max and the min, so that axis drops out
+                tNear = Max((nearPlane - packet.mOrigin[axis]) * packet.mInverseDirection[axis], tNear);
+                tFar = Min((farPlane - packet.mOrigin[axis]) * packet.mInverseDirection[axis], tFar);
+            }
+            tEntry = tNear;
+            return MoveMask(LessEqual(tNear, tFar));
+        }
+
+        // Moller-Trumbore of every lane against one triangle with the tolerances of IntersectionUtils::RayIntersectTriangle:
+        // the lanes hitting it in (H_EPSILON, closest], with their ray parameters in t
+        inline uint32_t PacketIntersectTriangle(const RayPacket &packet, const PacketTriangle &triangle, const PacketFloat &closest, PacketFloat &t)
+        {
+            const PacketFloat edge1[3] = {PacketFloat::Broadcast(triangle.mEdge1[0]), PacketFloat::Broadcast(triangle.mEdge1[1]),
+                                          PacketFloat::Broadcast(triangle.mEdge1[2])};
+            const PacketFloat edge2[3] = {PacketFloat::Broadcast(triangle.mEdge2[0]), PacketFloat::Broadcast(triangle.mEdge2[1]),
+                                          PacketFloat::Broadcast(triangle.mEdge2[2])};
+            const PacketFloat *direction = packet.mDirection;
+            const PacketFloat h[3] = {direction[1] * edge2[2] - direction[2] * edge2[1], direction[2] * edge2[0] - direction[0] * edge2[2],
+                                      direction[0] * edge2[1] - direction[1] * edge2[0]};
+            const PacketFloat det = edge1[0] * h[0] + edge1[1] * h[1] + edge1[2] * h[2];
+            const PacketFloat one = PacketFloat::Broadcast(1.f), zero = PacketFloat::Broadcast(0.f);
+            const PacketFloat epsilon = PacketFloat::Broadcast(static_cast<float>(H_EPSILON));
+            const PacketFloat invDet = one / det;
+            const PacketFloat s[3] = {packet.mOrigin[0] - PacketFloat::Broadcast(triangle.mVertex[0]),
+                                      packet.mOrigin[1] - PacketFloat::Broadcast(triangle.mVertex[1]),
+                                      packet.mOrigin[2] - PacketFloat::Broadcast(triangle.mVertex[2])};
+            const PacketFloat u = (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]) * invDet;
+            const PacketFloat q[3] = {s[1] * edge1[2] - s[2] * edge1[1], s[2] * edge1[0] - s[0] * edge1[2], s[0] * edge1[1] - s[1] * edge1[0]};
+            const PacketFloat v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * invDet;
+            t = (edge2[0] * q[0] + edge2[1] * q[1] + edge2[2] * q[2]) * invDet;
+            PacketFloat hit = And(GreaterEqual(Abs(det), epsilon), And(GreaterEqual(u, zero), LessEqual(u, one)));
+            hit = And(hit, And(GreaterEqual(v, zero), LessEqual(u + v, one)));
+            return MoveMask(And(hit, And(Greater(t, epsilon), LessEqual(t, closest))));
+        }
+
+        // the same test for a single ray
+        inline bool IntersectTriangle(const float *origin, const float *direction, const PacketTriangle &triangle, float &t)
+        {
+            const float *edge1 = triangle.mEdge1, *edge2 = triangle.mEdge2;
+            const float h[3] = {direction[1] * edge2[2] - direction[2] * edge2[1], direction[2] * edge2[0] - direction[0] * edge2[2],
+                                direction[0] * edge2[1] - direction[1] * edge2[0]};
+            const float det = edge1[0] * h[0] + edge1[1] * h[1] + edge1[2] * h[2];
+            if (!(std::abs(det) >= static_cast<float>(H_EPSILON)))
+                return false;
+            const float invDet = 1.f / det;
+            const float s[3] = {origin[0] - triangle.mVertex[0], origin[1] - triangle.mVertex[1], origin[2] - triangle.mVertex[2]};
+            const float u = (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]) * invDet;
+            if (!(u >= 0.f && u <= 1.f))
+                return false;
+            const float q[3] = {s[1] * edge1[2] - s[2] * edge1[1], s[2] * edge1[0] - s[0] * edge1[2], s[0] * edge1[1] - s[1] * edge1[0]};
+            const float v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * invDet;
+            if (!(v >= 0.f && u + v <= 1.f))
+                return false;
+            t = (edge2[0] * q[0] + edge2[1] * q[1] + edge2[2] * q[2]) * invDet;
+            return t > static_cast<float>(H_EPSILON);
+        }
+    }
+
+    /// <summary>
+    /// BVH over the triangles of a mesh for ray casts in float, one ray at a time or in batches. A batch is sorted by
+    /// direction octant and origin Morton code so neighbouring rays share a packet of RAY_PACKET_WIDTH rays; a packet
+    /// walks the tree as one, testing every node box and triangle against all of its rays with SSE/AVX (a scalar loop
+    /// elsewhere), and the packets run in parallel. Coherent batches (camera rays, shadow rays towards one light) visit
+    /// few nodes per packet; scattered rays split the packet early and are better cast one at a time.
+    /// The tree is a binned SAH BVH flattened into a CompactBVH; hits report the index of the triangle in the mesh.
+    /// </summary>
+    class TriangleBVH
+    {
+    public:
+        TriangleBVH() {}
+
+        template <typename IntType>
+        TriangleBVH(const std::vector<HVector3> &vertices, const std::vector<TriangleIndex<IntType>> &triangles,
+                    const SAHBuildSettings &settings = SAHBuildSettings(), const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+        {
+            Build(vertices, triangles, settings, policy);
+        }
+
+        /// @brief false, leaving the BVH empty, when the mesh does not fit the 32 bit slots and counts of CompactNode
+        template <typename IntType>
+        bool Build(const std::vector<HVector3> &vertices, const std::vector<TriangleIndex<IntType>> &triangles,
+                   const SAHBuildSettings &settings = SAHBuildSettings(), const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+        {
+            Clear();
+            if (triangles.size() >= size_t(CompactNode<3>::INNER_NODE))
+                return false;
+            const uint32_t triangleCount = static_cast<uint32_t>(triangles.size());
+            std::vector<HAABBox3D> boxes(triangleCount);
+            Parallel::ParallelFor<uint32_t>(0, triangleCount, [&](uint32_t i)
+                                            {
+                boxes[i].setEmpty();
+                for (int corner = 0; corner < 3; corner++)
+                    boxes[i].extend(vertices[triangles[i].vertices[corner]]); },
+                                            policy);
+            std::vector<TreeNode<HAABBox3D>> nodes;
+            std::vector<uint32_t> primitiveIndices;
+            TreeUtils::Builder::BuildSAHBVH(boxes, nodes, settings, &primitiveIndices, policy);
+            // checked in release builds too, a tree that did not fit is empty and would silently miss every ray
+            if (!m_Tree.Flatten(nodes))
+            {
+                Clear();
+                return false;
+            }
+
+            m_Triangles.resize(triangleCount);
+            Parallel::ParallelFor<uint32_t>(0, triangleCount, [&](uint32_t slot)
+                                            {
+                const TriangleIndex<IntType> &triangle = triangles[primitiveIndices[slot]];
+                const HVector3 &vertex = vertices[triangle.vertices[0]];
+                const HVector3 edge1 = vertices[triangle.vertices[1]] - vertex, edge2 = vertices[triangle.vertices[2]] - vertex;
+                PacketTriangle &packed = m_Triangles[slot];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    packed.mVertex[axis] = static_cast<float>(vertex[axis]);
+                    packed.mEdge1[axis] = static_cast<float>(edge1[axis]);
+                    packed.mEdge2[axis] = static_cast<float>(edge2[axis]);
+                }
+                packed.mIndex = primitiveIndices[slot]; },
+                                            policy);
+            return true;
+        }
+
+        void Clear()
+        {
+            m_Tree = CompactBVH3D();
+            m_Triangles.clear();
+        }
+
+        bool Empty() const
+        {
+            return m_Tree.Empty();
+        }
+
+        const CompactBVH3D &GetTree() const
+        {
+            return m_Tree;
+        }
+
+        /// @brief triangles in leaf slot order
+        const std::vector<PacketTriangle> &GetTriangles() const
+        {
+            return m_Triangles;
+        }
+
+        size_t GetMemorySize() const
+        {
+            return m_Tree.GetMemorySize() + m_Triangles.size() * sizeof(PacketTriangle);
+        }
+
+        /// @brief closest triangle along origin + t * direction with t in (0, tMax]
+        bool RayCastClosest(const HVector3 &origin, const HVector3 &direction, RayHit &hit, const HReal tMax = H_REAL_MAX) const
+        {
+            const bool found = m_Tree.RayCastClosest(origin, direction, hit, tMax, SlotIntersector(m_Triangles, origin, direction));
+            if (found)
+                hit.mIndex = m_Triangles[hit.mIndex].mIndex;
+            return found;
+        }
+
+        /// @brief whether any triangle is hit in (0, tMax] (shadow rays)
+        bool RayCastAny(const HVector3 &origin, const HVector3 &direction, const HReal tMax = H_REAL_MAX) const
+        {
+            return m_Tree.RayCastAny(origin, direction, tMax, SlotIntersector(m_Triangles, origin, direction));
+        }
+
+        /// @brief RayCastClosest of every ray origins[i] + t * directions[i] into hits[i], traced in packets
+        void RayCastClosest(const std::vector<HVector3> &origins, const std::vector<HVector3> &directions, std::vector<RayHit> &hits,
+                            const HReal tMax = H_REAL_MAX, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+        {
+            assert(origins.size() == directions.size());
+            hits.assign(origins.size(), RayHit());
+            _CastPackets(origins, directions, tMax, false, policy, [&](uint32_t ray, uint32_t slot, float t)
+                         {
+                hits[ray].mIndex = m_Triangles[slot].mIndex;
+                hits[ray].mT = t; });
+        }
+
+        /// @brief RayCastAny of every ray into occluded[i] (1 when something is hit), traced in packets
+        void RayCastAny(const std::vector<HVector3> &origins, const std::vector<HVector3> &directions, std::vector<uint8_t> &occluded,
+                        const HReal tMax = H_REAL_MAX, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+        {
+            assert(origins.size() == directions.size());
+            occluded.assign(origins.size(), 0);
+            _CastPackets(origins, directions, tMax, true, policy, [&](uint32_t ray, uint32_t, float)
+                         { occluded[ray] = 1; });
+        }
+
+    private:
+        struct PacketEntry
+        {
+            uint32_t mNode;
+            uint32_t mLanes;
+            float mT;
+        };
+
+        // slot test of the single ray casts, on the ray rounded to float once
+        struct SlotIntersector
+        {
+            SlotIntersector(const std::vector<PacketTriangle> &triangles, const HVector3 &origin, const HVector3 &direction)
+                : mTriangles(triangles)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    mOrigin[axis] = static_cast<float>(origin[axis]);
+                    mDirection[axis] = static_cast<float>(direction[axis]);
+                }
+            }
+
+            bool operator()(const uint32_t slot, HReal, HReal &t) const
+            {
+                float tHit;
+                if (!_Private::IntersectTriangle(mOrigin, mDirection, mTriangles[slot], tHit))
+                    return false;
+                t = tHit;
+                return true;
+            }
+
+            const std::vector<PacketTriangle> &mTriangles;
+            float mOrigin[3];
+            float mDirection[3];
+        };
+
+        // ray order of the packets: sorted by direction octant, then by the Morton code of the origin in the bounds of
+        // all origins, stable so rays of equal keys (a camera) keep the order they came in
+        void _SortRays(const std::vector<HVector3> &origins, const std::vector<HVector3> &directions, std::vector<uint32_t> &order,
+                       const Parallel::ExecutionPolicy &policy) const
+        {
+            const uint32_t count = static_cast<uint32_t>(origins.size());
+            order.resize(count);
+            std::iota(order.begin(), order.end(), 0u);
+            const HAABBox3D bounds = Parallel::ParallelReduce<uint32_t>(
+                0, count, HAABBox3D(), [&](uint32_t i, HAABBox3D &box)
+                { box.extend(origins[i]); },
+                [](const HAABBox3D &a, const HAABBox3D &b)
+                { return a.merged(b); });
+            // cubic cells, so a flat spread of origins (a terrain) is not cut into thin layers along its short axis
+            const HReal extent = bounds.sizes().maxCoeff();
+            const HReal scale = extent > 0 ? HReal(1023) / extent : HReal(0);
+            std::vector<uint64_t> keys(count);
+            Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+                                            {
+                const HVector3 cell = (origins[i] - bounds.min()) * scale;
+                const uint64_t octant = uint64_t(directions[i][0] < 0) | uint64_t(directions[i][1] < 0) << 1 | uint64_t(directions[i][2] < 0) << 2;
+                keys[i] = octant << 30 | MortonEncode3(uint32_t(cell[0]), uint32_t(cell[1]), uint32_t(cell[2])); },
+                                            policy);
+            Parallel::ParallelRadixSort<uint32_t>(keys.data(), order.data(), count, 33, policy);
+        }
+
+        template <class HitFunction>
+        void _CastPackets(const std::vector<HVector3> &origins, const std::vector<HVector3> &directions, const HReal tMax, const bool anyHit,
+                          const Parallel::ExecutionPolicy &policy, const HitFunction &onHit) const
+        {
+            if (m_Tree.Empty() || origins.empty())
+                return;
+            std::vector<uint32_t> order;
+            _SortRays(origins, directions, order, policy);
+            const uint32_t rayCount = static_cast<uint32_t>(order.size());
+            const uint32_t packetCount = (rayCount + RAY_PACKET_WIDTH - 1) / RAY_PACKET_WIDTH;
+            Parallel::ParallelFor<uint32_t>(0, packetCount, [&](uint32_t packet)
+                                            {
+                // the lanes past the last ray repeat the first one and stay inactive
+                const uint32_t first = packet * RAY_PACKET_WIDTH;
+                const uint32_t count = std::min(RAY_PACKET_WIDTH, rayCount - first);
+                uint32_t rays[RAY_PACKET_WIDTH];
+                for (uint32_t lane = 0; lane < RAY_PACKET_WIDTH; lane++)
+                    rays[lane] = order[first + (lane < count ? lane : 0)];
+                _TracePacket(origins, directions, rays, (1u << count) - 1, tMax, anyHit, onHit); },
+                                            policy);
+        }
+
+        // the packet walks the tree depth first, nearer child first by the smallest entry among its lanes; each node keeps
+        // the lanes that entered it, so a lane that missed a subtree never tests its triangles
+        template <class HitFunction>
+        void _TracePacket(const std::vector<HVector3> &origins, const std::vector<HVector3> &directions, const uint32_t *rays,
+                          uint32_t active, const HReal tMax, const bool anyHit, const HitFunction &onHit) const
+        {
+            float values[3][2][RAY_PACKET_WIDTH];
+            for (uint32_t lane = 0; lane < RAY_PACKET_WIDTH; lane++)
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    values[axis][0][lane] = static_cast<float>(origins[rays[lane]][axis]);
+                    values[axis][1][lane] = static_cast<float>(directions[rays[lane]][axis]);
+                }
+            _Private::RayPacket packet;
+            const _Private::PacketFloat one = _Private::PacketFloat::Broadcast(1.f), zero = _Private::PacketFloat::Broadcast(0.f);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                packet.mOrigin[axis] = _Private::PacketFloat::Load(values[axis][0]);
+                packet.mDirection[axis] = _Private::PacketFloat::Load(values[axis][1]);
+                packet.mInverseDirection[axis] = one / packet.mDirection[axis];
+                // 1 / -0 is -inf, so the sign is taken from the inverse as the single ray traversals do
+                packet.mNegative[axis] = Greater(zero, packet.mInverseDirection[axis]);
+            }
+
+            float closest[RAY_PACKET_WIDTH];
+            uint32_t slots[RAY_PACKET_WIDTH];
+            std::fill(closest, closest + RAY_PACKET_WIDTH, _Private::FloatAbove(tMax));
+            std::fill(slots, slots + RAY_PACKET_WIDTH, UINT_MAX);
+            _Private::PacketFloat closestPacket = _Private::PacketFloat::Load(closest);
+            float tEntry[2][RAY_PACKET_WIDTH];
+            _Private::PacketFloat tPacket;
+
+            const std::vector<CompactNode<3>> &nodes = m_Tree.GetNodes();
+            uint32_t lanes = _Private::PacketEntersBox(packet, nodes[0].mMin, nodes[0].mMax, closestPacket, tPacket) & active;
+            FixedStack<PacketEntry> stack;
+            if (lanes != 0)
+                stack.Push(PacketEntry{0u, lanes, 0.f});
+            while (!stack.Empty())
+            {
+                const PacketEntry entry = stack.Pop();
+                lanes = entry.mLanes & active;
+                if (lanes == 0 || entry.mT > _FarthestClosest(closest, lanes))
+                    continue;
+                const CompactNode<3> &node = nodes[entry.mNode];
+                if (node.IsLeaf())
+                {
+                    for (uint32_t slot = node.First(); slot < node.First() + node.Count(); slot++)
+                    {
+                        uint32_t hits = _Private::PacketIntersectTriangle(packet, m_Triangles[slot], closestPacket, tPacket) & lanes;
+                        if (hits == 0)
+                            continue;
+                        float t[RAY_PACKET_WIDTH];
+                        tPacket.Store(t);
+                        for (uint32_t mask = hits; mask != 0; mask &= mask - 1)
+                        {
+                            const uint32_t lane = CountTrailingZeros32(mask);
+                            closest[lane] = t[lane];
+                            slots[lane] = slot;
+                        }
+                        closestPacket = _Private::PacketFloat::Load(closest);
+                        if (anyHit)
+                        {
+                            active &= ~hits;
+                            lanes &= ~hits;
+                            if (lanes == 0)
+                                break;
+                        }
+                    }
+                    if (anyHit && active == 0)
+                        break;
+                    continue;
+                }
+                const uint32_t children[2] = {entry.mNode + 1, node.SecondChild()};
+                uint32_t entered[2];
+                float nearest[2];
+                for (int child = 0; child < 2; child++)
+                {
+                    entered[child] = _Private::PacketEntersBox(packet, nodes[children[child]].mMin, nodes[children[child]].mMax, closestPacket, tPacket) & lanes;
+                    tPacket.Store(tEntry[child]);
+                    nearest[child] = _NearestEntry(tEntry[child], entered[child]);
+                }
+                // the farther child goes below the nearer one, so the nearer is popped first
+                const int nearChild = nearest[1] < nearest[0] ? 1 : 0;
+                if (entered[1 - nearChild] != 0)
+                    stack.Push(PacketEntry{children[1 - nearChild], entered[1 - nearChild], nearest[1 - nearChild]});
+                if (entered[nearChild] != 0)
+                    stack.Push(PacketEntry{children[nearChild], entered[nearChild], nearest[nearChild]});
+            }
+
+            for (uint32_t lane = 0; lane < RAY_PACKET_WIDTH; lane++)
+                if (slots[lane] != UINT_MAX)
+                    onHit(rays[lane], slots[lane], closest[lane]);
+        }
+
+        static float _NearestEntry(const float *tEntry, uint32_t lanes)
+        {
+            float nearest = std::numeric_limits<float>::infinity();
+            for (; lanes != 0; lanes &= lanes - 1)
+                nearest = std::min(nearest, tEntry[CountTrailingZeros32(lanes)]);
+            return nearest;
+        }
+
+        static float _FarthestClosest(const float *closest, uint32_t lanes)
+        {
+            float farthest = -std::numeric_limits<float>::infinity();
+            for (; lanes != 0; lanes &= lanes - 1)
+                farthest = std::max(farthest, closest[CountTrailingZeros32(lanes)]);
+            return farthest;
+        }
+
+    private:
+        CompactBVH3D m_Tree;
+        std::vector<PacketTriangle> m_Triangles;
+    };
+
+}; // namespace MathLib
@@ -0,0 +1,459 @@
+#pragma once
+#include <Math/Accelerate/AccelerateCommon.h>
+#include <Math/Accelerate/TreeUtils.h>
+#include <Math/HasherFunction.h>
+#include <Math/Parallel.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define H_WIDE_BVH_SSE
+#include <immintrin.h>
+#endif
+#if defined(__AVX__)
+#define H_WIDE_BVH_AVX
+#endif
+
+namespace MathLib
+{
+    // Children per node of the wide tree Accelerator queries: one AVX register of floats when the build targets AVX
+    // (-mavx2, /arch:AVX2), one SSE register otherwise.
+#ifdef H_WIDE_BVH_AVX
+    const uint32_t WIDE_BVH_WIDTH = 8;
+#else
+    const uint32_t WIDE_BVH_WIDTH = 4;
+#endif
+
+    // Node of a WideBVH: the boxes of up to Width children as float structure of arrays, so one register holds one bound
+    // of all children along one axis. Child i is an inner node (mCount[i] == INNER_CHILD, mChild[i] its node index), a
+    // leaf (mChild[i] its first slot, mCount[i] its slot count) or an unused lane whose empty box no test accepts.
+    template <int Dim, uint32_t Width>
+    struct alignas(64) WideNode
+    {
+        static constexpr uint32_t INNER_CHILD = UINT_MAX;
+
+        float mMin[Dim][Width];
+        float mMax[Dim][Width];
+        uint32_t mChild[Width];
+        uint32_t mCount[Width];
+    };
+
+    namespace _Private
+    {
+        // a ray in the precision of the wide nodes; the slab planes met first are picked once from the direction signs
+        template <int Dim>
+        struct WideRay
+        {
+            float mOrigin[Dim];
+            float mInverseDirection[Dim];
+            bool mNegative[Dim];
+        };
+
+        // bit i set when the ray enters child i within [0, tMax], with the entry parameter in tEntry[i]. A NaN slab
+        // (ray inside a slab plane) loses both the max and the min below, so that axis drops out as in RayEntersBox.
+        template <int Dim, uint32_t Width>
+        inline uint32_t RayEntersChildren(const WideNode<Dim, Width> &node, const WideRay<Dim> &ray, const float tMax, float *tEntry)
+        {
+#ifdef H_WIDE_BVH_AVX
+            if constexpr (Width % 8 == 0)
+            {
+                uint32_t mask = 0;
+                for (uint32_t lane = 0; lane < Width; lane += 8)
+                {
+                    __m256 tNear = _mm256_setzero_ps(), tFar = _mm256_set1_ps(tMax);
+                    for (int axis = 0; axis < Dim; axis++)
+                    {
+                        const __m256 origin = _mm256_set1_ps(ray.mOrigin[axis]);
+                        const __m256 inverseDirection = _mm256_set1_ps(ray.mInverseDirection[axis]);
+                        const float *nearPlanes = ray.mNegative[axis] ? node.mMax[axis] : node.mMin[axis];
+                        const float *farPlanes = ray.mNegative[axis] ? node.mMin[axis] : node.mMax[axis];
+                        tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearPlanes + lane), origin), inverseDirection), tNear);
+                        tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farPlanes + lane), origin), inverseDirection), tFar);
+                    }
+                    _mm256_storeu_ps(tEntry + lane, tNear);
+                    mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ))) << lane;
+                }
+                return mask;
+            }
+#endif
+#ifdef H_WIDE_BVH_SSE
+            if constexpr (Width % 4 == 0)
+            {
+                uint32_t mask = 0;
+                for (uint32_t lane = 0; lane < Width; lane += 4)
+                {
+                    __m128 tNear = _mm_setzero_ps(), tFar = _mm_set1_ps(tMax);
+                    for (int axis = 0; axis < Dim; axis++)
+                    {
+                        const __m128 origin = _mm_set1_ps(ray.mOrigin[axis]);
+                        const __m128 inverseDirection = _mm_set1_ps(ray.mInverseDirection[axis]);
+                        const float *nearPlanes = ray.mNegative[axis] ? node.mMax[axis] : node.mMin[axis];
+                        const float *farPlanes = ray.mNegative[axis] ? node.mMin[axis] : node.mMax[axis];
+                        tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearPlanes + lane), origin), inverseDirection), tNear);
+                        tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farPlanes + lane), origin), inverseDirection), tFar);
+                    }
+                    _mm_storeu_ps(tEntry + lane, tNear);
+                    mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) << lane;
+                }
+                return mask;
+            }
+#endif
+            uint32_t mask = 0;
+            for (uint32_t lane = 0; lane < Width; lane++)
+            {
+                float tNear = 0, tFar = tMax;
+                for (int axis = 0; axis < Dim; axis++)
+                {
+                    const float *nearPlanes = ray.mNegative[axis] ? node.mMax[axis] : node.mMin[axis];
+                    const float *farPlanes = ray.mNegative[axis] ? node.mMin[axis] : node.mMax[axis];
+                    const float t0 = (nearPlanes[lane] - ray.mOrigin[axis]) * ray.mInverseDirection[axis];
+                    const float t1 = (farPlanes[lane] - ray.mOrigin[axis]) * ray.mInverseDirection[axis];
+                    tNear = t0 > tNear ? t0 : tNear;
+                    tFar = t1 < tFar ? t1 : tFar;
+                }
+                tEntry[lane] = tNear;
+                mask |= static_cast<uint32_t>(tNear <= tFar) << lane;
+            }
+            return mask;
+        }
+
+        // bit i set when child i overlaps [min, max]
+        template <int Dim, uint32_t Width>
+        inline uint32_t ChildrenOverlap(const WideNode<Dim, Width> &node, const float *min, const float *max)
+        {
+#ifdef H_WIDE_BVH_AVX
+            if constexpr (Width % 8 == 0)
+            {
+                uint32_t mask = 0;
+                for (uint32_t lane = 0; lane < Width; lane += 8)
+                {
+                    __m256 overlap = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                    for (int axis = 0; axis < Dim; axis++)
+                    {
+                        overlap = _mm256_and_ps(overlap, _mm256_cmp_ps(_mm256_load_ps(node.mMin[axis] + lane), _mm256_set1_ps(max[axis]), _CMP_LE_OQ));
+                        overlap = _mm256_and_ps(overlap, _mm256_cmp_ps(_mm256_load_ps(node.mMax[axis] + lane), _mm256_set1_ps(min[axis]), _CMP_GE_OQ));
+                    }
+                    mask |= static_cast<uint32_t>(_mm256_movemask_ps(overlap)) << lane;
+                }
+                return mask;
+            }
+#endif
+#ifdef H_WIDE_BVH_SSE
+            if constexpr (Width % 4 == 0)
+            {
+                uint32_t mask = 0;
+                for (uint32_t lane = 0; lane < Width; lane += 4)
+                {
+                    __m128 overlap = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                    for (int axis = 0; axis < Dim; axis++)
+                    {
+                        overlap = _mm_and_ps(overlap, _mm_cmple_ps(_mm_load_ps(node.mMin[axis] + lane), _mm_set1_ps(max[axis])));
+                        overlap = _mm_and_ps(overlap, _mm_cmpge_ps(_mm_load_ps(node.mMax[axis] + lane), _mm_set1_ps(min[axis])));
+                    }
+                    mask |= static_cast<uint32_t>(_mm_movemask_ps(overlap)) << lane;
+                }
+                return mask;
+            }
+#endif
+            uint32_t mask = 0;
+            for (uint32_t lane = 0; lane < Width; lane++)
+            {
+                bool overlap = true;
+                for (int axis = 0; axis < Dim; axis++)
+                    overlap = overlap && node.mMin[axis][lane] <= max[axis] && node.mMax[axis][lane] >= min[axis];
+                mask |= static_cast<uint32_t>(overlap) << lane;
+            }
+            return mask;
+        }
+    }
+
+    /// <summary>
+    /// Wide BVH collapsed from a binary tree of any TreeUtils builder: every node holds up to Width children, and a
+    /// traversal step tests all of them at once with SSE/AVX (a scalar loop elsewhere). The queries take the bBoxes
+    /// of the binary tree and report the same slots as the TreeUtils queries; Refit() follows a binary tree refitted
+    /// with TreeUtils::Refit, any other change of the binary tree needs a new Collapse().
+    /// Width must be a multiple of 4 for the SSE kernel and of 8 for the AVX one.
+    /// </summary>
+    template <class BBox, uint32_t Width = WIDE_BVH_WIDTH>
+    class WideBVH
+    {
+        static_assert(Width >= 2 && Width <= 32, "the child masks are 32 bit");
+
+    public:
+        static constexpr int Dim = BBox::AmbientDimAtCompileTime;
+        typedef WideNode<Dim, Width> Node;
+        typedef typename BBox::VectorType VectorType;
+
+        WideBVH() {}
+
+        explicit WideBVH(const std::vector<TreeNode<BBox>> &nodes)
+        {
+            Collapse(nodes);
+        }
+
+        /// @brief rebuilds the wide nodes: each one opens the largest inner node among its children until Width are reached
+        void Collapse(const std::vector<TreeNode<BBox>> &nodes)
+        {
+            Clear();
+            if (nodes.empty())
+                return;
+            m_Nodes.reserve(nodes.size() / (Width - 1) + 1);
+            m_Nodes.emplace_back();
+            // (binary node, wide node it becomes); a leaf root is the only child of the wide root
+            std::vector<std::pair<uint32_t, uint32_t>> pending(1, std::make_pair(0u, 0u));
+            while (!pending.empty())
+            {
+                const std::pair<uint32_t, uint32_t> entry = pending.back();
+                pending.pop_back();
+                uint32_t children[Width];
+                uint32_t count = 1;
+                children[0] = entry.first;
+                if (!nodes[entry.first].IsLeaf())
+                {
+                    children[0] = nodes[entry.first].m_Index;
+                    children[1] = nodes[entry.first].m_Index + 1;
+                    count = 2;
+                }
+                while (count < Width)
+                {
+                    uint32_t largest = UINT_MAX;
+                    HReal largestArea = -1;
+                    for (uint32_t i = 0; i < count; i++)
+                    {
+                        const HReal area = SurfaceArea(nodes[children[i]].m_bbox);
+                        if (!nodes[children[i]].IsLeaf() && area > largestArea)
+                        {
+                            largest = i;
+                            largestArea = area;
+                        }
+                    }
+                    if (largest == UINT_MAX)
+                        break;
+                    const uint32_t opened = children[largest];
+                    children[largest] = nodes[opened].m_Index;
+                    children[count++] = nodes[opened].m_Index + 1;
+                }
+
+                Node node;
+                m_Sources.resize(m_Nodes.size() * Width, UINT_MAX);
+                for (uint32_t lane = 0; lane < Width; lane++)
+                {
+                    node.mChild[lane] = 0;
+                    node.mCount[lane] = 0;
+                    if (lane >= count)
+                    {
+                        _SetEmpty(node, lane);
+                        continue;
+                    }
+                    const TreeNode<BBox> &child = nodes[children[lane]];
+                    _SetBox(node, lane, child.m_bbox);
+                    m_Sources[entry.second * Width + lane] = children[lane];
+                    if (child.IsLeaf())
+                    {
+                        node.mChild[lane] = child.m_Index;
+                        node.mCount[lane] = child.m_End - child.m_Index;
+                        continue;
+                    }
+                    node.mChild[lane] = static_cast<uint32_t>(m_Nodes.size());
+                    node.mCount[lane] = Node::INNER_CHILD;
+                    pending.emplace_back(children[lane], node.mChild[lane]);
+                    m_Nodes.emplace_back();
+                }
+                m_Nodes[entry.second] = node;
+            }
+            m_Sources.resize(m_Nodes.size() * Width, UINT_MAX);
+        }
+
+        /// @brief copies the bounds of nodes, the binary tree collapsed last, after its boxes changed but not its topology
+        void Refit(const std::vector<TreeNode<BBox>> &nodes, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+        {
+            Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(m_Nodes.size()), [&](uint32_t node)
+                                            {
+                for (uint32_t lane = 0; lane < Width; lane++)
+                    if (m_Sources[node * Width + lane] != UINT_MAX)
+                        _SetBox(m_Nodes[node], lane, nodes[m_Sources[node * Width + lane]].m_bbox); },
+                                            policy);
+        }
+
+        void Clear()
+        {
+            m_Nodes.clear();
+            m_Sources.clear();
+        }
+
+        bool Empty() const
+        {
+            return m_Nodes.empty();
+        }
+
+        const std::vector<Node> &GetNodes() const
+        {
+            return m_Nodes;
+        }
+
+        size_t GetMemorySize() const
+        {
+            return m_Nodes.size() * sizeof(Node);
+        }
+
+        /// @brief visitor(slot) for every box overlapping box; a bool visitor stops the query by returning false
+        template <class Visitor>
+        bool QueryOverlaps(const std::vector<BBox> &bBoxes, const BBox &box, const Visitor &visitor) const
+        {
+            return _VisitOverlapping(box, [&](uint32_t slot)
+                                     { return !bBoxes[slot].intersects(box) || MathLib::_Private::_VisitData(visitor, slot); });
+        }
+
+        /// @brief visitor(slot) for every box containing point, stopping like QueryOverlaps
+        template <class Visitor>
+        bool QueryPoint(const std::vector<BBox> &bBoxes, const VectorType &point, const Visitor &visitor) const
+        {
+            return _VisitOverlapping(BBox(point, point), [&](uint32_t slot)
+                                     { return !bBoxes[slot].contains(point) || MathLib::_Private::_VisitData(visitor, slot); });
+        }
+
+        /// @brief closest primitive along origin + t * direction with t in [0, tMax], as TreeUtils::RayCastClosest
+        template <class Intersector>
+        bool RayCastClosest(const VectorType &origin, const VectorType &direction, RayHit &hit, const HReal tMax,
+                            const Intersector &intersect) const
+        {
+            return _RayTraverse(origin, direction, tMax, false, intersect, hit);
+        }
+
+        /// @brief whether any primitive is hit in [0, tMax], stopping at the first hit found
+        template <class Intersector>
+        bool RayCastAny(const VectorType &origin, const VectorType &direction, const HReal tMax, const Intersector &intersect) const
+        {
+            RayHit hit;
+            return _RayTraverse(origin, direction, tMax, true, intersect, hit);
+        }
+
+    private:
+        // a wide node is at most as deep as the binary node it came from and keeps up to Width - 1 siblings pending
+        static constexpr uint32_t STACK_SIZE = TRAVERSAL_STACK_SIZE * (Width - 1);
+
+        struct RayEntry
+        {
+            uint32_t mChild;
+            uint32_t mCount;
+            float mT;
+        };
+
+        static void _SetBox(Node &node, const uint32_t lane, const BBox &box)
+        {
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                node.mMin[axis][lane] = _Private::FloatBelow(box.min()[axis]);
+                node.mMax[axis][lane] = _Private::FloatAbove(box.max()[axis]);
+            }
+        }
+
+        static void _SetEmpty(Node &node, const uint32_t lane)
+        {
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                node.mMin[axis][lane] = std::numeric_limits<float>::infinity();
+                node.mMax[axis][lane] = -std::numeric_limits<float>::infinity();
+            }
+        }
+
+        template <class SlotVisitor>
+        bool _VisitOverlapping(const BBox &box, const SlotVisitor &visitSlot) const
+        {
+            if (m_Nodes.empty())
+                return true;
+            float min[Dim], max[Dim];
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                min[axis] = _Private::FloatBelow(box.min()[axis]);
+                max[axis] = _Private::FloatAbove(box.max()[axis]);
+            }
+            FixedStack<uint32_t, STACK_SIZE> stack;
+            stack.Push(0u);
+            while (!stack.Empty())
+            {
+                const Node &node = m_Nodes[stack.Pop()];
+                for (uint32_t mask = _Private::ChildrenOverlap(node, min, max); mask != 0; mask &= mask - 1)
+                {
+                    const uint32_t lane = CountTrailingZeros32(mask);
+                    if (node.mCount[lane] == Node::INNER_CHILD)
+                    {
+                        stack.Push(node.mChild[lane]);
+                        continue;
+                    }
+                    for (uint32_t slot = node.mChild[lane]; slot < node.mChild[lane] + node.mCount[lane]; slot++)
+                        if (!visitSlot(slot))
+                            return false;
+                }
+            }
+            return true;
+        }
+
+        // near-first walk like TreeUtils::RayCastClosest: the entered children are pushed farthest first
+        template <class Intersector>
+        bool _RayTraverse(const VectorType &origin, const VectorType &direction, const HReal tMax, const bool anyHit,
+                          const Intersector &intersect, RayHit &hit) const
+        {
+            hit = RayHit();
+            if (m_Nodes.empty())
+                return false;
+            _Private::WideRay<Dim> ray;
+            for (int axis = 0; axis < Dim; axis++)
+            {
+                ray.mOrigin[axis] = static_cast<float>(origin[axis]);
+                ray.mInverseDirection[axis] = 1.f / static_cast<float>(direction[axis]);
+                ray.mNegative[axis] = std::signbit(ray.mInverseDirection[axis]);
+            }
+            HReal closest = tMax;
+            FixedStack<RayEntry, STACK_SIZE> stack;
+            stack.Push(RayEntry{0u, Node::INNER_CHILD, 0.f});
+            while (!stack.Empty())
+            {
+                const RayEntry entry = stack.Pop();
+                if (entry.mT > closest)
+                    continue;
+                if (entry.mCount != Node::INNER_CHILD)
+                {
+                    for (uint32_t slot = entry.mChild; slot < entry.mChild + entry.mCount; slot++)
+                    {
+                        HReal t;
+                        if (intersect(slot, closest, t) && t <= closest)
+                        {
+                            closest = t;
+                            hit.mIndex = slot;
+                            hit.mT = t;
+                            if (anyHit)
+                                return true;
+                        }
+                    }
+                    continue;
+                }
+                const Node &node = m_Nodes[entry.mChild];
+                float tEntry[Width];
+                uint32_t mask = _Private::RayEntersChildren(node, ray, _Private::FloatAbove(closest), tEntry);
+                // insertion sort of the entered children by decreasing entry, so the nearest is popped next
+                RayEntry entered[Width];
+                uint32_t count = 0;
+                for (; mask != 0; mask &= mask - 1)
+                {
+                    const uint32_t lane = CountTrailingZeros32(mask);
+                    const RayEntry child{node.mChild[lane], node.mCount[lane], tEntry[lane]};
+                    uint32_t i = count++;
+                    for (; i > 0 && entered[i - 1].mT < child.mT; i--)
+                        entered[i] = entered[i - 1];
+                    entered[i] = child;
+                }
+                for (uint32_t i = 0; i < count; i++)
+                    stack.Push(entered[i]);
+            }
+            return hit.mIndex != UINT_MAX;
+        }
+
+    private:
+        std::vector<Node> m_Nodes;
+        // binary node behind every lane, UINT_MAX for unused lanes, Width entries per node
+        std::vector<uint32_t> m_Sources;
+    };
+
+    typedef WideBVH<HAABBox2D> WideBVH2D;
+    typedef WideBVH<HAABBox3D> WideBVH3D;
+
+}; // namespace MathLib
@@ -29,14 +29,14 @@ namespace MathLib
             x = Clamp(x, 0, m_Size[0] - 1);
             y = Clamp(y, 0, m_Size[1] - 1);
             assert((x < m_Size[0]) && (y < m_Size[1]));
-            return m_Data[x * m_Size[0] + y];
+            return m_Data[x * m_Size[1] + y];
         }
         Type operator()(size_t x, size_t y) const
         {
             x = Clamp(x, 0, m_Size[0] - 1);
             y = Clamp(y, 0, m_Size[1] - 1);
             assert((x < m_Size[0]) && (y < m_Size[1]));
-            return m_Data[x * m_Size[0] + y];
+            return m_Data[x * m_Size[1] + y];
         }
 
         Type &operator()(const HVector2I &pos)
@@ -122,6 +122,10 @@ namespace MathLib
             return m_Data;
         }
 
+        /// @brief contiguous storage, y is the fastest axis
+        Type *Data() { return m_Data.data(); }
+        const Type *Data() const { return m_Data.data(); }
+
         void SetData(std::vector<Type> &data)
         {
             assert(m_Data.size() == data.size());
@@ -133,13 +137,11 @@ namespace MathLib
             memset(m_Data.data(), 0, m_Data.size() * sizeof(Type));
         }
 
-        void ExecuteUpdate(ArrayUpdateFn updateFn)
+        template <class UpdateFn>
+        void ExecuteUpdate(const UpdateFn &updateFn, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
         {
-            const Parallel::ParallelFunction2<uint32_t> fn = [&](uint32_t x, uint32_t y)
-            {
-                (*this)(x, y) = updateFn(x, y);
-            };
-            Parallel::ParallelFor<uint32_t>(0, m_Size[0], 0, m_Size[1], fn);
+            Parallel::ParallelFor<uint32_t>(0, m_Size[0], 0, m_Size[1], [&](uint32_t x, uint32_t y)
+                                            { (*this)(x, y) = updateFn(x, y); }, policy);
         }
 
         uint32_t GetSizeX() const
@@ -51,7 +51,7 @@ namespace MathLib
 
 		Array3D& operator+=(Array3D const& rhs)
 		{
-			assert(m_SizeX == rhs.m_SizeX && m_SizeY == rhs.m_SizeY && m_SizeZ == rhs.m_SizeZ)
+			assert(m_SizeX == rhs.m_SizeX && m_SizeY == rhs.m_SizeY && m_SizeZ == rhs.m_SizeZ);
 			for (size_t i = 0; i < m_Data.size(); ++i)
 			{
 				m_Data[i] += rhs.m_Data[i];
@@ -61,9 +61,9 @@ namespace MathLib
 
 		Array3D& operator-=(Array3D const& rhs)
 		{
-			assert(m_SizeX == rhs.m_SizeX && m_SizeY == rhs.m_SizeY && m_SizeZ == rhs.m_SizeZ)
-				for (size_t i = 0; i < m_Data.size(); ++i)
-				{
+			assert(m_SizeX == rhs.m_SizeX && m_SizeY == rhs.m_SizeY && m_SizeZ == rhs.m_SizeZ);
+			for (size_t i = 0; i < m_Data.size(); ++i)
+			{
 				m_Data[i] -= rhs.m_Data[i];
 			}
 			return *this;
@@ -84,6 +84,10 @@ namespace MathLib
 			return m_Data;
 		}
 
+		/// @brief contiguous storage, x is the fastest axis
+		Type* Data() { return m_Data.data(); }
+		const Type* Data() const { return m_Data.data(); }
+
 		void SetData(const std::vector<Type>& data)
 		{
 			assert(m_Data.size() == data.size());
@@ -95,9 +99,10 @@ namespace MathLib
 			memset(m_Data.data(), 0, m_Data.size() * sizeof(Type));
 		}
 		
-		void ExecuteUpdate(std::function<void(size_t, size_t, size_t)> func)
+		template <class UpdateFn>
+		void ExecuteUpdate(const UpdateFn& func, const Parallel::ExecutionPolicy& policy = Parallel::ExecutionPolicy())
 		{
-			Parallel::ParallelFor<size_t>(0,m_SizeX,0, m_SizeY, 0,m_SizeZ, func);
+			Parallel::ParallelFor<size_t>(0, m_SizeX, 0, m_SizeY, 0, m_SizeZ, func, policy);
 		}
 
 		size_t getSizeX() const
@@ -0,0 +1,321 @@
+#pragma once
+#include <Math/Math.h>
+#include <Math/HashGrid.h>
+#include <Math/Parallel.h>
+#include <atomic>
+#include <memory>
+
+namespace MathLib
+{
+	/// <summary>
+	/// Static point grid in the classic SPH layout, for point sets that are rebuilt every frame.
+	/// Build() computes a cell per point over the bounding box of the points, counting-sorts the points by cell
+	/// and stores a prefix-summed cell start array next to the reordered points, all in flat arrays.
+	/// Every pass runs through the Parallel namespace and the arrays are reused, so a rebuild allocates nothing
+	/// once the sizes are stable. Points are identified by their index in the array passed to Build().
+	/// The cell array is dense over the bounds, so this suits compact particle sets rather than sparse worlds.
+	/// </summary>
+	class CompactGrid3D
+	{
+	public:
+		CompactGrid3D(HReal dx = 1.f)
+			: m_Dx(dx), m_OverDx(1.f / dx)
+		{
+		}
+
+		void SetGridSize(HReal dx)
+		{
+			m_Dx = dx;
+			m_OverDx = 1.f / dx;
+		}
+
+		HReal GetGridSize() const
+		{
+			return m_Dx;
+		}
+
+		bool Build(const std::vector<HVector3>& points, const Parallel::ExecutionPolicy& policy = Parallel::ExecutionPolicy())
+		{
+			return Build(points.data(), static_cast<uint32_t>(points.size()), policy);
+		}
+
+		/// @brief false, leaving the grid empty, when the bounds hold too many cells for the 32 bit cell ids
+		bool Build(const HVector3* points, const uint32_t count, const Parallel::ExecutionPolicy& policy = Parallel::ExecutionPolicy())
+		{
+			Clear();
+			if (count == 0)
+				return true;
+
+			HAABBox3D bounds = Parallel::ParallelReduce<uint32_t>(
+				0, count, HAABBox3D(), [&](uint32_t i, HAABBox3D& box)
+				{ box.extend(points[i]); },
+				[](const HAABBox3D& a, const HAABBox3D& b)
+				{ return a.merged(b); });
+			// checked in release builds too, a wrapped cell count would index the cell arrays out of bounds; the
+			// extents are tested in double before any integer conversion, which also rejects non-finite bounds
+			const HVector3 cells = (bounds.max() - bounds.min()) * m_OverDx;
+			double cellCount = 1;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (!(double(cells[axis]) < double(INT32_MAX)))
+					return false;
+				cellCount *= double(uint32_t(cells[axis]) + 1);
+			}
+			if (cellCount >= double(UINT32_MAX))
+				return false;
+			m_Origin = bounds.min();
+			m_Dims = HVector3UI(uint32_t(cells[0]) + 1, uint32_t(cells[1]) + 1, uint32_t(cells[2]) + 1);
+			m_CellCount = m_Dims[0] * m_Dims[1] * m_Dims[2];
+
+			if (m_CellCapacity < m_CellCount)
+			{
+				m_CellCapacity = m_CellCount;
+				m_Counts.reset(new std::atomic<uint32_t>[m_CellCapacity]);
+			}
+			Parallel::ParallelFor<uint32_t>(0, m_CellCount, [&](uint32_t cell)
+											{ m_Counts[cell].store(0, std::memory_order_relaxed); }, policy);
+
+			// key every point and reserve its slot inside the cell
+			m_PointCells.resize(count);
+			m_PointOffsets.resize(count);
+			Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+											{
+				const uint32_t cell = _CellId(_CellCoordinate(points[i]));
+				m_PointCells[i] = cell;
+				m_PointOffsets[i] = m_Counts[cell].fetch_add(1, std::memory_order_relaxed); }, policy);
+
+			m_CellStart.resize(size_t(m_CellCount) + 1);
+			m_CellStart[m_CellCount] = Parallel::ParallelExclusiveScan<uint32_t>(
+				m_CellCount, [&](uint32_t cell)
+				{ return m_Counts[cell].load(std::memory_order_relaxed); },
+				m_CellStart.data(), policy);
+
+			m_SortedIndices.resize(count);
+			Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+											{ m_SortedIndices[m_CellStart[m_PointCells[i]] + m_PointOffsets[i]] = i; }, policy);
+			// the slot order inside a cell depends on thread timing; sort the (short) cell ranges so builds are reproducible
+			Parallel::ParallelFor<uint32_t>(0, m_CellCount, [&](uint32_t cell)
+											{
+				if (m_CellStart[cell + 1] - m_CellStart[cell] > 1)
+					std::sort(m_SortedIndices.begin() + m_CellStart[cell], m_SortedIndices.begin() + m_CellStart[cell + 1]); }, policy);
+
+			m_SortedPoints.resize(count);
+			Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t slot)
+											{ m_SortedPoints[slot] = points[m_SortedIndices[slot]]; }, policy);
+			return true;
+		}
+
+		/// @brief number of points in the last build
+		unsigned int Size() const
+		{
+			return static_cast<unsigned int>(m_SortedIndices.size());
+		}
+
+		uint32_t GetCellCount() const
+		{
+			return m_CellCount;
+		}
+
+		void Clear()
+		{
+			m_SortedIndices.clear();
+			m_SortedPoints.clear();
+			m_CellStart.clear();
+			m_CellCount = 0;
+			m_Dims = HVector3UI::Zero();
+		}
+
+		/// @brief original point indices in cell order, points of one cell are contiguous
+		const std::vector<uint32_t>& GetSortedIndices() const
+		{
+			return m_SortedIndices;
+		}
+
+		/// @brief point positions in the same order as GetSortedIndices()
+		const std::vector<HVector3>& GetSortedPoints() const
+		{
+			return m_SortedPoints;
+		}
+
+		/// @brief indices of the points in the cell of position
+		DataSpan<uint32_t> FindPoint(const HVector3& position) const
+		{
+			HVector3I cell;
+			if (!_ClampedCell(position, cell) || cell != _CellCoordinate(position))
+				return DataSpan<uint32_t>();
+			const uint32_t id = _CellId(cell);
+			return DataSpan<uint32_t>(m_SortedIndices.data() + m_CellStart[id], m_CellStart[id + 1] - m_CellStart[id]);
+		}
+
+		/// @brief visitor(index) for the points in the cells overlapping [min, max]; a bool visitor stops on false
+		template <class Visitor>
+		void FindBox(const HVector3& min, const HVector3& max, const Visitor& visitor) const
+		{
+			_VisitSlots(min, max, [&](uint32_t slot)
+						{ return _Private::_VisitData(visitor, m_SortedIndices[slot]); });
+		}
+
+		bool FindBox(const HVector3& min, const HVector3& max, std::vector<uint32_t>& data) const
+		{
+			data.resize(0);
+			FindBox(min, max, [&](uint32_t index)
+					{ data.push_back(index); });
+			return data.size() > 0;
+		}
+
+		/// @brief visitor(index) for the points within radius of center
+		template <class Visitor>
+		void FindRadius(const HVector3& center, const HReal radius, const Visitor& visitor) const
+		{
+			const HReal sqRadius = radius * radius;
+			_VisitSlots(center - HVector3::Constant(radius), center + HVector3::Constant(radius), [&](uint32_t slot)
+						{
+				if ((m_SortedPoints[slot] - center).squaredNorm() > sqRadius)
+					return true;
+				return _Private::_VisitData(visitor, m_SortedIndices[slot]); });
+		}
+
+		/// <summary>
+		/// The k points closest to center within maxRadius as (squared distance, index), sorted by distance.
+		/// Cells are searched in growing rings around the cell of center, clipped to the grid: a center outside the grid
+		/// starts at the first ring touching it and the search ends at the last, so the cost depends on the grid and
+		/// not on how far away center is.
+		/// </summary>
+		uint32_t KNearest(const HVector3& center, const uint32_t k, std::vector<std::pair<HReal, uint32_t>>& result,
+						  const HReal maxRadius = H_REAL_MAX) const
+		{
+			result.clear();
+			if (k == 0 || Size() == 0)
+				return 0;
+			const HReal sqMaxRadius = maxRadius < std::sqrt(H_REAL_MAX) ? maxRadius * maxRadius : H_REAL_MAX;
+			// a center outside the grid is clamped to the layer of cells around it: every grid cell is as many rings
+			// away from the clamped cell as it is along the clamped axis from the real one, or fewer, so the ring bound
+			// below still holds
+			const HVector3I centerCell = _CellCoordinate(center);
+			const int64_t cx = centerCell[0], cy = centerCell[1], cz = centerCell[2];
+			int64_t firstRing = 0, lastRing = 0;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const int64_t below = int64_t(centerCell[axis]), above = int64_t(m_Dims[axis]) - 1 - centerCell[axis];
+				firstRing = std::max(firstRing, std::max(-below, -above));
+				lastRing = std::max(lastRing, std::max(below, above));
+			}
+			const int64_t maxRing = maxRadius * m_OverDx < HReal(lastRing) ? int64_t(std::ceil(maxRadius * m_OverDx)) + 1 : lastRing;
+			auto visitCell = [&](const int64_t x, const int64_t y, const int64_t z)
+			{
+				const uint32_t id = _CellId(HVector3I(int(x), int(y), int(z)));
+				for (uint32_t slot = m_CellStart[id]; slot < m_CellStart[id + 1]; slot++)
+				{
+					const HReal sqDistance = (m_SortedPoints[slot] - center).squaredNorm();
+					if (sqDistance <= sqMaxRadius)
+						_Private::_PushNearest(result, k, sqDistance, m_SortedIndices[slot]);
+				}
+			};
+			for (int64_t ring = firstRing; ring <= maxRing; ring++)
+			{
+				// the part of the shell inside the grid: its two z faces, then the y and x faces of the planes between
+				const int64_t xBegin = std::max(-ring, -cx), xEnd = std::min(ring, int64_t(m_Dims[0]) - 1 - cx);
+				const int64_t yBegin = std::max(-ring, -cy), yEnd = std::min(ring, int64_t(m_Dims[1]) - 1 - cy);
+				const int64_t zBegin = std::max(-ring, -cz), zEnd = std::min(ring, int64_t(m_Dims[2]) - 1 - cz);
+				auto visitRow = [&](const int64_t dy, const int64_t dz)
+				{
+					for (int64_t dx = xBegin; dx <= xEnd; dx++)
+						visitCell(cx + dx, cy + dy, cz + dz);
+				};
+				for (int64_t dz = -ring; dz <= ring; dz += std::max<int64_t>(2 * ring, 1))
+				{
+					if (dz < zBegin || dz > zEnd)
+						continue;
+					for (int64_t dy = yBegin; dy <= yEnd; dy++)
+						visitRow(dy, dz);
+				}
+				const bool left = xBegin == -ring, right = ring > 0 && xEnd == ring;
+				const bool front = yBegin == -ring, back = ring > 0 && yEnd == ring;
+				if (left || right || front || back)
+				{
+					for (int64_t dz = std::max(zBegin, 1 - ring); dz <= std::min(zEnd, ring - 1); dz++)
+					{
+						if (front)
+							visitRow(-ring, dz);
+						if (back)
+							visitRow(ring, dz);
+						if (!left && !right)
+							continue;
+						// rows inside the shell only contribute their two end cells
+						for (int64_t dy = std::max(yBegin, 1 - ring); dy <= std::min(yEnd, ring - 1); dy++)
+						{
+							if (left)
+								visitCell(cx - ring, cy + dy, cz + dz);
+							if (right)
+								visitCell(cx + ring, cy + dy, cz + dz);
+						}
+					}
+				}
+				const HReal reach = HReal(ring) * m_Dx;
+				if (result.size() == k && result.front().first <= reach * reach)
+					break;
+			}
+			std::sort_heap(result.begin(), result.end(), [](const std::pair<HReal, uint32_t>& a, const std::pair<HReal, uint32_t>& b)
+						   { return a.first < b.first; });
+			return static_cast<uint32_t>(result.size());
+		}
+
+	private:
+		/// @brief cell of position, clamped to the layer of cells around the grid before the int conversion
+		HVector3I _CellCoordinate(const HVector3& position) const
+		{
+			const HVector3 local = ((position - m_Origin) * m_OverDx).cwiseMax(-1).cwiseMin(m_Dims.cast<HReal>());
+			return HVector3I(int(std::floor(local[0])), int(std::floor(local[1])), int(std::floor(local[2])));
+		}
+
+		uint32_t _CellId(const HVector3I& cell) const
+		{
+			return uint32_t(cell[0]) + m_Dims[0] * (uint32_t(cell[1]) + m_Dims[1] * uint32_t(cell[2]));
+		}
+
+		/// @brief cell of position clamped into the grid, false when the grid is empty
+		bool _ClampedCell(const HVector3& position, HVector3I& cell) const
+		{
+			if (m_CellCount == 0)
+				return false;
+			const HVector3 local = ((position - m_Origin) * m_OverDx).cwiseMax(0).cwiseMin((m_Dims.cast<HReal>() - HVector3::Ones()));
+			cell = HVector3I(int(local[0]), int(local[1]), int(local[2]));
+			return true;
+		}
+
+		template <class SlotVisitor>
+		void _VisitSlots(const HVector3& min, const HVector3& max, const SlotVisitor& visitor) const
+		{
+			HVector3I minCell, maxCell;
+			if (!_ClampedCell(min, minCell) || !_ClampedCell(max, maxCell))
+				return;
+			const HVector3 gridMax = m_Origin + m_Dims.cast<HReal>() * m_Dx;
+			if ((max.array() < m_Origin.array()).any() || (min.array() > gridMax.array()).any())
+				return;
+			for (int z = minCell[2]; z <= maxCell[2]; z++)
+				for (int y = minCell[1]; y <= maxCell[1]; y++)
+				{
+					// cells along x are adjacent, so a row is one contiguous slot range
+					const uint32_t begin = m_CellStart[_CellId(HVector3I(minCell[0], y, z))];
+					const uint32_t end = m_CellStart[_CellId(HVector3I(maxCell[0], y, z)) + 1];
+					for (uint32_t slot = begin; slot < end; slot++)
+						if (!visitor(slot))
+							return;
+				}
+		}
+
+	private:
+		HReal m_Dx;
+		HReal m_OverDx;
+		HVector3 m_Origin = HVector3::Zero();
+		HVector3UI m_Dims = HVector3UI::Zero();
+		uint32_t m_CellCount = 0;
+		uint32_t m_CellCapacity = 0;
+		std::unique_ptr<std::atomic<uint32_t>[]> m_Counts;
+		std::vector<uint32_t> m_CellStart;
+		std::vector<uint32_t> m_PointCells;
+		std::vector<uint32_t> m_PointOffsets;
+		std::vector<uint32_t> m_SortedIndices;
+		std::vector<HVector3> m_SortedPoints;
+	};
+}
@@ -0,0 +1,259 @@
+#ifndef HMATH_THREADPOOL_H
+#define HMATH_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MathLib
+{
+    namespace Parallel
+    {
+        /// <summary>
+        /// Work-stealing pool used by Parallel.h when TBB is not available.
+        /// Every worker owns a deque: it pushes and pops its own tasks at the back (LIFO, cache friendly)
+        /// and steals from the front of the other deques (FIFO, takes the biggest pieces of work).
+        /// Threads that wait for a fork-join loop keep executing tasks, so nested loops cannot deadlock.
+        /// </summary>
+        class ThreadPool
+        {
+        public:
+            typedef std::function<void()> Task;
+
+        public:
+            explicit ThreadPool(uint32_t workerCount = _DefaultWorkerCount())
+            {
+                // queue 0 is shared by every thread outside the pool, queue i + 1 belongs to worker i
+                for (uint32_t i = 0; i < workerCount + 1; i++)
+                    m_Queues.emplace_back(std::make_unique<WorkQueue>());
+                for (uint32_t i = 0; i < workerCount; i++)
+                    m_Workers.emplace_back([this, i]()
+                                           { _WorkerLoop(i + 1); });
+            }
+
+            ~ThreadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_SleepMutex);
+                    m_Stop = true;
+                }
+                m_SleepCondition.notify_all();
+                for (std::thread &worker : m_Workers)
+                    worker.join();
+            }
+
+            ThreadPool(const ThreadPool &) = delete;
+            ThreadPool &operator=(const ThreadPool &) = delete;
+
+            static ThreadPool &Instance()
+            {
+                static ThreadPool pool;
+                return pool;
+            }
+
+            uint32_t GetWorkerCount() const
+            {
+                return static_cast<uint32_t>(m_Workers.size());
+            }
+
+            /// @brief number of threads that execute a loop: the workers plus the calling thread
+            uint32_t GetConcurrency() const
+            {
+                return GetWorkerCount() + 1;
+            }
+
+            /// @brief index of the calling worker in [0, GetWorkerCount()), -1 for threads outside this pool
+            int32_t GetCurrentWorkerIndex() const
+            {
+                const ThreadInfo &info = _CurrentThread();
+                return info.mPool == this ? static_cast<int32_t>(info.mQueue) - 1 : -1;
+            }
+
+            void Submit(Task task)
+            {
+                WorkQueue &queue = *m_Queues[_CurrentQueue()];
+                // count first so a thief never sees more tasks than m_TaskCount announces
+                m_TaskCount.fetch_add(1, std::memory_order_release);
+                {
+                    std::lock_guard<std::mutex> lock(queue.mMutex);
+                    queue.mTasks.push_back(std::move(task));
+                }
+                std::lock_guard<std::mutex> lock(m_SleepMutex);
+                m_SleepCondition.notify_one();
+            }
+
+            /// @brief runs queued tasks on the calling thread until pending drops to zero
+            void Wait(const std::atomic<size_t> &pending)
+            {
+                while (pending.load(std::memory_order_acquire) != 0)
+                {
+                    if (!_TryRunOne(_CurrentQueue()))
+                        std::this_thread::yield();
+                }
+            }
+
+            /// <summary>
+            /// Fork-join loop over [begin, end). The range is halved recursively until a piece is at most grain long;
+            /// one half is pushed for stealing and the other is processed right away. body(chunkBegin, chunkEnd).
+            /// If a body throws, the pieces already queued still finish (the rest of the throwing piece is skipped)
+            /// and the first exception is rethrown on the calling thread once the loop is done.
+            /// </summary>
+            template <class RangeBody>
+            void ParallelFor(size_t begin, size_t end, size_t grain, const RangeBody &body)
+            {
+                if (begin >= end)
+                    return;
+                grain = std::max<size_t>(1, grain);
+                if (end - begin <= grain || m_Workers.empty())
+                {
+                    body(begin, end);
+                    return;
+                }
+                LoopState state;
+                _SplitGuarded(begin, end, grain, body, state);
+                Wait(state.mPending);
+                if (state.mError)
+                    std::rethrow_exception(state.mError);
+            }
+
+        private:
+            struct alignas(64) WorkQueue
+            {
+                std::mutex mMutex;
+                std::deque<Task> mTasks;
+            };
+
+            struct LoopState
+            {
+                std::atomic<size_t> mPending{0};
+                std::mutex mErrorMutex;
+                std::exception_ptr mError;
+            };
+
+            struct ThreadInfo
+            {
+                const ThreadPool *mPool = nullptr;
+                uint32_t mQueue = 0;
+            };
+
+            static uint32_t _DefaultWorkerCount()
+            {
+                const uint32_t hardware = std::thread::hardware_concurrency();
+                return hardware > 1 ? hardware - 1 : 0;
+            }
+
+            static ThreadInfo &_CurrentThread()
+            {
+                static thread_local ThreadInfo info;
+                return info;
+            }
+
+            uint32_t _CurrentQueue() const
+            {
+                const ThreadInfo &info = _CurrentThread();
+                return info.mPool == this ? info.mQueue : 0;
+            }
+
+            template <class RangeBody>
+            void _Split(size_t begin, size_t end, size_t grain, const RangeBody &body, LoopState &state)
+            {
+                while (end - begin > grain)
+                {
+                    const size_t mid = begin + (end - begin) / 2;
+                    state.mPending.fetch_add(1, std::memory_order_relaxed);
+                    Submit([this, mid, end, grain, &body, &state]()
+                           {
+                        _SplitGuarded(mid, end, grain, body, state);
+                        state.mPending.fetch_sub(1, std::memory_order_release); });
+                    end = mid;
+                }
+                body(begin, end);
+            }
+
+            /// @brief _Split that keeps the first exception in state instead of unwinding past the pending count
+            template <class RangeBody>
+            void _SplitGuarded(size_t begin, size_t end, size_t grain, const RangeBody &body, LoopState &state)
+            {
+                try
+                {
+                    _Split(begin, end, grain, body, state);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(state.mErrorMutex);
+                    if (!state.mError)
+                        state.mError = std::current_exception();
+                }
+            }
+
+            bool _PopBack(WorkQueue &queue, Task &task)
+            {
+                std::lock_guard<std::mutex> lock(queue.mMutex);
+                if (queue.mTasks.empty())
+                    return false;
+                task = std::move(queue.mTasks.back());
+                queue.mTasks.pop_back();
+                return true;
+            }
+
+            bool _PopFront(WorkQueue &queue, Task &task)
+            {
+                std::lock_guard<std::mutex> lock(queue.mMutex);
+                if (queue.mTasks.empty())
+                    return false;
+                task = std::move(queue.mTasks.front());
+                queue.mTasks.pop_front();
+                return true;
+            }
+
+            bool _TryRunOne(const uint32_t self)
+            {
+                if (m_TaskCount.load(std::memory_order_acquire) == 0)
+                    return false;
+                Task task;
+                bool found = _PopBack(*m_Queues[self], task);
+                const uint32_t queueCount = static_cast<uint32_t>(m_Queues.size());
+                for (uint32_t i = 1; i < queueCount && !found; i++)
+                    found = _PopFront(*m_Queues[(self + i) % queueCount], task);
+                if (!found)
+                    return false;
+                m_TaskCount.fetch_sub(1, std::memory_order_relaxed);
+                task();
+                return true;
+            }
+
+            void _WorkerLoop(const uint32_t queue)
+            {
+                ThreadInfo &info = _CurrentThread();
+                info.mPool = this;
+                info.mQueue = queue;
+                while (true)
+                {
+                    if (_TryRunOne(queue))
+                        continue;
+                    std::unique_lock<std::mutex> lock(m_SleepMutex);
+                    m_SleepCondition.wait(lock, [this]()
+                                          { return m_Stop || m_TaskCount.load(std::memory_order_acquire) > 0; });
+                    if (m_Stop)
+                        return;
+                }
+            }
+
+        private:
+            std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+            std::vector<std::thread> m_Workers;
+            std::atomic<size_t> m_TaskCount{0};
+            std::mutex m_SleepMutex;
+            std::condition_variable m_SleepCondition;
+            bool m_Stop = false;
+        };
+    } // namespace Parallel
+} // namespace MathLib
+
+#endif // !HMATH_THREADPOOL_H
@@ -303,5 +303,45 @@ namespace MathLib
 			return true;
 		}
 
+		// Moller-Trumbore on the segment ab; the parallel test is relative to the edge lengths, so it does not depend on
+		// the units of the mesh
+		inline bool SegmentIntersectTriangle3D(const HVector3 &a, const HVector3 &b, const HVector3 &v0, const HVector3 &v1, const HVector3 &v2)
+		{
+			const HVector3 dir = b - a;
+			const HVector3 edge1 = v1 - v0;
+			const HVector3 edge2 = v2 - v0;
+			const HVector3 h = dir.cross(edge2);
+			const HReal det = edge1.dot(h);
+			if (std::abs(det) <= H_EPSILON * edge1.norm() * edge2.norm() * dir.norm())
+				return false;
+			const HReal invDet = HReal(1) / det;
+			const HVector3 s = a - v0;
+			const HReal u = s.dot(h) * invDet;
+			if (u < 0 || u > 1)
+				return false;
+			const HVector3 q = s.cross(edge1);
+			const HReal v = dir.dot(q) * invDet;
+			if (v < 0 || u + v > 1)
+				return false;
+			const HReal t = edge2.dot(q) * invDet;
+			return t >= 0 && t <= 1;
+		}
+
+		// two non-coplanar triangles cross exactly when an edge of one passes through the other
+		inline bool TriTriOverlap3D(const HVector3 &v0, const HVector3 &v1, const HVector3 &v2, const HVector3 &u0, const HVector3 &u1, const HVector3 &u2)
+		{
+			return SegmentIntersectTriangle3D(u0, u1, v0, v1, v2) || SegmentIntersectTriangle3D(u1, u2, v0, v1, v2) ||
+				   SegmentIntersectTriangle3D(u2, u0, v0, v1, v2) || SegmentIntersectTriangle3D(v0, v1, u0, u1, u2) ||
+				   SegmentIntersectTriangle3D(v1, v2, u0, u1, u2) || SegmentIntersectTriangle3D(v2, v0, u0, u1, u2);
+		}
+
+		// Triangles (s, v1, v2) and (s, u1, u2) sharing only the vertex s always touch there. An edge leaving s meets the
+		// plane of the other triangle only in s unless the two are coplanar, so they cross exactly when the edge opposite
+		// s of one passes through the other.
+		inline bool TriTriOverlapSharedVertex3D(const HVector3 &s, const HVector3 &v1, const HVector3 &v2, const HVector3 &u1, const HVector3 &u2)
+		{
+			return SegmentIntersectTriangle3D(v1, v2, s, u1, u2) || SegmentIntersectTriangle3D(u1, u2, s, v1, v2);
+		}
+
 	} // namespace IntersectionUtils
 } // namespace MathLib
\ No newline at end of file
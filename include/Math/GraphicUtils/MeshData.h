@@ -393,17 +393,19 @@ namespace MathLib
 		template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
 		inline HReal CalCulateVolume(const MeshData<IntType> &meshdata)
 		{
-			HReal volume = 0;
 			const std::vector<HVector3> &vertices = meshdata.m_Vertices;
 			const std::vector<IntType> &indices = meshdata.m_Indices;
 			const size_t triangleCount = indices.size() / 3;
-			for (size_t i = 0; i < triangleCount; i++)
-			{
-				const HVector3 &a = vertices[indices[3 * i]];
-				const HVector3 &b = vertices[indices[3 * i + 1]];
-				const HVector3 &c = vertices[indices[3 * i + 2]];
-				volume += (a[0] * b[1] * c[2] - a[0] * b[2] * c[1] - a[1] * b[0] * c[2] + a[1] * b[2] * c[0] + a[2] * b[0] * c[1] - a[2] * b[1] * c[0]);
-			}
+			const HReal volume = Parallel::ParallelTransformReduce<size_t>(
+				0, triangleCount, HReal(0),
+				[&](size_t i) -> HReal
+				{
+					const HVector3 &a = vertices[indices[3 * i]];
+					const HVector3 &b = vertices[indices[3 * i + 1]];
+					const HVector3 &c = vertices[indices[3 * i + 2]];
+					return (a[0] * b[1] * c[2] - a[0] * b[2] * c[1] - a[1] * b[0] * c[2] + a[1] * b[2] * c[0] + a[2] * b[0] * c[1] - a[2] * b[1] * c[0]);
+				},
+				std::plus<HReal>(), Parallel::ReduceOrder::eDeterministic);
 			return HReal(1.0f / 6.0f) * std::abs(volume);
 		}
 
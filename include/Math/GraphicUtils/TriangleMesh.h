@@ -1,5 +1,7 @@
 #pragma once
 #include <Math/Math.h>
+#include <Math/Accelerate/TreeUtils.h>
+#include <Math/Geometry/Intersection.h>
 #include <Math/GraphicUtils/MeshCommon.h>
 #include <vector>
 namespace MathLib
@@ -110,6 +112,58 @@ namespace MathLib
 				return m_Triangles.size();
 			}
 
+			/// <summary>
+			/// Pairs (i, j), i < j, of triangles that cross each other, sorted. The broad phase finds the overlapping
+			/// bounding boxes with a BVH self query, then the pairs are checked in parallel. Pairs sharing an edge are
+			/// dropped, outside a common plane they only meet along that edge; pairs sharing one vertex are reported when
+			/// an edge opposite the shared vertex passes through the other triangle, such as a neighbour folded back
+			/// through the fan; all other pairs go through TriTriOverlap3D. Coplanar overlaps are not reported.
+			/// </summary>
+			void FindSelfIntersections(std::vector<std::pair<uint32_t, uint32_t>> &pairs, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+			{
+				std::vector<HAABBox3D> boxes = GetBoundingBoxes();
+				std::vector<TreeNode<HAABBox3D>> nodes;
+				std::vector<uint32_t> primitiveIndices;
+				TreeUtils::Builder::BuildSAHBVH(boxes, nodes, SAHBuildSettings(), &primitiveIndices, policy);
+				TreeUtils::FindOverlappingPairs(nodes, boxes, pairs, policy);
+
+				std::vector<uint8_t> crossing(pairs.size());
+				Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(pairs.size()), [&](uint32_t p)
+												{
+					std::pair<uint32_t, uint32_t> &pair = pairs[p];
+					pair = std::minmax(primitiveIndices[pair.first], primitiveIndices[pair.second]);
+					const TriangleIndex<IntType> &a = m_Triangles[pair.first];
+					const TriangleIndex<IntType> &b = m_Triangles[pair.second];
+					crossing[p] = 0;
+					int shared = 0, sharedA = 0, sharedB = 0;
+					for (int i = 0; i < 3; i++)
+						for (int j = 0; j < 3; j++)
+							if (a.vertices[i] == b.vertices[j])
+							{
+								shared++;
+								sharedA = i;
+								sharedB = j;
+							}
+					if (shared > 1)
+						return;
+					if (shared == 1)
+					{
+						crossing[p] = IntersectionUtils::TriTriOverlapSharedVertex3D(m_Vertices[a.vertices[sharedA]],
+																					  m_Vertices[a.vertices[(sharedA + 1) % 3]], m_Vertices[a.vertices[(sharedA + 2) % 3]],
+																					  m_Vertices[b.vertices[(sharedB + 1) % 3]], m_Vertices[b.vertices[(sharedB + 2) % 3]]);
+						return;
+					}
+					crossing[p] = IntersectionUtils::TriTriOverlap3D(m_Vertices[a.vertices[0]], m_Vertices[a.vertices[1]], m_Vertices[a.vertices[2]],
+																	 m_Vertices[b.vertices[0]], m_Vertices[b.vertices[1]], m_Vertices[b.vertices[2]]); },
+												policy);
+				uint32_t kept = 0;
+				for (uint32_t p = 0; p < pairs.size(); p++)
+					if (crossing[p])
+						pairs[kept++] = pairs[p];
+				pairs.resize(kept);
+				std::sort(pairs.begin(), pairs.end());
+			}
+
 			void ComputeNormals()
 			{
 				m_Normals.resize(m_Vertices.size(), HVector3(0.0f, 0.0f, 0.0f));
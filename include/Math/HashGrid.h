@@ -2,8 +2,33 @@
 #include <Math/Math.h>
 #include <Math/HashTable.h>
 #include <Math/MathUtils.h>
+#include <Math/Epsilon.h>
+#include <algorithm>
 namespace MathLib {
-	template <typename DataType>
+	namespace _Private
+	{
+		// rounds a position already divided by the cell size to a cell coordinate of KeyEncoder's range,
+		// saturating at the border so far away (or non finite) positions share the outermost cells
+		template <class KeyEncoder>
+		inline int32_t _GridCoordinate(const HReal scaled)
+		{
+			const HReal rounded = std::round(scaled);
+			if (!(rounded > HReal(KeyEncoder::MIN_COORDINATE)))
+				return int32_t(KeyEncoder::MIN_COORDINATE);
+			if (rounded >= HReal(KeyEncoder::MAX_COORDINATE))
+				return int32_t(KeyEncoder::MAX_COORDINATE);
+			return int32_t(rounded);
+		}
+	}
+
+	/// <summary>
+	/// Spatial hash over signed cells: a position maps to the cell round(position / dx), and the cell is packed into one
+	/// uint64_t by KeyEncoder (PackedGridKey2D/3D, or MortonGridKey2D/3D for Z-ordered keys), see HasherFunction.h.
+	/// Negative coordinates are fine; the 3D keys hold 21 bits per axis, so cells beyond +-2^20 (and any position in 2D
+	/// beyond +-2^31 cells) are clamped into the border cells, which stays correct but makes those cells crowded.
+	/// HasherFunction hashes the packed key; HashTable mixes it again, so the identity std::hash is enough.
+	/// </summary>
+	template <typename DataType, class KeyEncoder = PackedGridKey2D, class HasherFunction = std::hash<uint64_t>>
 	class HashGrid2D
 	{
 	public:
@@ -12,6 +37,7 @@ namespace MathLib {
 			, m_OverDx(1.f / dx)
 			, m_Grid(expectedSize)
 		{
+			_ResetBounds();
 		}
 
 		void SetGridSize(HReal dx)
@@ -23,12 +49,14 @@ namespace MathLib {
 
 		void AddPoint(const HVector2& position, const DataType& data)
 		{
-			m_Grid.Insert(VectorRound2(position * m_OverDx), data);
+			const HVector2I cell = _Cell(position);
+			_ExtendBounds(cell);
+			m_Grid.Insert(KeyEncoder::Encode(cell), data);
 		}
 
 		void DeletePoint(const HVector2& position, const DataType& data)
 		{
-			m_Grid.Erase(VectorRound2(position * m_OverDx), data);
+			m_Grid.Erase(_Key(position), data);
 		}
 
 		unsigned int Size() const
@@ -39,6 +67,7 @@ namespace MathLib {
 		void Clear()
 		{
 			m_Grid.Clear();
+			_ResetBounds();
 		}
 
 		void Reserve(unsigned int expectedSize)
@@ -48,59 +77,225 @@ namespace MathLib {
 
 		bool FindFirstPoint(const HVector2& position, DataType& data) const
 		{
-			return m_Grid.GetFirstData(VectorRound2(position * m_OverDx), data);
+			return m_Grid.GetFirstData(_Key(position), data);
 		}
 
 		bool FindPoint(const HVector2& position, std::vector<DataType>& data) const
 		{
 			data.resize(0);
-			return m_Grid.GetAllData(VectorRound2(position * m_OverDx), data) && data.size() > 0;
+			return m_Grid.GetAllData(_Key(position), data) && data.size() > 0;
 		}
 		void AddBox(const HVector2& min, const HVector2& max, const DataType& data)
 		{
-			HVector2UI minIndex = VectorRound2(min * m_OverDx);
-			HVector2UI maxIndex = VectorRound2(max * m_OverDx);
+			const HVector2I minIndex = _Cell(min);
+			const HVector2I maxIndex = _Cell(max);
+			_ExtendBounds(minIndex);
+			_ExtendBounds(maxIndex);
 
-			for (unsigned int j = minIndex[1]; j <= maxIndex[1]; j++)
-				for (unsigned int i = minIndex[0]; i <= maxIndex[0]; i++)
+			for (int64_t j = minIndex[1]; j <= maxIndex[1]; j++)
+				for (int64_t i = minIndex[0]; i <= maxIndex[0]; i++)
 				{
-					m_Grid.Insert(HVector2UI(i, j), data);
+					m_Grid.Insert(KeyEncoder::Encode(HVector2I(int32_t(i), int32_t(j))), data);
 				}
 		}
 		void DeleteBox(const HVector2& min, const HVector2& max, const DataType& data)
 		{
-			HVector2UI minIndex = VectorRound2(min * m_OverDx);
-			HVector2UI maxIndex = VectorRound2(max * m_OverDx);
+			const HVector2I minIndex = _Cell(min);
+			const HVector2I maxIndex = _Cell(max);
 
-			for (unsigned int j = minIndex[1]; j <= maxIndex[1]; j++)
-				for (unsigned int i = minIndex[0]; i <= maxIndex[0]; i++)
+			for (int64_t j = minIndex[1]; j <= maxIndex[1]; j++)
+				for (int64_t i = minIndex[0]; i <= maxIndex[0]; i++)
 				{
-					m_Grid.Erase(HVector2UI(i, j), data);
+					m_Grid.Erase(KeyEncoder::Encode(HVector2I(int32_t(i), int32_t(j))), data);
 				}
 		}
 		bool FindBox(const HVector2& min, const HVector2& max, std::vector<DataType>& data)const
 		{
 			data.resize(0);
-			HVector2UI minIndex = VectorRound2(min * m_OverDx);
-			HVector2UI maxIndex = VectorRound2(max * m_OverDx);
-			for (unsigned int j = minIndex[1]; j <= maxIndex[1]; j++)
-				for (unsigned int i = minIndex[0]; i <= maxIndex[0]; i++)
+			FindBox(min, max, [&](const DataType& value)
+					{ data.push_back(value); });
+			return data.size() > 0;
+		}
+
+		/// @brief the data stored in the cell of position, read in place; invalidated by the next modification
+		DataSpan<DataType> FindPoint(const HVector2& position) const
+		{
+			return m_Grid.Find(_Key(position));
+		}
+
+		/// @brief visitor(data) for everything in the cells overlapping [min, max], walked in place without allocating.
+		/// A visitor returning bool stops the query when it returns false.
+		template <class Visitor>
+		void FindBox(const HVector2& min, const HVector2& max, const Visitor& visitor) const
+		{
+			const HVector2I minIndex = _Cell(min);
+			const HVector2I maxIndex = _Cell(max);
+			for (int64_t j = minIndex[1]; j <= maxIndex[1]; j++)
+				for (int64_t i = minIndex[0]; i <= maxIndex[0]; i++)
+					for (const DataType& data : m_Grid.Find(KeyEncoder::Encode(HVector2I(int32_t(i), int32_t(j)))))
+						if (!_Private::_VisitData(visitor, data))
+							return;
+		}
+
+		/// @brief visitor(data) for the data whose positionOf(data) lies within radius of center
+		template <class PositionFunction, class Visitor>
+		void FindRadius(const HVector2& center, const HReal radius, const PositionFunction& positionOf, const Visitor& visitor) const
+		{
+			const HReal sqRadius = radius * radius;
+			FindBox(center - HVector2::Constant(radius), center + HVector2::Constant(radius), [&](const DataType& data)
+					{
+				if ((positionOf(data) - center).squaredNorm() > sqRadius)
+					return true;
+				return _Private::_VisitData(visitor, data); });
+		}
+
+		/// <summary>
+		/// The k data closest to center (by positionOf(data)) within maxRadius, as (squared distance, data) sorted by distance.
+		/// Cells are searched in growing rings around the center cell until no unvisited cell can hold anything closer.
+		/// The rings are clipped to the bounds of the cells filled since the last Clear(), so the search ends at those
+		/// bounds even for k above the point count and a center far outside them skips the empty rings; once the rings
+		/// would cost more lookups than the table has keys, the remaining cells are read from the table directly.
+		/// result is caller owned so repeated queries reuse its storage. Meant for grids filled with AddPoint:
+		/// data inserted into several cells by AddBox would be reported once per cell.
+		/// </summary>
+		template <class PositionFunction>
+		uint32_t KNearest(const HVector2& center, const uint32_t k, const PositionFunction& positionOf,
+						  std::vector<std::pair<HReal, DataType>>& result, const HReal maxRadius = H_REAL_MAX) const
+		{
+			result.clear();
+			if (k == 0 || Size() == 0)
+				return 0;
+			const HVector2I centerCell = _Cell(center);
+			const HReal sqMaxRadius = maxRadius < std::sqrt(H_REAL_MAX) ? maxRadius * maxRadius : H_REAL_MAX;
+			int64_t firstRing, lastRing;
+			_RingBounds(centerCell, firstRing, lastRing);
+			const int64_t maxRing = maxRadius * m_OverDx < HReal(lastRing) ? int64_t(std::ceil(maxRadius * m_OverDx)) + 1 : lastRing;
+			const int64_t cx = centerCell[0], cy = centerCell[1];
+			auto visitData = [&](const DataSpan<DataType>& span)
+			{
+				for (const DataType& data : span)
+				{
+					const HReal sqDistance = (positionOf(data) - center).squaredNorm();
+					if (sqDistance <= sqMaxRadius)
+						_Private::_PushNearest(result, k, sqDistance, data);
+				}
+			};
+			uint32_t visitedCells = 0;
+			auto visitCell = [&](const int64_t x, const int64_t y)
+			{
+				const DataSpan<DataType> span = m_Grid.Find(KeyEncoder::Encode(HVector2I(int32_t(x), int32_t(y))));
+				if (span.Empty())
+					return;
+				visitedCells++;
+				visitData(span);
+			};
+			double lookups = 0;
+			for (int64_t ring = firstRing; ring <= maxRing; ring++)
+			{
+				// sparse grids: once the rings would cost more lookups than the table has keys, the cells not read yet
+				// (at least ring away) are taken from the table directly
+				const double shellCells = _ClippedCells(centerCell, ring) - _ClippedCells(centerCell, ring - 1);
+				if (lookups + shellCells > 2. * m_Grid.Size())
+				{
+					m_Grid.ForEach([&](const uint64_t key, const DataSpan<DataType>& span)
+								   {
+						const HVector2I cell = KeyEncoder::Decode(key);
+						if (std::max(std::abs(cell[0] - cx), std::abs(cell[1] - cy)) >= ring)
+							visitData(span); });
+					break;
+				}
+				lookups += shellCells;
+
+				// the part of the ring inside the bounds: its bottom and top rows, then the two ends of the rows between
+				const int64_t xBegin = std::max(-ring, m_MinCell[0] - cx), xEnd = std::min(ring, m_MaxCell[0] - cx);
+				const int64_t yBegin = std::max(-ring, m_MinCell[1] - cy), yEnd = std::min(ring, m_MaxCell[1] - cy);
+				for (int64_t dy = -ring; dy <= ring; dy += std::max<int64_t>(2 * ring, 1))
 				{
-					std::vector<DataType> temp;
-					if (m_Grid.GetAllData(HVector2UI(i, j), temp) && (!temp.empty()))
+					if (dy < yBegin || dy > yEnd)
+						continue;
+					for (int64_t dx = xBegin; dx <= xEnd; dx++)
+						visitCell(cx + dx, cy + dy);
+				}
+				const bool left = xBegin == -ring, right = ring > 0 && xEnd == ring;
+				if (left || right)
+				{
+					for (int64_t dy = std::max(yBegin, 1 - ring); dy <= std::min(yEnd, ring - 1); dy++)
 					{
-						data.insert(data.end(), temp.begin(), temp.end());
+						if (left)
+							visitCell(cx - ring, cy + dy);
+						if (right)
+							visitCell(cx + ring, cy + dy);
 					}
 				}
-			return data.size() > 0;
+				// anything in an unvisited cell is at least ring cells away, half a cell of slack on both ends
+				const HReal reach = HReal(ring) * m_Dx;
+				if ((result.size() == k && result.front().first <= reach * reach) || visitedCells == m_Grid.Size())
+					break;
+			}
+			std::sort_heap(result.begin(), result.end(), [](const std::pair<HReal, DataType>& a, const std::pair<HReal, DataType>& b)
+						   { return a.first < b.first; });
+			return static_cast<uint32_t>(result.size());
+		}
+	private:
+		HVector2I _Cell(const HVector2& position) const
+		{
+			const HVector2 scaled = position * m_OverDx;
+			return HVector2I(_Private::_GridCoordinate<KeyEncoder>(scaled[0]), _Private::_GridCoordinate<KeyEncoder>(scaled[1]));
+		}
+
+		uint64_t _Key(const HVector2& position) const
+		{
+			return KeyEncoder::Encode(_Cell(position));
+		}
+
+		void _ResetBounds()
+		{
+			m_MinCell = HVector2I::Constant(INT32_MAX);
+			m_MaxCell = HVector2I::Constant(INT32_MIN);
+		}
+
+		void _ExtendBounds(const HVector2I& cell)
+		{
+			m_MinCell = m_MinCell.cwiseMin(cell);
+			m_MaxCell = m_MaxCell.cwiseMax(cell);
 		}
+
+		/// @brief the first and the last ring around centerCell that reach into the bounds
+		void _RingBounds(const HVector2I& centerCell, int64_t& firstRing, int64_t& lastRing) const
+		{
+			firstRing = 0;
+			lastRing = 0;
+			for (int axis = 0; axis < 2; axis++)
+			{
+				const int64_t below = int64_t(centerCell[axis]) - m_MinCell[axis], above = int64_t(m_MaxCell[axis]) - centerCell[axis];
+				firstRing = std::max(firstRing, std::max(-below, -above));
+				lastRing = std::max(lastRing, std::max(below, above));
+			}
+		}
+
+		/// @brief number of cells at most ring away from centerCell that lie inside the bounds
+		double _ClippedCells(const HVector2I& centerCell, const int64_t ring) const
+		{
+			double cells = 1;
+			for (int axis = 0; axis < 2; axis++)
+			{
+				const int64_t begin = std::max(-ring, int64_t(m_MinCell[axis]) - centerCell[axis]);
+				const int64_t end = std::min(ring, int64_t(m_MaxCell[axis]) - centerCell[axis]);
+				cells *= double(std::max<int64_t>(0, end - begin + 1));
+			}
+			return cells;
+		}
+
 	private:
 		HReal m_Dx;
 		HReal m_OverDx;
-		HashTable<HVector2UI, DataType> m_Grid;
+		HashTable<uint64_t, DataType, HasherFunction> m_Grid;
+		// cells filled since the last Clear(), not shrunk by deletions; they bound the KNearest rings
+		HVector2I m_MinCell;
+		HVector2I m_MaxCell;
 	};
 
-	template <typename DataType>
+	template <typename DataType, class KeyEncoder = PackedGridKey3D, class HasherFunction = std::hash<uint64_t>>
 	class HashGrid3D
 	{
 	public:
@@ -109,6 +304,7 @@ namespace MathLib {
 			, m_OverDx(1.f / dx)
 			, m_Grid(expectedSize)
 		{
+			_ResetBounds();
 		}
 
 		void SetGridSize(HReal dx)
@@ -120,12 +316,14 @@ namespace MathLib {
 
 		void AddPoint(const HVector3& position, const DataType& data)
 		{
-			m_Grid.Insert(VectorRound3(position * m_OverDx), data);
+			const HVector3I cell = _Cell(position);
+			_ExtendBounds(cell);
+			m_Grid.Insert(KeyEncoder::Encode(cell), data);
 		}
 
 		void DeletePoint(const HVector3& position, const DataType& data)
 		{
-			m_Grid.Erase(VectorRound3(position * m_OverDx), data);
+			m_Grid.Erase(_Key(position), data);
 		}
 
 		unsigned int Size() const
@@ -136,6 +334,7 @@ namespace MathLib {
 		void Clear()
 		{
 			m_Grid.Clear();
+			_ResetBounds();
 		}
 
 		void Reserve(unsigned int expectedSize)
@@ -145,61 +344,245 @@ namespace MathLib {
 
 		bool FindFirstPoint(const HVector3& position, DataType& data) const
 		{
-			return m_Grid.GetFirstData(VectorRound3(position * m_OverDx), data);
+			return m_Grid.GetFirstData(_Key(position), data);
 		}
 
 		bool FindPoint(const HVector3& position, std::vector<DataType>& data) const
 		{
 			data.resize(0);
-			return m_Grid.GetAllData(VectorRound3(position * m_OverDx), data) && data.size() > 0;
+			return m_Grid.GetAllData(_Key(position), data) && data.size() > 0;
 		}
 		void AddBox(const HVector3& min, const HVector3& max, const DataType& data)
 		{
-			HVector3UI minIndex = VectorRound3(min * m_OverDx);
-			HVector3UI maxIndex = VectorRound3(max * m_OverDx);
+			const HVector3I minIndex = _Cell(min);
+			const HVector3I maxIndex = _Cell(max);
+			_ExtendBounds(minIndex);
+			_ExtendBounds(maxIndex);
 
-			for (unsigned int k = minIndex[2]; k <= maxIndex[2]; k++)
-				for (unsigned int j = minIndex[1]; j <= maxIndex[1]; j++)
-					for (unsigned int i = minIndex[0]; i <= maxIndex[0]; i++)
+			for (int64_t k = minIndex[2]; k <= maxIndex[2]; k++)
+				for (int64_t j = minIndex[1]; j <= maxIndex[1]; j++)
+					for (int64_t i = minIndex[0]; i <= maxIndex[0]; i++)
 					{
-						m_Grid.Insert(HVector3UI(i, j, k), data);
+						m_Grid.Insert(KeyEncoder::Encode(HVector3I(int32_t(i), int32_t(j), int32_t(k))), data);
 					}
 		}
 		void DeleteBox(const HVector3& min, const HVector3& max, const DataType& data)
 		{
-			HVector3UI minIndex = VectorRound3(min * m_OverDx);
-			HVector3UI maxIndex = VectorRound3(max * m_OverDx);
+			const HVector3I minIndex = _Cell(min);
+			const HVector3I maxIndex = _Cell(max);
 
-			for (unsigned int k = minIndex[2]; k <= maxIndex[2]; k++)
-				for (unsigned int j = minIndex[1]; j <= maxIndex[1]; j++)
-					for (unsigned int i = minIndex[0]; i <= maxIndex[0]; i++)
+			for (int64_t k = minIndex[2]; k <= maxIndex[2]; k++)
+				for (int64_t j = minIndex[1]; j <= maxIndex[1]; j++)
+					for (int64_t i = minIndex[0]; i <= maxIndex[0]; i++)
 					{
-						m_Grid.Erase(HVector3UI(i, j, k), data);
+						m_Grid.Erase(KeyEncoder::Encode(HVector3I(int32_t(i), int32_t(j), int32_t(k))), data);
 					}
 		}
 
 		bool FindBox(const HVector3& min, const HVector3& max, std::vector<DataType>& data)const
 		{
 			data.resize(0);
-			HVector3UI minIndex = VectorRound3(min * m_OverDx);
-			HVector3UI maxIndex = VectorRound3(max * m_OverDx);
-			for (unsigned int k = minIndex[2]; k <= maxIndex[2]; k++)
-				for (unsigned int j = minIndex[1]; j <= maxIndex[1]; j++)
-					for (unsigned int i = minIndex[0]; i <= maxIndex[0]; i++)
+			FindBox(min, max, [&](const DataType& value)
+					{ data.push_back(value); });
+			return data.size() > 0;
+		}
+
+		/// @brief the data stored in the cell of position, read in place; invalidated by the next modification
+		DataSpan<DataType> FindPoint(const HVector3& position) const
+		{
+			return m_Grid.Find(_Key(position));
+		}
+
+		/// @brief visitor(data) for everything in the cells overlapping [min, max], walked in place without allocating.
+		/// A visitor returning bool stops the query when it returns false.
+		template <class Visitor>
+		void FindBox(const HVector3& min, const HVector3& max, const Visitor& visitor) const
+		{
+			const HVector3I minIndex = _Cell(min);
+			const HVector3I maxIndex = _Cell(max);
+			for (int64_t k = minIndex[2]; k <= maxIndex[2]; k++)
+				for (int64_t j = minIndex[1]; j <= maxIndex[1]; j++)
+					for (int64_t i = minIndex[0]; i <= maxIndex[0]; i++)
+						for (const DataType& data : m_Grid.Find(KeyEncoder::Encode(HVector3I(int32_t(i), int32_t(j), int32_t(k)))))
+							if (!_Private::_VisitData(visitor, data))
+								return;
+		}
+
+		/// @brief visitor(data) for the data whose positionOf(data) lies within radius of center
+		template <class PositionFunction, class Visitor>
+		void FindRadius(const HVector3& center, const HReal radius, const PositionFunction& positionOf, const Visitor& visitor) const
+		{
+			const HReal sqRadius = radius * radius;
+			FindBox(center - HVector3::Constant(radius), center + HVector3::Constant(radius), [&](const DataType& data)
+					{
+				if ((positionOf(data) - center).squaredNorm() > sqRadius)
+					return true;
+				return _Private::_VisitData(visitor, data); });
+		}
+
+		/// <summary>
+		/// The k data closest to center (by positionOf(data)) within maxRadius, as (squared distance, data) sorted by distance.
+		/// Cells are searched in growing rings around the center cell until no unvisited cell can hold anything closer.
+		/// The rings are clipped to the bounds of the cells filled since the last Clear(), so the search ends at those
+		/// bounds even for k above the point count and a center far outside them skips the empty rings; once the rings
+		/// would cost more lookups than the table has keys, the remaining cells are read from the table directly.
+		/// result is caller owned so repeated queries reuse its storage. Meant for grids filled with AddPoint:
+		/// data inserted into several cells by AddBox would be reported once per cell.
+		/// </summary>
+		template <class PositionFunction>
+		uint32_t KNearest(const HVector3& center, const uint32_t k, const PositionFunction& positionOf,
+						  std::vector<std::pair<HReal, DataType>>& result, const HReal maxRadius = H_REAL_MAX) const
+		{
+			result.clear();
+			if (k == 0 || Size() == 0)
+				return 0;
+			const HVector3I centerCell = _Cell(center);
+			const HReal sqMaxRadius = maxRadius < std::sqrt(H_REAL_MAX) ? maxRadius * maxRadius : H_REAL_MAX;
+			int64_t firstRing, lastRing;
+			_RingBounds(centerCell, firstRing, lastRing);
+			const int64_t maxRing = maxRadius * m_OverDx < HReal(lastRing) ? int64_t(std::ceil(maxRadius * m_OverDx)) + 1 : lastRing;
+			const int64_t cx = centerCell[0], cy = centerCell[1], cz = centerCell[2];
+			auto visitData = [&](const DataSpan<DataType>& span)
+			{
+				for (const DataType& data : span)
+				{
+					const HReal sqDistance = (positionOf(data) - center).squaredNorm();
+					if (sqDistance <= sqMaxRadius)
+						_Private::_PushNearest(result, k, sqDistance, data);
+				}
+			};
+			uint32_t visitedCells = 0;
+			auto visitCell = [&](const int64_t x, const int64_t y, const int64_t z)
+			{
+				const DataSpan<DataType> span = m_Grid.Find(KeyEncoder::Encode(HVector3I(int32_t(x), int32_t(y), int32_t(z))));
+				if (span.Empty())
+					return;
+				visitedCells++;
+				visitData(span);
+			};
+			double lookups = 0;
+			for (int64_t ring = firstRing; ring <= maxRing; ring++)
+			{
+				// sparse grids: once the shells would cost more lookups than the table has keys, the cells not read yet
+				// (at least ring away) are taken from the table directly
+				const double shellCells = _ClippedCells(centerCell, ring) - _ClippedCells(centerCell, ring - 1);
+				if (lookups + shellCells > 2. * m_Grid.Size())
+				{
+					m_Grid.ForEach([&](const uint64_t key, const DataSpan<DataType>& span)
+								   {
+						const HVector3I cell = KeyEncoder::Decode(key);
+						if (std::max({std::abs(cell[0] - cx), std::abs(cell[1] - cy), std::abs(cell[2] - cz)}) >= ring)
+							visitData(span); });
+					break;
+				}
+				lookups += shellCells;
+
+				// the part of the shell inside the bounds: its two z faces, then the y and x faces of the planes between
+				const int64_t xBegin = std::max(-ring, m_MinCell[0] - cx), xEnd = std::min(ring, m_MaxCell[0] - cx);
+				const int64_t yBegin = std::max(-ring, m_MinCell[1] - cy), yEnd = std::min(ring, m_MaxCell[1] - cy);
+				const int64_t zBegin = std::max(-ring, m_MinCell[2] - cz), zEnd = std::min(ring, m_MaxCell[2] - cz);
+				auto visitRow = [&](const int64_t dy, const int64_t dz)
+				{
+					for (int64_t dx = xBegin; dx <= xEnd; dx++)
+						visitCell(cx + dx, cy + dy, cz + dz);
+				};
+				for (int64_t dz = -ring; dz <= ring; dz += std::max<int64_t>(2 * ring, 1))
+				{
+					if (dz < zBegin || dz > zEnd)
+						continue;
+					for (int64_t dy = yBegin; dy <= yEnd; dy++)
+						visitRow(dy, dz);
+				}
+				const bool left = xBegin == -ring, right = ring > 0 && xEnd == ring;
+				const bool front = yBegin == -ring, back = ring > 0 && yEnd == ring;
+				if (left || right || front || back)
+				{
+					for (int64_t dz = std::max(zBegin, 1 - ring); dz <= std::min(zEnd, ring - 1); dz++)
 					{
-						std::vector<DataType> temp;
-						if (m_Grid.GetAllData(HVector3UI(i, j, k), temp) && (!temp.empty()))
+						if (front)
+							visitRow(-ring, dz);
+						if (back)
+							visitRow(ring, dz);
+						if (!left && !right)
+							continue;
+						// rows inside the shell only contribute their two end cells
+						for (int64_t dy = std::max(yBegin, 1 - ring); dy <= std::min(yEnd, ring - 1); dy++)
 						{
-							data.insert(data.end(), temp.begin(), temp.end());
+							if (left)
+								visitCell(cx - ring, cy + dy, cz + dz);
+							if (right)
+								visitCell(cx + ring, cy + dy, cz + dz);
 						}
 					}
-			return data.size() > 0;
+				}
+				// anything in an unvisited cell is at least ring cells away, half a cell of slack on both ends
+				const HReal reach = HReal(ring) * m_Dx;
+				if ((result.size() == k && result.front().first <= reach * reach) || visitedCells == m_Grid.Size())
+					break;
+			}
+			std::sort_heap(result.begin(), result.end(), [](const std::pair<HReal, DataType>& a, const std::pair<HReal, DataType>& b)
+						   { return a.first < b.first; });
+			return static_cast<uint32_t>(result.size());
+		}
+
+	private:
+		HVector3I _Cell(const HVector3& position) const
+		{
+			const HVector3 scaled = position * m_OverDx;
+			return HVector3I(_Private::_GridCoordinate<KeyEncoder>(scaled[0]), _Private::_GridCoordinate<KeyEncoder>(scaled[1]),
+							 _Private::_GridCoordinate<KeyEncoder>(scaled[2]));
+		}
+
+		uint64_t _Key(const HVector3& position) const
+		{
+			return KeyEncoder::Encode(_Cell(position));
+		}
+
+		void _ResetBounds()
+		{
+			m_MinCell = HVector3I::Constant(INT32_MAX);
+			m_MaxCell = HVector3I::Constant(INT32_MIN);
+		}
+
+		void _ExtendBounds(const HVector3I& cell)
+		{
+			m_MinCell = m_MinCell.cwiseMin(cell);
+			m_MaxCell = m_MaxCell.cwiseMax(cell);
+		}
+
+		/// @brief the first and the last ring around centerCell that reach into the bounds
+		void _RingBounds(const HVector3I& centerCell, int64_t& firstRing, int64_t& lastRing) const
+		{
+			firstRing = 0;
+			lastRing = 0;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const int64_t below = int64_t(centerCell[axis]) - m_MinCell[axis], above = int64_t(m_MaxCell[axis]) - centerCell[axis];
+				firstRing = std::max(firstRing, std::max(-below, -above));
+				lastRing = std::max(lastRing, std::max(below, above));
+			}
+		}
+
+		/// @brief number of cells at most ring away from centerCell that lie inside the bounds
+		double _ClippedCells(const HVector3I& centerCell, const int64_t ring) const
+		{
+			double cells = 1;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const int64_t begin = std::max(-ring, int64_t(m_MinCell[axis]) - centerCell[axis]);
+				const int64_t end = std::min(ring, int64_t(m_MaxCell[axis]) - centerCell[axis]);
+				cells *= double(std::max<int64_t>(0, end - begin + 1));
+			}
+			return cells;
 		}
 
 	private:
 		HReal m_Dx;
 		HReal m_OverDx;
-		HashTable<HVector3UI, DataType> m_Grid;
+		HashTable<uint64_t, DataType, HasherFunction> m_Grid;
+		// cells filled since the last Clear(), not shrunk by deletions; they bound the KNearest rings
+		HVector3I m_MinCell;
+		HVector3I m_MaxCell;
 	};
   
 	typedef HashGrid2D<unsigned int> HashGrid2DUI;
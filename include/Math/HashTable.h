@@ -1,106 +1,393 @@
 #pragma once
 #include <Math/Math.h>
 #include <Math/HasherFunction.h>
-#include <unordered_map>
+#include <cstring>
+#include <type_traits>
 namespace MathLib
 {
-	template <class Key, class DataType, class HasherFunction = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+	namespace _Private
+	{
+		/// <summary>
+		/// Values stored under one HashTable key. Up to InlineCapacity values live inside the table slot itself,
+		/// larger buckets move to one contiguous heap block. Values are kept in insertion order and are memcpy'd,
+		/// so DataType has to be trivially copyable (indices, small POD structs).
+		/// </summary>
+		template <class DataType, uint32_t InlineCapacity>
+		class InlineBucket
+		{
+			static_assert(std::is_trivially_copyable<DataType>::value, "HashTable values must be trivially copyable");
+			static_assert(InlineCapacity > 0, "InlineBucket needs room for at least one value");
+
+		public:
+			InlineBucket() {}
+			InlineBucket(const InlineBucket &other) { _CopyFrom(other); }
+			InlineBucket(InlineBucket &&other) noexcept { _MoveFrom(other); }
+			~InlineBucket() { _Free(); }
+
+			InlineBucket &operator=(const InlineBucket &other)
+			{
+				if (this != &other)
+				{
+					_Free();
+					_CopyFrom(other);
+				}
+				return *this;
+			}
+
+			InlineBucket &operator=(InlineBucket &&other) noexcept
+			{
+				if (this != &other)
+				{
+					_Free();
+					_MoveFrom(other);
+				}
+				return *this;
+			}
+
+			uint32_t Size() const { return m_Size; }
+			bool Empty() const { return m_Size == 0; }
+			const DataType *Data() const { return m_Capacity > InlineCapacity ? m_Storage.mHeap : reinterpret_cast<const DataType *>(m_Storage.mInline); }
+			DataType *Data() { return m_Capacity > InlineCapacity ? m_Storage.mHeap : reinterpret_cast<DataType *>(m_Storage.mInline); }
+			const DataType &operator[](const uint32_t index) const { return Data()[index]; }
+
+			void PushBack(const DataType &data)
+			{
+				if (m_Size == m_Capacity)
+					_Grow(m_Capacity * 2);
+				std::memcpy(static_cast<void *>(Data() + m_Size), &data, sizeof(DataType));
+				m_Size++;
+			}
+
+			/// @brief removes the first value equal to data, keeping the order of the others
+			bool EraseValue(const DataType &data)
+			{
+				DataType *values = Data();
+				for (uint32_t i = 0; i < m_Size; i++)
+				{
+					if (values[i] == data)
+					{
+						std::memmove(static_cast<void *>(values + i), values + i + 1, (m_Size - i - 1) * sizeof(DataType));
+						m_Size--;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			void Clear()
+			{
+				_Free();
+				m_Size = 0;
+				m_Capacity = InlineCapacity;
+			}
+
+		private:
+			void _Grow(const uint32_t capacity)
+			{
+				DataType *heap = static_cast<DataType *>(::operator new(sizeof(DataType) * capacity));
+				std::memcpy(static_cast<void *>(heap), Data(), sizeof(DataType) * m_Size);
+				_Free();
+				m_Storage.mHeap = heap;
+				m_Capacity = capacity;
+			}
+
+			void _Free()
+			{
+				if (m_Capacity > InlineCapacity)
+					::operator delete(m_Storage.mHeap);
+			}
+
+			void _CopyFrom(const InlineBucket &other)
+			{
+				m_Size = 0;
+				m_Capacity = InlineCapacity;
+				if (other.m_Size > InlineCapacity)
+				{
+					m_Storage.mHeap = static_cast<DataType *>(::operator new(sizeof(DataType) * other.m_Size));
+					m_Capacity = other.m_Size;
+				}
+				std::memcpy(static_cast<void *>(Data()), other.Data(), sizeof(DataType) * other.m_Size);
+				m_Size = other.m_Size;
+			}
+
+			void _MoveFrom(InlineBucket &other)
+			{
+				std::memcpy(static_cast<void *>(&m_Storage), &other.m_Storage, sizeof(m_Storage));
+				m_Size = other.m_Size;
+				m_Capacity = other.m_Capacity;
+				other.m_Size = 0;
+				other.m_Capacity = InlineCapacity;
+			}
+
+		private:
+			// value-initialized, so moving a fresh bucket (the slot of a new key) copies defined bytes
+			union Storage
+			{
+				alignas(DataType) unsigned char mInline[sizeof(DataType) * InlineCapacity];
+				DataType *mHeap;
+			} m_Storage{};
+			uint32_t m_Size = 0;
+			uint32_t m_Capacity = InlineCapacity;
+		};
+
+		// as many values as fit in 16 bytes, so small index buckets never touch the heap
+		template <class DataType>
+		constexpr uint32_t DefaultInlineCapacity()
+		{
+			return sizeof(DataType) >= 16 ? 1 : static_cast<uint32_t>(16 / sizeof(DataType));
+		}
+	}
+
+	/// @brief read-only view of the values stored under one key; invalidated by the next Insert/Erase/Clear
+	template <class DataType>
+	class DataSpan
+	{
+	public:
+		DataSpan() = default;
+		DataSpan(const DataType *data, const uint32_t size) : m_Data(data), m_Size(size) {}
+
+		const DataType *begin() const { return m_Data; }
+		const DataType *end() const { return m_Data + m_Size; }
+		const DataType &operator[](const uint32_t index) const { return m_Data[index]; }
+		uint32_t Size() const { return m_Size; }
+		bool Empty() const { return m_Size == 0; }
+
+	private:
+		const DataType *m_Data = nullptr;
+		uint32_t m_Size = 0;
+	};
+
+	/// <summary>
+	/// Flat multimap from Key to a list of DataType, used by the spatial hash grids.
+	/// Open addressing with Robin Hood probing: keys and their first values live in one contiguous slot array,
+	/// lookups stop as soon as they pass a slot closer to its home than the probe, and erase shifts the following
+	/// slots back instead of leaving tombstones. A key disappears once its last value is erased.
+	/// </summary>
+	template <class Key, class DataType, class HasherFunction = std::hash<Key>, class KeyEqual = std::equal_to<Key>,
+			  uint32_t InlineCapacity = _Private::DefaultInlineCapacity<DataType>()>
 	class HashTable
 	{
+	public:
+		typedef _Private::InlineBucket<DataType, InlineCapacity> Bucket;
+
 	public:
 		HashTable(unsigned int expectedSize=64)
-			:m_HashTable(expectedSize)
 		{
+			Reserve(expectedSize);
 		}
 
 		void Insert(const Key& key, const DataType& data)
 		{
-			auto it = m_HashTable.find(key);
-			if (it == m_HashTable.end())
-			{
-				m_HashTable[key] = std::vector<DataType>();
-				m_HashTable[key].push_back(data);
-			}
-			else
-			{
-				it->second.push_back(data);
-			}
+			size_t index = _Find(key);
+			if (index == INVALID_INDEX)
+				index = _InsertKey(key);
+			m_Slots[index].mBucket.PushBack(data);
 		}
 
 		void Erase(const Key& key, const DataType& data)
 		{
-			auto it = m_HashTable.find(key);
-			if (it != m_HashTable.end())
-			{
-				auto& vec = it->second;
-				auto vecIt = std::find(vec.begin(), vec.end(), data);
-				if (vecIt != vec.end())
-				{
-					vec.erase(vecIt);
-				}
-			}
+			const size_t index = _Find(key);
+			if (index == INVALID_INDEX)
+				return;
+			Bucket &bucket = m_Slots[index].mBucket;
+			if (bucket.EraseValue(data) && bucket.Empty())
+				_EraseSlot(index);
 		}
 
 		unsigned int Size() const
 		{
-			return m_HashTable.size();
+			return m_Count;
 		}
 
 		void Clear()
 		{
-			m_HashTable.clear();
+			// keeps the slot array so rebuilding a table of the same size does not allocate again
+			for (size_t i = 0; i < m_Distances.size(); i++)
+			{
+				if (m_Distances[i] != 0)
+				{
+					m_Slots[i].mBucket.Clear();
+					m_Distances[i] = 0;
+				}
+			}
+			m_Count = 0;
 		}
 
 		void Reserve(unsigned int size)
 		{
-			m_HashTable.reserve(size);
+			size_t capacity = MIN_CAPACITY;
+			while (capacity * MAX_LOAD_NUMERATOR < size_t(size) * MAX_LOAD_DENOMINATOR)
+				capacity *= 2;
+			if (capacity > m_Slots.size())
+				_Rehash(capacity);
 		}
 
 		bool HasKey(const Key& key) const
 		{
-			return m_HashTable.find(key) != m_HashTable.end();
+			return _Find(key) != INVALID_INDEX;
 		}
 
 		bool GetFirstData(const Key& key, DataType& data) const
 		{
-			auto it = m_HashTable.find(key);
-			if (it != m_HashTable.end())
+			return GetData(key, 0, data);
+		}
+
+		bool GetData(const Key& key, unsigned int index, DataType& data) const
+		{
+			const size_t slot = _Find(key);
+			if (slot != INVALID_INDEX && m_Slots[slot].mBucket.Size() > index)
 			{
-				if (it->second.size() > 0)
-				{
-					data = it->second[0];
-					return true;
-				}
+				data = m_Slots[slot].mBucket[index];
+				return true;
 			}
 			return false;
 		}
 
-		bool GetData(const Key& key, unsigned int index, DataType& data) const
+		/// @brief the values under key without copying them, empty if the key is absent
+		DataSpan<DataType> Find(const Key& key) const
 		{
-			auto it = m_HashTable.find(key);
-			if (it != m_HashTable.end())
+			const size_t slot = _Find(key);
+			if (slot == INVALID_INDEX)
+				return DataSpan<DataType>();
+			const Bucket &bucket = m_Slots[slot].mBucket;
+			return DataSpan<DataType>(bucket.Data(), bucket.Size());
+		}
+
+		/// @brief visitor(key, values) for every key, in slot order
+		template <class Visitor>
+		void ForEach(const Visitor& visitor) const
+		{
+			for (size_t i = 0; i < m_Distances.size(); i++)
 			{
-				if (it->second.size() > index)
-				{
-					data = it->second[index];
-					return true;
-				}
+				if (m_Distances[i] == 0)
+					continue;
+				const Bucket &bucket = m_Slots[i].mBucket;
+				visitor(m_Slots[i].mKey, DataSpan<DataType>(bucket.Data(), bucket.Size()));
 			}
-			return false;
 		}
 
 		bool GetAllData(const Key& key, std::vector<DataType>& data) const
 		{
-			auto it = m_HashTable.find(key);
-			if (it != m_HashTable.end())
+			const size_t slot = _Find(key);
+			if (slot != INVALID_INDEX)
 			{
-				data = it->second;
+				const Bucket &bucket = m_Slots[slot].mBucket;
+				data.assign(bucket.Data(), bucket.Data() + bucket.Size());
 				return true;
 			}
 			return false;
 		}
 
 	private:
-		std::unordered_map<Key, std::vector<DataType>, HasherFunction, KeyEqual> m_HashTable;
+		struct Slot
+		{
+			Key mKey;
+			Bucket mBucket;
+		};
+
+		static constexpr size_t INVALID_INDEX = ~size_t(0);
+		static constexpr size_t MIN_CAPACITY = 16;
+		// grow above 7/8 load; Robin Hood keeps probe lengths short even that full
+		static constexpr size_t MAX_LOAD_NUMERATOR = 7;
+		static constexpr size_t MAX_LOAD_DENOMINATOR = 8;
+
+		size_t _HomeIndex(const Key& key) const
+		{
+			// Fibonacci hashing: spreads weak hashes (the XOR-combined vector hashes) over the high bits
+			const uint64_t hash = static_cast<uint64_t>(m_Hasher(key)) * 0x9E3779B97F4A7C15ull;
+			return static_cast<size_t>(hash >> m_Shift);
+		}
+
+		size_t _Find(const Key& key) const
+		{
+			const size_t mask = m_Slots.size() - 1;
+			size_t index = _HomeIndex(key);
+			for (uint32_t distance = 1; m_Distances[index] >= distance; distance++)
+			{
+				if (m_Distances[index] == distance && m_KeyEqual(m_Slots[index].mKey, key))
+					return index;
+				index = (index + 1) & mask;
+			}
+			return INVALID_INDEX;
+		}
+
+		size_t _InsertKey(const Key& key)
+		{
+			if ((m_Count + 1) * MAX_LOAD_DENOMINATOR > m_Slots.size() * MAX_LOAD_NUMERATOR)
+				_Rehash(m_Slots.size() * 2);
+			Slot slot{key, Bucket()};
+			m_Count++;
+			return _PlaceSlot(slot);
+		}
+
+		/// @brief Robin Hood insertion of a key that is not in the table, returns where the new key landed
+		size_t _PlaceSlot(Slot& slot)
+		{
+			const size_t mask = m_Slots.size() - 1;
+			size_t index = _HomeIndex(slot.mKey);
+			size_t result = INVALID_INDEX;
+			uint32_t distance = 1;
+			while (true)
+			{
+				if (m_Distances[index] == 0)
+				{
+					m_Slots[index] = std::move(slot);
+					m_Distances[index] = distance;
+					return result == INVALID_INDEX ? index : result;
+				}
+				if (m_Distances[index] < distance)
+				{
+					// take the slot from the richer entry and carry that one further
+					std::swap(m_Slots[index], slot);
+					std::swap(m_Distances[index], distance);
+					if (result == INVALID_INDEX)
+						result = index;
+				}
+				index = (index + 1) & mask;
+				distance++;
+			}
+		}
+
+		void _EraseSlot(size_t index)
+		{
+			// backward shift: pull the following displaced slots one step closer to their home
+			const size_t mask = m_Slots.size() - 1;
+			size_t next = (index + 1) & mask;
+			while (m_Distances[next] > 1)
+			{
+				m_Slots[index] = std::move(m_Slots[next]);
+				m_Distances[index] = m_Distances[next] - 1;
+				index = next;
+				next = (next + 1) & mask;
+			}
+			m_Slots[index].mBucket.Clear();
+			m_Distances[index] = 0;
+			m_Count--;
+		}
+
+		void _Rehash(const size_t capacity)
+		{
+			std::vector<Slot, HAlignedAllocator<Slot>> oldSlots(capacity);
+			std::vector<uint32_t> oldDistances(capacity, 0);
+			oldSlots.swap(m_Slots);
+			oldDistances.swap(m_Distances);
+			m_Shift = 64;
+			for (size_t size = capacity; size > 1; size >>= 1)
+				m_Shift--;
+			for (size_t i = 0; i < oldSlots.size(); i++)
+			{
+				if (oldDistances[i] != 0)
+					_PlaceSlot(oldSlots[i]);
+			}
+		}
+
+	private:
+		std::vector<Slot, HAlignedAllocator<Slot>> m_Slots;
+		// probe distance + 1 of every slot, 0 marks an empty slot
+		std::vector<uint32_t> m_Distances;
+		uint32_t m_Count = 0;
+		uint32_t m_Shift = 64;
+		HasherFunction m_Hasher;
+		KeyEqual m_KeyEqual;
 	};
-}
\ No newline at end of file
+}
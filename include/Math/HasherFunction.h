@@ -1,9 +1,272 @@
 #pragma once
 #include <Math/Math.h>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
 
 namespace MathLib
 {
+	/// @brief 64x64 -> 128 bit multiply folded back to 64 bits (the wyhash "mum" mixer)
+	inline uint64_t MultiplyFold64(const uint64_t a, const uint64_t b)
+	{
+#if defined(__SIZEOF_INT128__)
+		const __uint128_t product = static_cast<__uint128_t>(a) * b;
+		return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		uint64_t high;
+		const uint64_t low = _umul128(a, b, &high);
+		return low ^ high;
+#else
+		const uint64_t aLow = a & 0xFFFFFFFFull, aHigh = a >> 32;
+		const uint64_t bLow = b & 0xFFFFFFFFull, bHigh = b >> 32;
+		const uint64_t lowLow = aLow * bLow, lowHigh = aLow * bHigh, highLow = aHigh * bLow, highHigh = aHigh * bHigh;
+		const uint64_t middle = (lowLow >> 32) + (lowHigh & 0xFFFFFFFFull) + (highLow & 0xFFFFFFFFull);
+		const uint64_t low = (middle << 32) | (lowLow & 0xFFFFFFFFull);
+		const uint64_t high = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+		return low ^ high;
+#endif
+	}
+
+	/// @brief number of leading zero bits of v, 64 for v == 0
+	inline uint32_t CountLeadingZeros64(const uint64_t v)
+	{
+		if (v == 0)
+			return 64;
+#if defined(__GNUC__) || defined(__clang__)
+		return static_cast<uint32_t>(__builtin_clzll(v));
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanReverse64(&index, v);
+		return 63 - static_cast<uint32_t>(index);
+#else
+		uint32_t count = 0;
+		for (uint64_t bit = 1ull << 63; !(v & bit); bit >>= 1)
+			count++;
+		return count;
+#endif
+	}
+
+	/// @brief number of trailing zero bits of v, 32 for v == 0
+	inline uint32_t CountTrailingZeros32(const uint32_t v)
+	{
+		if (v == 0)
+			return 32;
+#if defined(__GNUC__) || defined(__clang__)
+		return static_cast<uint32_t>(__builtin_ctz(v));
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward(&index, v);
+		return static_cast<uint32_t>(index);
+#else
+		uint32_t count = 0;
+		for (uint32_t bit = 1; !(v & bit); bit <<= 1)
+			count++;
+		return count;
+#endif
+	}
+
+	/// @brief spreads the low 32 bits of v to the even bits of the result
+	inline uint64_t MortonSpread2(uint64_t v)
+	{
+		v &= 0xFFFFFFFFull;
+		v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+		v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+		v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		v = (v | (v << 2)) & 0x3333333333333333ull;
+		v = (v | (v << 1)) & 0x5555555555555555ull;
+		return v;
+	}
+
+	/// @brief spreads the low 21 bits of v to every third bit of the result
+	inline uint64_t MortonSpread3(uint64_t v)
+	{
+		v &= 0x1FFFFFull;
+		v = (v | (v << 32)) & 0x001F00000000FFFFull;
+		v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+		v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+		v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+		v = (v | (v << 2)) & 0x1249249249249249ull;
+		return v;
+	}
+
+	inline uint64_t MortonEncode2(const uint32_t x, const uint32_t y)
+	{
+		return MortonSpread2(x) | (MortonSpread2(y) << 1);
+	}
+
+	/// @brief interleaves the low 21 bits of every coordinate
+	inline uint64_t MortonEncode3(const uint32_t x, const uint32_t y, const uint32_t z)
+	{
+		return MortonSpread3(x) | (MortonSpread3(y) << 1) | (MortonSpread3(z) << 2);
+	}
+
+	/// @brief inverse of MortonSpread2, gathers the even bits into the low 32 bits
+	inline uint32_t MortonCompact2(uint64_t v)
+	{
+		v &= 0x5555555555555555ull;
+		v = (v | (v >> 1)) & 0x3333333333333333ull;
+		v = (v | (v >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+		v = (v | (v >> 4)) & 0x00FF00FF00FF00FFull;
+		v = (v | (v >> 8)) & 0x0000FFFF0000FFFFull;
+		v = (v | (v >> 16)) & 0x00000000FFFFFFFFull;
+		return static_cast<uint32_t>(v);
+	}
+
+	/// @brief inverse of MortonSpread3, gathers every third bit into the low 21 bits
+	inline uint32_t MortonCompact3(uint64_t v)
+	{
+		v &= 0x1249249249249249ull;
+		v = (v | (v >> 2)) & 0x10C30C30C30C30C3ull;
+		v = (v | (v >> 4)) & 0x100F00F00F00F00Full;
+		v = (v | (v >> 8)) & 0x001F0000FF0000FFull;
+		v = (v | (v >> 16)) & 0x001F00000000FFFFull;
+		v = (v | (v >> 32)) & 0x00000000001FFFFFull;
+		return static_cast<uint32_t>(v);
+	}
+
+	/// <summary>
+	/// Grid key encoders: pack signed cell coordinates into one uint64_t, so a HashGrid key hashes and compares
+	/// as a single integer. Coordinates are stored with a bias, 32 bits per axis in 2D and 21 bits in 3D;
+	/// cells outside [MIN_COORDINATE, MAX_COORDINATE] have to be clamped by the caller (HashGrid does).
+	/// PackedGridKey lays the axes out as plain bit fields, MortonGridKey interleaves them so that keys of
+	/// neighbouring cells are numerically close (Z-order), which keeps sorted key lists spatially coherent.
+	/// </summary>
+	struct PackedGridKey2D
+	{
+		typedef HVector2I Cell;
+		static constexpr int64_t MIN_COORDINATE = INT32_MIN;
+		static constexpr int64_t MAX_COORDINATE = INT32_MAX;
 
+		static uint64_t Encode(const HVector2I &cell)
+		{
+			return uint64_t(uint32_t(cell[0]) ^ 0x80000000u) | (uint64_t(uint32_t(cell[1]) ^ 0x80000000u) << 32);
+		}
+
+		static HVector2I Decode(const uint64_t key)
+		{
+			return HVector2I(int32_t(uint32_t(key) ^ 0x80000000u), int32_t(uint32_t(key >> 32) ^ 0x80000000u));
+		}
+	};
+
+	struct PackedGridKey3D
+	{
+		typedef HVector3I Cell;
+		static constexpr int64_t MIN_COORDINATE = -(int64_t(1) << 20);
+		static constexpr int64_t MAX_COORDINATE = (int64_t(1) << 20) - 1;
+
+		static uint64_t Encode(const HVector3I &cell)
+		{
+			return _Bias(cell[0]) | (_Bias(cell[1]) << 21) | (_Bias(cell[2]) << 42);
+		}
+
+		static HVector3I Decode(const uint64_t key)
+		{
+			return HVector3I(_Unbias(key), _Unbias(key >> 21), _Unbias(key >> 42));
+		}
+
+		static uint64_t _Bias(const int32_t v) { return uint64_t(int64_t(v) - MIN_COORDINATE) & 0x1FFFFFull; }
+		static int32_t _Unbias(const uint64_t v) { return int32_t(int64_t(v & 0x1FFFFFull) + MIN_COORDINATE); }
+	};
+
+	struct MortonGridKey2D
+	{
+		typedef HVector2I Cell;
+		static constexpr int64_t MIN_COORDINATE = INT32_MIN;
+		static constexpr int64_t MAX_COORDINATE = INT32_MAX;
+
+		static uint64_t Encode(const HVector2I &cell)
+		{
+			return MortonEncode2(uint32_t(cell[0]) ^ 0x80000000u, uint32_t(cell[1]) ^ 0x80000000u);
+		}
+
+		static HVector2I Decode(const uint64_t key)
+		{
+			return HVector2I(int32_t(MortonCompact2(key) ^ 0x80000000u), int32_t(MortonCompact2(key >> 1) ^ 0x80000000u));
+		}
+	};
+
+	struct MortonGridKey3D
+	{
+		typedef HVector3I Cell;
+		static constexpr int64_t MIN_COORDINATE = PackedGridKey3D::MIN_COORDINATE;
+		static constexpr int64_t MAX_COORDINATE = PackedGridKey3D::MAX_COORDINATE;
+
+		static uint64_t Encode(const HVector3I &cell)
+		{
+			return MortonEncode3(uint32_t(PackedGridKey3D::_Bias(cell[0])), uint32_t(PackedGridKey3D::_Bias(cell[1])),
+								 uint32_t(PackedGridKey3D::_Bias(cell[2])));
+		}
+
+		static HVector3I Decode(const uint64_t key)
+		{
+			return HVector3I(PackedGridKey3D::_Unbias(MortonCompact3(key)), PackedGridKey3D::_Unbias(MortonCompact3(key >> 1)),
+							 PackedGridKey3D::_Unbias(MortonCompact3(key >> 2)));
+		}
+	};
+
+	/// <summary>
+	/// Hashers for integer grid keys (HVector2I/3I/4I, HVector2UI/3UI/4UI), usable as the HashTable HasherFunction.
+	/// TeschnerHasher: prime multiply + XOR from Teschner et al. 2003, the classic spatial hash; cheapest to evaluate.
+	/// MortonHasher: interleaves the coordinates (21 bits each in 3D), collision free inside that range and keeps
+	/// neighbouring cells close in the hash; relies on HashTable's Fibonacci mixing to spread the buckets.
+	/// WyHasher: packs the components into two words and mixes them with one 128 bit multiply (wyhash style),
+	/// the best avalanche of the three at nearly the cost of Teschner.
+	/// </summary>
+	template <class Key>
+	struct TeschnerHasher
+	{
+		static_assert(Key::RowsAtCompileTime >= 1 && Key::RowsAtCompileTime <= 4, "grid keys have 1 to 4 components");
+
+		std::size_t operator()(const Key &key) const
+		{
+			static constexpr uint64_t primes[4] = {73856093ull, 19349663ull, 83492791ull, 50331653ull};
+			uint64_t hash = 0;
+			for (int i = 0; i < Key::RowsAtCompileTime; i++)
+				hash ^= static_cast<uint64_t>(static_cast<uint32_t>(key[i])) * primes[i];
+			return static_cast<std::size_t>(hash);
+		}
+	};
+
+	template <class Key>
+	struct MortonHasher
+	{
+		static_assert(Key::RowsAtCompileTime >= 2 && Key::RowsAtCompileTime <= 4, "Morton keys have 2 to 4 components");
+
+		std::size_t operator()(const Key &key) const
+		{
+			if constexpr (Key::RowsAtCompileTime == 2)
+				return static_cast<std::size_t>(MortonEncode2(static_cast<uint32_t>(key[0]), static_cast<uint32_t>(key[1])));
+			else if constexpr (Key::RowsAtCompileTime == 3)
+				return static_cast<std::size_t>(MortonEncode3(static_cast<uint32_t>(key[0]), static_cast<uint32_t>(key[1]), static_cast<uint32_t>(key[2])));
+			else
+			{
+				// 16 bits per axis: two 2D codes of 16 bit coordinates, interleaved once more
+				const uint64_t xz = MortonEncode2(static_cast<uint32_t>(key[0]) & 0xFFFF, static_cast<uint32_t>(key[2]) & 0xFFFF);
+				const uint64_t yw = MortonEncode2(static_cast<uint32_t>(key[1]) & 0xFFFF, static_cast<uint32_t>(key[3]) & 0xFFFF);
+				return static_cast<std::size_t>(MortonSpread2(xz) | (MortonSpread2(yw) << 1));
+			}
+		}
+	};
+
+	template <class Key>
+	struct WyHasher
+	{
+		static_assert(Key::RowsAtCompileTime >= 1 && Key::RowsAtCompileTime <= 4, "grid keys have 1 to 4 components");
+
+		std::size_t operator()(const Key &key) const
+		{
+			uint64_t words[2] = {0, 0};
+			for (int i = 0; i < Key::RowsAtCompileTime; i++)
+				words[i >> 1] |= static_cast<uint64_t>(static_cast<uint32_t>(key[i])) << ((i & 1) * 32);
+			return static_cast<std::size_t>(MultiplyFold64(words[0] ^ 0xa0761d6478bd642full, words[1] ^ 0xe7037ed1a0b428dbull));
+		}
+	};
+
+	/// @brief order dependent combination for the floating point vector hashes
+	inline std::size_t HashCombine(const std::size_t seed, const std::size_t value)
+	{
+		return static_cast<std::size_t>(MultiplyFold64(static_cast<uint64_t>(seed) ^ 0xa0761d6478bd642full, static_cast<uint64_t>(value) ^ 0xe7037ed1a0b428dbull));
+	}
 };
 
 namespace std
@@ -13,7 +276,10 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector4& v) const
 		{
-			return std::hash<MathLib::HReal>()(v(0)) ^ std::hash<MathLib::HReal>()(v(1)) ^ std::hash<MathLib::HReal>()(v(2)) ^ std::hash<MathLib::HReal>()(v(3));
+			std::size_t seed = std::hash<MathLib::HReal>()(v(0));
+			for (int i = 1; i < 4; i++)
+				seed = MathLib::HashCombine(seed, std::hash<MathLib::HReal>()(v(i)));
+			return seed;
 		}
 	};
 
@@ -31,7 +297,10 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector3& v) const
 		{
-			return std::hash<MathLib::HReal>()(v(0)) ^ std::hash<MathLib::HReal>()(v(1)) ^ std::hash<MathLib::HReal>()(v(2));
+			std::size_t seed = std::hash<MathLib::HReal>()(v(0));
+			for (int i = 1; i < 3; i++)
+				seed = MathLib::HashCombine(seed, std::hash<MathLib::HReal>()(v(i)));
+			return seed;
 		}
 	};
 
@@ -49,7 +318,10 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector2& v) const
 		{
-			return std::hash<MathLib::HReal>()(v(0)) ^ std::hash<MathLib::HReal>()(v(1));
+			std::size_t seed = std::hash<MathLib::HReal>()(v(0));
+			for (int i = 1; i < 2; i++)
+				seed = MathLib::HashCombine(seed, std::hash<MathLib::HReal>()(v(i)));
+			return seed;
 		}
 	};
 
@@ -67,7 +339,7 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector2I& v) const
 		{
-			return std::hash<int>()(v(0)) ^ std::hash<int>()(v(1));
+			return MathLib::WyHasher<MathLib::HVector2I>()(v);
 		}
 	};
 
@@ -85,7 +357,7 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector3I& v) const
 		{
-			return std::hash<int>()(v(0)) ^ std::hash<int>()(v(1)) ^ std::hash<int>()(v(2));
+			return MathLib::WyHasher<MathLib::HVector3I>()(v);
 		}
 	};
 
@@ -103,7 +375,7 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector4I& v) const
 		{
-			return std::hash<int>()(v(0)) ^ std::hash<int>()(v(1)) ^ std::hash<int>()(v(2)) ^ std::hash<int>()(v(3));
+			return MathLib::WyHasher<MathLib::HVector4I>()(v);
 		}
 	};
 
@@ -121,7 +393,7 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector2UI& v) const
 		{
-			return std::hash<unsigned int>()(v(0)) ^ std::hash<unsigned int>()(v(1));
+			return MathLib::WyHasher<MathLib::HVector2UI>()(v);
 		}
 	};
 
@@ -139,7 +411,7 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector3UI& v) const
 		{
-			return std::hash<unsigned int>()(v(0)) ^ std::hash<unsigned int>()(v(1)) ^ std::hash<unsigned int>()(v(2));
+			return MathLib::WyHasher<MathLib::HVector3UI>()(v);
 		}
 	};
 
@@ -157,7 +429,7 @@ namespace std
 	{
 		std::size_t operator()(const MathLib::HVector4UI& v) const
 		{
-			return std::hash<unsigned int>()(v(0)) ^ std::hash<unsigned int>()(v(1)) ^ std::hash<unsigned int>()(v(2)) ^ std::hash<unsigned int>()(v(3));
+			return MathLib::WyHasher<MathLib::HVector4UI>()(v);
 		}
 	};
 
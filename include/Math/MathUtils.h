@@ -1,5 +1,8 @@
 #pragma once
 #include <Math/Math.h>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
 
 #define HVECTOR_ROUND(dim) inline HVector##dim##UI VectorRound##dim(const HVector##dim &v)
 namespace MathLib
@@ -147,4 +150,39 @@ namespace MathLib
 				return false;
 		return true;
 	}
-}
\ No newline at end of file
+
+	namespace _Private
+	{
+		// calls visitor(data); a visitor that returns bool can stop the query early by returning false
+		template <class Visitor, class DataType>
+		inline bool _VisitData(const Visitor& visitor, const DataType& data)
+		{
+			if constexpr (std::is_same<decltype(visitor(data)), bool>::value)
+				return visitor(data);
+			else
+			{
+				visitor(data);
+				return true;
+			}
+		}
+
+		// inserts into a max-heap of the k closest (squared distance, data) pairs
+		template <class DataType>
+		inline void _PushNearest(std::vector<std::pair<HReal, DataType>>& heap, const uint32_t k, const HReal sqDistance, const DataType& data)
+		{
+			auto closer = [](const std::pair<HReal, DataType>& a, const std::pair<HReal, DataType>& b)
+			{ return a.first < b.first; };
+			if (heap.size() < k)
+			{
+				heap.emplace_back(sqDistance, data);
+				std::push_heap(heap.begin(), heap.end(), closer);
+			}
+			else if (sqDistance < heap.front().first)
+			{
+				std::pop_heap(heap.begin(), heap.end(), closer);
+				heap.back() = std::make_pair(sqDistance, data);
+				std::push_heap(heap.begin(), heap.end(), closer);
+			}
+		}
+	}
+}
@@ -1,18 +1,44 @@
 #pragma once
 #include <Math/Math.h>
-#ifdef USE_TBB
+#include <functional>
+#include <mutex>
+
+// Backend selection: USE_THREAD_POOL picks the built-in std::thread work-stealing pool (it wins over USE_TBB so a
+// single target can opt out of TBB), otherwise USE_TBB picks TBB, otherwise every loop runs serially.
+#if defined(USE_THREAD_POOL)
+#define PARALLEL_BACKEND_THREAD_POOL
+#elif defined(USE_TBB)
+#define PARALLEL_BACKEND_TBB
+#endif
+
+#ifdef PARALLEL_BACKEND_TBB
 #include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
 #include <tbb/blocked_range.h>
 #include <tbb/blocked_range2d.h>
 #include <tbb/blocked_range3d.h>
-#include <tbb/parallel_for.h>
-#define DEFAULT_GRAIN_SIZE 1000
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#endif
+#ifdef PARALLEL_BACKEND_THREAD_POOL
+#include <Math/Core/ThreadPool.h>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <thread>
 #endif
+#include <memory>
+
+#define DEFAULT_GRAIN_SIZE 1000
 
 namespace MathLib
 {
     namespace Parallel
     {
+        // Type-erased loop bodies. The ParallelFor overloads below take any callable and call it directly,
+        // so these are only needed when a body has to be stored or chosen at runtime.
         template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
         using ParallelFunction = std::function<void(IntType)>;
         template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
@@ -20,200 +46,715 @@ namespace MathLib
         template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
         using ParallelFunction3 = std::function<void(IntType, IntType, IntType)>;
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void ParallelFor(IntType start, IntType end, const ParallelFunction<IntType> &func)
+        enum class Partitioner
+        {
+            eAuto,     // adaptive splitting, good default for uneven loop bodies
+            eSimple,   // split down to the grain size, the grain has to be chosen with care
+            eStatic,   // one even chunk per worker, lowest overhead for uniform bodies
+            eAffinity  // replays the previous thread mapping when the same policy is reused
+        };
+
+        /// <summary>
+        /// How a ParallelFor is split and scheduled. The default policy lets the scheduler pick everything.
+        /// mGrainSize is per axis: [0] is the innermost (begin0/end0) axis, 0 means chosen automatically.
+        /// </summary>
+        struct ExecutionPolicy
         {
-#ifdef USE_TBB
-            tbb::parallel_for(tbb::blocked_range<IntType>(start, end),
-                [&](const tbb::blocked_range<IntType>& range) {
-                    for (IntType i = range.begin(); i != range.end(); ++i) {
+            explicit ExecutionPolicy(const Partitioner partitioner = Partitioner::eAuto, const uint32_t maxConcurrency = 0)
+                : mPartitioner(partitioner), mMaxConcurrency(maxConcurrency)
+            {
+#ifdef PARALLEL_BACKEND_TBB
+                if (mPartitioner == Partitioner::eAffinity)
+                    mAffinity = std::make_shared<tbb::affinity_partitioner>();
+#endif
+            }
+
+            static ExecutionPolicy Serial()
+            {
+                ExecutionPolicy policy;
+                policy.mSerial = true;
+                return policy;
+            }
+
+            size_t mGrainSize[3] = {0, 0, 0};
+            Partitioner mPartitioner = Partitioner::eAuto;
+            uint32_t mMaxConcurrency = 0; // 0 means every available worker
+            bool mSerial = false;
+#ifdef PARALLEL_BACKEND_TBB
+            std::shared_ptr<tbb::affinity_partitioner> mAffinity;
+#endif
+        };
+
+        inline uint32_t GetMaxConcurrency(const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+            if (policy.mSerial)
+                return 1;
+#if defined(PARALLEL_BACKEND_TBB)
+            const uint32_t available = static_cast<uint32_t>(tbb::this_task_arena::max_concurrency());
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+            const uint32_t available = ThreadPool::Instance().GetConcurrency();
+#else
+            const uint32_t available = 1;
+#endif
+            return policy.mMaxConcurrency > 0 ? std::min(policy.mMaxConcurrency, available) : available;
+        }
+
+        inline size_t _GrainSize(const ExecutionPolicy &policy, const uint32_t axis, const size_t extent)
+        {
+            if (policy.mGrainSize[axis] > 0)
+                return policy.mGrainSize[axis];
+#ifdef PARALLEL_BACKEND_THREAD_POOL
+            // the pool always splits down to the grain: one chunk per thread for static or capped loops, a few otherwise
+            const bool evenSplit = policy.mPartitioner == Partitioner::eStatic || policy.mMaxConcurrency > 0;
+            const size_t chunks = GetMaxConcurrency(policy) * (evenSplit ? 1 : 4);
+            return std::max<size_t>(1, (extent + chunks - 1) / chunks);
+#else
+            // simple_partitioner splits all the way down to the grain, so give it a few chunks per worker
+            if (policy.mPartitioner == Partitioner::eSimple)
+                return std::max<size_t>(1, extent / (4 * GetMaxConcurrency(policy)));
+            return 1;
+#endif
+        }
+
+#ifdef PARALLEL_BACKEND_TBB
+        template <typename Range, typename Body>
+        void _ParallelForRange(const Range &range, const Body &body, const ExecutionPolicy &policy)
+        {
+            auto run = [&]()
+            {
+                switch (policy.mPartitioner)
+                {
+                case Partitioner::eSimple:
+                    tbb::parallel_for(range, body, tbb::simple_partitioner());
+                    break;
+                case Partitioner::eStatic:
+                    tbb::parallel_for(range, body, tbb::static_partitioner());
+                    break;
+                case Partitioner::eAffinity:
+                    if (policy.mAffinity)
+                        tbb::parallel_for(range, body, *policy.mAffinity);
+                    else
+                    {
+                        tbb::affinity_partitioner partitioner;
+                        tbb::parallel_for(range, body, partitioner);
+                    }
+                    break;
+                default:
+                    tbb::parallel_for(range, body, tbb::auto_partitioner());
+                    break;
+                }
+            };
+            if (policy.mMaxConcurrency > 0)
+            {
+                tbb::task_arena arena(static_cast<int>(policy.mMaxConcurrency));
+                arena.execute(run);
+            }
+            else
+                run();
+        }
+#endif
+
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void ParallelFor(IntType start, IntType end, const Function &func, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+#ifdef PARALLEL_BACKEND_TBB
+            if (!policy.mSerial && start < end)
+            {
+                _ParallelForRange(
+                    tbb::blocked_range<IntType>(start, end, _GrainSize(policy, 0, end - start)),
+                    [&](const tbb::blocked_range<IntType>& range) {
+                        for (IntType i = range.begin(); i != range.end(); ++i) {
+                            func(i);
+                        }
+                    },
+                    policy);
+                return;
+            }
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+            if (!policy.mSerial && start < end)
+            {
+                const size_t count = static_cast<size_t>(end - start);
+                ThreadPool::Instance().ParallelFor(0, count, _GrainSize(policy, 0, count), [&](size_t begin, size_t chunkEnd) {
+                    for (IntType i = start + static_cast<IntType>(begin); i != start + static_cast<IntType>(chunkEnd); ++i) {
                         func(i);
                     }
                 });
-#else
+                return;
+            }
+#endif
             for (IntType i = start; i < end; i++) {
                 func(i);
             }
-#endif
+        }
 
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void ParallelFor(IntType count, const Function &func, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+            ParallelFor<IntType>(0, count, func, policy);
         }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void SafeParallelFor(IntType start, IntType end, const ParallelFunction<IntType>&func)
-        {
-#ifdef USE_TBB
-            tbb::parallel_for(
-                tbb::blocked_range<IntType>(start, end, DEFAULT_GRAIN_SIZE),
-                [&](const tbb::blocked_range<IntType>& range) {
-                    for (IntType i = range.begin(); i != range.end(); ++i) {
-                        tbb::mutex mutex;
-                        tbb::mutex::scoped_lock lock(mutex);
-                        func(i);
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void ParallelFor(const std::vector<IntType> &indices, const Function &func, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+            ParallelFor<size_t>(0, indices.size(), [&](size_t i) { func(indices[i]); }, policy);
+        }
+
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void ParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, const Function &func, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+#ifdef PARALLEL_BACKEND_TBB
+            if (!policy.mSerial && begin0 < end0 && begin1 < end1)
+            {
+                _ParallelForRange(
+                    tbb::blocked_range2d<IntType>(
+                        begin1, end1, _GrainSize(policy, 1, end1 - begin1),
+                        begin0, end0, _GrainSize(policy, 0, end0 - begin0)
+                    ),
+                    [&](const tbb::blocked_range2d<IntType>& range) {
+                        for (IntType i = range.rows().begin(); i != range.rows().end(); ++i) {
+                            for (IntType j = range.cols().begin(); j != range.cols().end(); ++j) {
+                                func(i, j);
+                            }
+                        }
+                    },
+                    policy);
+                return;
+            }
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+            if (!policy.mSerial && begin0 < end0 && begin1 < end1)
+            {
+                // split over rows only, the inner axis stays contiguous inside a chunk
+                const size_t rows = static_cast<size_t>(end1 - begin1);
+                ThreadPool::Instance().ParallelFor(0, rows, _GrainSize(policy, 1, rows), [&](size_t begin, size_t chunkEnd) {
+                    for (IntType i = begin1 + static_cast<IntType>(begin); i != begin1 + static_cast<IntType>(chunkEnd); ++i) {
+                        for (IntType j = begin0; j < end0; ++j) {
+                            func(i, j);
+                        }
                     }
+                });
+                return;
+            }
+#endif
+            for (IntType i = begin1; i < end1; i++) {
+                for (IntType j = begin0; j < end0; j++) {
+                    func(i, j);
                 }
-            );
-#else
-            ParallelFor(start, end, func);
+            }
+        }
+
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void ParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, IntType begin2, IntType end2, const Function &func, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+#ifdef PARALLEL_BACKEND_TBB
+            if (!policy.mSerial && begin0 < end0 && begin1 < end1 && begin2 < end2)
+            {
+                _ParallelForRange(
+                    tbb::blocked_range3d<IntType>(
+                        begin2, end2, _GrainSize(policy, 2, end2 - begin2),
+                        begin1, end1, _GrainSize(policy, 1, end1 - begin1),
+                        begin0, end0, _GrainSize(policy, 0, end0 - begin0)
+                    ),
+                    [&](const tbb::blocked_range3d<IntType>& range) {
+                        for (IntType i = range.pages().begin(); i != range.pages().end(); ++i) {
+                            for (IntType j = range.rows().begin(); j != range.rows().end(); ++j) {
+                                for (IntType k = range.cols().begin(); k != range.cols().end(); ++k) {
+                                    func(i, j, k);
+                                }
+                            }
+                        }
+                    },
+                    policy);
+                return;
+            }
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+            if (!policy.mSerial && begin0 < end0 && begin1 < end1 && begin2 < end2)
+            {
+                // split over (page, row) pairs so thin volumes still produce enough chunks
+                const size_t rows = static_cast<size_t>(end1 - begin1);
+                const size_t pageRows = static_cast<size_t>(end2 - begin2) * rows;
+                ThreadPool::Instance().ParallelFor(0, pageRows, _GrainSize(policy, 1, pageRows), [&](size_t begin, size_t chunkEnd) {
+                    for (size_t t = begin; t < chunkEnd; ++t) {
+                        const IntType i = begin2 + static_cast<IntType>(t / rows);
+                        const IntType j = begin1 + static_cast<IntType>(t % rows);
+                        for (IntType k = begin0; k < end0; ++k) {
+                            func(i, j, k);
+                        }
+                    }
+                });
+                return;
+            }
 #endif
+            for (IntType i = begin2; i < end2; i++) {
+                for (IntType j = begin1; j < end1; j++) {
+                    for (IntType k = begin0; k < end0; k++) {
+                        func(i, j, k);
+                    }
+                }
+            }
         }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void ParallelFor(IntType count, const ParallelFunction<IntType>&func)
+        // SafeParallelFor runs the body under one lock shared by the whole loop, so bodies are fully serialized.
+        // Prefer ParallelReduce or ThreadLocal for accumulations; they need no lock at all.
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void SafeParallelFor(IntType start, IntType end, const Function &func)
         {
-            ParallelFor<IntType>(0, count, func);
+            std::mutex mutex;
+            ParallelFor<IntType>(start, end, [&](IntType i)
+                                 {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    func(i); });
         }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void SafeParallelFor(IntType count, const ParallelFunction<IntType>&func)
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void SafeParallelFor(IntType count, const Function &func)
         {
             SafeParallelFor<IntType>(0, count, func);
         }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void ParallelFor(const std::vector<IntType> &indices, const ParallelFunction<IntType>&func)
-        {
-#ifdef USE_TBB
-            tbb::parallel_for(
-                tbb::blocked_range<size_t>(0, indices.size(), DEFAULT_GRAIN_SIZE),
-                [&](const tbb::blocked_range<size_t>& range) {
-                    for (size_t i = range.begin(); i != range.end(); ++i) {
-                        func(indices[i]);
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void SafeParallelFor(const std::vector<IntType> &indices, const Function &func)
+        {
+            std::mutex mutex;
+            ParallelFor(indices, [&](IntType i)
+                        {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    func(i); });
+        }
+
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void SafeParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, const Function &func)
+        {
+            std::mutex mutex;
+            ParallelFor<IntType>(begin0, end0, begin1, end1, [&](IntType i, IntType j)
+                                 {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    func(i, j); });
+        }
+
+        template <typename IntType, typename Function, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void SafeParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, IntType begin2, IntType end2, const Function &func)
+        {
+            std::mutex mutex;
+            ParallelFor<IntType>(begin0, end0, begin1, end1, begin2, end2, [&](IntType i, IntType j, IntType k)
+                                 {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    func(i, j, k); });
+        }
+
+        enum class ReduceOrder
+        {
+            eDefault,      // partial results are combined in whatever order the scheduler finishes them
+            eDeterministic // fixed split and combine order, bitwise reproducible for floating point
+        };
+
+        /// <summary>
+        /// Reduces [start, end) into one value without locks.
+        /// func(i, value) accumulates element i into a partial value that starts from identity,
+        /// combine(a, b) merges two partial values and must be associative.
+        /// </summary>
+        template <typename IntType, typename ValueType, typename Function, typename Combine, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        ValueType ParallelReduce(IntType start, IntType end, const ValueType &identity, const Function &func, const Combine &combine, const ReduceOrder order = ReduceOrder::eDefault)
+        {
+            if (start >= end)
+                return identity;
+#ifdef PARALLEL_BACKEND_TBB
+            auto body = [&](const tbb::blocked_range<IntType> &range, ValueType value) -> ValueType
+            {
+                for (IntType i = range.begin(); i != range.end(); ++i)
+                {
+                    func(i, value);
+                }
+                return value;
+            };
+            if (order == ReduceOrder::eDeterministic)
+                return tbb::parallel_deterministic_reduce(tbb::blocked_range<IntType>(start, end, DEFAULT_GRAIN_SIZE), identity, body, combine);
+            return tbb::parallel_reduce(tbb::blocked_range<IntType>(start, end), identity, body, combine);
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+            // one partial value per chunk, combined in index order afterwards; with a fixed chunk size the result
+            // does not depend on the number of threads
+            const size_t count = static_cast<size_t>(end - start);
+            const size_t grain = order == ReduceOrder::eDeterministic ? DEFAULT_GRAIN_SIZE : _GrainSize(ExecutionPolicy(), 0, count);
+            const size_t chunkCount = (count + grain - 1) / grain;
+            std::vector<ValueType, HAlignedAllocator<ValueType>> partials(chunkCount, identity);
+            ThreadPool::Instance().ParallelFor(0, chunkCount, _GrainSize(ExecutionPolicy(), 0, chunkCount), [&](size_t begin, size_t chunkEnd) {
+                for (size_t c = begin; c < chunkEnd; ++c) {
+                    const IntType chunkStart = start + static_cast<IntType>(c * grain);
+                    const IntType chunkStop = start + static_cast<IntType>(std::min(count, (c + 1) * grain));
+                    for (IntType i = chunkStart; i != chunkStop; ++i) {
+                        func(i, partials[c]);
                     }
                 }
-            );
+            });
+            ValueType value = identity;
+            for (const ValueType &partial : partials)
+                value = combine(value, partial);
+            return value;
 #else
-            ParallelFor<IntType>(0, static_cast<IntType>(indices.size()),
-                [&](IntType i) { func(indices[i]); });
+            ValueType value = identity;
+            for (IntType i = start; i < end; i++)
+            {
+                func(i, value);
+            }
+            return value;
 #endif
         }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void SafeParallelFor(const std::vector<IntType> &indices, const ParallelFunction<IntType>&func)
-        {
-#ifdef USE_TBB
-            tbb::parallel_for(
-                tbb::blocked_range<size_t>(0, indices.size(), DEFAULT_GRAIN_SIZE),
-                [&](const tbb::blocked_range<size_t>& range) {
-                    for (size_t i = range.begin(); i != range.end(); ++i) {
-                        tbb::mutex mutex;
-                        tbb::mutex::scoped_lock lock(mutex);
-                        func(indices[i]);
+        /// <summary>
+        /// Reduces transform(i) over [start, end) with combine, e.g. a sum or a min/max of per-element values.
+        /// </summary>
+        template <typename IntType, typename ValueType, typename Transform, typename Combine, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        ValueType ParallelTransformReduce(IntType start, IntType end, const ValueType &identity, const Transform &transform, const Combine &combine, const ReduceOrder order = ReduceOrder::eDefault)
+        {
+            return ParallelReduce<IntType>(
+                start, end, identity, [&](IntType i, ValueType &value)
+                { value = combine(value, transform(i)); },
+                combine, order);
+        }
+
+        /// <summary>
+        /// Exclusive prefix sum: output[i] = input(0) + ... + input(i - 1), returns the total.
+        /// Runs in fixed size blocks (block sums, a serial scan over them, then a pass per block),
+        /// so the result does not depend on the thread count.
+        /// </summary>
+        template <typename IntType, typename ValueType, typename InputFunction, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        ValueType ParallelExclusiveScan(IntType count, const InputFunction &input, ValueType *output, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+            const IntType blockSize = 4096;
+            const IntType blockCount = (count + blockSize - 1) / blockSize;
+            std::vector<ValueType> blockSums(blockCount, ValueType(0));
+            ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                 {
+                ValueType sum(0);
+                const IntType end = std::min(count, (block + 1) * blockSize);
+                for (IntType i = block * blockSize; i < end; i++)
+                    sum += input(i);
+                blockSums[block] = sum; },
+                                 policy);
+            ValueType total(0);
+            for (IntType block = 0; block < blockCount; block++)
+            {
+                const ValueType sum = blockSums[block];
+                blockSums[block] = total;
+                total += sum;
+            }
+            ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                 {
+                ValueType sum = blockSums[block];
+                const IntType end = std::min(count, (block + 1) * blockSize);
+                for (IntType i = block * blockSize; i < end; i++)
+                {
+                    const ValueType value = input(i);
+                    output[i] = sum;
+                    sum += value;
+                } },
+                                 policy);
+            return total;
+        }
+
+        /// <summary>
+        /// Runs first() and second() as two tasks that may execute concurrently and returns when both are done.
+        /// Nested calls are fine, which makes this the building block for divide and conquer recursion.
+        /// </summary>
+        template <typename First, typename Second>
+        void ParallelInvoke(const First &first, const Second &second, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+#ifdef PARALLEL_BACKEND_TBB
+            if (!policy.mSerial)
+            {
+                tbb::parallel_invoke(first, second);
+                return;
+            }
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+            ThreadPool &pool = ThreadPool::Instance();
+            if (!policy.mSerial && pool.GetWorkerCount() > 0)
+            {
+                // second goes to the queue for stealing, the caller runs first and then helps until second is done;
+                // an exception of either one is rethrown only after both have finished
+                std::atomic<size_t> pending(1);
+                std::exception_ptr secondError;
+                pool.Submit([&]()
+                            {
+                    try
+                    {
+                        second();
                     }
+                    catch (...)
+                    {
+                        secondError = std::current_exception();
+                    }
+                    pending.fetch_sub(1, std::memory_order_release); });
+                std::exception_ptr firstError;
+                try
+                {
+                    first();
                 }
-            );
-#else
-            SafeParallelFor<IntType>(0, static_cast<IntType>(indices.size()),
-                [&](IntType i) { func(indices[i]); });
+                catch (...)
+                {
+                    firstError = std::current_exception();
+                }
+                pool.Wait(pending);
+                if (firstError)
+                    std::rethrow_exception(firstError);
+                if (secondError)
+                    std::rethrow_exception(secondError);
+                return;
+            }
 #endif
+            first();
+            second();
         }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void ParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, const ParallelFunction2<IntType>&func)
-        {
-#ifdef USE_TBB
-            tbb::parallel_for(
-                tbb::blocked_range2d<IntType>(
-                    begin1, end1, DEFAULT_GRAIN_SIZE,
-                    begin0, end0, DEFAULT_GRAIN_SIZE
-                ),
-                [&](const tbb::blocked_range2d<IntType>& range) {
-                    for (IntType i = range.rows().begin(); i != range.rows().end(); ++i) {
-                        for (IntType j = range.cols().begin(); j != range.cols().end(); ++j) {
-                            func(i, j);
-                        }
-                    }
+        /// <summary>
+        /// Stable partition of data[0, count): elements with predicate(element) == true move to the front, both groups
+        /// keep their relative order. Returns the number of true elements. Like ParallelExclusiveScan it works in fixed
+        /// size blocks (flag and count per block, a serial scan over the block counts, then a scatter through a scratch
+        /// copy), so the result does not depend on the thread count. Small inputs should use std::partition instead.
+        /// </summary>
+        template <typename IntType, typename ValueType, typename Predicate, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        IntType ParallelPartition(ValueType *data, IntType count, const Predicate &predicate, const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+            const IntType blockSize = 4096;
+            const IntType blockCount = (count + blockSize - 1) / blockSize;
+            std::vector<uint8_t> flags(count);
+            std::vector<IntType> trueOffsets(blockCount, 0);
+            ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                 {
+                IntType trueCount = 0;
+                const IntType end = std::min(count, (block + 1) * blockSize);
+                for (IntType i = block * blockSize; i < end; i++)
+                {
+                    flags[i] = predicate(data[i]) ? 1 : 0;
+                    trueCount += flags[i];
                 }
-            );
-#else
-            for (IntType i = begin1; i < end1; i++) {
-                for (IntType j = begin0; j < end0; j++) {
-                    func(i, j);
+                trueOffsets[block] = trueCount; },
+                                 policy);
+            IntType trueTotal = 0;
+            for (IntType block = 0; block < blockCount; block++)
+            {
+                const IntType trueCount = trueOffsets[block];
+                trueOffsets[block] = trueTotal;
+                trueTotal += trueCount;
             }
-        }
-#endif
+            std::vector<ValueType, HAlignedAllocator<ValueType>> scratch(count);
+            ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                 {
+                const IntType begin = block * blockSize;
+                const IntType end = std::min(count, begin + blockSize);
+                IntType trueSlot = trueOffsets[block];
+                // false elements before this block = elements before it minus the true ones
+                IntType falseSlot = trueTotal + begin - trueOffsets[block];
+                for (IntType i = begin; i < end; i++)
+                    scratch[flags[i] ? trueSlot++ : falseSlot++] = data[i]; },
+                                 policy);
+            ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                 {
+                const IntType begin = block * blockSize;
+                std::copy(scratch.begin() + begin, scratch.begin() + std::min(count, begin + blockSize), data + begin); },
+                                 policy);
+            return trueTotal;
         }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void SafeParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, const ParallelFunction2<IntType>&func)
-        {
-#ifdef USE_TBB
-            tbb::parallel_for(
-                tbb::blocked_range2d<IntType>(
-                    begin1, end1, DEFAULT_GRAIN_SIZE,
-                    begin0, end0, DEFAULT_GRAIN_SIZE
-                ),
-                [&](const tbb::blocked_range2d<IntType>& range) {
-                    for (IntType i = range.rows().begin(); i != range.rows().end(); ++i) {
-                        for (IntType j = range.cols().begin(); j != range.cols().end(); ++j) {
-                            tbb::mutex mutex;
-                            tbb::mutex::scoped_lock lock(mutex);
-                            func(i, j);
-                        }
+        /// <summary>
+        /// Stable LSD radix sort of keys[0, count) by their low keyBits bits, values[i] moves along with keys[i].
+        /// Every 8 bit pass counts the digits per fixed size block, scans all block histograms serially and then scatters
+        /// each block stably through scratch arrays, so the result does not depend on the thread count.
+        /// </summary>
+        template <typename IntType, typename KeyType, typename ValueType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
+        void ParallelRadixSort(KeyType *keys, ValueType *values, IntType count, const uint32_t keyBits = sizeof(KeyType) * 8,
+                               const ExecutionPolicy &policy = ExecutionPolicy())
+        {
+            static_assert(std::is_unsigned<KeyType>::value, "ParallelRadixSort sorts unsigned integer keys");
+            const IntType blockSize = 16384;
+            const IntType blockCount = (count + blockSize - 1) / blockSize;
+            std::vector<KeyType> keyScratch(count);
+            std::vector<ValueType, HAlignedAllocator<ValueType>> valueScratch(count);
+            // offsets[block * 256 + digit]: first the digit counts of the block, then where the block writes that digit
+            std::vector<IntType> offsets(size_t(blockCount) * 256);
+            KeyType *keysIn = keys, *keysOut = keyScratch.data();
+            ValueType *valuesIn = values, *valuesOut = valueScratch.data();
+            for (uint32_t shift = 0; shift < keyBits; shift += 8)
+            {
+                ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                     {
+                    IntType *histogram = offsets.data() + size_t(block) * 256;
+                    std::fill(histogram, histogram + 256, IntType(0));
+                    const IntType end = std::min(count, (block + 1) * blockSize);
+                    for (IntType i = block * blockSize; i < end; i++)
+                        histogram[(keysIn[i] >> shift) & 0xFF]++; },
+                                     policy);
+                IntType total = 0;
+                for (uint32_t digit = 0; digit < 256; digit++)
+                {
+                    for (IntType block = 0; block < blockCount; block++)
+                    {
+                        IntType &offset = offsets[size_t(block) * 256 + digit];
+                        const IntType digitCount = offset;
+                        offset = total;
+                        total += digitCount;
                     }
-                        }
-            );
+                }
+                ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                     {
+                    IntType *offset = offsets.data() + size_t(block) * 256;
+                    const IntType end = std::min(count, (block + 1) * blockSize);
+                    for (IntType i = block * blockSize; i < end; i++)
+                    {
+                        const IntType slot = offset[(keysIn[i] >> shift) & 0xFF]++;
+                        keysOut[slot] = keysIn[i];
+                        valuesOut[slot] = valuesIn[i];
+                    } },
+                                     policy);
+                std::swap(keysIn, keysOut);
+                std::swap(valuesIn, valuesOut);
+            }
+            if (keysIn != keys)
+            {
+                ParallelFor<IntType>(0, blockCount, [&](IntType block)
+                                     {
+                    const IntType begin = block * blockSize;
+                    const IntType end = std::min(count, begin + blockSize);
+                    std::copy(keysIn + begin, keysIn + end, keys + begin);
+                    std::copy(valuesIn + begin, valuesIn + end, values + begin); },
+                                     policy);
+            }
+        }
+
+        /// <summary>
+        /// One lazily created value per worker thread. Local() is safe to call from any loop body;
+        /// Combine/ForEach walk all values once the parallel work has finished.
+        /// With the thread pool, threads outside the pool (the callers of concurrent loops, which also run each
+        /// other's stolen tasks while they wait) get their own value each, kept in a map under a mutex; a per thread
+        /// cache of the last lookup keeps that off the fast path.
+        /// </summary>
+        template <typename ValueType>
+        class ThreadLocal
+        {
+        public:
+            ThreadLocal(const ValueType &exemplar = ValueType())
+#ifdef PARALLEL_BACKEND_TBB
+                : m_Values(exemplar)
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+                : m_Exemplar(exemplar), m_Values(ThreadPool::Instance().GetWorkerCount()), m_Id(_NextId())
 #else
-            ParallelFor(begin0, end0, begin1, end1, func);
+                : m_Exemplar(exemplar), m_Value(exemplar)
 #endif
-        }
+            {
+            }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void ParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, IntType begin2, IntType end2, const ParallelFunction3<IntType>&func)
-        {
-#ifdef USE_TBB
-            tbb::parallel_for(
-                tbb::blocked_range3d<IntType>(
-                    begin2, end2, DEFAULT_GRAIN_SIZE,
-                    begin1, end1, DEFAULT_GRAIN_SIZE,
-                    begin0, end0, DEFAULT_GRAIN_SIZE
-                ),
-                [&](const tbb::blocked_range3d<IntType>& range) {
-                    for (IntType i = range.pages().begin(); i != range.pages().end(); ++i) {
-                        for (IntType j = range.rows().begin(); j != range.rows().end(); ++j) {
-                            for (IntType k = range.cols().begin(); k != range.cols().end(); ++k) {
-                                func(i, j, k);
-                            }
-                        }
-                    }
+            ValueType &Local()
+            {
+#ifdef PARALLEL_BACKEND_TBB
+                return m_Values.local();
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+                const int32_t worker = ThreadPool::Instance().GetCurrentWorkerIndex();
+                if (worker >= 0)
+                {
+                    std::unique_ptr<ValueType> &value = m_Values[worker];
+                    if (!value)
+                        value = std::make_unique<ValueType>(m_Exemplar);
+                    return *value;
                 }
-            );
-#else
-            for (IntType i = begin2; i < end2; i++) {
-                for (IntType j = begin1; j < end1; j++) {
-                    for (IntType k = begin0; k < end0; k++) {
-                        func(i, j, k);
-                    }
+                ExternalCache &cache = _CurrentExternal();
+                if (cache.mId != m_Id)
+                {
+                    std::lock_guard<std::mutex> lock(m_ExternalMutex);
+                    std::unique_ptr<ValueType> &value = m_External[std::this_thread::get_id()];
+                    if (!value)
+                        value = std::make_unique<ValueType>(m_Exemplar);
+                    cache.mId = m_Id;
+                    cache.mValue = value.get();
                 }
+                return *static_cast<ValueType *>(cache.mValue);
+#else
+                return m_Value;
+#endif
+            }
+
+            template <typename Function>
+            void ForEach(const Function &func) const
+            {
+#ifdef PARALLEL_BACKEND_TBB
+                for (const ValueType &value : m_Values)
+                    func(value);
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+                for (const std::unique_ptr<ValueType> &value : m_Values)
+                    if (value)
+                        func(*value);
+                for (const auto &value : m_External)
+                    func(*value.second);
+#else
+                func(m_Value);
+#endif
             }
+
+            template <typename CombineFunction>
+            ValueType Combine(const CombineFunction &combine)
+            {
+#ifdef PARALLEL_BACKEND_TBB
+                return m_Values.combine(combine);
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+                // like enumerable_thread_specific::combine, an untouched ThreadLocal yields the exemplar
+                bool first = true;
+                ValueType combined = m_Exemplar;
+                ForEach([&](const ValueType &value)
+                        {
+                    combined = first ? value : combine(combined, value);
+                    first = false; });
+                return combined;
+#else
+                return m_Value;
 #endif
-        }
+            }
 
-        template <typename IntType, typename = std::enable_if_t<std::is_integral<IntType>::value>>
-        void SafeParallelFor(IntType begin0, IntType end0, IntType begin1, IntType end1, IntType begin2, IntType end2, const ParallelFunction3<IntType>&func)
-        {
-#ifdef USE_TBB
-            tbb::parallel_for(
-                tbb::blocked_range3d<IntType>(
-                    begin2, end2, DEFAULT_GRAIN_SIZE,
-                    begin1, end1, DEFAULT_GRAIN_SIZE,
-                    begin0, end0, DEFAULT_GRAIN_SIZE
-                ),
-                [&](const tbb::blocked_range3d<IntType>& range) {
-                    for (IntType i = range.pages().begin(); i != range.pages().end(); ++i) {
-                        for (IntType j = range.rows().begin(); j != range.rows().end(); ++j) {
-                            for (IntType k = range.cols().begin(); k != range.cols().end(); ++k) {
-                                tbb::mutex mutex;
-                                tbb::mutex::scoped_lock lock(mutex);
-                                func(i, j, k);
-                            }
-                        }
-                    }
-                        }
-            );
+            void Clear()
+            {
+#ifdef PARALLEL_BACKEND_TBB
+                m_Values.clear();
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+                for (std::unique_ptr<ValueType> &value : m_Values)
+                    value.reset();
+                m_External.clear();
+                // a fresh id invalidates the cached pointers of the external threads
+                m_Id = _NextId();
 #else
-            ParallelFor(begin0, end0, begin1, end1, begin2, end2, func);
+                m_Value = m_Exemplar;
 #endif
-        }
+            }
+
+        private:
+#ifdef PARALLEL_BACKEND_TBB
+            tbb::enumerable_thread_specific<ValueType> m_Values;
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+            struct ExternalCache
+            {
+                uint64_t mId = 0;
+                void *mValue = nullptr;
+            };
+
+            static uint64_t _NextId()
+            {
+                // ids are never reused, so a cache entry cannot match a later ThreadLocal at the same address
+                static std::atomic<uint64_t> next(1);
+                return next.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            static ExternalCache &_CurrentExternal()
+            {
+                static thread_local ExternalCache cache;
+                return cache;
+            }
+
+            ValueType m_Exemplar;
+            // one value per worker, indexed by GetCurrentWorkerIndex()
+            std::vector<std::unique_ptr<ValueType>> m_Values;
+            std::mutex m_ExternalMutex;
+            std::map<std::thread::id, std::unique_ptr<ValueType>> m_External;
+            uint64_t m_Id;
+#else
+            ValueType m_Exemplar;
+            ValueType m_Value;
+#endif
+        };
 
     } // namespace Parallel
 
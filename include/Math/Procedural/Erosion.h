@@ -38,7 +38,7 @@ namespace MathLib
 				m_BrushPositions.ReSize(resolution[0], resolution[1]);
 				m_BrushWeights.ReSize(resolution[0], resolution[1]);
 
-				Parallel::ParallelFunction2<int32_t> fn = [&](int32_t x, int32_t y)
+				auto fn = [&](int32_t x, int32_t y)
 					{
 						std::vector<int32_t> xOffset(erosionRadius * erosionRadius * 4);
 						std::vector<int32_t> yOffset(erosionRadius * erosionRadius * 4);
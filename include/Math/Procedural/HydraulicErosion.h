@@ -34,7 +34,7 @@ namespace MathLib
 			void Erode(const uint32_t numIterations) override
 			{
 				const HVector2I& resolution = m_Resolution;
-				Parallel::ParallelFunction<uint32_t> fn = [&](uint32_t i)
+				auto fn = [&](uint32_t i)
 					{				
 						HVector2 particlePosition = m_RandomGenerator->GetVector2(HVector2(0,0), HVector2(resolution[0]-1, resolution[1]-1));
 						HVector2 velocity;
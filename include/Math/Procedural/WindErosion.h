@@ -29,7 +29,7 @@ namespace MathLib
 			void Erode(const uint32_t numIterations) override
 			{
 				const HVector2I& resolution = m_Resolution;
-				Parallel::ParallelFunction<uint32_t> fn = [&](uint32_t i)
+				auto fn = [&](uint32_t i)
 					{
 						HVector3 particlePosition(m_RandomGenerator->GetReal(0, resolution[0] - 1), 1.5, m_RandomGenerator->GetReal(0, resolution[1] - 1));
 						HVector3 velocity;
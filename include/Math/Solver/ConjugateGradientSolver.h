@@ -3,21 +3,39 @@
 #include <Math/Solver/SolverCommon.h>
 #include <Math/Solver/DiagonalPreconditioner.h>
 #include <memory>
+#include <type_traits>
 namespace MathLib
 {
     namespace SolverTool
     {
+        /// <summary>
+        /// Preconditioned conjugate gradient on a symmetric positive definite operator: HMatrixX, HSparseMatrixRowMajor,
+        /// HSparseMatrixColMajor or a matrix-free operator such as LinearOperator, see OperatorTraits. The operator is
+        /// referenced, not copied. Products, preconditioner and vector updates run in SOLVER_BLOCK_SIZE blocks under the
+        /// execution policy, the dot products are reduced in block order so the iteration count does not depend on the
+        /// thread count. Solve() iterates from the given x until |b - Ax| <= tolerance * |b| and returns -1 when the
+        /// iteration limit is reached first. The preconditioner is kept across solves: the one given to
+        /// SetPreconditioner(), or a Jacobi preconditioner built by the first Solve() when none was given.
+        /// </summary>
+        template <class Operator = HMatrixX>
         class ConjugateGradientSolver : public LinearSolverBase
         {
         public:
-            ConjugateGradientSolver(HMatrixX &matrix)
-                : m_Matrix(matrix),
-                  m_MaxIterations(std::max(matrix.rows(), matrix.cols())),
+            ConjugateGradientSolver(const Operator &op, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+                : m_Operator(op),
+                  m_MaxIterations(OperatorTraits<Operator>::Rows(op)),
                   m_Iterations(0),
-                  m_Tolerance(1e-11),
+                  m_Tolerance(HReal(1e-6)),
+                  m_Residual(0),
+                  m_Policy(policy),
                   m_Preconditioner(nullptr)
             {
             }
+            // the operator is only referenced: a temporary, or another matrix type that would convert into one, would
+            // leave m_Operator dangling once the constructor returns
+            ConjugateGradientSolver(const Operator &&, const Parallel::ExecutionPolicy & = Parallel::ExecutionPolicy()) = delete;
+            template <class Other, typename = std::enable_if_t<!std::is_base_of<Operator, std::decay_t<Other>>::value>>
+            ConjugateGradientSolver(const Other &, const Parallel::ExecutionPolicy & = Parallel::ExecutionPolicy()) = delete;
             ~ConjugateGradientSolver()
             {
                 m_Preconditioner.reset();
@@ -25,59 +43,93 @@ namespace MathLib
 
             void SetMaxIterations(uint32_t maxIterations) { m_MaxIterations = maxIterations; }
             void SetTolerance(HReal tolerance) { m_Tolerance = tolerance; }
-            void SetPreconditioner(PreconditionerTool::Preconditioner *preconditioner) { m_Preconditioner = std::make_unique<PreconditionerTool::Preconditioner>(preconditioner); }
+            /// @brief takes ownership of preconditioner; nullptr makes the next Solve() build the default Jacobi one, as
+            /// needed when the values of the operator change
+            void SetPreconditioner(PreconditionerTool::Preconditioner *preconditioner) { m_Preconditioner.reset(preconditioner); }
+            void SetExecutionPolicy(const Parallel::ExecutionPolicy &policy) { m_Policy = policy; }
             uint32_t GetIterations() const { return m_Iterations; }
             uint32_t GetMaxIterations() const { return m_MaxIterations; }
             HReal GetTolerance() const { return m_Tolerance; }
+            /// @brief |b - Ax| / |b| when the last Solve() stopped
+            HReal GetResidual() const { return m_Residual; }
 
             int Solve(HVectorX &x, const HVectorX &b) override
             {
+                typedef OperatorTraits<Operator> Traits;
+                const Eigen::Index rows = Traits::Rows(m_Operator);
+                assert(b.size() == rows);
                 m_Iterations = 0;
-                m_Preconditioner = std::make_unique<PreconditionerTool::DiagonalPreconditioner>(m_Matrix);
+                m_Residual = 0;
+                if (x.size() != rows)
+                    x.setZero(rows);
+                if (!m_Preconditioner)
+                    m_Preconditioner = std::make_unique<PreconditionerTool::DiagonalPreconditioner>(m_Operator, m_Policy);
 
-                HVectorX r = b - m_Matrix * x;
-
-                HVectorX z(m_Matrix.cols());
-                m_Preconditioner->Apply(z, r);
+                const HReal bNorm = std::sqrt(_Private::Dot(b, b, m_Partials, m_Policy));
+                if (bNorm == 0)
+                {
+                    x.setZero();
+                    return 0;
+                }
+                Traits::Multiply(m_Operator, x, m_W, m_Policy);
+                m_R.resize(rows);
+                _Private::ForBlocks(rows, [&](Eigen::Index begin, Eigen::Index size)
+                                    { m_R.segment(begin, size) = b.segment(begin, size) - m_W.segment(begin, size); }, m_Policy);
 
-                HReal rkDotzk = r.dot(z);
-                HVectorX p = z;
-                HVectorX w(m_Matrix.rows());
+                m_Preconditioner->Apply(m_Z, m_R);
+                HReal rkDotzk = _Private::Dot(m_R, m_Z, m_Partials, m_Policy);
+                m_P = m_Z;
+                const HReal threshold = m_Tolerance * bNorm;
+                HReal rNorm = std::sqrt(_Private::Dot(m_R, m_R, m_Partials, m_Policy));
 
-                while (r.norm() >= m_Tolerance && m_Iterations < m_MaxIterations) {
-                    w = m_Matrix * p;
+                while (rNorm > threshold && m_Iterations < m_MaxIterations)
+                {
+                    Traits::Multiply(m_Operator, m_P, m_W, m_Policy);
 
-                    HReal alpha = rkDotzk / p.dot(w);
-                    x += alpha * p;
-                    r -= alpha * w;
+                    const HReal alpha = rkDotzk / _Private::Dot(m_P, m_W, m_Partials, m_Policy);
+                    // x and r in one pass, which also yields |r|^2
+                    rNorm = std::sqrt(_Private::SumBlocks(rows, [&](Eigen::Index begin, Eigen::Index size)
+                                                          {
+                        x.segment(begin, size) += alpha * m_P.segment(begin, size);
+                        m_R.segment(begin, size) -= alpha * m_W.segment(begin, size);
+                        return m_R.segment(begin, size).squaredNorm(); }, m_Partials, m_Policy));
+                    m_Iterations++;
+                    if (rNorm <= threshold)
+                        break;
 
-                    m_Preconditioner->Apply(z, r);
+                    m_Preconditioner->Apply(m_Z, m_R);
 
-                    HReal rkDotzkNew = r.dot(z);
-                    HReal beta = rkDotzkNew / rkDotzk;
-                    p = z + beta * p;
+                    const HReal rkDotzkNew = _Private::Dot(m_R, m_Z, m_Partials, m_Policy);
+                    const HReal beta = rkDotzkNew / rkDotzk;
+                    _Private::ForBlocks(rows, [&](Eigen::Index begin, Eigen::Index size)
+                                        { m_P.segment(begin, size) = m_Z.segment(begin, size) + beta * m_P.segment(begin, size); }, m_Policy);
                     rkDotzk = rkDotzkNew;
-                    m_Iterations++;
                 }
-
-                m_Preconditioner.reset();
+                m_Residual = rNorm / bNorm;
 #ifdef _DEBUG
-                HVectorX residual = m_Matrix * x - b;
-                HReal infNorm = residual.cwiseAbs().maxCoeff();
+                Traits::Multiply(m_Operator, x, m_W, m_Policy);
+                HReal infNorm = (m_W - b).cwiseAbs().maxCoeff();
                 if (infNorm > 1.0e-6) {
                     std::cout << "ConjugateGradientSolver::Solve() - residual inf norm: " << infNorm << std::endl;
-                    return -1;
                 }
 #endif
-                return 0;
+                return rNorm <= threshold ? 0 : -1;
             }
 
         private:
+            const Operator &m_Operator;
             uint32_t m_MaxIterations;
             uint32_t m_Iterations;
             HReal m_Tolerance;
-            HMatrixX &m_Matrix;
+            HReal m_Residual;
+            Parallel::ExecutionPolicy m_Policy;
             std::unique_ptr<PreconditionerTool::Preconditioner> m_Preconditioner;
+            // work vectors, kept between solves
+            HVectorX m_R;
+            HVectorX m_Z;
+            HVectorX m_P;
+            HVectorX m_W;
+            std::vector<HReal> m_Partials;
         };
     } // namespace SolverTool
-} // namespace MathLib
\ No newline at end of file
+} // namespace MathLib
@@ -9,11 +9,15 @@ namespace MathLib
         class DiagonalPreconditioner : virtual public Preconditioner
         {
         public:
-            DiagonalPreconditioner(HMatrixX &matrix)
+            /// @brief Jacobi preconditioner of any operator SolverTool::OperatorTraits knows
+            template <class Operator>
+            DiagonalPreconditioner(const Operator &op, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+                : m_Policy(policy)
             {
-                for (int i = 0; i < matrix.rows(); i++)
+                SolverTool::OperatorTraits<Operator>::Diagonal(op, m_Diagonals);
+                for (int i = 0; i < m_Diagonals.size(); i++)
                 {
-                    HReal value = matrix.coeff(i, i);
+                    HReal value = m_Diagonals(i);
                     if (value == 0.0f)
                         m_Diagonals(i) = 1;
                     else
@@ -23,14 +27,15 @@ namespace MathLib
 
             void Apply(HVectorX &w, const HVectorX &v) override
             {
-                assert(w.size() == m_Diagonals.size());
                 assert(v.size() == m_Diagonals.size());
-                for (int i = 0; i < w.size(); i++)
-                    w(i) = m_Diagonals(i) * v(i);
+                w.resize(m_Diagonals.size());
+                SolverTool::_Private::ForBlocks(w.size(), [&](Eigen::Index begin, Eigen::Index size)
+                                                { w.segment(begin, size) = m_Diagonals.segment(begin, size).cwiseProduct(v.segment(begin, size)); }, m_Policy);
             }
 
         private:
             HVectorX m_Diagonals;
+            Parallel::ExecutionPolicy m_Policy;
         };
     } // namespace PreconditionerTool
 } // namespace MathLib
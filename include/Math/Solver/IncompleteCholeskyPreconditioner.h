@@ -0,0 +1,123 @@
+#pragma once
+#include <Math/Math.h>
+#include <Math/Solver/SolverCommon.h>
+
+namespace MathLib
+{
+    namespace PreconditionerTool
+    {
+        // A pivot below this fraction of the original diagonal counts as a breakdown of the incomplete factorization.
+        const HReal CHOLESKY_PIVOT_THRESHOLD = HReal(0.25);
+
+        /// <summary>
+        /// Incomplete Cholesky preconditioner L L^T ~ A of a sparse symmetric positive definite matrix, L keeping the
+        /// sparsity of the lower triangle of A (zero fill). modification = 0 gives IC(0); 1 gives MIC(0), which adds the
+        /// dropped fill to the diagonal so that L L^T keeps the row sums of A, typically 0.97 for grid Laplacians. Pivots
+        /// below CHOLESKY_PIVOT_THRESHOLD of the original diagonal are replaced by that diagonal, which keeps the factor
+        /// defined for MIC(0) and singular (pure Neumann) problems. The constructor factorizes once, Factorize() redoes
+        /// it when the values of the matrix change. The two triangular solves of Apply() are serial.
+        /// </summary>
+        class IncompleteCholeskyPreconditioner : virtual public Preconditioner
+        {
+        public:
+            template <class Matrix>
+            IncompleteCholeskyPreconditioner(const Matrix &matrix, const HReal modification = 0)
+                : m_Modification(modification)
+            {
+                Factorize(matrix);
+            }
+
+            template <class Matrix>
+            void Factorize(const Matrix &matrix)
+            {
+                assert(matrix.rows() == matrix.cols());
+                m_Factor = matrix.template triangularView<Eigen::Lower>();
+                m_Factor.makeCompressed();
+                const int size = static_cast<int>(m_Factor.cols());
+                const int *outer = m_Factor.outerIndexPtr();
+                const int *rows = m_Factor.innerIndexPtr();
+                HReal *values = m_Factor.valuePtr();
+                // columns are sorted, so each one starts with its diagonal
+                HVectorX original(size);
+                for (int k = 0; k < size; k++)
+                {
+                    assert(outer[k] < outer[k + 1] && rows[outer[k]] == k);
+                    original[k] = values[outer[k]];
+                }
+
+                for (int k = 0; k < size; k++)
+                {
+                    const int end = outer[k + 1];
+                    HReal pivot = values[outer[k]];
+                    if (!(pivot > CHOLESKY_PIVOT_THRESHOLD * original[k]))
+                        pivot = original[k];
+                    pivot = std::sqrt(pivot);
+                    values[outer[k]] = pivot;
+                    for (int p = outer[k] + 1; p < end; p++)
+                        values[p] /= pivot;
+
+                    // subtract L(:, k) L(j, k) from every later column j the column k reaches
+                    for (int p = outer[k] + 1; p < end; p++)
+                    {
+                        const int j = rows[p];
+                        const HReal ljk = values[p];
+                        int q = outer[j];
+                        const int columnEnd = outer[j + 1];
+                        for (int r = p; r < end; r++)
+                        {
+                            const int i = rows[r];
+                            const HReal update = values[r] * ljk;
+                            while (q < columnEnd && rows[q] < i)
+                                q++;
+                            if (q < columnEnd && rows[q] == i)
+                                values[q] -= update;
+                            else if (m_Modification != 0)
+                            {
+                                // fill outside the pattern moves onto both diagonals
+                                values[outer[i]] -= m_Modification * update;
+                                values[outer[j]] -= m_Modification * update;
+                            }
+                        }
+                    }
+                }
+                m_InversePivots.resize(size);
+                for (int k = 0; k < size; k++)
+                    m_InversePivots[k] = HReal(1) / values[outer[k]];
+            }
+
+            void Apply(HVectorX &w, const HVectorX &v) override
+            {
+                assert(v.size() == m_Factor.cols());
+                const int size = static_cast<int>(m_Factor.cols());
+                const int *outer = m_Factor.outerIndexPtr();
+                const int *rows = m_Factor.innerIndexPtr();
+                const HReal *values = m_Factor.valuePtr();
+                w = v;
+                // L y = v, column by column
+                for (int k = 0; k < size; k++)
+                {
+                    const HReal yk = w[k] * m_InversePivots[k];
+                    w[k] = yk;
+                    for (int p = outer[k] + 1; p < outer[k + 1]; p++)
+                        w[rows[p]] -= values[p] * yk;
+                }
+                // L^T w = y, a column of L is a row of L^T
+                for (int k = size - 1; k >= 0; k--)
+                {
+                    HReal sum = w[k];
+                    for (int p = outer[k] + 1; p < outer[k + 1]; p++)
+                        sum -= values[p] * w[rows[p]];
+                    w[k] = sum * m_InversePivots[k];
+                }
+            }
+
+            const HSparseMatrixColMajor &GetFactor() const { return m_Factor; }
+
+        private:
+            HSparseMatrixColMajor m_Factor;
+            // the solves multiply instead of dividing by the diagonal of L
+            HVectorX m_InversePivots;
+            HReal m_Modification;
+        };
+    } // namespace PreconditionerTool
+} // namespace MathLib
@@ -0,0 +1,178 @@
+#pragma once
+#include <Math/Math.h>
+#include <Math/Solver/SolverCommon.h>
+#include <Math/Solver/StencilOperator.h>
+#include <vector>
+
+namespace MathLib
+{
+    namespace PreconditionerTool
+    {
+        struct MultigridSettings
+        {
+            // weighted Jacobi sweeps before and after the coarse correction, the same count keeps the cycle symmetric
+            uint32_t mSmoothingSteps = 2;
+            HReal mJacobiWeight = HReal(2) / HReal(3);
+            // the piecewise constant correction undershoots smooth errors, scaling it up keeps the iteration count
+            // nearly independent of the grid size; values up to 2 keep the cycle positive definite
+            HReal mCorrectionWeight = HReal(1.8);
+            // levels are halved until at most this many cells remain, which are then solved directly
+            uint32_t mCoarsestSize = 512;
+        };
+
+        /// <summary>
+        /// One geometric multigrid V-cycle on a grid Laplacian (SolverTool::LaplacianOperator) as the preconditioner of
+        /// ConjugateGradientSolver. Each level halves the extents; a coarse cell restricts to the sum of its fine cells
+        /// and adds mCorrectionWeight times its correction back to each of them, the coarse stencil is scaled so that it
+        /// equals P^T A P for even extents (shift * 2^Dim, scale * 2^(Dim-1)). The levels are matrix-free and smoothed
+        /// by weighted Jacobi, the coarsest one is factorized densely. The hierarchy is built once by the constructor;
+        /// the iteration count then grows only slowly with the grid size, unlike Jacobi or incomplete Cholesky.
+        /// </summary>
+        template <int Dim>
+        class MultigridPreconditioner : virtual public Preconditioner
+        {
+        public:
+            MultigridPreconditioner(const SolverTool::LaplacianOperator<Dim> &op, const MultigridSettings &settings = MultigridSettings(),
+                                    const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+                : m_Settings(settings), m_Policy(policy)
+            {
+                m_Levels.emplace_back(op);
+                while (m_Levels.back().mOperator.Rows() > m_Settings.mCoarsestSize)
+                {
+                    const SolverTool::LaplacianOperator<Dim> &fine = m_Levels.back().mOperator;
+                    std::array<uint32_t, Dim> extents = fine.GetExtents();
+                    bool coarsened = false;
+                    for (uint32_t &extent : extents)
+                    {
+                        coarsened |= extent > 1;
+                        extent = (extent + 1) / 2;
+                    }
+                    if (!coarsened)
+                        break;
+                    SolverTool::StencilSettings coarse = fine.GetSettings();
+                    coarse.mShift *= HReal(1 << Dim);
+                    coarse.mScale *= HReal(1 << (Dim - 1));
+                    m_Levels.emplace_back(SolverTool::LaplacianOperator<Dim>(extents, coarse));
+                }
+                for (Level &level : m_Levels)
+                {
+                    level.mOperator.Diagonal(level.mInverseDiagonal);
+                    level.mInverseDiagonal = level.mInverseDiagonal.cwiseInverse();
+                }
+
+                // the coarsest operator column by column
+                const SolverTool::LaplacianOperator<Dim> &coarsest = m_Levels.back().mOperator;
+                const Eigen::Index rows = coarsest.Rows();
+                HMatrixX dense(rows, rows);
+                HVectorX unit = HVectorX::Zero(rows), column;
+                for (Eigen::Index i = 0; i < rows; i++)
+                {
+                    unit[i] = 1;
+                    coarsest.Multiply(unit, column, Parallel::ExecutionPolicy::Serial());
+                    dense.col(i) = column;
+                    unit[i] = 0;
+                }
+                m_CoarseSolver.compute(dense);
+            }
+
+            void Apply(HVectorX &w, const HVectorX &v) override
+            {
+                Level &finest = m_Levels.front();
+                assert(v.size() == finest.mOperator.Rows());
+                finest.mB = v;
+                _Cycle(0);
+                w = finest.mX;
+            }
+
+            uint32_t GetLevelCount() const { return static_cast<uint32_t>(m_Levels.size()); }
+
+        private:
+            struct Level
+            {
+                Level(const SolverTool::LaplacianOperator<Dim> &op) : mOperator(op) {}
+
+                SolverTool::LaplacianOperator<Dim> mOperator;
+                HVectorX mInverseDiagonal;
+                HVectorX mX;
+                HVectorX mB;
+                HVectorX mR;
+            };
+
+            void _Cycle(const size_t index)
+            {
+                Level &level = m_Levels[index];
+                const Eigen::Index rows = level.mOperator.Rows();
+                if (index + 1 == m_Levels.size())
+                {
+                    level.mX = m_CoarseSolver.solve(level.mB);
+                    return;
+                }
+                const HReal weight = m_Settings.mJacobiWeight;
+                // the first sweep from x = 0 needs no product
+                level.mX.resize(rows);
+                level.mR.resize(rows);
+                SolverTool::_Private::ForBlocks(rows, [&](Eigen::Index begin, Eigen::Index size)
+                                                { level.mX.segment(begin, size) = weight * level.mInverseDiagonal.segment(begin, size).cwiseProduct(level.mB.segment(begin, size)); }, m_Policy);
+                for (uint32_t step = 1; step < m_Settings.mSmoothingSteps; step++)
+                    _Smooth(level);
+
+                // restrict r = b - Ax, solve the coarse level from zero and add its correction
+                Level &coarse = m_Levels[index + 1];
+                level.mOperator.Apply(level.mX.data(), level.mR.data(), m_Policy);
+                SolverTool::_Private::ForBlocks(rows, [&](Eigen::Index begin, Eigen::Index size)
+                                                { level.mR.segment(begin, size) = level.mB.segment(begin, size) - level.mR.segment(begin, size); }, m_Policy);
+                coarse.mB.resize(coarse.mOperator.Rows());
+                _Transfer(level, coarse, [](HReal &fine, HReal &coarseValue)
+                          { coarseValue += fine; }, level.mR.data(), coarse.mB.data(), true);
+                _Cycle(index + 1);
+                const HReal correction = m_Settings.mCorrectionWeight;
+                _Transfer(level, coarse, [correction](HReal &fine, HReal &coarseValue)
+                          { fine += correction * coarseValue; }, level.mX.data(), coarse.mX.data(), false);
+
+                for (uint32_t step = 0; step < m_Settings.mSmoothingSteps; step++)
+                    _Smooth(level);
+            }
+
+            /// @brief x += weight * D^-1 (b - Ax)
+            void _Smooth(Level &level)
+            {
+                const Eigen::Index rows = level.mOperator.Rows();
+                const HReal weight = m_Settings.mJacobiWeight;
+                level.mOperator.Apply(level.mX.data(), level.mR.data(), m_Policy);
+                SolverTool::_Private::ForBlocks(rows, [&](Eigen::Index begin, Eigen::Index size)
+                                                { level.mX.segment(begin, size) += weight * level.mInverseDiagonal.segment(begin, size).cwiseProduct(level.mB.segment(begin, size) - level.mR.segment(begin, size)); }, m_Policy);
+            }
+
+            /// @brief function(fine cell, its coarse cell) for every fine cell, in parallel over the coarse grid lines
+            template <class Function>
+            void _Transfer(const Level &fineLevel, const Level &coarseLevel, const Function &function, HReal *fine, HReal *coarse, const bool clearCoarse)
+            {
+                const std::array<uint32_t, Dim> &fineExtents = fineLevel.mOperator.GetExtents();
+                const std::array<uint32_t, Dim> &coarseExtents = coarseLevel.mOperator.GetExtents();
+                const uint32_t planes = Dim == 3 ? coarseExtents[Dim - 1] : 1;
+                Parallel::ParallelFor<uint32_t>(0, coarseExtents[1] * planes, [&](uint32_t line)
+                                                {
+                    const uint32_t row = line % coarseExtents[1], plane = line / coarseExtents[1];
+                    HReal *coarseLine = coarse + size_t(line) * coarseExtents[0];
+                    if (clearCoarse)
+                        std::fill(coarseLine, coarseLine + coarseExtents[0], HReal(0));
+                    for (uint32_t fineRow = 2 * row; fineRow < std::min(2 * row + 2, fineExtents[1]); fineRow++)
+                        for (uint32_t finePlane = 2 * plane; finePlane < std::min(2 * plane + 2, Dim == 3 ? fineExtents[Dim - 1] : 1u); finePlane++)
+                        {
+                            HReal *fineLine = fine + (size_t(finePlane) * fineExtents[1] + fineRow) * fineExtents[0];
+                            for (uint32_t x = 0; x < fineExtents[0]; x++)
+                                function(fineLine[x], coarseLine[x / 2]);
+                        } }, m_Policy);
+            }
+
+        private:
+            MultigridSettings m_Settings;
+            Parallel::ExecutionPolicy m_Policy;
+            std::vector<Level> m_Levels;
+            Eigen::LDLT<HMatrixX> m_CoarseSolver;
+        };
+
+        typedef MultigridPreconditioner<2> MultigridPreconditioner2D;
+        typedef MultigridPreconditioner<3> MultigridPreconditioner3D;
+    } // namespace PreconditionerTool
+} // namespace MathLib
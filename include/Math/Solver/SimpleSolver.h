@@ -1,34 +1,99 @@
 #pragma once
 #include <Math/Math.h>
 #include <Math/Solver/SolverCommon.h>
+#include <type_traits>
 
 namespace MathLib
 {
     namespace SolverTool
     {
+        // Batched solves hand each parallel task this many right-hand side columns.
+        const uint32_t SOLVER_RHS_BLOCK_SIZE = 8;
+
+        /// <summary>
+        /// Sparse LDLT direct solver that keeps its factorization. Analyze() computes the fill reducing ordering and the
+        /// symbolic factorization of a sparsity pattern, Factorize() the numeric factorization of a matrix with that
+        /// pattern, and every Solve() reuses the cached factors, so a system with new values but the same pattern only
+        /// needs Factorize() and a new right-hand side only Solve(). The matrix is referenced, not copied; Solve()
+        /// factorizes it on first use. The block Solve() takes one right-hand side per column and runs the triangular
+        /// solves on SOLVER_RHS_BLOCK_SIZE columns at once, which reads the factors once per block, the blocks in parallel.
+        /// </summary>
         class SimpleLinearSolver : public LinearSolverBase
         {
+            template <class Other>
+            using _IsOtherMatrix = std::integral_constant<bool, !std::is_same<std::decay_t<Other>, HSparseMatrixColMajor>::value &&
+                                                                    !std::is_base_of<SimpleLinearSolver, std::decay_t<Other>>::value>;
+
         public:
-            SimpleLinearSolver(HMatrixX &matrix)
-                : m_Matrix(matrix)
+            SimpleLinearSolver()
+                : m_Matrix(nullptr), m_Analyzed(false), m_Factorized(false)
             {
             }
 
-            int Solve(HVectorX &x, const HVectorX &b) override
+            SimpleLinearSolver(const HSparseMatrixColMajor &matrix)
+                : m_Matrix(&matrix), m_Analyzed(false), m_Factorized(false)
             {
-                const HSparseMatrixColMajor& matrix = smart_cast<HSparseMatrixColMajor&>(&m_Matrix.matrix());
-                Eigen::SimplicialLDLT<HSparseMatrixColMajor> solver;
-                solver.compute(matrix);
+            }
+            // the matrix is only referenced: a temporary, or another matrix type that would convert into one, would
+            // leave m_Matrix dangling before the lazy Factorize() reads it
+            SimpleLinearSolver(const HSparseMatrixColMajor &&) = delete;
+            template <class Other, typename = std::enable_if_t<_IsOtherMatrix<Other>::value>>
+            SimpleLinearSolver(const Other &) = delete;
 
-                if (solver.info() != Eigen::Success)
+            /// @brief symbolic factorization of the pattern of matrix, which becomes the matrix of the solver
+            int Analyze(const HSparseMatrixColMajor &matrix)
+            {
+                m_Matrix = &matrix;
+                m_Factorized = false;
+                m_Solver.analyzePattern(matrix);
+                m_Analyzed = m_Solver.info() == Eigen::Success;
+                if (!m_Analyzed)
+                {
+#ifdef _DEBUG
+                    std::cerr << "LinearSolver LDLT Analysis failed" << std::endl;
+#endif
+                    return -1;
+                }
+                return 0;
+            }
+            int Analyze(const HSparseMatrixColMajor &&) = delete;
+            template <class Other, typename = std::enable_if_t<_IsOtherMatrix<Other>::value>>
+            int Analyze(const Other &) = delete;
+
+            /// @brief numeric factorization of matrix, which must have the pattern of the last Analyze()
+            int Factorize(const HSparseMatrixColMajor &matrix)
+            {
+                m_Matrix = &matrix;
+                return Factorize();
+            }
+            int Factorize(const HSparseMatrixColMajor &&) = delete;
+            template <class Other, typename = std::enable_if_t<_IsOtherMatrix<Other>::value>>
+            int Factorize(const Other &) = delete;
+
+            /// @brief numeric factorization of the current matrix after its values changed
+            int Factorize()
+            {
+                assert(m_Matrix);
+                if (!m_Analyzed && Analyze(*m_Matrix) != 0)
+                    return -1;
+                m_Solver.factorize(*m_Matrix);
+                m_Factorized = m_Solver.info() == Eigen::Success;
+                if (!m_Factorized)
                 {
 #ifdef _DEBUG
                     std::cerr << "LinearSolver LDLT Decomposition failed" << std::endl;
 #endif
                     return -1;
                 }
-                x = solver.solve(b);
-                if (!solver.info() != Eigen::Success)
+                return 0;
+            }
+
+            int Solve(HVectorX &x, const HVectorX &b) override
+            {
+                if (!m_Factorized && Factorize() != 0)
+                    return -1;
+                x = m_Solver.solve(b);
+                if (m_Solver.info() != Eigen::Success)
                 {
 #ifdef _DEBUG
                     std::cerr << "LinearSolver LDLT Solving failed" << std::endl;
@@ -41,25 +106,95 @@ namespace MathLib
                 return 0;
             }
 
+            /// @brief solves A X = B for every column of B
+            int Solve(HMatrixX &x, const HMatrixX &b, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+            {
+                if (!m_Factorized && Factorize() != 0)
+                    return -1;
+                assert(b.rows() == m_Matrix->rows());
+                x.resize(b.rows(), b.cols());
+                const uint32_t blockCount = static_cast<uint32_t>((b.cols() + SOLVER_RHS_BLOCK_SIZE - 1) / SOLVER_RHS_BLOCK_SIZE);
+                // solving only reads the factors, the blocks are independent
+                Parallel::ParallelFor<uint32_t>(0, blockCount, [&](uint32_t block)
+                                                {
+                    const Eigen::Index begin = Eigen::Index(block) * SOLVER_RHS_BLOCK_SIZE;
+                    _SolveBlock(x, b, begin, std::min<Eigen::Index>(SOLVER_RHS_BLOCK_SIZE, b.cols() - begin)); }, policy);
+                return 0;
+            }
+
+            bool IsAnalyzed() const { return m_Analyzed; }
+            bool IsFactorized() const { return m_Factorized; }
+
+        private:
+            typedef Eigen::Matrix<HReal, Eigen::Dynamic, int(SOLVER_RHS_BLOCK_SIZE), Eigen::RowMajor> RightHandSideBlock;
+            typedef Eigen::Matrix<HReal, 1, int(SOLVER_RHS_BLOCK_SIZE)> RightHandSideRow;
+
+            /// @brief columns [begin, begin + size) of x from those of b; each entry of L is read once for the whole
+            /// block and applied to a row of SOLVER_RHS_BLOCK_SIZE values
+            void _SolveBlock(HMatrixX &x, const HMatrixX &b, const Eigen::Index begin, const Eigen::Index size) const
+            {
+                const HSparseMatrixColMajor &factor = m_Solver.matrixL().nestedExpression();
+                const HVectorX &diagonal = m_Solver.vectorD();
+                const int rows = static_cast<int>(factor.rows());
+                const int *outer = factor.outerIndexPtr();
+                const int *inner = factor.innerIndexPtr();
+                const HReal *values = factor.valuePtr();
+                RightHandSideBlock y = RightHandSideBlock::Zero(rows, SOLVER_RHS_BLOCK_SIZE);
+                if (m_Solver.permutationP().size() > 0)
+                    y.leftCols(size) = m_Solver.permutationP() * b.middleCols(begin, size);
+                else
+                    y.leftCols(size) = b.middleCols(begin, size);
+
+                // L z = P b, then L^T (P x) = D^-1 z; L is unit lower triangular
+                for (int j = 0; j < rows; j++)
+                {
+                    const RightHandSideRow yj = y.row(j);
+                    for (int p = outer[j]; p < outer[j + 1]; p++)
+                        if (inner[p] > j)
+                            y.row(inner[p]) -= values[p] * yj;
+                }
+                for (int j = rows - 1; j >= 0; j--)
+                {
+                    RightHandSideRow yj = y.row(j) / diagonal[j];
+                    for (int p = outer[j]; p < outer[j + 1]; p++)
+                        if (inner[p] > j)
+                            yj -= values[p] * y.row(inner[p]);
+                    y.row(j) = yj;
+                }
+
+                if (m_Solver.permutationPinv().size() > 0)
+                    x.middleCols(begin, size) = m_Solver.permutationPinv() * y.leftCols(size);
+                else
+                    x.middleCols(begin, size) = y.leftCols(size);
+            }
+
         private:
-            HMatrixX &m_Matrix;
+            const HSparseMatrixColMajor *m_Matrix;
+            Eigen::SimplicialLDLT<HSparseMatrixColMajor> m_Solver;
+            bool m_Analyzed;
+            bool m_Factorized;
         };
 
         class SimpleConjugateGradientSolver : public LinearSolverBase
         {
         public:
-            SimpleConjugateGradientSolver(HMatrixX& matrix)
+            SimpleConjugateGradientSolver(const HSparseMatrixRowMajor& matrix)
                 : m_Matrix(matrix)
             {
             }
+            // m_Matrix is a reference: a temporary, or a column-major matrix that would convert into one, would
+            // dangle once the constructor returns
+            SimpleConjugateGradientSolver(const HSparseMatrixRowMajor&&) = delete;
+            template <class Other, typename = std::enable_if_t<!std::is_same<std::decay_t<Other>, HSparseMatrixRowMajor>::value &&
+                                                               !std::is_base_of<SimpleConjugateGradientSolver, std::decay_t<Other>>::value>>
+            SimpleConjugateGradientSolver(const Other&) = delete;
 
             int Solve(HVectorX& x, const HVectorX& b) override
             {
-                const HSparseMatrixRowMajor& matrix = smart_cast<HSparseMatrixRowMajor&>(&m_Matrix.matrix());
                 Eigen::ConjugateGradient<HSparseMatrixRowMajor, Eigen::Upper> solver;
                 solver.setTolerance(1e-7);
                 solver.setMaxIterations(10000);
-                solver.compute(matrix);
+                solver.compute(m_Matrix);
 
                 if (solver.info() != Eigen::Success)
                 {
@@ -69,7 +204,7 @@ namespace MathLib
                     return -1;
                 }
                 x = solver.solve(b);
-                if (!solver.info() != Eigen::Success)
+                if (solver.info() != Eigen::Success)
                 {
 #ifdef _DEBUG
                     std::cerr << "ConjugateGradientSolver Solving failed" << std::endl;
@@ -82,7 +217,7 @@ namespace MathLib
                 return 0;
             }
         private:
-            HMatrixX& m_Matrix;
+            const HSparseMatrixRowMajor& m_Matrix;
         };
     } // namespace SolverTool
 } // namespace MathLib
\ No newline at end of file
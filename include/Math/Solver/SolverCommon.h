@@ -1,5 +1,7 @@
 #pragma once
 #include <Math/Math.h>
+#include <Math/Parallel.h>
+#include <functional>
 
 namespace MathLib
 {
@@ -8,6 +10,7 @@ namespace MathLib
         class Preconditioner
         {
         public:
+            virtual ~Preconditioner() = default;
             virtual void Apply(HVectorX &w, const HVectorX &v) = 0;
         };
     } // namespace PreconditionerTool
@@ -16,7 +19,139 @@ namespace MathLib
         class LinearSolverBase
         {
         public:
+            virtual ~LinearSolverBase() = default;
             virtual int Solve(HVectorX &x, const HVectorX &b) = 0;
         };
+
+        // The vector kernels of the iterative solvers work on blocks of this many entries, one block per parallel task
+        // step; dot products sum the block results in block order, so they do not depend on the thread count.
+        const uint32_t SOLVER_BLOCK_SIZE = 1024;
+
+        /// @brief y = matrix * x with the rows in parallel
+        inline void SparseMultiply(const HSparseMatrixRowMajor &matrix, const HVectorX &x, HVectorX &y,
+                                   const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy())
+        {
+            assert(x.size() == matrix.cols());
+            y.resize(matrix.rows());
+            const int *outer = matrix.outerIndexPtr();
+            const int *nonZeros = matrix.innerNonZeroPtr();
+            const int *columns = matrix.innerIndexPtr();
+            const HReal *values = matrix.valuePtr();
+            Parallel::ParallelFor<int>(0, static_cast<int>(matrix.rows()), [&](int row)
+                                       {
+                const int end = nonZeros ? outer[row] + nonZeros[row] : outer[row + 1];
+                HReal sum = 0;
+                for (int i = outer[row]; i < end; i++)
+                    sum += values[i] * x[columns[i]];
+                y[row] = sum; }, policy);
+        }
+
+        /// <summary>
+        /// How the solvers use an operator: Rows(op), Multiply(op, x, y, policy) for y = op * x and Diagonal(op, d) for
+        /// the Jacobi preconditioner. The primary template calls the members of the same names, which is how matrix-free
+        /// operators plug in; HMatrixX and both sparse layouts are specialized below. Only the row-major sparse product
+        /// runs in parallel, a column-major product would scatter into y from every column.
+        /// </summary>
+        template <class Operator>
+        struct OperatorTraits
+        {
+            static uint32_t Rows(const Operator &op) { return op.Rows(); }
+            static void Multiply(const Operator &op, const HVectorX &x, HVectorX &y, const Parallel::ExecutionPolicy &policy) { op.Multiply(x, y, policy); }
+            static void Diagonal(const Operator &op, HVectorX &diagonal) { op.Diagonal(diagonal); }
+        };
+
+        template <>
+        struct OperatorTraits<HMatrixX>
+        {
+            static uint32_t Rows(const HMatrixX &op) { return static_cast<uint32_t>(op.rows()); }
+            static void Multiply(const HMatrixX &op, const HVectorX &x, HVectorX &y, const Parallel::ExecutionPolicy &) { y.noalias() = op * x; }
+            static void Diagonal(const HMatrixX &op, HVectorX &diagonal) { diagonal = op.diagonal(); }
+        };
+
+        template <>
+        struct OperatorTraits<HSparseMatrixRowMajor>
+        {
+            static uint32_t Rows(const HSparseMatrixRowMajor &op) { return static_cast<uint32_t>(op.rows()); }
+            static void Multiply(const HSparseMatrixRowMajor &op, const HVectorX &x, HVectorX &y, const Parallel::ExecutionPolicy &policy) { SparseMultiply(op, x, y, policy); }
+            static void Diagonal(const HSparseMatrixRowMajor &op, HVectorX &diagonal) { diagonal = op.diagonal(); }
+        };
+
+        template <>
+        struct OperatorTraits<HSparseMatrixColMajor>
+        {
+            static uint32_t Rows(const HSparseMatrixColMajor &op) { return static_cast<uint32_t>(op.rows()); }
+            static void Multiply(const HSparseMatrixColMajor &op, const HVectorX &x, HVectorX &y, const Parallel::ExecutionPolicy &) { y.noalias() = op * x; }
+            static void Diagonal(const HSparseMatrixColMajor &op, HVectorX &diagonal) { diagonal = op.diagonal(); }
+        };
+
+        /// <summary>
+        /// Matrix-free operator from callbacks: multiply(x, y) computes y = A * x, diagonal(d) the diagonal of A for the
+        /// Jacobi preconditioner (all ones when not given). The callbacks own any parallelism.
+        /// </summary>
+        class LinearOperator
+        {
+        public:
+            typedef std::function<void(const HVectorX &x, HVectorX &y)> MultiplyFunction;
+            typedef std::function<void(HVectorX &diagonal)> DiagonalFunction;
+
+            LinearOperator(const uint32_t rows, const MultiplyFunction &multiply, const DiagonalFunction &diagonal = DiagonalFunction())
+                : m_Rows(rows), m_Multiply(multiply), m_Diagonal(diagonal)
+            {
+            }
+
+            uint32_t Rows() const { return m_Rows; }
+
+            void Multiply(const HVectorX &x, HVectorX &y, const Parallel::ExecutionPolicy &) const
+            {
+                y.resize(m_Rows);
+                m_Multiply(x, y);
+            }
+
+            void Diagonal(HVectorX &diagonal) const
+            {
+                if (m_Diagonal)
+                    m_Diagonal(diagonal);
+                else
+                    diagonal.setOnes(m_Rows);
+            }
+
+        private:
+            uint32_t m_Rows;
+            MultiplyFunction m_Multiply;
+            DiagonalFunction m_Diagonal;
+        };
+
+        namespace _Private
+        {
+            /// @brief function(begin, size) for the SOLVER_BLOCK_SIZE blocks of [0, count), in parallel
+            template <class Function>
+            inline void ForBlocks(const Eigen::Index count, const Function &function, const Parallel::ExecutionPolicy &policy)
+            {
+                const uint32_t blockCount = static_cast<uint32_t>((count + SOLVER_BLOCK_SIZE - 1) / SOLVER_BLOCK_SIZE);
+                Parallel::ParallelFor<uint32_t>(0, blockCount, [&](uint32_t block)
+                                                {
+                    const Eigen::Index begin = Eigen::Index(block) * SOLVER_BLOCK_SIZE;
+                    function(begin, std::min<Eigen::Index>(SOLVER_BLOCK_SIZE, count - begin)); }, policy);
+            }
+
+            /// @brief sum of function(begin, size) over the blocks of [0, count); partials is scratch storage
+            template <class Function>
+            inline HReal SumBlocks(const Eigen::Index count, const Function &function, std::vector<HReal> &partials, const Parallel::ExecutionPolicy &policy)
+            {
+                partials.resize(static_cast<size_t>((count + SOLVER_BLOCK_SIZE - 1) / SOLVER_BLOCK_SIZE));
+                ForBlocks(count, [&](Eigen::Index begin, Eigen::Index size)
+                          { partials[begin / SOLVER_BLOCK_SIZE] = function(begin, size); }, policy);
+                HReal sum = 0;
+                for (const HReal partial : partials)
+                    sum += partial;
+                return sum;
+            }
+
+            inline HReal Dot(const HVectorX &a, const HVectorX &b, std::vector<HReal> &partials, const Parallel::ExecutionPolicy &policy)
+            {
+                return SumBlocks(a.size(), [&](Eigen::Index begin, Eigen::Index size)
+                                 { return a.segment(begin, size).dot(b.segment(begin, size)); }, partials, policy);
+            }
+        } // namespace _Private
     } // namespace SolverTool
-} // namespace MathLib
\ No newline at end of file
+} // namespace MathLib
@@ -0,0 +1,236 @@
+#pragma once
+#include <Math/Math.h>
+#include <Math/Array2D.h>
+#include <Math/Array3D.h>
+#include <Math/Solver/SolverCommon.h>
+#include <array>
+
+namespace MathLib
+{
+    namespace SolverTool
+    {
+        enum class StencilBoundary
+        {
+            eDirichlet, // values outside the grid are zero, every cell keeps the full 2 * Dim diagonal
+            eNeumann    // zero flux across the border, a cell only couples to the neighbours inside the grid
+        };
+
+        // The operator is mShift * I + mScale * L with L the 5-point (2D) or 7-point (3D) negative Laplacian of unit
+        // spacing: mScale = 1 / h^2 for a Poisson solve, mShift = 1 and mScale = lambda for implicit smoothing of a
+        // heightmap. A pure Neumann Laplacian (mShift = 0) is singular and only solvable for b summing to zero.
+        struct StencilSettings
+        {
+            HReal mScale = 1.f;
+            HReal mShift = 0.f;
+            StencilBoundary mBoundary = StencilBoundary::eDirichlet;
+        };
+
+        namespace _Private
+        {
+            template <class Type, class Alloc>
+            size_t GridSize(const Array2D<Type, Alloc> &grid) { return size_t(grid.GetSizeX()) * grid.GetSizeY(); }
+            template <class Type>
+            size_t GridSize(const Array3D<Type> &grid) { return grid.getSizeX() * grid.getSizeY() * grid.getSizeZ(); }
+        } // namespace _Private
+
+        // Rows of 3D grids are processed in tiles of about this many bytes per plane, the three planes a tile touches
+        // then stay in cache while the tile moves through z.
+        const uint32_t STENCIL_TILE_BYTES = 32 * 1024;
+
+        /// <summary>
+        /// Matrix-free Laplacian on the storage of Array2D<HReal> / Array3D<HReal>: nothing is assembled, a product reads
+        /// the grid and its neighbour lines once. Extents are given in memory order, fastest axis first; the array
+        /// constructors take them from the array (Array2D keeps y contiguous, Array3D x). Every grid line is one Eigen
+        /// array expression, so the inner loop is vectorized; the lines run in parallel, 3D grids in cache sized tiles.
+        /// Plugs into ConjugateGradientSolver through the Rows/Multiply/Diagonal members, SolveGrid runs it on arrays.
+        /// </summary>
+        template <int Dim>
+        class LaplacianOperator
+        {
+            static_assert(Dim == 2 || Dim == 3, "LaplacianOperator has 5-point (2D) and 7-point (3D) stencils");
+
+        public:
+            LaplacianOperator(const std::array<uint32_t, Dim> &extents, const StencilSettings &settings = StencilSettings())
+                : m_Extents(extents), m_Settings(settings)
+            {
+            }
+
+            template <class Alloc, int D = Dim, typename = std::enable_if_t<D == 2>>
+            LaplacianOperator(const Array2D<HReal, Alloc> &grid, const StencilSettings &settings = StencilSettings())
+                : LaplacianOperator(std::array<uint32_t, Dim>{grid.GetSizeY(), grid.GetSizeX()}, settings)
+            {
+            }
+
+            template <int D = Dim, typename = std::enable_if_t<D == 3>>
+            LaplacianOperator(const Array3D<HReal> &grid, const StencilSettings &settings = StencilSettings())
+                : LaplacianOperator(std::array<uint32_t, Dim>{uint32_t(grid.getSizeX()), uint32_t(grid.getSizeY()), uint32_t(grid.getSizeZ())}, settings)
+            {
+            }
+
+            const std::array<uint32_t, Dim> &GetExtents() const { return m_Extents; }
+            const StencilSettings &GetSettings() const { return m_Settings; }
+
+            uint32_t Rows() const
+            {
+                uint32_t rows = 1;
+                for (const uint32_t extent : m_Extents)
+                    rows *= extent;
+                return rows;
+            }
+
+            void Multiply(const HVectorX &x, HVectorX &y, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+            {
+                assert(x.size() == Rows());
+                y.resize(Rows());
+                Apply(x.data(), y.data(), policy);
+            }
+
+            template <class Alloc, int D = Dim, typename = std::enable_if_t<D == 2>>
+            void Apply(const Array2D<HReal, Alloc> &x, Array2D<HReal, Alloc> &y, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+            {
+                assert(_Private::GridSize(x) == Rows() && _Private::GridSize(y) == Rows());
+                Apply(x.Data(), y.Data(), policy);
+            }
+
+            template <int D = Dim, typename = std::enable_if_t<D == 3>>
+            void Apply(const Array3D<HReal> &x, Array3D<HReal> &y, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+            {
+                assert(_Private::GridSize(x) == Rows() && _Private::GridSize(y) == Rows());
+                Apply(x.Data(), y.Data(), policy);
+            }
+
+            /// @brief y = A x on raw grid storage in the memory order of the extents; x and y must not overlap
+            void Apply(const HReal *x, HReal *y, const Parallel::ExecutionPolicy &policy = Parallel::ExecutionPolicy()) const
+            {
+                const uint32_t lineCount = Rows() / m_Extents[0];
+                if (lineCount == 0)
+                    return;
+                if (Dim == 2)
+                {
+                    Parallel::ParallelFor<uint32_t>(0, lineCount, [&](uint32_t line)
+                                                    { _Line(x, y, line, 0); }, policy);
+                    return;
+                }
+                // tiles of rows along the second axis, each swept through all planes
+                const uint32_t rowsPerPlane = m_Extents[1];
+                const uint32_t tileRows = std::max<uint32_t>(1, STENCIL_TILE_BYTES / uint32_t(sizeof(HReal) * m_Extents[0]));
+                const uint32_t tileCount = (rowsPerPlane + tileRows - 1) / tileRows;
+                // a few plane chunks per tile give the scheduler enough tasks on flat grids
+                const uint32_t planeCount = m_Extents[Dim - 1];
+                const uint32_t planeChunk = std::max<uint32_t>(4, planeCount / 8);
+                const uint32_t chunkCount = (planeCount + planeChunk - 1) / planeChunk;
+                // the body gets (index in the second range, index in the first), so plane chunks are the split axis
+                Parallel::ParallelFor<uint32_t>(0, tileCount, 0, chunkCount, [&](uint32_t chunk, uint32_t tile)
+                                                {
+                    const uint32_t rowEnd = std::min(rowsPerPlane, (tile + 1) * tileRows);
+                    const uint32_t planeEnd = std::min(planeCount, (chunk + 1) * planeChunk);
+                    for (uint32_t plane = chunk * planeChunk; plane < planeEnd; plane++)
+                        for (uint32_t row = tile * tileRows; row < rowEnd; row++)
+                            _Line(x, y, row, plane); }, policy);
+            }
+
+            void Diagonal(HVectorX &diagonal) const
+            {
+                diagonal.resize(Rows());
+                const HReal full = m_Settings.mShift + m_Settings.mScale * HReal(2 * Dim);
+                if (m_Settings.mBoundary == StencilBoundary::eDirichlet)
+                {
+                    diagonal.setConstant(full);
+                    return;
+                }
+                for (uint32_t i = 0; i < Rows(); i++)
+                {
+                    // one coupling less for every border the cell sits on
+                    uint32_t index = i, missing = 0;
+                    for (int axis = 0; axis < Dim; axis++)
+                    {
+                        const uint32_t coordinate = index % m_Extents[axis];
+                        index /= m_Extents[axis];
+                        missing += (coordinate == 0) + (coordinate + 1 == m_Extents[axis]);
+                    }
+                    diagonal[i] = full - m_Settings.mScale * HReal(missing);
+                }
+            }
+
+        private:
+            typedef Eigen::Array<HReal, Eigen::Dynamic, 1> Line;
+
+            /// @brief y = A x along the grid line (row, plane) of the fastest axis
+            void _Line(const HReal *x, HReal *y, const uint32_t row, const uint32_t plane) const
+            {
+                const Eigen::Index length = m_Extents[0];
+                const size_t rowStride = m_Extents[0];
+                const size_t planeStride = size_t(m_Extents[0]) * m_Extents[1];
+                const size_t offset = row * rowStride + (Dim == 3 ? plane * planeStride : 0);
+                const HReal scale = m_Settings.mScale;
+                const Eigen::Map<const Line> center(x + offset, length);
+                Eigen::Map<Line> out(y + offset, length);
+
+                // the lines next to this one, missing beyond the border
+                const HReal *sides[4];
+                int sideCount = 0;
+                if (row > 0)
+                    sides[sideCount++] = x + offset - rowStride;
+                if (row + 1 < m_Extents[1])
+                    sides[sideCount++] = x + offset + rowStride;
+                if (Dim == 3 && plane > 0)
+                    sides[sideCount++] = x + offset - planeStride;
+                if (Dim == 3 && plane + 1 < m_Extents[Dim - 1])
+                    sides[sideCount++] = x + offset + planeStride;
+
+                const bool neumann = m_Settings.mBoundary == StencilBoundary::eNeumann;
+                const HReal diagonal = m_Settings.mShift + scale * HReal(neumann ? sideCount + 2 : 2 * Dim);
+                if (sideCount == 2 * (Dim - 1))
+                {
+                    // interior line, one fused expression
+                    if (Dim == 2)
+                        out = diagonal * center - scale * (Eigen::Map<const Line>(sides[0], length) + Eigen::Map<const Line>(sides[1], length));
+                    else
+                        out = diagonal * center - scale * ((Eigen::Map<const Line>(sides[0], length) + Eigen::Map<const Line>(sides[1], length)) +
+                                                           (Eigen::Map<const Line>(sides[2], length) + Eigen::Map<const Line>(sides[3], length)));
+                }
+                else
+                {
+                    out = diagonal * center;
+                    for (int side = 0; side < sideCount; side++)
+                        out -= scale * Eigen::Map<const Line>(sides[side], length);
+                }
+                // neighbours along the line
+                if (length > 1)
+                {
+                    out.head(length - 1) -= scale * center.tail(length - 1);
+                    out.tail(length - 1) -= scale * center.head(length - 1);
+                }
+                if (neumann)
+                {
+                    // the two end cells have one in-line neighbour less than the diagonal assumed
+                    out[0] -= scale * center[0];
+                    out[length - 1] -= scale * center[length - 1];
+                }
+            }
+
+        private:
+            std::array<uint32_t, Dim> m_Extents;
+            StencilSettings m_Settings;
+        };
+
+        typedef LaplacianOperator<2> LaplacianOperator2D;
+        typedef LaplacianOperator<3> LaplacianOperator3D;
+
+        /// <summary>
+        /// solver.Solve on grid storage (Array2D / Array3D): x holds the initial guess and receives the solution. The
+        /// solvers iterate on HVectorX, so x and b are copied in and the result copied back, once per solve.
+        /// </summary>
+        template <class Solver, class Grid>
+        int SolveGrid(Solver &solver, Grid &x, const Grid &b)
+        {
+            const Eigen::Index size = static_cast<Eigen::Index>(_Private::GridSize(b));
+            assert(_Private::GridSize(x) == _Private::GridSize(b));
+            HVectorX vectorX = Eigen::Map<const HVectorX>(x.Data(), size);
+            const HVectorX vectorB = Eigen::Map<const HVectorX>(b.Data(), size);
+            const int status = solver.Solve(vectorX, vectorB);
+            Eigen::Map<HVectorX>(x.Data(), size) = vectorX;
+            return status;
+        }
+    } // namespace SolverTool
+} // namespace MathLib
@@ -0,0 +1,305 @@
+#pragma once
+#include <Math/Parallel.h>
+#include <atomic>
+#include <condition_variable>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace MathLib
+{
+    namespace Parallel
+    {
+        namespace _Private
+        {
+            void _SpawnTask(const std::shared_ptr<class TaskNode> &node);
+
+            /// <summary>
+            /// One unit of work in the task system. A node runs once every predecessor has finished and
+            /// Launch() has been called; it then releases its successors.
+            /// m_Predecessors starts at 1 for the launch token, so dependencies can be added safely until Launch().
+            /// Tasks must not throw: like the rest of the library, errors are reported through return values.
+            /// </summary>
+            class TaskNode : public std::enable_shared_from_this<TaskNode>
+            {
+            public:
+                explicit TaskNode(std::function<void()> work = nullptr) : m_Work(std::move(work)) {}
+
+                /// @brief must be called before Launch()
+                void SetWork(std::function<void()> work)
+                {
+                    m_Work = std::move(work);
+                }
+
+                /// @brief successor runs after this node; a no-op wait if this node already finished
+                void Precede(const std::shared_ptr<TaskNode> &successor)
+                {
+                    successor->m_Predecessors.fetch_add(1, std::memory_order_relaxed);
+                    {
+                        std::lock_guard<std::mutex> lock(m_Mutex);
+                        if (!m_Finished)
+                        {
+                            m_Successors.push_back(successor);
+                            return;
+                        }
+                    }
+                    successor->_Release();
+                }
+
+                void Launch()
+                {
+                    _Release();
+                }
+
+                bool IsFinished() const
+                {
+                    return m_Pending.load(std::memory_order_acquire) == 0;
+                }
+
+                void Wait()
+                {
+#ifdef PARALLEL_BACKEND_THREAD_POOL
+                    // help with queued work instead of blocking, the task may sit in this thread's own deque
+                    ThreadPool::Instance().Wait(m_Pending);
+#else
+                    std::unique_lock<std::mutex> lock(m_Mutex);
+                    m_Done.wait(lock, [this]()
+                               { return m_Finished; });
+#endif
+                }
+
+                void Execute()
+                {
+                    if (m_Work)
+                        m_Work();
+                    m_Work = nullptr;
+
+                    std::vector<std::shared_ptr<TaskNode>> successors;
+                    {
+                        std::lock_guard<std::mutex> lock(m_Mutex);
+                        m_Finished = true;
+                        m_Pending.store(0, std::memory_order_release);
+                        successors.swap(m_Successors);
+                    }
+                    m_Done.notify_all();
+                    for (const std::shared_ptr<TaskNode> &successor : successors)
+                        successor->_Release();
+                }
+
+            private:
+                void _Release()
+                {
+                    if (m_Predecessors.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        _SpawnTask(shared_from_this());
+                }
+
+            private:
+                std::function<void()> m_Work;
+                std::atomic<uint32_t> m_Predecessors{1};
+                std::atomic<size_t> m_Pending{1};
+                std::mutex m_Mutex;
+                std::condition_variable m_Done;
+                std::vector<std::shared_ptr<TaskNode>> m_Successors;
+                bool m_Finished = false;
+            };
+
+            inline void _SpawnTask(const std::shared_ptr<TaskNode> &node)
+            {
+#if defined(PARALLEL_BACKEND_TBB)
+                // enqueued tasks are guaranteed a worker even when the submitting thread never joins the arena
+                static tbb::task_arena arena;
+                arena.enqueue([node]()
+                              { node->Execute(); });
+#elif defined(PARALLEL_BACKEND_THREAD_POOL)
+                ThreadPool::Instance().Submit([node]()
+                                              { node->Execute(); });
+#else
+                node->Execute();
+#endif
+            }
+
+            template <typename ValueType>
+            struct FutureState : public TaskNode
+            {
+                std::optional<ValueType> mValue;
+            };
+
+            template <>
+            struct FutureState<void> : public TaskNode
+            {
+            };
+
+            template <typename ValueType, typename Function, typename... Args>
+            void _StoreResult(FutureState<ValueType> &state, Function &func, Args &...args)
+            {
+                if constexpr (std::is_void<ValueType>::value)
+                    func(args...);
+                else
+                    state.mValue.emplace(func(args...));
+            }
+        } // namespace _Private
+
+        /// <summary>
+        /// Handle to the result of an asynchronous task, created by Async, Then or WhenAll. Copies share the result.
+        /// Get()/Wait() block the caller; inside a task prefer Then() so no worker sits idle waiting.
+        /// </summary>
+        template <typename ValueType>
+        class Future
+        {
+        public:
+            typedef std::add_lvalue_reference_t<ValueType> Reference;
+
+        public:
+            Future() = default;
+            explicit Future(std::shared_ptr<_Private::FutureState<ValueType>> state) : m_State(std::move(state)) {}
+
+            bool IsValid() const
+            {
+                return m_State != nullptr;
+            }
+
+            bool IsReady() const
+            {
+                return m_State->IsFinished();
+            }
+
+            void Wait() const
+            {
+                m_State->Wait();
+            }
+
+            Reference Get() const
+            {
+                m_State->Wait();
+                if constexpr (!std::is_void<ValueType>::value)
+                    return *m_State->mValue;
+            }
+
+            /// @brief runs func(value) (or func() for Future<void>) once this result is ready
+            template <typename Function>
+            auto Then(Function func) const
+            {
+                typedef std::conditional_t<std::is_void<ValueType>::value, std::invoke_result<Function>, std::invoke_result<Function, Reference>> ResultTrait;
+                typedef typename ResultTrait::type ResultType;
+
+                auto state = std::make_shared<_Private::FutureState<ResultType>>();
+                // the result node is kept alive by the scheduler while it runs, a raw pointer avoids a reference cycle
+                _Private::FutureState<ResultType> *result = state.get();
+                std::shared_ptr<_Private::FutureState<ValueType>> source = m_State;
+                state->SetWork([result, source, func]() mutable
+                               {
+                    if constexpr (std::is_void<ValueType>::value)
+                        _Private::_StoreResult(*result, func);
+                    else
+                        _Private::_StoreResult(*result, func, *source->mValue); });
+                m_State->Precede(state);
+                state->Launch();
+                return Future<ResultType>(state);
+            }
+
+            std::shared_ptr<_Private::TaskNode> _Node() const
+            {
+                return m_State;
+            }
+
+        private:
+            std::shared_ptr<_Private::FutureState<ValueType>> m_State;
+        };
+
+        /// @brief runs func() as a task and returns its result as a Future
+        template <typename Function>
+        auto Async(Function func)
+        {
+            typedef std::invoke_result_t<Function> ResultType;
+            auto state = std::make_shared<_Private::FutureState<ResultType>>();
+            _Private::FutureState<ResultType> *result = state.get();
+            state->SetWork([result, func]() mutable
+                           { _Private::_StoreResult(*result, func); });
+            state->Launch();
+            return Future<ResultType>(state);
+        }
+
+        /// @brief a Future that becomes ready once every future in the list is ready
+        template <typename ValueType>
+        Future<void> WhenAll(const std::vector<Future<ValueType>> &futures)
+        {
+            auto state = std::make_shared<_Private::FutureState<void>>();
+            for (const Future<ValueType> &future : futures)
+                future._Node()->Precede(state);
+            state->Launch();
+            return Future<void>(state);
+        }
+
+        /// <summary>
+        /// Static dependency graph: add tasks and edges once, then Run() it as many times as needed.
+        /// Each Run() schedules every task as soon as its dependencies finished, independent branches run concurrently.
+        /// </summary>
+        class TaskGraph
+        {
+        public:
+            typedef uint32_t TaskId;
+
+        public:
+            template <typename Function>
+            TaskId AddTask(Function func, const std::vector<TaskId> &dependencies = {})
+            {
+                const TaskId id = static_cast<TaskId>(m_Works.size());
+                m_Works.emplace_back(std::move(func));
+                for (const TaskId dependency : dependencies)
+                    AddDependency(dependency, id);
+                return id;
+            }
+
+            /// @brief before has to finish before after starts
+            void AddDependency(const TaskId before, const TaskId after)
+            {
+                assert(before < m_Works.size() && after < m_Works.size() && before != after);
+                m_Edges.emplace_back(before, after);
+            }
+
+            uint32_t GetTaskCount() const
+            {
+                return static_cast<uint32_t>(m_Works.size());
+            }
+
+            /// @brief starts a run without blocking; the previous run must have finished
+            void Run()
+            {
+                assert(IsFinished());
+                m_Nodes.clear();
+                m_Nodes.reserve(m_Works.size());
+                for (const std::function<void()> &work : m_Works)
+                    m_Nodes.emplace_back(std::make_shared<_Private::TaskNode>(work));
+                for (const std::pair<TaskId, TaskId> &edge : m_Edges)
+                    m_Nodes[edge.first]->Precede(m_Nodes[edge.second]);
+                for (const std::shared_ptr<_Private::TaskNode> &node : m_Nodes)
+                    node->Launch();
+            }
+
+            void Wait()
+            {
+                for (const std::shared_ptr<_Private::TaskNode> &node : m_Nodes)
+                    node->Wait();
+            }
+
+            bool IsFinished() const
+            {
+                for (const std::shared_ptr<_Private::TaskNode> &node : m_Nodes)
+                    if (!node->IsFinished())
+                        return false;
+                return true;
+            }
+
+            void RunAndWait()
+            {
+                Run();
+                Wait();
+            }
+
+        private:
+            std::vector<std::function<void()>> m_Works;
+            std::vector<std::pair<TaskId, TaskId>> m_Edges;
+            std::vector<std::shared_ptr<_Private::TaskNode>> m_Nodes;
+        };
+    } // namespace Parallel
+} // namespace MathLib
@@ -87,14 +87,17 @@ namespace MathLib
             {
                 HReal &minValue = *min;
                 HReal &maxValue = *max;
-                minValue = H_REAL_MAX;
-                maxValue = H_REAL_MIN;
-
-                for (size_t i = 0; i < realData.size(); i++)
-                {
-                    minValue = std::min(minValue, realData[i]);
-                    maxValue = std::max(maxValue, realData[i]);
-                }
+                const HVector2 minMax = Parallel::ParallelReduce<size_t>(
+                    0, realData.size(), HVector2(H_REAL_MAX, H_REAL_MIN),
+                    [&](size_t i, HVector2 &value)
+                    {
+                        value[0] = std::min(value[0], realData[i]);
+                        value[1] = std::max(value[1], realData[i]);
+                    },
+                    [](const HVector2 &a, const HVector2 &b)
+                    { return HVector2(std::min(a[0], b[0]), std::max(a[1], b[1])); });
+                minValue = minMax[0];
+                maxValue = minMax[1];
 
                 const HReal range = maxValue - minValue;
                 pFn = [&](int i)
@@ -198,7 +201,7 @@ namespace MathLib
             std::vector<HReal> realData;
             Uint8ToReal(data, realData, min, max);
 
-            Array2D<HVector<Type, N>>::ArrayUpdateFn updateFn;
+            typename Array2D<HVector<Type, N>>::ArrayUpdateFn updateFn;
 
             uint32_t channels = std::min(static_cast<int>(format), N);
 
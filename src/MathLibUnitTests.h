@@ -2,7 +2,7 @@
 #include <gtest/gtest.h>
 #include <Math/Math.h>
 #include <Math/HGraphicUtils>
-// #include <Math/HSolver>
+#include <Math/HSolver>
 #include <Math/HAccelerate>
 #include <Math/HGeometry>
 #include <Math/Visual/ImageUtils.h>
@@ -14,4 +14,7 @@
 #include "TestOrientation.h"
 #include "TestEarClip.h"
 #include "TestImageUtils.h"
-#include "TestProcedural.h"
\ No newline at end of file
+#include "TestProcedural.h"
+#include "TestParallel.h"
+#include "TestAccelerate.h"
+#include "TestSolver.h"
\ No newline at end of file
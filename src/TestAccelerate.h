@@ -0,0 +1,1237 @@
+#pragma once
+#include <gtest/gtest.h>
+#include <Math/Math.h>
+#include <Math/HAccelerate>
+#include <Math/Geometry/Intersection.h>
+#include <functional>
+#include <random>
+
+namespace
+{
+	// clustered soup: a few dense blobs of small boxes plus some large boxes spread over the scene
+	std::vector<MathLib::HAABBox3D> MakeClusteredBoxes(const uint32_t count, const uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<MathLib::HReal> unit(0.f, 1.f);
+		std::normal_distribution<MathLib::HReal> normal(0.f, 1.f);
+		std::vector<MathLib::HVector3> clusters(6);
+		for (MathLib::HVector3& cluster : clusters)
+			cluster = MathLib::HVector3(unit(random), unit(random), unit(random)) * 100.f;
+		std::vector<MathLib::HAABBox3D> boxes(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const bool large = i % 50 == 0;
+			const MathLib::HVector3 center = large ? MathLib::HVector3(MathLib::HVector3(unit(random), unit(random), unit(random)) * 100.f)
+												   : MathLib::HVector3(clusters[i % clusters.size()] + MathLib::HVector3(normal(random), normal(random), normal(random)) * 2.f);
+			const MathLib::HVector3 half = MathLib::HVector3(unit(random), unit(random), unit(random)) * (large ? 5.f : 0.2f);
+			boxes[i] = MathLib::HAABBox3D(center - half, center + half);
+		}
+		return boxes;
+	}
+
+	// every box sits in exactly one leaf, inside the boxes of all its ancestors
+	template <class BBox>
+	void ExpectValidBVH(const std::vector<MathLib::TreeNode<BBox>>& nodes, const std::vector<BBox>& boxes, const uint32_t maxLeafSize)
+	{
+		std::vector<uint32_t> covered(boxes.size(), 0);
+		std::vector<uint32_t> stack(1, 0u);
+		while (!stack.empty())
+		{
+			const MathLib::TreeNode<BBox>& node = nodes[stack.back()];
+			stack.pop_back();
+			if (node.IsLeaf())
+			{
+				EXPECT_LE(node.m_End - node.m_Index, maxLeafSize);
+				for (uint32_t i = node.m_Index; i < node.m_End; i++)
+				{
+					covered[i]++;
+					EXPECT_TRUE(node.m_bbox.contains(boxes[i]));
+				}
+				continue;
+			}
+			for (uint32_t child = node.m_Index; child < node.m_Index + 2; child++)
+			{
+				EXPECT_TRUE(node.m_bbox.contains(nodes[child].m_bbox));
+				stack.push_back(child);
+			}
+		}
+		for (const uint32_t count : covered)
+			ASSERT_EQ(count, 1u);
+	}
+}
+
+TEST(AccelerateTest, SAHBVHStructure)
+{
+	const std::vector<MathLib::HAABBox3D> original = MakeClusteredBoxes(5000, 1);
+	std::vector<MathLib::HAABBox3D> boxes = original;
+	std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> nodes;
+	std::vector<uint32_t> primitiveIndices;
+	MathLib::SAHBuildSettings settings;
+	settings.mMaxLeafSize = 4;
+	MathLib::TreeUtils::Builder::BuildSAHBVH(boxes, nodes, settings, &primitiveIndices);
+
+	ExpectValidBVH(nodes, boxes, settings.mMaxLeafSize);
+	ASSERT_EQ(primitiveIndices.size(), original.size());
+	for (uint32_t i = 0; i < boxes.size(); i++)
+		EXPECT_TRUE(boxes[i].isApprox(original[primitiveIndices[i]]));
+
+	const MathLib::TreeUtils::TreeQuality quality = MathLib::TreeUtils::EvaluateTree(nodes, settings);
+	EXPECT_EQ(quality.mNodeCount, nodes.size());
+	EXPECT_EQ(quality.mLeafCount * 2 - 1, quality.mNodeCount);
+	uint32_t histogramBoxes = 0;
+	for (uint32_t size = 0; size < quality.mLeafSizeHistogram.size(); size++)
+		histogramBoxes += size * quality.mLeafSizeHistogram[size];
+	EXPECT_EQ(histogramBoxes, 5000u);
+
+	// the midpoint BVH degenerates into long chains around the clusters
+	std::vector<MathLib::HAABBox3D> midpointBoxes = original;
+	std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> midpointNodes;
+	MathLib::TreeUtils::Builder::BuildBVH(midpointBoxes, midpointNodes);
+	ExpectValidBVH(midpointNodes, midpointBoxes, UINT32_MAX);
+	EXPECT_LT(quality.mMaxDepth, MathLib::TreeUtils::EvaluateTree(midpointNodes, settings).mMaxDepth);
+
+	// and on evenly spread boxes the SAH tree wins by its own metric
+	std::mt19937 random(4);
+	std::uniform_real_distribution<MathLib::HReal> coordinate(0.f, 100.f);
+	std::vector<MathLib::HAABBox3D> uniform;
+	for (uint32_t i = 0; i < 5000; i++)
+	{
+		const MathLib::HVector3 corner(coordinate(random), coordinate(random), coordinate(random));
+		uniform.emplace_back(corner, MathLib::HVector3(corner + MathLib::HVector3::Constant(0.5f)));
+	}
+	midpointBoxes = uniform;
+	MathLib::TreeUtils::Builder::BuildBVH(midpointBoxes, midpointNodes);
+	MathLib::TreeUtils::Builder::BuildSAHBVH(uniform, nodes, settings);
+	EXPECT_LT(MathLib::TreeUtils::EvaluateTree(nodes, settings).mSAHCost, MathLib::TreeUtils::EvaluateTree(midpointNodes, settings).mSAHCost);
+}
+
+TEST(AccelerateTest, SAHBVHDegenerateInput)
+{
+	// identical boxes leave no split plane; the builder still has to honour the leaf size
+	std::vector<MathLib::HAABBox3D> boxes(37, MathLib::HAABBox3D(MathLib::HVector3::Zero(), MathLib::HVector3::Ones()));
+	std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> nodes;
+	MathLib::SAHBuildSettings settings;
+	settings.mMaxLeafSize = 2;
+	MathLib::TreeUtils::Builder::BuildSAHBVH(boxes, nodes, settings);
+	ExpectValidBVH(nodes, boxes, 2u);
+
+	std::vector<MathLib::HAABBox3D> empty;
+	MathLib::TreeUtils::Builder::BuildSAHBVH(empty, nodes);
+	EXPECT_TRUE(nodes.empty());
+
+	std::vector<MathLib::HAABBox2D> boxes2D;
+	for (int i = 0; i < 200; i++)
+		boxes2D.emplace_back(MathLib::HVector2(i % 17, i / 17), MathLib::HVector2(i % 17 + 0.5f, i / 17 + 0.5f));
+	std::vector<MathLib::TreeNode<MathLib::HAABBox2D>> nodes2D;
+	MathLib::TreeUtils::Builder::BuildSAHBVH(boxes2D, nodes2D);
+	ExpectValidBVH(nodes2D, boxes2D, MathLib::SAHBuildSettings().mMaxLeafSize);
+}
+
+TEST(AccelerateTest, ParallelBuildMatchesSerial)
+{
+	// large enough for several levels of parallel splits above PARALLEL_BUILD_THRESHOLD
+	const std::vector<MathLib::HAABBox3D> original = MakeClusteredBoxes(60000, 3);
+	const MathLib::SAHBuildSettings settings;
+	typedef std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> Tree;
+	auto expectSameTree = [&](const Tree& serialTree, const Tree& parallelTree, const std::vector<MathLib::HAABBox3D>& parallelBoxes,
+							  const uint32_t maxLeafSize)
+	{
+		ExpectValidBVH(parallelTree, parallelBoxes, maxLeafSize);
+		const MathLib::TreeUtils::TreeQuality serial = MathLib::TreeUtils::EvaluateTree(serialTree, settings);
+		const MathLib::TreeUtils::TreeQuality parallel = MathLib::TreeUtils::EvaluateTree(parallelTree, settings);
+		EXPECT_EQ(serial.mNodeCount, parallel.mNodeCount);
+		EXPECT_EQ(serial.mMaxDepth, parallel.mMaxDepth);
+		EXPECT_NEAR(serial.mSAHCost, parallel.mSAHCost, serial.mSAHCost * 1e-4f);
+		// stable partitions on both paths give the very same nodes
+		ASSERT_EQ(serialTree.size(), parallelTree.size());
+		for (size_t i = 0; i < serialTree.size(); i++)
+		{
+			ASSERT_EQ(serialTree[i].m_Index, parallelTree[i].m_Index) << "Node " << i;
+			ASSERT_EQ(serialTree[i].m_End, parallelTree[i].m_End) << "Node " << i;
+			ASSERT_TRUE(serialTree[i].m_bbox.isApprox(parallelTree[i].m_bbox)) << "Node " << i;
+		}
+	};
+	const MathLib::Parallel::ExecutionPolicy serialPolicy = MathLib::Parallel::ExecutionPolicy::Serial();
+
+	std::vector<MathLib::HAABBox3D> serialBoxes = original, parallelBoxes = original;
+	Tree serialTree, parallelTree;
+	MathLib::TreeUtils::Builder::BuildBVH(serialBoxes, serialTree, nullptr, serialPolicy);
+	MathLib::TreeUtils::Builder::BuildBVH(parallelBoxes, parallelTree);
+	expectSameTree(serialTree, parallelTree, parallelBoxes, 1u);
+
+	serialBoxes = parallelBoxes = original;
+	MathLib::TreeUtils::Builder::BuildAABBTree(serialBoxes, serialTree, nullptr, serialPolicy);
+	MathLib::TreeUtils::Builder::BuildAABBTree(parallelBoxes, parallelTree);
+	expectSameTree(serialTree, parallelTree, parallelBoxes, 1u);
+
+	serialBoxes = parallelBoxes = original;
+	MathLib::TreeUtils::Builder::BuildKDTree(serialBoxes, serialTree, nullptr, serialPolicy);
+	MathLib::TreeUtils::Builder::BuildKDTree(parallelBoxes, parallelTree);
+	expectSameTree(serialTree, parallelTree, parallelBoxes, 1u);
+	// the median split keeps the KD tree balanced
+	EXPECT_LE(MathLib::TreeUtils::EvaluateTree(parallelTree).mMaxDepth, 16u);
+
+	serialBoxes = parallelBoxes = original;
+	std::vector<uint32_t> serialIndices, primitiveIndices;
+	MathLib::TreeUtils::Builder::BuildSAHBVH(serialBoxes, serialTree, settings, &serialIndices, serialPolicy);
+	MathLib::TreeUtils::Builder::BuildSAHBVH(parallelBoxes, parallelTree, settings, &primitiveIndices);
+	expectSameTree(serialTree, parallelTree, parallelBoxes, settings.mMaxLeafSize);
+	EXPECT_EQ(serialIndices, primitiveIndices);
+	for (uint32_t i = 0; i < parallelBoxes.size(); i++)
+		ASSERT_TRUE(parallelBoxes[i].isApprox(original[primitiveIndices[i]]));
+}
+
+TEST(AccelerateTest, AcceleratorSAHType)
+{
+	std::vector<MathLib::HAABBox3D> boxes = MakeClusteredBoxes(1000, 2);
+	MathLib::Accelerator3D accelerator;
+	MathLib::SAHBuildSettings settings;
+	settings.mMaxLeafSize = 8;
+	accelerator.SetSAHSettings(settings);
+	accelerator.SetType(MathLib::AcceleratorType::eSAHBVH);
+	accelerator.Build(boxes);
+	ASSERT_FALSE(accelerator.GetTree().empty());
+	ExpectValidBVH(accelerator.GetTree(), accelerator.GetBoxes(), 8u);
+	for (uint32_t i = 0; i < boxes.size(); i++)
+		ASSERT_TRUE(accelerator.GetBoxes()[i].isApprox(boxes[accelerator.GetPrimitiveIndices()[i]]));
+}
+
+TEST(AccelerateTest, LBVHStructure)
+{
+	const std::vector<MathLib::HAABBox3D> original = MakeClusteredBoxes(20000, 5);
+	MathLib::SAHBuildSettings costs;
+	for (const bool wideCodes : {false, true})
+	{
+		std::vector<MathLib::HAABBox3D> boxes = original;
+		std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> nodes;
+		std::vector<uint32_t> primitiveIndices;
+		MathLib::LBVHBuildSettings settings;
+		settings.mWideMortonCodes = wideCodes;
+		MathLib::TreeUtils::Builder::BuildLBVH(boxes, nodes, settings, &primitiveIndices);
+		ASSERT_EQ(nodes.size(), 2 * original.size() - 1);
+		ExpectValidBVH(nodes, boxes, 1u);
+		ASSERT_EQ(primitiveIndices.size(), original.size());
+		for (uint32_t i = 0; i < boxes.size(); i++)
+			ASSERT_TRUE(boxes[i].isApprox(original[primitiveIndices[i]]));
+
+		// treelet restructuring only moves inner nodes and lowers the SAH cost
+		const MathLib::HReal linearCost = MathLib::TreeUtils::EvaluateTree(nodes, costs).mSAHCost;
+		std::vector<MathLib::HAABBox3D> optimizedBoxes = original;
+		std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> optimizedNodes;
+		settings.mTreeletPasses = 2;
+		MathLib::TreeUtils::Builder::BuildLBVH(optimizedBoxes, optimizedNodes, settings);
+		ASSERT_EQ(optimizedNodes.size(), nodes.size());
+		ExpectValidBVH(optimizedNodes, optimizedBoxes, 1u);
+		EXPECT_LT(MathLib::TreeUtils::EvaluateTree(optimizedNodes, costs).mSAHCost, linearCost * 0.95f);
+	}
+
+	// the restructuring works on any tree in the BVH layout
+	std::vector<MathLib::HAABBox3D> boxes = original;
+	std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> nodes;
+	MathLib::TreeUtils::Builder::BuildAABBTree(boxes, nodes);
+	const MathLib::HReal aabbCost = MathLib::TreeUtils::EvaluateTree(nodes, costs).mSAHCost;
+	MathLib::TreeUtils::Builder::OptimizeTreelets(nodes, 5u, costs, MathLib::Parallel::ExecutionPolicy::Serial());
+	ExpectValidBVH(nodes, boxes, 1u);
+	EXPECT_LT(MathLib::TreeUtils::EvaluateTree(nodes, costs).mSAHCost, aabbCost);
+}
+
+TEST(AccelerateTest, LBVHDegenerateInput)
+{
+	// identical centers give identical codes, the index breaks the ties
+	std::vector<MathLib::HAABBox3D> boxes(37, MathLib::HAABBox3D(MathLib::HVector3::Zero(), MathLib::HVector3::Ones()));
+	std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> nodes;
+	MathLib::TreeUtils::Builder::BuildLBVH(boxes, nodes);
+	ASSERT_EQ(nodes.size(), 73u);
+	ExpectValidBVH(nodes, boxes, 1u);
+
+	std::vector<MathLib::HAABBox3D> single(1, boxes[0]);
+	MathLib::TreeUtils::Builder::BuildLBVH(single, nodes);
+	ASSERT_EQ(nodes.size(), 1u);
+	EXPECT_TRUE(nodes[0].IsLeaf());
+
+	std::vector<MathLib::HAABBox3D> empty;
+	MathLib::TreeUtils::Builder::BuildLBVH(empty, nodes);
+	EXPECT_TRUE(nodes.empty());
+
+	std::vector<MathLib::HAABBox2D> boxes2D;
+	for (int i = 0; i < 500; i++)
+		boxes2D.emplace_back(MathLib::HVector2(i % 23, i / 23), MathLib::HVector2(i % 23 + 0.5f, i / 23 + 0.5f));
+	std::vector<MathLib::TreeNode<MathLib::HAABBox2D>> nodes2D;
+	MathLib::LBVHBuildSettings settings;
+	settings.mTreeletPasses = 1;
+	MathLib::Accelerator2D accelerator;
+	accelerator.SetLBVHSettings(settings);
+	accelerator.SetType(MathLib::AcceleratorType::eLBVH);
+	accelerator.Build(boxes2D);
+	ASSERT_EQ(accelerator.GetTree().size(), 999u);
+	ExpectValidBVH(accelerator.GetTree(), accelerator.GetBoxes(), 1u);
+}
+
+TEST(AccelerateTest, LooseTreeStructure)
+{
+	typedef std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> Tree;
+	// a huge box over the whole scene cannot sink into any child cell
+	std::vector<MathLib::HAABBox3D> original = MakeClusteredBoxes(20000, 6);
+	const uint32_t hugeBox = static_cast<uint32_t>(original.size());
+	original.emplace_back(MathLib::HVector3::Constant(-10.f), MathLib::HVector3::Constant(110.f));
+
+	MathLib::LooseTreeBuildSettings settings;
+	std::vector<MathLib::HAABBox3D> boxes = original;
+	Tree nodes;
+	std::vector<uint32_t> primitiveIndices;
+	MathLib::TreeUtils::Builder::BuildOctTree(boxes, nodes, settings, &primitiveIndices);
+	// every leaf holds a box, so the tree stays linear in the box count
+	ASSERT_LT(nodes.size(), 2 * original.size());
+	ExpectValidBVH(nodes, boxes, UINT32_MAX);
+	for (uint32_t i = 0; i < boxes.size(); i++)
+		ASSERT_TRUE(boxes[i].isApprox(original[primitiveIndices[i]]));
+	// an octree level is three binary levels plus one for the large boxes it keeps
+	const MathLib::TreeUtils::TreeQuality quality = MathLib::TreeUtils::EvaluateTree(nodes);
+	EXPECT_LE(quality.mMaxDepth, 4 * settings.mMaxDepth + 1);
+
+	// the huge box stays in the leaf next to the root children
+	const uint32_t hugeSlot = static_cast<uint32_t>(std::find(primitiveIndices.begin(), primitiveIndices.end(), hugeBox) - primitiveIndices.begin());
+	ASSERT_FALSE(nodes[0].IsLeaf());
+	bool hugeAtRoot = false;
+	for (uint32_t child = nodes[0].m_Index; child < nodes[0].m_Index + 2; child++)
+		hugeAtRoot |= nodes[child].IsLeaf() && nodes[child].m_Index <= hugeSlot && hugeSlot < nodes[child].m_End;
+	EXPECT_TRUE(hugeAtRoot);
+
+	// the limits are honoured and change the tree
+	MathLib::LooseTreeBuildSettings coarse;
+	coarse.mMaxDepth = 3;
+	coarse.mMinSize = 32;
+	std::vector<MathLib::HAABBox3D> coarseBoxes = original;
+	Tree coarseNodes;
+	MathLib::TreeUtils::Builder::BuildOctTree(coarseBoxes, coarseNodes, coarse);
+	ExpectValidBVH(coarseNodes, coarseBoxes, UINT32_MAX);
+	EXPECT_LE(MathLib::TreeUtils::EvaluateTree(coarseNodes).mMaxDepth, 4 * coarse.mMaxDepth + 1);
+	EXPECT_LT(coarseNodes.size(), nodes.size() / 4);
+
+	// the build is deterministic under any policy
+	std::vector<MathLib::HAABBox3D> serialBoxes = original;
+	Tree serialNodes;
+	MathLib::TreeUtils::Builder::BuildOctTree(serialBoxes, serialNodes, settings, nullptr, MathLib::Parallel::ExecutionPolicy::Serial());
+	ASSERT_EQ(serialNodes.size(), nodes.size());
+	for (uint32_t i = 0; i < nodes.size(); i++)
+	{
+		ASSERT_EQ(serialNodes[i].m_Index, nodes[i].m_Index);
+		ASSERT_EQ(serialNodes[i].m_End, nodes[i].m_End);
+	}
+	for (uint32_t i = 0; i < boxes.size(); i++)
+		ASSERT_TRUE(serialBoxes[i].isApprox(boxes[i]));
+
+	// coincident points end up in one leaf once the depth limit stops the halving
+	std::vector<MathLib::HAABBox3D> points(100, MathLib::HAABBox3D(MathLib::HVector3::Ones(), MathLib::HVector3::Ones()));
+	for (int i = 0; i < 100; i++)
+		points.emplace_back(MathLib::HVector3(i % 5, i / 5 % 5, i / 25), MathLib::HVector3(i % 5, i / 5 % 5, i / 25));
+	MathLib::LooseTreeBuildSettings single;
+	single.mMinSize = 1;
+	MathLib::TreeUtils::Builder::BuildOctTree(points, nodes, single);
+	ExpectValidBVH(nodes, points, UINT32_MAX);
+	uint32_t largestLeaf = 0;
+	for (const MathLib::TreeNode<MathLib::HAABBox3D>& node : nodes)
+		if (node.IsLeaf())
+			largestLeaf = std::max(largestLeaf, node.m_End - node.m_Index);
+	EXPECT_EQ(largestLeaf, 101u);
+
+	std::vector<MathLib::HAABBox2D> boxes2D;
+	for (int i = 0; i < 500; i++)
+		boxes2D.emplace_back(MathLib::HVector2(i % 23, i / 23), MathLib::HVector2(i % 23 + 0.5f, i / 23 + 0.5f));
+	std::vector<MathLib::TreeNode<MathLib::HAABBox2D>> nodes2D;
+	MathLib::TreeUtils::Builder::BuildQuadTree(boxes2D, nodes2D);
+	ASSERT_LT(nodes2D.size(), 2 * boxes2D.size());
+	ExpectValidBVH(nodes2D, boxes2D, MathLib::LooseTreeBuildSettings().mMinSize);
+}
+
+namespace
+{
+	template <class BBox>
+	void ExpectQueriesMatchBruteForce(const std::vector<BBox>& boxes, const std::vector<typename BBox::VectorType>& points)
+	{
+		typedef typename BBox::VectorType Vector;
+		const MathLib::AcceleratorType types[] = {MathLib::AcceleratorType::eBVH, MathLib::AcceleratorType::eAABB, MathLib::AcceleratorType::eKDTree,
+												  MathLib::AcceleratorType::eSAHBVH, MathLib::AcceleratorType::eLBVH,
+												  BBox::AmbientDimAtCompileTime == 2 ? MathLib::AcceleratorType::eQuadTree : MathLib::AcceleratorType::eOctTree};
+		MathLib::Accelerator<BBox> accelerator;
+		accelerator.Build(boxes);
+		for (const MathLib::AcceleratorType type : types)
+		{
+			accelerator.SetType(type);
+			std::vector<uint32_t> found, expected;
+			std::vector<std::pair<MathLib::HReal, uint32_t>> nearest;
+			for (uint32_t q = 0; q + 1 < points.size(); q++)
+			{
+				const Vector& point = points[q];
+				const BBox query(point.cwiseMin(points[q + 1]), point.cwiseMax(points[q + 1]));
+
+				expected.clear();
+				for (uint32_t i = 0; i < boxes.size(); i++)
+					if (boxes[i].intersects(query))
+						expected.push_back(i);
+				accelerator.QueryOverlaps(query, found);
+				std::sort(found.begin(), found.end());
+				ASSERT_EQ(found, expected);
+
+				expected.clear();
+				for (uint32_t i = 0; i < boxes.size(); i++)
+					if (boxes[i].contains(point))
+						expected.push_back(i);
+				accelerator.QueryPoint(point, found);
+				std::sort(found.begin(), found.end());
+				ASSERT_EQ(found, expected);
+
+				// rays from the point towards the next one, the distance to it is the ray length
+				const Vector direction = points[q + 1] - point;
+				MathLib::HReal expectedT = H_REAL_MAX;
+				for (const BBox& box : boxes)
+				{
+					MathLib::HReal t;
+					if (MathLib::TreeUtils::_Private::RayEntersBox(point, Vector(direction.cwiseInverse()), box, MathLib::HReal(1), t))
+						expectedT = std::min(expectedT, t);
+				}
+				MathLib::RayHit hit;
+				ASSERT_EQ(accelerator.RayCastClosest(point, direction, hit, 1.f), expectedT != H_REAL_MAX);
+				ASSERT_EQ(accelerator.RayCastAny(point, direction, 1.f), expectedT != H_REAL_MAX);
+				if (expectedT != H_REAL_MAX)
+				{
+					EXPECT_NEAR(hit.mT, expectedT, 1e-5f);
+					EXPECT_LT(boxes[hit.mIndex].squaredExteriorDistance(point + direction * hit.mT), 1e-4f);
+				}
+
+				std::vector<std::pair<MathLib::HReal, uint32_t>> distances(boxes.size());
+				for (uint32_t i = 0; i < boxes.size(); i++)
+					distances[i] = std::make_pair(boxes[i].squaredExteriorDistance(point), i);
+				std::sort(distances.begin(), distances.end());
+				std::pair<MathLib::HReal, uint32_t> closest;
+				ASSERT_TRUE(accelerator.Nearest(point, closest));
+				EXPECT_EQ(closest.first, distances[0].first);
+				EXPECT_EQ(boxes[closest.second].squaredExteriorDistance(point), distances[0].first);
+
+				const uint32_t k = 1 + q % 9;
+				ASSERT_EQ(accelerator.KNearest(point, k, nearest), k);
+				for (uint32_t i = 0; i < k; i++)
+				{
+					EXPECT_EQ(nearest[i].first, distances[i].first);
+					EXPECT_EQ(boxes[nearest[i].second].squaredExteriorDistance(point), nearest[i].first);
+				}
+				// a radius limit drops the farther boxes
+				const MathLib::HReal radius = std::sqrt(distances[k - 1].first) * 0.5f;
+				uint32_t inside = 0;
+				while (inside < k && distances[inside].first <= radius * radius)
+					inside++;
+				EXPECT_EQ(accelerator.KNearest(point, k, nearest, radius), inside);
+			}
+		}
+	}
+}
+
+TEST(AccelerateTest, AcceleratorQueries)
+{
+	std::mt19937 random(8);
+	std::uniform_real_distribution<MathLib::HReal> unit(0.f, 1.f);
+	std::vector<MathLib::HVector3> points3D(200);
+	for (MathLib::HVector3& point : points3D)
+		point = MathLib::HVector3(unit(random), unit(random), unit(random)) * 110.f - MathLib::HVector3::Constant(5.f);
+	ExpectQueriesMatchBruteForce(MakeClusteredBoxes(3000, 6), points3D);
+
+	std::vector<MathLib::HAABBox2D> boxes2D;
+	std::vector<MathLib::HVector2> points2D(200);
+	for (uint32_t i = 0; i < 2000; i++)
+	{
+		const MathLib::HVector2 corner(unit(random) * 100.f, unit(random) * 100.f);
+		boxes2D.emplace_back(corner, MathLib::HVector2(corner + MathLib::HVector2(unit(random), unit(random)) * 3.f));
+	}
+	for (MathLib::HVector2& point : points2D)
+		point = MathLib::HVector2(unit(random), unit(random)) * 110.f - MathLib::HVector2::Constant(5.f);
+	ExpectQueriesMatchBruteForce(boxes2D, points2D);
+}
+
+TEST(AccelerateTest, TreeQueriesStopAndCustomPrimitives)
+{
+	// spheres inside their boxes: the exact primitive tests must win over the box tests
+	std::vector<MathLib::HVector3> centers;
+	for (int z = 0; z < 10; z++)
+		for (int y = 0; y < 10; y++)
+			for (int x = 0; x < 10; x++)
+				centers.emplace_back(x * 3.f, y * 3.f, z * 3.f);
+	const MathLib::HReal radius = 1.f;
+	std::vector<MathLib::HAABBox3D> boxes;
+	for (const MathLib::HVector3& center : centers)
+		boxes.emplace_back(center - MathLib::HVector3::Constant(radius), center + MathLib::HVector3::Constant(radius));
+	MathLib::Accelerator3D accelerator;
+	accelerator.SetType(MathLib::AcceleratorType::eSAHBVH);
+	accelerator.Build(boxes);
+
+	auto sphereDistance = [&](uint32_t index)
+	{
+		const MathLib::HReal distance = std::max((centers[index] - MathLib::HVector3(1.5f, 1.5f, 1.5f)).norm() - radius, MathLib::HReal(0));
+		return distance * distance;
+	};
+	std::pair<MathLib::HReal, uint32_t> nearest;
+	ASSERT_TRUE(accelerator.Nearest(MathLib::HVector3(1.5f, 1.5f, 1.5f), nearest, H_REAL_MAX, sphereDistance));
+	EXPECT_NEAR(nearest.first, std::pow(std::sqrt(3.f * 1.5f * 1.5f) - 1.f, 2.f), 1e-4f);
+	EXPECT_FALSE(accelerator.Nearest(MathLib::HVector3(1.5f, 1.5f, 1.5f), nearest, 0.5f, sphereDistance));
+
+	// a ray along the box corners misses every sphere, the box test would not
+	const MathLib::HVector3 origin(-5.f, 1.f, 1.f), direction(1.f, 0.f, 0.f);
+	auto sphereHit = [&](uint32_t index, MathLib::HReal tMax, MathLib::HReal& t)
+	{
+		const MathLib::HVector3 toCenter = centers[index] - origin;
+		const MathLib::HReal along = toCenter.dot(direction);
+		const MathLib::HReal sqOffset = toCenter.squaredNorm() - along * along;
+		if (sqOffset > radius * radius)
+			return false;
+		t = along - std::sqrt(radius * radius - sqOffset);
+		return t >= 0 && t <= tMax;
+	};
+	MathLib::RayHit hit;
+	EXPECT_TRUE(accelerator.RayCastClosest(origin, direction, hit));
+	EXPECT_FALSE(accelerator.RayCastClosest(origin, direction, hit, H_REAL_MAX, sphereHit));
+	EXPECT_FALSE(accelerator.RayCastAny(origin, direction, H_REAL_MAX, sphereHit));
+	const MathLib::HVector3 centerRow(-5.f, 3.f, 3.f);
+	ASSERT_TRUE(accelerator.RayCastClosest(centerRow, direction, hit, H_REAL_MAX, [&](uint32_t index, MathLib::HReal tMax, MathLib::HReal& t)
+										   {
+		const MathLib::HVector3 toCenter = centers[index] - centerRow;
+		const MathLib::HReal along = toCenter.dot(direction);
+		const MathLib::HReal sqOffset = toCenter.squaredNorm() - along * along;
+		t = along - std::sqrt(std::max(radius * radius - sqOffset, MathLib::HReal(0)));
+		return sqOffset <= radius * radius && t >= 0 && t <= tMax; }));
+	EXPECT_TRUE(centers[hit.mIndex].isApprox(MathLib::HVector3(0.f, 3.f, 3.f)));
+	EXPECT_NEAR(hit.mT, 4.f, 1e-5f);
+
+	// a bool visitor stops the walk
+	uint32_t visited = 0;
+	accelerator.QueryOverlaps(MathLib::HAABBox3D(MathLib::HVector3::Constant(-10.f), MathLib::HVector3::Constant(40.f)), [&](uint32_t)
+							  { return ++visited < 5; });
+	EXPECT_EQ(visited, 5u);
+
+	// the fixed Intersect prunes by the node boxes instead of reporting every leaf
+	EXPECT_TRUE(MathLib::TreeUtils::Intersect(accelerator.GetTree(), MathLib::HAABBox3D(MathLib::HVector3::Constant(0.5f), MathLib::HVector3::Constant(0.6f))));
+	EXPECT_FALSE(MathLib::TreeUtils::Intersect(accelerator.GetTree(), MathLib::HAABBox3D(MathLib::HVector3::Constant(50.f), MathLib::HVector3::Constant(60.f))));
+
+	MathLib::Accelerator2D empty;
+	std::vector<uint32_t> indices;
+	EXPECT_FALSE(empty.QueryOverlaps(MathLib::HAABBox2D(MathLib::HVector2::Zero(), MathLib::HVector2::Ones()), indices));
+	EXPECT_FALSE(empty.RayCastAny(MathLib::HVector2::Zero(), MathLib::HVector2::UnitX()));
+	EXPECT_FALSE(empty.Nearest(MathLib::HVector2::Zero(), nearest));
+}
+
+namespace
+{
+	// every live index sits in exactly one leaf with its current box, inside the boxes of all its ancestors
+	template <class BBox>
+	void ExpectValidAccelerator(const MathLib::Accelerator<BBox>& accelerator, const std::vector<BBox>& boxes, const std::vector<bool>& live)
+	{
+		const std::vector<MathLib::TreeNode<BBox>>& nodes = accelerator.GetTree();
+		std::vector<uint32_t> covered(boxes.size(), 0);
+		std::vector<uint32_t> stack;
+		if (!nodes.empty())
+			stack.push_back(0u);
+		while (!stack.empty())
+		{
+			const MathLib::TreeNode<BBox>& node = nodes[stack.back()];
+			stack.pop_back();
+			if (node.IsLeaf())
+			{
+				for (uint32_t slot = node.m_Index; slot < node.m_End; slot++)
+				{
+					const uint32_t index = accelerator.GetPrimitiveIndices()[slot];
+					ASSERT_LT(index, boxes.size());
+					covered[index]++;
+					EXPECT_TRUE(accelerator.GetBoxes()[slot].isApprox(boxes[index]));
+					EXPECT_TRUE(node.m_bbox.contains(boxes[index]));
+				}
+				continue;
+			}
+			for (uint32_t child = node.m_Index; child < node.m_Index + 2; child++)
+			{
+				EXPECT_TRUE(node.m_bbox.contains(nodes[child].m_bbox));
+				stack.push_back(child);
+			}
+		}
+		for (uint32_t index = 0; index < boxes.size(); index++)
+			ASSERT_EQ(covered[index], live[index] ? 1u : 0u);
+	}
+}
+
+TEST(AccelerateTest, DeepTreeQuery)
+{
+	// a hand-built chain far deeper than TRAVERSAL_STACK_SIZE: every level leaves its leaf on the stack and descends
+	// into the inner child, so the query only stays correct if the stack spills instead of overflowing
+	const uint32_t depth = 4 * MathLib::TRAVERSAL_STACK_SIZE;
+	const MathLib::HAABBox3D unit(MathLib::HVector3::Zero(), MathLib::HVector3::Ones());
+	std::vector<MathLib::HAABBox3D> boxes(depth + 1, unit);
+	std::vector<MathLib::TreeNode<MathLib::HAABBox3D>> nodes;
+	for (uint32_t level = 0; level < depth; level++)
+	{
+		// inner node 2 * level, its leaf at 2 * level + 1, the next inner node at 2 * level + 2
+		nodes.emplace_back(unit, 2 * level + 1);
+		nodes.emplace_back(unit, level, level + 1);
+	}
+	nodes.emplace_back(unit, depth, depth + 1);
+
+	std::vector<uint32_t> visited(boxes.size(), 0);
+	EXPECT_TRUE(MathLib::TreeUtils::QueryOverlaps(nodes, boxes, unit, [&](uint32_t slot)
+												  { visited[slot]++; }));
+	for (uint32_t slot = 0; slot < boxes.size(); slot++)
+		ASSERT_EQ(visited[slot], 1u) << "Slot " << slot;
+}
+
+TEST(AccelerateTest, AcceleratorRefit)
+{
+	std::vector<MathLib::HAABBox3D> boxes = MakeClusteredBoxes(20000, 9);
+	const std::vector<bool> live(boxes.size(), true);
+	for (const MathLib::AcceleratorType type : {MathLib::AcceleratorType::eSAHBVH, MathLib::AcceleratorType::eLBVH, MathLib::AcceleratorType::eOctTree})
+	{
+		MathLib::Accelerator3D accelerator;
+		accelerator.SetType(type);
+		accelerator.Build(boxes);
+		std::vector<MathLib::HAABBox3D> moved = boxes;
+		for (uint32_t i = 0; i < moved.size(); i++)
+			moved[i].translate(MathLib::HVector3(std::sin(i * 0.1f), std::cos(i * 0.3f), 0.5f) * 3.f);
+		accelerator.Refit(moved);
+		ExpectValidAccelerator(accelerator, moved, live);
+
+		// refitting to the original boxes restores the original bounds exactly
+		accelerator.Refit(boxes, MathLib::Parallel::ExecutionPolicy::Serial());
+		MathLib::Accelerator3D rebuilt;
+		rebuilt.SetType(type);
+		rebuilt.Build(boxes);
+		ASSERT_EQ(accelerator.GetTree().size(), rebuilt.GetTree().size());
+		for (uint32_t i = 0; i < rebuilt.GetTree().size(); i++)
+			ASSERT_TRUE(accelerator.GetTree()[i].m_bbox.isApprox(rebuilt.GetTree()[i].m_bbox));
+	}
+}
+
+TEST(AccelerateTest, AcceleratorInsertRemove)
+{
+	std::mt19937 random(10);
+	std::uniform_real_distribution<MathLib::HReal> unit(0.f, 1.f);
+	auto randomBox = [&]()
+	{
+		const MathLib::HVector3 corner = MathLib::HVector3(unit(random), unit(random), unit(random)) * 100.f;
+		return MathLib::HAABBox3D(corner, MathLib::HVector3(corner + MathLib::HVector3(unit(random), unit(random), unit(random)) * 2.f));
+	};
+	std::vector<MathLib::HAABBox3D> boxes = MakeClusteredBoxes(2000, 11);
+	std::vector<bool> live(boxes.size(), true);
+	MathLib::Accelerator3D accelerator;
+	MathLib::SAHBuildSettings settings;
+	settings.mMaxLeafSize = 4;
+	accelerator.SetSAHSettings(settings);
+	accelerator.SetType(MathLib::AcceleratorType::eSAHBVH);
+	accelerator.Build(boxes);
+
+	for (uint32_t step = 0; step < 6000; step++)
+	{
+		const uint32_t index = uint32_t(unit(random) * boxes.size()) % boxes.size();
+		if (unit(random) < 0.45f && live[index])
+		{
+			accelerator.Remove(index);
+			live[index] = false;
+			continue;
+		}
+		const MathLib::HAABBox3D box = randomBox();
+		const uint32_t inserted = accelerator.Insert(box);
+		if (inserted == boxes.size())
+		{
+			boxes.push_back(box);
+			live.push_back(false);
+		}
+		ASSERT_FALSE(live[inserted]);
+		boxes[inserted] = box;
+		live[inserted] = true;
+	}
+	ExpectValidAccelerator(accelerator, boxes, live);
+
+	std::vector<uint32_t> found, expected;
+	for (uint32_t q = 0; q < 100; q++)
+	{
+		const MathLib::HAABBox3D query = randomBox();
+		expected.clear();
+		for (uint32_t i = 0; i < boxes.size(); i++)
+			if (live[i] && boxes[i].intersects(query))
+				expected.push_back(i);
+		accelerator.QueryOverlaps(query, found);
+		std::sort(found.begin(), found.end());
+		ASSERT_EQ(found, expected);
+	}
+
+	// the rotations keep the incrementally grown tree close to a rebuilt one
+	const MathLib::HReal dynamicCost = MathLib::TreeUtils::EvaluateTree(accelerator.GetTree()).mSAHCost;
+	accelerator.SetType(MathLib::AcceleratorType::eSAHBVH);
+	ExpectValidAccelerator(accelerator, boxes, live);
+	EXPECT_LT(dynamicCost, MathLib::TreeUtils::EvaluateTree(accelerator.GetTree()).mSAHCost * 2.f);
+
+	// removing everything leaves an empty tree that still takes new boxes
+	for (uint32_t i = 0; i < boxes.size(); i++)
+		if (live[i])
+			accelerator.Remove(i);
+	EXPECT_TRUE(accelerator.GetTree().empty());
+	const uint32_t index = accelerator.Insert(boxes[0]);
+	std::pair<MathLib::HReal, uint32_t> nearest;
+	ASSERT_TRUE(accelerator.Nearest(boxes[0].center(), nearest));
+	EXPECT_EQ(nearest.second, index);
+}
+
+TEST(AccelerateTest, OverlappingPairs)
+{
+	const std::vector<MathLib::HAABBox3D> first = MakeClusteredBoxes(6000, 12), second = MakeClusteredBoxes(3000, 13);
+	std::vector<std::pair<uint32_t, uint32_t>> expectedSelf, expectedCross;
+	for (uint32_t i = 0; i < first.size(); i++)
+	{
+		for (uint32_t j = i + 1; j < first.size(); j++)
+			if (first[i].intersects(first[j]))
+				expectedSelf.emplace_back(i, j);
+		for (uint32_t j = 0; j < second.size(); j++)
+			if (first[i].intersects(second[j]))
+				expectedCross.emplace_back(i, j);
+	}
+	ASSERT_FALSE(expectedSelf.empty());
+	ASSERT_FALSE(expectedCross.empty());
+
+	// leaves of several boxes and trees of different shapes on both sides
+	MathLib::SAHBuildSettings settings;
+	settings.mMaxLeafSize = 4;
+	std::vector<std::pair<uint32_t, uint32_t>> pairs;
+	for (const MathLib::AcceleratorType type : {MathLib::AcceleratorType::eSAHBVH, MathLib::AcceleratorType::eLBVH, MathLib::AcceleratorType::eKDTree})
+	{
+		MathLib::Accelerator3D firstAccelerator, secondAccelerator;
+		firstAccelerator.SetSAHSettings(settings);
+		firstAccelerator.SetType(type);
+		firstAccelerator.Build(first);
+		secondAccelerator.Build(second);
+		firstAccelerator.FindOverlappingPairs(pairs);
+		ASSERT_EQ(pairs, expectedSelf);
+		firstAccelerator.FindOverlappingPairs(pairs, MathLib::Parallel::ExecutionPolicy::Serial());
+		ASSERT_EQ(pairs, expectedSelf);
+		firstAccelerator.FindOverlappingPairs(secondAccelerator, pairs);
+		ASSERT_EQ(pairs, expectedCross);
+	}
+
+	MathLib::Accelerator3D empty, single;
+	single.Build(std::vector<MathLib::HAABBox3D>(1, first[0]));
+	single.FindOverlappingPairs(pairs);
+	EXPECT_TRUE(pairs.empty());
+	empty.FindOverlappingPairs(single, pairs);
+	EXPECT_TRUE(pairs.empty());
+}
+
+namespace
+{
+	// a flattened tree reports the same slots and hits as the TreeUtils queries on the binary nodes it came from
+	template <class BBox, class Flattened>
+	void ExpectQueriesMatchTree(const std::vector<MathLib::TreeNode<BBox>>& nodes, const std::vector<BBox>& boxes, const std::vector<BBox>& queries,
+								const Flattened& flattened)
+	{
+		typedef typename BBox::VectorType Vector;
+		std::vector<uint32_t> expected, found;
+		for (const BBox& query : queries)
+		{
+			expected.clear();
+			found.clear();
+			MathLib::TreeUtils::QueryOverlaps(nodes, boxes, query, [&](uint32_t slot)
+											  { expected.push_back(slot); });
+			flattened.QueryOverlaps(boxes, query, [&](uint32_t slot)
+									{ found.push_back(slot); });
+			std::sort(expected.begin(), expected.end());
+			std::sort(found.begin(), found.end());
+			ASSERT_EQ(found, expected);
+
+			found.clear();
+			flattened.QueryPoint(boxes, query.center(), [&](uint32_t slot)
+								 { found.push_back(slot); });
+			for (const uint32_t slot : found)
+				EXPECT_TRUE(boxes[slot].contains(query.center()));
+
+			// rays from the query corner towards the center of the scene
+			const Vector origin = query.min();
+			const Vector direction = (nodes[0].m_bbox.center() - origin).normalized();
+			const Vector inverseDirection = direction.cwiseInverse();
+			auto boxHit = [&](uint32_t slot, MathLib::HReal tMax, MathLib::HReal& t)
+			{ return MathLib::TreeUtils::_Private::RayEntersBox(origin, inverseDirection, boxes[slot], tMax, t); };
+			MathLib::RayHit expectedHit, hit;
+			const bool hitTree = MathLib::TreeUtils::RayCastClosest(nodes, origin, direction, expectedHit, H_REAL_MAX, boxHit);
+			ASSERT_EQ(flattened.RayCastClosest(origin, direction, hit, H_REAL_MAX, boxHit), hitTree);
+			EXPECT_EQ(hit.mT, expectedHit.mT);
+			EXPECT_EQ(flattened.RayCastAny(origin, direction, H_REAL_MAX, boxHit), hitTree);
+		}
+	}
+
+	// depth-first layout of the compact formats, then the queries
+	template <class Compact, class BBox>
+	void ExpectCompactMatchesTree(const std::vector<MathLib::TreeNode<BBox>>& nodes, const std::vector<BBox>& boxes, const std::vector<BBox>& queries)
+	{
+		Compact compact;
+		ASSERT_TRUE(compact.Flatten(nodes));
+		ASSERT_EQ(compact.GetNodes().size(), nodes.size());
+
+		// depth first with the first child next to its parent, every node inside its parent, every slot in one leaf
+		std::vector<uint32_t> covered(boxes.size(), 0);
+		std::vector<std::pair<uint32_t, BBox>> stack(1, std::make_pair(0u, compact.GetRootBox()));
+		while (!stack.empty())
+		{
+			const std::pair<uint32_t, BBox> entry = stack.back();
+			stack.pop_back();
+			const auto& node = compact.GetNodes()[entry.first];
+			const BBox box = node.GetBox(entry.second);
+			// the float format rounds the root outwards in double builds, inner nodes stay inside their decoded parents
+			EXPECT_TRUE(entry.first == 0 || entry.second.contains(box));
+			if (node.IsLeaf())
+			{
+				for (uint32_t slot = node.First(); slot < node.First() + node.Count(); slot++)
+				{
+					covered[slot]++;
+					EXPECT_TRUE(box.contains(boxes[slot]));
+				}
+				continue;
+			}
+			EXPECT_GT(node.SecondChild(), entry.first + 1);
+			stack.emplace_back(entry.first + 1, box);
+			stack.emplace_back(node.SecondChild(), box);
+		}
+		for (const uint32_t count : covered)
+			ASSERT_EQ(count, 1u);
+
+		ExpectQueriesMatchTree(nodes, boxes, queries, compact);
+	}
+}
+
+TEST(AccelerateTest, CompactLayouts)
+{
+	EXPECT_EQ(sizeof(MathLib::CompactNode<3>), 32u);
+	EXPECT_EQ(alignof(MathLib::CompactNode<3>), 32u);
+	EXPECT_EQ(sizeof(MathLib::QuantizedNode<3>), 16u);
+	EXPECT_EQ(sizeof(MathLib::QuantizedNode<2>), 12u);
+
+	const std::vector<MathLib::HAABBox3D> boxes = MakeClusteredBoxes(3000, 21);
+	std::vector<MathLib::HAABBox3D> queries = MakeClusteredBoxes(300, 22);
+	for (MathLib::HAABBox3D& query : queries)
+		query = MathLib::HAABBox3D(query.center() - MathLib::HVector3::Constant(1.5f), query.center() + MathLib::HVector3::Constant(1.5f));
+	MathLib::LBVHBuildSettings lbvhSettings;
+	lbvhSettings.mTreeletPasses = 2;
+	const std::function<void(std::vector<MathLib::HAABBox3D>&, MathLib::BVHTree3D&)> builders[] = {
+		[](std::vector<MathLib::HAABBox3D>& b, MathLib::BVHTree3D& n)
+		{ MathLib::TreeUtils::Builder::BuildBVH(b, n); },
+		[](std::vector<MathLib::HAABBox3D>& b, MathLib::BVHTree3D& n)
+		{ MathLib::TreeUtils::Builder::BuildSAHBVH(b, n, MathLib::SAHBuildSettings()); },
+		[&](std::vector<MathLib::HAABBox3D>& b, MathLib::BVHTree3D& n)
+		{ MathLib::TreeUtils::Builder::BuildLBVH(b, n, lbvhSettings); }};
+	for (const auto& build : builders)
+	{
+		std::vector<MathLib::HAABBox3D> tree = boxes;
+		MathLib::BVHTree3D nodes;
+		build(tree, nodes);
+		ExpectCompactMatchesTree<MathLib::CompactBVH3D>(nodes, tree, queries);
+		ExpectCompactMatchesTree<MathLib::QuantizedBVH3D>(nodes, tree, queries);
+	}
+
+	std::mt19937 random(23);
+	std::uniform_real_distribution<MathLib::HReal> unit(0.f, 1.f);
+	std::vector<MathLib::HAABBox2D> boxes2D, queries2D;
+	for (uint32_t i = 0; i < 2000; i++)
+	{
+		const MathLib::HVector2 corner(unit(random) * 100.f, unit(random) * 100.f);
+		boxes2D.emplace_back(corner, MathLib::HVector2(corner + MathLib::HVector2(unit(random), unit(random)) * 3.f));
+		if (i % 10 == 0)
+			queries2D.emplace_back(corner, MathLib::HVector2(corner + MathLib::HVector2::Constant(4.f)));
+	}
+	MathLib::BVHTree2D nodes2D;
+	MathLib::TreeUtils::Builder::BuildSAHBVH(boxes2D, nodes2D, MathLib::SAHBuildSettings());
+	ExpectCompactMatchesTree<MathLib::CompactBVH2D>(nodes2D, boxes2D, queries2D);
+	ExpectCompactMatchesTree<MathLib::QuantizedBVH2D>(nodes2D, boxes2D, queries2D);
+
+	// a leaf too large for the quantized format is refused, the float format takes it
+	MathLib::BVHTree3D bigLeaf(1, MathLib::TreeNode<MathLib::HAABBox3D>(MathLib::MergeBoxes(boxes), 0, 200));
+	MathLib::QuantizedBVH3D quantized;
+	EXPECT_FALSE(quantized.Flatten(bigLeaf));
+	EXPECT_TRUE(quantized.Empty());
+	EXPECT_TRUE(MathLib::CompactBVH3D().Flatten(bigLeaf));
+	EXPECT_TRUE(quantized.Flatten(MathLib::BVHTree3D()));
+}
+
+namespace
+{
+	// every slot in one leaf lane, every lane inside the lane that points at its node, then the queries before and after a refit
+	template <uint32_t Width, class BBox>
+	void ExpectWideMatchesTree(std::vector<MathLib::TreeNode<BBox>> nodes, std::vector<BBox> boxes, const std::vector<BBox>& queries)
+	{
+		typedef MathLib::WideBVH<BBox, Width> Wide;
+		Wide wide(nodes);
+		ASSERT_FALSE(wide.Empty());
+		EXPECT_LT(wide.GetNodes().size(), nodes.size());
+		auto laneBox = [&](const typename Wide::Node& node, uint32_t lane)
+		{
+			BBox box;
+			for (int axis = 0; axis < BBox::AmbientDimAtCompileTime; axis++)
+			{
+				box.min()[axis] = node.mMin[axis][lane];
+				box.max()[axis] = node.mMax[axis][lane];
+			}
+			return box;
+		};
+		std::vector<uint32_t> covered(boxes.size(), 0);
+		std::vector<std::pair<uint32_t, BBox>> stack(1, std::make_pair(0u, nodes[0].m_bbox));
+		while (!stack.empty())
+		{
+			const std::pair<uint32_t, BBox> entry = stack.back();
+			stack.pop_back();
+			const typename Wide::Node& node = wide.GetNodes()[entry.first];
+			uint32_t children = 0;
+			for (uint32_t lane = 0; lane < Width; lane++)
+			{
+				const BBox box = laneBox(node, lane);
+				if (box.isEmpty())
+					continue;
+				children++;
+				EXPECT_TRUE(entry.first == 0 || entry.second.contains(box));
+				if (node.mCount[lane] == Wide::Node::INNER_CHILD)
+				{
+					stack.emplace_back(node.mChild[lane], box);
+					continue;
+				}
+				for (uint32_t slot = node.mChild[lane]; slot < node.mChild[lane] + node.mCount[lane]; slot++)
+				{
+					covered[slot]++;
+					EXPECT_TRUE(box.contains(boxes[slot]));
+				}
+			}
+			EXPECT_GE(children, 2u);
+		}
+		for (const uint32_t count : covered)
+			ASSERT_EQ(count, 1u);
+		ExpectQueriesMatchTree(nodes, boxes, queries, wide);
+
+		// every box moves, the binary tree is refitted and the wide tree follows it
+		std::vector<uint32_t> parents;
+		MathLib::TreeUtils::ComputeParents(nodes, parents);
+		for (uint32_t i = 0; i < boxes.size(); i++)
+			boxes[i].translate(boxes[i].sizes() * (i % 3 == 0 ? 1.5f : -0.5f));
+		MathLib::TreeUtils::Refit(nodes, parents, boxes);
+		wide.Refit(nodes);
+		ExpectQueriesMatchTree(nodes, boxes, queries, wide);
+	}
+}
+
+TEST(AccelerateTest, WideBVH)
+{
+	const std::vector<MathLib::HAABBox3D> boxes = MakeClusteredBoxes(3000, 31);
+	std::vector<MathLib::HAABBox3D> queries = MakeClusteredBoxes(300, 32);
+	for (MathLib::HAABBox3D& query : queries)
+		query = MathLib::HAABBox3D(query.center() - MathLib::HVector3::Constant(1.5f), query.center() + MathLib::HVector3::Constant(1.5f));
+	for (const uint32_t maxLeafSize : {1u, 4u})
+	{
+		MathLib::SAHBuildSettings settings;
+		settings.mMaxLeafSize = maxLeafSize;
+		std::vector<MathLib::HAABBox3D> tree = boxes;
+		MathLib::BVHTree3D nodes;
+		MathLib::TreeUtils::Builder::BuildSAHBVH(tree, nodes, settings);
+		ExpectWideMatchesTree<4>(nodes, tree, queries);
+		ExpectWideMatchesTree<8>(nodes, tree, queries);
+		// widths that only the scalar kernel handles
+		ExpectWideMatchesTree<3>(nodes, tree, queries);
+	}
+	std::vector<MathLib::HAABBox3D> tree = boxes;
+	MathLib::BVHTree3D nodes;
+	MathLib::TreeUtils::Builder::BuildLBVH(tree, nodes);
+	ExpectWideMatchesTree<MathLib::WIDE_BVH_WIDTH>(nodes, tree, queries);
+
+	std::mt19937 random(33);
+	std::uniform_real_distribution<MathLib::HReal> unit(0.f, 1.f);
+	std::vector<MathLib::HAABBox2D> boxes2D, queries2D;
+	for (uint32_t i = 0; i < 2000; i++)
+	{
+		const MathLib::HVector2 corner(unit(random) * 100.f, unit(random) * 100.f);
+		boxes2D.emplace_back(corner, MathLib::HVector2(corner + MathLib::HVector2(unit(random), unit(random)) * 3.f));
+		if (i % 10 == 0)
+			queries2D.emplace_back(corner, MathLib::HVector2(corner + MathLib::HVector2::Constant(4.f)));
+	}
+	MathLib::BVHTree2D nodes2D;
+	MathLib::TreeUtils::Builder::BuildBVH(boxes2D, nodes2D);
+	ExpectWideMatchesTree<4>(nodes2D, boxes2D, queries2D);
+	ExpectWideMatchesTree<8>(nodes2D, boxes2D, queries2D);
+
+	// a single leaf becomes the only child of the wide root
+	MathLib::WideBVH3D single(MathLib::BVHTree3D(1, MathLib::TreeNode<MathLib::HAABBox3D>(MathLib::MergeBoxes(boxes), 0, 10)));
+	uint32_t visited = 0;
+	single.QueryOverlaps(boxes, MathLib::MergeBoxes(boxes), [&](uint32_t)
+						 { visited++; });
+	EXPECT_EQ(visited, 10u);
+
+	// the accelerator walks the wide tree until Insert drops it and Refit collapses it again
+	MathLib::Accelerator3D accelerator;
+	accelerator.Build(boxes);
+	EXPECT_FALSE(accelerator.GetWideTree().Empty());
+	accelerator.Insert(boxes[0]);
+	EXPECT_TRUE(accelerator.GetWideTree().Empty());
+	std::vector<MathLib::HAABBox3D> moved = boxes;
+	moved.push_back(boxes[0]);
+	accelerator.Refit(moved);
+	EXPECT_FALSE(accelerator.GetWideTree().Empty());
+	std::vector<uint32_t> indices;
+	accelerator.QueryPoint(boxes[0].center(), indices);
+	EXPECT_NE(std::find(indices.begin(), indices.end(), uint32_t(boxes.size())), indices.end());
+}
+
+namespace
+{
+	// heightfield over [0, size]^2 on an integer grid, two triangles per cell
+	void MakeHeightfield(const uint32_t size, std::vector<MathLib::HVector3>& vertices, std::vector<MathLib::TriangleIndex<uint32_t>>& triangles)
+	{
+		for (uint32_t z = 0; z <= size; z++)
+			for (uint32_t x = 0; x <= size; x++)
+				vertices.emplace_back(MathLib::HReal(x), 3.f * std::sin(0.3f * x) * std::cos(0.2f * z), MathLib::HReal(z));
+		for (uint32_t z = 0; z < size; z++)
+			for (uint32_t x = 0; x < size; x++)
+			{
+				const uint32_t corner = z * (size + 1) + x;
+				triangles.emplace_back(corner, corner + size + 1, corner + 1);
+				triangles.emplace_back(corner + 1, corner + size + 1, corner + size + 2);
+			}
+	}
+
+	// the packet batches report what the single ray casts of the same tree report
+	void ExpectBatchMatchesSingleRays(const MathLib::TriangleBVH& bvh, const std::vector<MathLib::HVector3>& origins,
+									  const std::vector<MathLib::HVector3>& directions, const MathLib::HReal tMax)
+	{
+		std::vector<MathLib::RayHit> hits;
+		std::vector<uint8_t> occluded;
+		bvh.RayCastClosest(origins, directions, hits, tMax);
+		bvh.RayCastAny(origins, directions, occluded, tMax);
+		ASSERT_EQ(hits.size(), origins.size());
+		ASSERT_EQ(occluded.size(), origins.size());
+		for (size_t i = 0; i < origins.size(); i++)
+		{
+			MathLib::RayHit hit;
+			const bool found = bvh.RayCastClosest(origins[i], directions[i], hit, tMax);
+			ASSERT_EQ(hits[i].mIndex != UINT_MAX, found);
+			EXPECT_EQ(occluded[i] != 0, found);
+			EXPECT_EQ(bvh.RayCastAny(origins[i], directions[i], tMax), found);
+			if (!found)
+				continue;
+			// rays through a shared edge may report either triangle at the same distance
+			EXPECT_FLOAT_EQ(float(hits[i].mT), float(hit.mT));
+			if (hits[i].mIndex != hit.mIndex)
+			{
+				EXPECT_NEAR(hits[i].mT, hit.mT, 1e-4f);
+			}
+		}
+	}
+}
+
+TEST(AccelerateTest, TriangleBVHRayBatches)
+{
+	std::vector<MathLib::HVector3> vertices;
+	std::vector<MathLib::TriangleIndex<uint32_t>> triangles;
+	MakeHeightfield(40, vertices, triangles);
+	const MathLib::TriangleBVH bvh(vertices, triangles);
+	EXPECT_EQ(bvh.GetTriangles().size(), triangles.size());
+
+	// rays aimed at the triangle centroids hit them where the brute force Moller-Trumbore does
+	std::mt19937 random(41);
+	std::uniform_real_distribution<MathLib::HReal> unit(0.f, 1.f);
+	std::vector<MathLib::HVector3> origins, directions;
+	for (uint32_t i = 0; i < 1001; i++)
+	{
+		const MathLib::TriangleIndex<uint32_t>& triangle = triangles[(i * 7919) % triangles.size()];
+		const MathLib::HVector3 target = (vertices[triangle[0]] + vertices[triangle[1]] + vertices[triangle[2]]) / 3.f;
+		origins.emplace_back(unit(random) * 40.f, 10.f + unit(random) * 10.f, unit(random) * 40.f);
+		directions.push_back(target - origins.back());
+	}
+	std::vector<MathLib::RayHit> hits;
+	bvh.RayCastClosest(origins, directions, hits);
+	for (size_t i = 0; i < origins.size(); i++)
+	{
+		MathLib::HReal closest = H_REAL_MAX;
+		for (const MathLib::TriangleIndex<uint32_t>& triangle : triangles)
+		{
+			MathLib::HReal t, u, v;
+			if (MathLib::IntersectionUtils::RayIntersectTriangle(origins[i], directions[i], vertices[triangle[0]], vertices[triangle[1]], vertices[triangle[2]], t, u, v))
+				closest = std::min(closest, t);
+		}
+		ASSERT_NE(hits[i].mIndex, UINT_MAX);
+		EXPECT_NEAR(hits[i].mT, closest, 1e-3f);
+	}
+	ExpectBatchMatchesSingleRays(bvh, origins, directions, H_REAL_MAX);
+	// a shorter tMax turns most of them into misses
+	ExpectBatchMatchesSingleRays(bvh, origins, directions, 0.5f);
+
+	// shadow rays towards one light, from every vertex and from the cell centres: the rays start in the slab planes
+	// of the triangle boxes and some have zero direction components
+	for (const MathLib::HVector3& light : {MathLib::HVector3(1.f, 0.6f, 0.f), MathLib::HVector3(0.f, 1.f, 0.f), MathLib::HVector3(-0.5f, 0.3f, 0.8f)})
+	{
+		std::vector<MathLib::HVector3> shadowOrigins, shadowDirections;
+		for (const MathLib::HVector3& vertex : vertices)
+		{
+			shadowOrigins.push_back(vertex + MathLib::HVector3(0.f, 0.01f, 0.f));
+			shadowOrigins.push_back(vertex + MathLib::HVector3(0.5f, 4.f, 0.5f));
+		}
+		shadowDirections.assign(shadowOrigins.size(), light);
+		ExpectBatchMatchesSingleRays(bvh, shadowOrigins, shadowDirections, H_REAL_MAX);
+	}
+
+	// scattered rays in every direction
+	origins.clear();
+	directions.clear();
+	for (uint32_t i = 0; i < 999; i++)
+	{
+		origins.emplace_back(unit(random) * 60.f - 10.f, unit(random) * 20.f - 5.f, unit(random) * 60.f - 10.f);
+		directions.emplace_back(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f);
+	}
+	ExpectBatchMatchesSingleRays(bvh, origins, directions, H_REAL_MAX);
+
+	MathLib::TriangleBVH empty;
+	empty.RayCastClosest(origins, directions, hits);
+	EXPECT_EQ(hits.size(), origins.size());
+	EXPECT_EQ(std::count_if(hits.begin(), hits.end(), [](const MathLib::RayHit& hit)
+							{ return hit.mIndex != UINT_MAX; }),
+			  0);
+	EXPECT_TRUE(empty.Build(vertices, triangles));
+	EXPECT_FALSE(empty.Empty());
+}
+
+namespace
+{
+	// brute force references for the point tree queries, checked on the distances since equidistant points may swap
+	template <class Vector>
+	std::vector<MathLib::HReal> BruteForceKNearest(const std::vector<Vector>& points, const Vector& center, const uint32_t k, const MathLib::HReal maxRadius)
+	{
+		std::vector<MathLib::HReal> distances;
+		for (const Vector& point : points)
+			if ((point - center).squaredNorm() <= maxRadius * maxRadius)
+				distances.push_back((point - center).squaredNorm());
+		std::sort(distances.begin(), distances.end());
+		distances.resize(std::min<size_t>(distances.size(), k));
+		return distances;
+	}
+
+	template <int Dim>
+	void ExpectPointQueriesMatchBruteForce(const MathLib::PointKDTree<Dim>& tree, const std::vector<MathLib::HVectorR<Dim>>& points,
+										   const std::vector<MathLib::HVectorR<Dim>>& centers, const uint32_t k, const MathLib::HReal radius)
+	{
+		std::vector<std::pair<MathLib::HReal, uint32_t>> nearest;
+		std::vector<uint32_t> found;
+		for (const MathLib::HVectorR<Dim>& center : centers)
+		{
+			const std::vector<MathLib::HReal> expected = BruteForceKNearest(points, center, k, H_REAL_MAX);
+			ASSERT_EQ(tree.KNearest(center, k, nearest), expected.size());
+			for (uint32_t i = 0; i < expected.size(); i++)
+			{
+				ASSERT_EQ(nearest[i].first, expected[i]);
+				ASSERT_EQ((points[nearest[i].second] - center).squaredNorm(), expected[i]);
+			}
+			const std::vector<MathLib::HReal> expectedInRadius = BruteForceKNearest(points, center, k, radius);
+			ASSERT_EQ(tree.KNearest(center, k, nearest, radius), expectedInRadius.size());
+
+			std::pair<MathLib::HReal, uint32_t> closest;
+			ASSERT_TRUE(tree.Nearest(center, closest));
+			ASSERT_EQ(closest.first, expected[0]);
+
+			std::vector<uint32_t> expectedRadius;
+			for (uint32_t i = 0; i < points.size(); i++)
+				if ((points[i] - center).squaredNorm() <= radius * radius)
+					expectedRadius.push_back(i);
+			tree.FindRadius(center, radius, found);
+			std::sort(found.begin(), found.end());
+			ASSERT_EQ(found, expectedRadius);
+		}
+	}
+}
+
+TEST(AccelerateTest, PointKDTree)
+{
+	std::vector<MathLib::HVector3> points;
+	for (const MathLib::HAABBox3D& box : MakeClusteredBoxes(20000, 7))
+		points.push_back(box.center());
+	// exact duplicates and a flat sheet of points
+	for (uint32_t i = 0; i < 500; i++)
+		points.push_back(points[i * 13]);
+	for (uint32_t i = 0; i < 1000; i++)
+		points.emplace_back(i % 40 * 0.5f, 50.f, i / 40 * 0.5f);
+	std::mt19937 random(8);
+	std::uniform_real_distribution<MathLib::HReal> unit(-10.f, 110.f);
+	std::vector<MathLib::HVector3> centers;
+	for (uint32_t i = 0; i < 90; i++)
+		centers.push_back(i % 3 == 0 ? points[(i * 7919) % points.size()] : MathLib::HVector3(unit(random), unit(random), unit(random)));
+
+	for (const uint32_t bucketSize : {1u, 8u, 32u})
+	{
+		MathLib::PointKDTree3D tree(bucketSize);
+		tree.Build(points);
+		ASSERT_EQ(tree.Size(), points.size());
+		// every split plane separates the two halves of its node
+		std::vector<std::pair<uint32_t, std::pair<uint32_t, uint32_t>>> stack(1, std::make_pair(0u, std::make_pair(0u, tree.Size())));
+		while (!stack.empty())
+		{
+			const uint32_t node = stack.back().first;
+			const uint32_t begin = stack.back().second.first, end = stack.back().second.second;
+			stack.pop_back();
+			if (node >= tree.GetNodes().size())
+			{
+				EXPECT_LE(end - begin, bucketSize);
+				continue;
+			}
+			const MathLib::PointKDNode& split = tree.GetNodes()[node];
+			const uint32_t mid = begin + (end - begin) / 2;
+			for (uint32_t slot = begin; slot < end; slot++)
+				ASSERT_TRUE(slot < mid ? tree.GetPoints()[slot][split.mAxis] <= split.mSplit : tree.GetPoints()[slot][split.mAxis] >= split.mSplit);
+			stack.push_back(std::make_pair(2 * node + 1, std::make_pair(begin, mid)));
+			stack.push_back(std::make_pair(2 * node + 2, std::make_pair(mid, end)));
+		}
+		for (uint32_t slot = 0; slot < tree.Size(); slot++)
+			ASSERT_TRUE(tree.GetPoints()[slot] == points[tree.GetIndices()[slot]]);
+		ExpectPointQueriesMatchBruteForce(tree, points, centers, 12, 3.f);
+
+		// the parallel build selects the same medians as the serial one
+		MathLib::PointKDTree3D serialTree(bucketSize);
+		serialTree.Build(points, MathLib::Parallel::ExecutionPolicy::Serial());
+		EXPECT_EQ(serialTree.GetIndices(), tree.GetIndices());
+	}
+
+	// batched queries give what the single ones do
+	MathLib::PointKDTree3D tree;
+	tree.Build(points);
+	std::vector<uint32_t> indices, offsets;
+	std::vector<MathLib::HReal> sqDistances;
+	tree.KNearest(centers, 5, indices, &sqDistances, 4.f);
+	std::vector<uint32_t> radiusIndices;
+	tree.FindRadius(centers, 4.f, offsets, radiusIndices);
+	ASSERT_EQ(offsets.size(), centers.size() + 1);
+	std::vector<std::pair<MathLib::HReal, uint32_t>> nearest;
+	std::vector<uint32_t> found;
+	for (uint32_t i = 0; i < centers.size(); i++)
+	{
+		const uint32_t count = tree.KNearest(centers[i], 5, nearest, 4.f);
+		for (uint32_t j = 0; j < 5; j++)
+		{
+			EXPECT_EQ(indices[i * 5 + j], j < count ? nearest[j].second : UINT_MAX);
+			EXPECT_EQ(sqDistances[i * 5 + j], j < count ? nearest[j].first : H_REAL_MAX);
+		}
+		tree.FindRadius(centers[i], 4.f, found);
+		ASSERT_EQ(std::vector<uint32_t>(radiusIndices.begin() + offsets[i], radiusIndices.begin() + offsets[i + 1]), found);
+	}
+
+	// a bool visitor stops the radius search
+	uint32_t visited = 0;
+	tree.FindRadius(points[0], 50.f, [&](uint32_t)
+					{ return ++visited < 3; });
+	EXPECT_EQ(visited, 3u);
+
+	// a regular 2D grid is all ties
+	std::vector<MathLib::HVector2> grid;
+	for (int i = 0; i < 900; i++)
+		grid.emplace_back(i % 30, i / 30);
+	MathLib::PointKDTree2D tree2D(4);
+	tree2D.Build(grid);
+	std::vector<MathLib::HVector2> centers2D;
+	for (int i = 0; i < 60; i++)
+		centers2D.emplace_back(i * 0.53f - 1.f, i % 7 * 4.5f + 0.5f);
+	ExpectPointQueriesMatchBruteForce(tree2D, grid, centers2D, 9, 1.5f);
+
+	MathLib::PointKDTree2D empty;
+	empty.Build(std::vector<MathLib::HVector2>());
+	std::pair<MathLib::HReal, uint32_t> closest;
+	EXPECT_FALSE(empty.Nearest(MathLib::HVector2::Zero(), closest));
+	EXPECT_EQ(empty.KNearest(MathLib::HVector2::Zero(), 3, nearest), 0u);
+	EXPECT_FALSE(empty.FindRadius(MathLib::HVector2::Zero(), 1.f, found));
+}
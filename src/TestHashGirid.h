@@ -1,5 +1,11 @@
 #pragma once
 #include <gtest/gtest.h>
+#include <Math/HashTable.h>
+#include <Math/HashGrid.h>
+#include <Math/HasherFunction.h>
+#include <Math/CompactGrid.h>
+#include <map>
+#include <random>
 class TestHashGirid:public testing::Test
 {
 public:
@@ -28,4 +34,354 @@ public:
 TEST_F(TestHashGirid, TestHashGrid)
 {
 	// Test code here
-}
\ No newline at end of file
+}
+
+TEST_F(TestHashGirid, TestHashTableMatchesReference)
+{
+	// random inserts and erases on a small key range so buckets overflow their inline storage and keys get removed
+	MathLib::HashTable<MathLib::HVector3UI, uint32_t> table(4);
+	std::map<std::tuple<uint32_t, uint32_t, uint32_t>, std::vector<uint32_t>> reference;
+	std::mt19937 random(7);
+	std::uniform_int_distribution<uint32_t> coordinate(0, 15);
+	std::uniform_int_distribution<uint32_t> value(0, 31);
+	for (int i = 0; i < 20000; i++)
+	{
+		const uint32_t x = coordinate(random), y = coordinate(random), z = coordinate(random);
+		const MathLib::HVector3UI key(x, y, z);
+		std::vector<uint32_t>& values = reference[std::make_tuple(x, y, z)];
+		const uint32_t data = value(random);
+		if (random() % 3 == 0)
+		{
+			table.Erase(key, data);
+			auto it = std::find(values.begin(), values.end(), data);
+			if (it != values.end())
+				values.erase(it);
+		}
+		else
+		{
+			table.Insert(key, data);
+			values.push_back(data);
+		}
+	}
+
+	uint32_t keyCount = 0;
+	std::vector<uint32_t> data;
+	for (const auto& entry : reference)
+	{
+		const MathLib::HVector3UI key(std::get<0>(entry.first), std::get<1>(entry.first), std::get<2>(entry.first));
+		EXPECT_EQ(table.HasKey(key), !entry.second.empty());
+		if (entry.second.empty())
+			continue;
+		keyCount++;
+		ASSERT_TRUE(table.GetAllData(key, data));
+		EXPECT_EQ(data, entry.second);
+		uint32_t first = 0, last = 0;
+		EXPECT_TRUE(table.GetFirstData(key, first));
+		EXPECT_EQ(first, entry.second.front());
+		EXPECT_TRUE(table.GetData(key, static_cast<unsigned int>(entry.second.size() - 1), last));
+		EXPECT_EQ(last, entry.second.back());
+		EXPECT_FALSE(table.GetData(key, static_cast<unsigned int>(entry.second.size()), last));
+	}
+	EXPECT_EQ(table.Size(), keyCount);
+
+	table.Clear();
+	EXPECT_EQ(table.Size(), 0u);
+	EXPECT_FALSE(table.HasKey(MathLib::HVector3UI(1, 2, 3)));
+	table.Insert(MathLib::HVector3UI(1, 2, 3), 5);
+	EXPECT_TRUE(table.GetAllData(MathLib::HVector3UI(1, 2, 3), data));
+	EXPECT_EQ(data, std::vector<uint32_t>{5});
+}
+
+TEST_F(TestHashGirid, TestHashGridFindBox)
+{
+	MathLib::HashGrid3DUI grid(1.f);
+	for (uint32_t i = 0; i < 10; i++)
+		for (uint32_t j = 0; j < 10; j++)
+			grid.AddPoint(MathLib::HVector3(i + 0.2f, j + 0.2f, 0.2f), i * 10 + j);
+	std::vector<uint32_t> found;
+	EXPECT_TRUE(grid.FindBox(MathLib::HVector3(2.f, 3.f, 0.f), MathLib::HVector3(4.f, 5.f, 0.f), found));
+	std::sort(found.begin(), found.end());
+	EXPECT_EQ(found, (std::vector<uint32_t>{23, 24, 25, 33, 34, 35, 43, 44, 45}));
+
+	grid.DeletePoint(MathLib::HVector3(3.2f, 4.2f, 0.2f), 34);
+	EXPECT_FALSE(grid.FindPoint(MathLib::HVector3(3.2f, 4.2f, 0.2f), found));
+	EXPECT_EQ(grid.Size(), 99u);
+}
+
+template <class Hasher>
+void ExpectDistinctGridHashes()
+{
+	const Hasher hasher;
+	EXPECT_NE(hasher(MathLib::HVector3UI(1, 2, 0)), hasher(MathLib::HVector3UI(2, 1, 0)));
+	std::vector<size_t> hashes;
+	for (uint32_t i = 0; i < 32; i++)
+		for (uint32_t j = 0; j < 32; j++)
+			for (uint32_t k = 0; k < 32; k++)
+				hashes.push_back(hasher(MathLib::HVector3UI(i, j, k)));
+	std::sort(hashes.begin(), hashes.end());
+	EXPECT_EQ(std::unique(hashes.begin(), hashes.end()), hashes.end()) << "A 32^3 block of cells should not collide.";
+
+	MathLib::HashTable<MathLib::HVector3UI, uint32_t, Hasher> table;
+	table.Insert(MathLib::HVector3UI(1, 2, 3), 7);
+	uint32_t data = 0;
+	EXPECT_TRUE(table.GetFirstData(MathLib::HVector3UI(1, 2, 3), data));
+	EXPECT_EQ(data, 7u);
+	EXPECT_FALSE(table.GetFirstData(MathLib::HVector3UI(2, 1, 3), data));
+}
+
+TEST_F(TestHashGirid, TestGridHashers)
+{
+	ExpectDistinctGridHashes<std::hash<MathLib::HVector3UI>>();
+	ExpectDistinctGridHashes<MathLib::TeschnerHasher<MathLib::HVector3UI>>();
+	ExpectDistinctGridHashes<MathLib::MortonHasher<MathLib::HVector3UI>>();
+	ExpectDistinctGridHashes<MathLib::WyHasher<MathLib::HVector3UI>>();
+
+	EXPECT_EQ(MathLib::MortonEncode2(3, 0), 5u);
+	EXPECT_EQ(MathLib::MortonEncode3(1, 1, 1), 7u);
+	EXPECT_EQ(MathLib::MortonEncode3(0x1FFFFF, 0, 0), 0x1249249249249249ull);
+	EXPECT_EQ(MathLib::MultiplyFold64(0xFFFFFFFFFFFFFFFFull, 2), 0xFFFFFFFFFFFFFFFEull ^ 1u);
+	EXPECT_NE(std::hash<MathLib::HVector2I>()(MathLib::HVector2I(5, 5)), std::hash<MathLib::HVector2I>()(MathLib::HVector2I(6, 6)));
+	EXPECT_NE(std::hash<MathLib::HVector2>()(MathLib::HVector2(1, 2)), std::hash<MathLib::HVector2>()(MathLib::HVector2(2, 1)));
+}
+
+TEST_F(TestHashGirid, TestHashGridQueries)
+{
+	std::mt19937 random(3);
+	std::uniform_real_distribution<MathLib::HReal> coordinate(0.f, 20.f);
+	std::vector<MathLib::HVector3> points(2000);
+	MathLib::HashGrid3DUI grid(1.5f);
+	for (uint32_t i = 0; i < points.size(); i++)
+	{
+		points[i] = MathLib::HVector3(coordinate(random), coordinate(random), coordinate(random));
+		grid.AddPoint(points[i], i);
+	}
+	auto positionOf = [&](uint32_t i) -> const MathLib::HVector3&
+	{ return points[i]; };
+
+	const MathLib::DataSpan<uint32_t> span = grid.FindPoint(points[5]);
+	EXPECT_NE(std::find(span.begin(), span.end(), 5u), span.end());
+
+	uint32_t visited = 0;
+	grid.FindBox(MathLib::HVector3::Zero(), MathLib::HVector3::Constant(20.f), [&](uint32_t)
+				 { return ++visited < 10; });
+	EXPECT_EQ(visited, 10u) << "A visitor returning false should stop the query.";
+
+	std::vector<std::pair<MathLib::HReal, uint32_t>> nearest;
+	for (int query = 0; query < 20; query++)
+	{
+		const MathLib::HVector3 center(coordinate(random), coordinate(random), coordinate(random));
+		std::vector<std::pair<MathLib::HReal, uint32_t>> reference;
+		for (uint32_t i = 0; i < points.size(); i++)
+			reference.emplace_back((points[i] - center).squaredNorm(), i);
+		std::sort(reference.begin(), reference.end());
+
+		std::vector<uint32_t> inRadius;
+		grid.FindRadius(center, 3.f, positionOf, [&](uint32_t i)
+						{ inRadius.push_back(i); });
+		std::sort(inRadius.begin(), inRadius.end());
+		std::vector<uint32_t> expected;
+		for (const auto& entry : reference)
+			if (entry.first <= 9.f)
+				expected.push_back(entry.second);
+		std::sort(expected.begin(), expected.end());
+		EXPECT_EQ(inRadius, expected);
+
+		EXPECT_EQ(grid.KNearest(center, 8, positionOf, nearest), 8u);
+		for (uint32_t i = 0; i < 8; i++)
+			EXPECT_EQ(nearest[i].second, reference[i].second);
+	}
+
+	EXPECT_EQ(grid.KNearest(MathLib::HVector3::Constant(10.f), 5000, positionOf, nearest), 2000u) << "k above the point count returns everything.";
+	EXPECT_EQ(grid.KNearest(MathLib::HVector3::Constant(10.f), 5, positionOf, nearest, 0.01f), 0u);
+
+	MathLib::HashGrid2DUI grid2D(1.f);
+	std::vector<MathLib::HVector2> points2D = {MathLib::HVector2(1, 1), MathLib::HVector2(5, 5), MathLib::HVector2(1.5f, 1.2f), MathLib::HVector2(9, 0)};
+	for (uint32_t i = 0; i < points2D.size(); i++)
+		grid2D.AddPoint(points2D[i], i);
+	std::vector<std::pair<MathLib::HReal, uint32_t>> nearest2D;
+	EXPECT_EQ(grid2D.KNearest(MathLib::HVector2(8, 1), 2, [&](uint32_t i)
+							  { return points2D[i]; }, nearest2D),
+			  2u);
+	EXPECT_EQ(nearest2D[0].second, 3u);
+	EXPECT_EQ(nearest2D[1].second, 1u);
+}
+
+TEST_F(TestHashGirid, TestHashGridKNearestSparse)
+{
+	// a few points hundreds of thousands of cells apart and a far away center: k above the point count has to stop at
+	// the occupied cells instead of growing rings towards the border of the key range
+	std::vector<MathLib::HVector3> points = {MathLib::HVector3(0, 0, 0), MathLib::HVector3(3e5f, 0, 0), MathLib::HVector3(2, 1, -1),
+											 MathLib::HVector3(0, -4e5f, 0)};
+	MathLib::HashGrid3DUI grid(1.f);
+	for (uint32_t i = 0; i < points.size(); i++)
+		grid.AddPoint(points[i], i);
+	auto positionOf = [&](uint32_t i) -> const MathLib::HVector3&
+	{ return points[i]; };
+	std::vector<std::pair<MathLib::HReal, uint32_t>> nearest;
+	EXPECT_EQ(grid.KNearest(MathLib::HVector3(-5e5f, 0, 0), 10, positionOf, nearest), 4u);
+	std::vector<uint32_t> order;
+	for (const std::pair<MathLib::HReal, uint32_t>& entry : nearest)
+		order.push_back(entry.second);
+	EXPECT_EQ(order, std::vector<uint32_t>({0, 2, 3, 1}));
+	EXPECT_EQ(grid.KNearest(MathLib::HVector3(1, 1, 1), 2, positionOf, nearest), 2u);
+	EXPECT_EQ(nearest[0].second, 0u);
+	EXPECT_EQ(nearest[1].second, 2u);
+
+	MathLib::HashGrid2DUI grid2D(1.f);
+	std::vector<MathLib::HVector2> points2D = {MathLib::HVector2(-1e6f, 0), MathLib::HVector2(1e6f, 5), MathLib::HVector2(0, 0)};
+	for (uint32_t i = 0; i < points2D.size(); i++)
+		grid2D.AddPoint(points2D[i], i);
+	EXPECT_EQ(grid2D.KNearest(MathLib::HVector2(0, 1e6f), 5, [&](uint32_t i)
+							  { return points2D[i]; }, nearest),
+			  3u);
+	EXPECT_EQ(nearest[0].second, 2u);
+
+	grid2D.Clear();
+	EXPECT_EQ(grid2D.KNearest(MathLib::HVector2(0, 0), 5, [&](uint32_t i)
+							  { return points2D[i]; }, nearest),
+			  0u);
+	grid2D.AddPoint(points2D[2], 2);
+	EXPECT_EQ(grid2D.KNearest(MathLib::HVector2(3, 4), 5, [&](uint32_t i)
+							  { return points2D[i]; }, nearest),
+			  1u);
+	EXPECT_FLOAT_EQ(nearest[0].first, 25.f);
+}
+
+template <class KeyEncoder>
+void ExpectSignedGridKeys()
+{
+	for (const MathLib::HVector3I& cell : {MathLib::HVector3I(0, 0, 0), MathLib::HVector3I(-1, 2, -3), MathLib::HVector3I(-(1 << 20), (1 << 20) - 1, 5)})
+		EXPECT_EQ(KeyEncoder::Decode(KeyEncoder::Encode(cell)), cell);
+	EXPECT_NE(KeyEncoder::Encode(MathLib::HVector3I(-1, 0, 0)), KeyEncoder::Encode(MathLib::HVector3I(1, 0, 0)));
+
+	std::mt19937 random(5);
+	std::uniform_real_distribution<MathLib::HReal> coordinate(-10.f, 10.f);
+	std::vector<MathLib::HVector3> points(2000);
+	MathLib::HashGrid3D<uint32_t, KeyEncoder> grid(1.f);
+	for (uint32_t i = 0; i < points.size(); i++)
+	{
+		points[i] = MathLib::HVector3(coordinate(random), coordinate(random), coordinate(random));
+		grid.AddPoint(points[i], i);
+	}
+	auto positionOf = [&](uint32_t i) -> const MathLib::HVector3&
+	{ return points[i]; };
+
+	// queries around the origin cross into negative cells on every axis
+	for (int query = 0; query < 20; query++)
+	{
+		const MathLib::HVector3 center(coordinate(random) * 0.2f, coordinate(random) * 0.2f, coordinate(random) * 0.2f);
+		std::vector<uint32_t> inRadius, expected;
+		grid.FindRadius(center, 2.f, positionOf, [&](uint32_t i)
+						{ inRadius.push_back(i); });
+		for (uint32_t i = 0; i < points.size(); i++)
+			if ((points[i] - center).squaredNorm() <= 4.f)
+				expected.push_back(i);
+		std::sort(inRadius.begin(), inRadius.end());
+		EXPECT_EQ(inRadius, expected);
+	}
+
+	// positions past the 21 bit key range share the border cells instead of wrapping around
+	grid.AddPoint(MathLib::HVector3(-1e9f, 0.f, 0.f), 9000);
+	grid.AddPoint(MathLib::HVector3(1e9f, 0.f, 0.f), 9001);
+	uint32_t data = 0;
+	EXPECT_TRUE(grid.FindFirstPoint(MathLib::HVector3(-1e9f, 0.f, 0.f), data));
+	EXPECT_EQ(data, 9000u);
+	EXPECT_TRUE(grid.FindFirstPoint(MathLib::HVector3(1e9f, 0.f, 0.f), data));
+	EXPECT_EQ(data, 9001u);
+}
+
+TEST_F(TestHashGirid, TestHashGridSignedKeys)
+{
+	ExpectSignedGridKeys<MathLib::PackedGridKey3D>();
+	ExpectSignedGridKeys<MathLib::MortonGridKey3D>();
+
+	EXPECT_LT(MathLib::MortonGridKey3D::Encode(MathLib::HVector3I(-1, -1, -1)), MathLib::MortonGridKey3D::Encode(MathLib::HVector3I(0, 0, 0)));
+	for (const MathLib::HVector2I& cell : {MathLib::HVector2I(INT32_MIN, INT32_MAX), MathLib::HVector2I(-7, 3)})
+	{
+		EXPECT_EQ(MathLib::PackedGridKey2D::Decode(MathLib::PackedGridKey2D::Encode(cell)), cell);
+		EXPECT_EQ(MathLib::MortonGridKey2D::Decode(MathLib::MortonGridKey2D::Encode(cell)), cell);
+	}
+
+	MathLib::HashGrid2D<uint32_t, MathLib::MortonGridKey2D> grid2D(0.5f);
+	grid2D.AddBox(MathLib::HVector2(-1.f, -1.f), MathLib::HVector2(1.f, 1.f), 3);
+	std::vector<uint32_t> found;
+	EXPECT_TRUE(grid2D.FindPoint(MathLib::HVector2(-0.9f, 0.4f), found));
+	EXPECT_EQ(grid2D.Size(), 25u);
+	grid2D.DeleteBox(MathLib::HVector2(-1.f, -1.f), MathLib::HVector2(1.f, 1.f), 3);
+	EXPECT_EQ(grid2D.Size(), 0u);
+}
+
+TEST_F(TestHashGirid, TestCompactGrid)
+{
+	std::mt19937 random(11);
+	std::uniform_real_distribution<MathLib::HReal> coordinate(-10.f, 10.f);
+	std::vector<MathLib::HVector3> points(3000);
+	for (MathLib::HVector3& point : points)
+		point = MathLib::HVector3(coordinate(random), coordinate(random), coordinate(random));
+
+	MathLib::CompactGrid3D grid(1.25f);
+	grid.Build(points);
+	EXPECT_EQ(grid.Size(), 3000u);
+	std::vector<uint32_t> sorted = grid.GetSortedIndices();
+	for (uint32_t slot = 0; slot < sorted.size(); slot++)
+		EXPECT_EQ(grid.GetSortedPoints()[slot], points[sorted[slot]]);
+	std::sort(sorted.begin(), sorted.end());
+	for (uint32_t i = 0; i < sorted.size(); i++)
+		ASSERT_EQ(sorted[i], i) << "Every point should appear exactly once.";
+
+	const MathLib::DataSpan<uint32_t> cell = grid.FindPoint(points[17]);
+	EXPECT_NE(std::find(cell.begin(), cell.end(), 17u), cell.end());
+	EXPECT_TRUE(grid.FindPoint(MathLib::HVector3::Constant(100.f)).Empty());
+
+	std::vector<std::pair<MathLib::HReal, uint32_t>> nearest;
+	for (int query = 0; query < 20; query++)
+	{
+		const MathLib::HVector3 center(coordinate(random), coordinate(random), coordinate(random));
+		std::vector<std::pair<MathLib::HReal, uint32_t>> reference;
+		for (uint32_t i = 0; i < points.size(); i++)
+			reference.emplace_back((points[i] - center).squaredNorm(), i);
+		std::sort(reference.begin(), reference.end());
+
+		std::vector<uint32_t> inRadius, expected;
+		grid.FindRadius(center, 2.5f, [&](uint32_t i)
+						{ inRadius.push_back(i); });
+		for (const auto& entry : reference)
+			if (entry.first <= 2.5f * 2.5f)
+				expected.push_back(entry.second);
+		std::sort(inRadius.begin(), inRadius.end());
+		std::sort(expected.begin(), expected.end());
+		EXPECT_EQ(inRadius, expected);
+
+		EXPECT_EQ(grid.KNearest(center, 10, nearest), 10u);
+		for (uint32_t i = 0; i < 10; i++)
+			EXPECT_EQ(nearest[i].second, reference[i].second);
+	}
+	EXPECT_EQ(grid.KNearest(MathLib::HVector3::Constant(50.f), 4000, nearest), 3000u);
+
+	// rebuilds are reproducible whatever the thread timing
+	MathLib::CompactGrid3D serialGrid(1.25f);
+	serialGrid.Build(points, MathLib::Parallel::ExecutionPolicy::Serial());
+	EXPECT_EQ(serialGrid.GetSortedIndices(), grid.GetSortedIndices());
+	std::vector<uint32_t> boxed;
+	EXPECT_FALSE(grid.FindBox(MathLib::HVector3::Constant(20.f), MathLib::HVector3::Constant(30.f), boxed));
+
+	// centers far outside the grid skip the empty rings instead of walking out to it
+	for (const MathLib::HVector3& far : std::vector<MathLib::HVector3>{MathLib::HVector3(1000.f, 0.f, 0.f), MathLib::HVector3(-1e6f, 3.f, 1e6f), MathLib::HVector3::Constant(1e15f)})
+	{
+		std::vector<std::pair<MathLib::HReal, uint32_t>> reference;
+		for (uint32_t i = 0; i < points.size(); i++)
+			reference.emplace_back((points[i] - far).squaredNorm(), i);
+		std::sort(reference.begin(), reference.end());
+		ASSERT_EQ(grid.KNearest(far, 1, nearest), 1u);
+		EXPECT_EQ(nearest[0].first, reference[0].first);
+	}
+	EXPECT_TRUE(grid.FindPoint(MathLib::HVector3::Constant(-1e30f)).Empty());
+
+	// bounds with more cells than the 32 bit cell ids leave the grid empty, in release builds too
+	MathLib::CompactGrid3D tinyCells(1e-3f);
+	EXPECT_FALSE(tinyCells.Build({MathLib::HVector3::Zero(), MathLib::HVector3::Constant(100.f)}));
+	EXPECT_EQ(tinyCells.Size(), 0u);
+	EXPECT_EQ(tinyCells.KNearest(MathLib::HVector3::Zero(), 1, nearest), 0u);
+	EXPECT_TRUE(tinyCells.Build(points.data(), 0));
+}
+
@@ -0,0 +1,370 @@
+#pragma once
+#include <gtest/gtest.h>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <Math/Math.h>
+#include <Math/Parallel.h>
+#include <Math/Array2D.h>
+#include <Math/Array3D.h>
+#include <Math/Core/ThreadPool.h>
+#include <Math/TaskGraph.h>
+
+TEST(ParallelTest, ParallelFor1D)
+{
+    std::vector<uint32_t> visited(10000, 0);
+    MathLib::Parallel::ParallelFor<uint32_t>(0, static_cast<uint32_t>(visited.size()), [&](uint32_t i)
+                                             { visited[i]++; });
+    for (size_t i = 0; i < visited.size(); i++)
+        EXPECT_EQ(visited[i], 1u) << "Index " << i << " should be visited exactly once.";
+}
+
+TEST(ParallelTest, ParallelForIndices)
+{
+    std::vector<uint32_t> indices;
+    for (uint32_t i = 0; i < 5000; i++)
+        indices.push_back(i * 2);
+    std::vector<uint32_t> visited(10000, 0);
+    MathLib::Parallel::ParallelFor(indices, [&](uint32_t i)
+                                   { visited[i]++; });
+    for (size_t i = 0; i < visited.size(); i++)
+        EXPECT_EQ(visited[i], i % 2 == 0 ? 1u : 0u);
+}
+
+TEST(ParallelTest, ParallelFor2D3D)
+{
+    const uint32_t size = 64;
+    std::vector<uint32_t> visited2D(size * size, 0);
+    MathLib::Parallel::ParallelFor<uint32_t>(0, size, 0, size, [&](uint32_t i, uint32_t j)
+                                             { visited2D[i * size + j]++; });
+    for (size_t i = 0; i < visited2D.size(); i++)
+        EXPECT_EQ(visited2D[i], 1u);
+
+    std::vector<uint32_t> visited3D(size * size * size, 0);
+    MathLib::Parallel::ParallelFor<uint32_t>(0, size, 0, size, 0, size, [&](uint32_t i, uint32_t j, uint32_t k)
+                                             { visited3D[(i * size + j) * size + k]++; });
+    for (size_t i = 0; i < visited3D.size(); i++)
+        EXPECT_EQ(visited3D[i], 1u);
+}
+
+TEST(ParallelTest, Array2DExecuteUpdate)
+{
+    MathLib::Array2D<MathLib::HReal> array(128, 128);
+    array.ExecuteUpdate([](uint32_t x, uint32_t y) -> MathLib::HReal
+                        { return MathLib::HReal(x + y); });
+    const MathLib::Array2D<MathLib::HReal>::ArrayUpdateFn erasedFn = [](uint32_t x, uint32_t y) -> MathLib::HReal
+    { return MathLib::HReal(x + y); };
+    MathLib::Array2D<MathLib::HReal> erasedArray(128, 128);
+    erasedArray.ExecuteUpdate(erasedFn);
+    EXPECT_EQ(array.GetData(), erasedArray.GetData());
+    EXPECT_EQ(array(3, 5), MathLib::HReal(8));
+}
+
+TEST(ParallelTest, SafeParallelFor)
+{
+    uint64_t counter = 0;
+    MathLib::Parallel::SafeParallelFor<uint32_t>(0, 100000, [&](uint32_t i)
+                                                 { counter += i; });
+    EXPECT_EQ(counter, uint64_t(99999) * 100000 / 2);
+}
+
+TEST(ParallelTest, ParallelReduce)
+{
+    const uint32_t count = 1000000;
+    const uint64_t sum = MathLib::Parallel::ParallelReduce<uint32_t>(
+        0, count, uint64_t(0), [](uint32_t i, uint64_t &value)
+        { value += i; },
+        std::plus<uint64_t>());
+    EXPECT_EQ(sum, uint64_t(count - 1) * count / 2);
+
+    std::vector<MathLib::HReal> data(count);
+    for (uint32_t i = 0; i < count; i++)
+        data[i] = std::sin(MathLib::HReal(i));
+    const MathLib::HReal maxValue = MathLib::Parallel::ParallelTransformReduce<uint32_t>(
+        0, count, H_REAL_MIN, [&](uint32_t i)
+        { return data[i]; },
+        [](MathLib::HReal a, MathLib::HReal b)
+        { return std::max(a, b); });
+    EXPECT_EQ(maxValue, *std::max_element(data.begin(), data.end()));
+
+    auto deterministicSum = [&]()
+    {
+        return MathLib::Parallel::ParallelTransformReduce<uint32_t>(
+            0, count, MathLib::HReal(0), [&](uint32_t i)
+            { return data[i]; },
+            std::plus<MathLib::HReal>(), MathLib::Parallel::ReduceOrder::eDeterministic);
+    };
+    const MathLib::HReal first = deterministicSum();
+    for (int i = 0; i < 5; i++)
+        EXPECT_EQ(first, deterministicSum()) << "Deterministic reduction should be bitwise reproducible.";
+}
+
+TEST(ParallelTest, ParallelExclusiveScan)
+{
+    std::vector<uint32_t> values(10001);
+    for (uint32_t i = 0; i < values.size(); i++)
+        values[i] = i % 7;
+    std::vector<uint32_t> scanned(values.size());
+    const uint32_t total = MathLib::Parallel::ParallelExclusiveScan<uint32_t>(
+        static_cast<uint32_t>(values.size()), [&](uint32_t i)
+        { return values[i]; },
+        scanned.data());
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < values.size(); i++)
+    {
+        ASSERT_EQ(scanned[i], sum);
+        sum += values[i];
+    }
+    EXPECT_EQ(total, sum);
+}
+
+TEST(ParallelTest, ParallelPartitionInvoke)
+{
+    const uint32_t count = 100003;
+    std::vector<uint32_t> data(count);
+    for (uint32_t i = 0; i < count; i++)
+        data[i] = (i * 7919u) % count;
+    std::vector<uint32_t> expected = data;
+    auto isEven = [](uint32_t value)
+    { return value % 2 == 0; };
+    const auto expectedEnd = std::stable_partition(expected.begin(), expected.end(), isEven);
+    const uint32_t trueCount = MathLib::Parallel::ParallelPartition<uint32_t>(data.data(), count, isEven);
+    EXPECT_EQ(trueCount, uint32_t(expectedEnd - expected.begin()));
+    EXPECT_EQ(data, expected) << "ParallelPartition should be stable.";
+
+    // recursive fork-join sum
+    std::function<uint64_t(uint32_t, uint32_t)> sum = [&](uint32_t begin, uint32_t end) -> uint64_t
+    {
+        if (end - begin < 1000)
+            return std::accumulate(data.begin() + begin, data.begin() + end, uint64_t(0));
+        uint64_t left = 0, right = 0;
+        const uint32_t mid = begin + (end - begin) / 2;
+        MathLib::Parallel::ParallelInvoke([&]()
+                                          { left = sum(begin, mid); },
+                                          [&]()
+                                          { right = sum(mid, end); });
+        return left + right;
+    };
+    EXPECT_EQ(sum(0, count), uint64_t(count - 1) * count / 2);
+}
+
+TEST(ParallelTest, ParallelRadixSort)
+{
+    const uint32_t count = 50000;
+    std::vector<uint64_t> keys(count);
+    std::vector<uint32_t> values(count);
+    uint64_t state = 7;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        // few distinct high bits so equal keys show whether the sort is stable
+        keys[i] = (state >> 20) & 0xFFFFF3FFull;
+        values[i] = i;
+    }
+    std::vector<std::pair<uint64_t, uint32_t>> expected(count);
+    for (uint32_t i = 0; i < count; i++)
+        expected[i] = std::make_pair(keys[i] & 0xFFFFFFull, i);
+    std::stable_sort(expected.begin(), expected.end(), [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b)
+                     { return a.first < b.first; });
+
+    // only the low 24 bits take part
+    MathLib::Parallel::ParallelRadixSort<uint32_t>(keys.data(), values.data(), count, 24);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ASSERT_EQ(keys[i] & 0xFFFFFFull, expected[i].first);
+        ASSERT_EQ(values[i], expected[i].second);
+    }
+}
+
+TEST(ParallelTest, ThreadLocal)
+{
+    MathLib::Parallel::ThreadLocal<uint64_t> counters(0);
+    MathLib::Parallel::ParallelFor<uint32_t>(0, 100000, [&](uint32_t i)
+                                             { counters.Local() += i; });
+    EXPECT_EQ(counters.Combine(std::plus<uint64_t>()), uint64_t(99999) * 100000 / 2);
+
+    counters.Clear();
+    EXPECT_EQ(counters.Combine(std::plus<uint64_t>()), 0u);
+}
+
+TEST(ParallelTest, ThreadLocalConcurrentCallers)
+{
+    // callers outside the pool run each other's stolen pieces while they wait, so each needs its own values
+    const uint32_t callerCount = 4, count = 20000;
+    std::vector<uint64_t> sums(callerCount, 0);
+    std::vector<std::thread> callers;
+    for (uint32_t caller = 0; caller < callerCount; caller++)
+        callers.emplace_back([&, caller]()
+                             {
+            for (uint32_t round = 0; round < 8; round++)
+            {
+                MathLib::Parallel::ThreadLocal<uint64_t> counters(0);
+                MathLib::Parallel::ParallelFor<uint32_t>(0, count, [&](uint32_t i)
+                                                         { counters.Local() += i + caller; });
+                sums[caller] += counters.Combine(std::plus<uint64_t>());
+            } });
+    for (std::thread &caller : callers)
+        caller.join();
+    for (uint32_t caller = 0; caller < callerCount; caller++)
+        EXPECT_EQ(sums[caller], 8 * (uint64_t(count - 1) * count / 2 + uint64_t(caller) * count));
+}
+
+TEST(ParallelTest, ExecutionPolicy)
+{
+    using namespace MathLib::Parallel;
+    const uint32_t size = 100;
+    std::vector<ExecutionPolicy> policies = {
+        ExecutionPolicy(),
+        ExecutionPolicy(Partitioner::eSimple),
+        ExecutionPolicy(Partitioner::eStatic),
+        ExecutionPolicy(Partitioner::eAffinity),
+        ExecutionPolicy(Partitioner::eAuto, 2),
+        ExecutionPolicy::Serial()};
+    policies[1].mGrainSize[0] = 7;
+    policies[1].mGrainSize[1] = 3;
+
+    for (const ExecutionPolicy &policy : policies)
+    {
+        std::vector<uint32_t> visited2D(size * size, 0);
+        ParallelFor<uint32_t>(0, size, 0, size, [&](uint32_t i, uint32_t j)
+                              { visited2D[i * size + j]++; }, policy);
+        EXPECT_EQ(std::count(visited2D.begin(), visited2D.end(), 1u), size * size);
+
+        std::vector<uint32_t> visited1D(size * size, 0);
+        ParallelFor<uint32_t>(0, size * size, [&](uint32_t i)
+                              { visited1D[i]++; }, policy);
+        EXPECT_EQ(std::count(visited1D.begin(), visited1D.end(), 1u), size * size);
+
+        MathLib::Array3D<uint32_t> array(16, 16, 16);
+        array.ExecuteUpdate([&](size_t x, size_t y, size_t z)
+                            { array(x, y, z) += 1; }, policy);
+        const std::vector<uint32_t> &data = array.GetData();
+        EXPECT_EQ(std::count(data.begin(), data.end(), 1u), 16 * 16 * 16);
+    }
+    EXPECT_EQ(GetMaxConcurrency(ExecutionPolicy::Serial()), 1u);
+}
+
+TEST(ParallelTest, ThreadPool)
+{
+    // an explicit pool so stealing and nesting are exercised whatever the hardware and backend
+    MathLib::Parallel::ThreadPool pool(4);
+    EXPECT_EQ(pool.GetConcurrency(), 5u);
+    EXPECT_EQ(pool.GetCurrentWorkerIndex(), -1);
+
+    const size_t outer = 64, inner = 1000;
+    std::vector<std::atomic<uint32_t>> visited(outer * inner);
+    pool.ParallelFor(0, outer, 1, [&](size_t begin, size_t end)
+                     {
+        for (size_t i = begin; i < end; i++)
+            pool.ParallelFor(0, inner, 16, [&](size_t innerBegin, size_t innerEnd)
+                             {
+                for (size_t j = innerBegin; j < innerEnd; j++)
+                    visited[i * inner + j]++; }); });
+    for (size_t i = 0; i < visited.size(); i++)
+        EXPECT_EQ(visited[i].load(), 1u) << "Index " << i << " should be visited exactly once.";
+}
+
+TEST(ParallelTest, ThreadPoolException)
+{
+    // a throwing piece must not leave the pending count behind, the other pieces still finish
+    MathLib::Parallel::ThreadPool pool(4);
+    const size_t count = 10000;
+    std::vector<std::atomic<uint32_t>> visited(count);
+    EXPECT_THROW(pool.ParallelFor(0, count, 16, [&](size_t begin, size_t end)
+                                  {
+        for (size_t i = begin; i < end; i++)
+        {
+            if (i == count / 3)
+                throw std::runtime_error("body failed");
+            visited[i]++;
+        } }),
+                 std::runtime_error);
+    for (size_t i = 0; i < count; i++)
+        EXPECT_LE(visited[i].load(), 1u);
+    EXPECT_EQ(visited[count - 1].load(), 1u);
+
+    // the pool is still usable afterwards
+    std::atomic<size_t> total(0);
+    pool.ParallelFor(0, count, 16, [&](size_t begin, size_t end)
+                     { total += end - begin; });
+    EXPECT_EQ(total.load(), count);
+
+    EXPECT_THROW(MathLib::Parallel::ParallelFor<uint32_t>(0, 100000, [&](uint32_t i)
+                                                          {
+        if (i == 77777)
+            throw std::runtime_error("body failed"); }),
+                 std::runtime_error);
+    EXPECT_THROW(MathLib::Parallel::ParallelInvoke([]() {}, []()
+                                                   { throw std::runtime_error("second failed"); }),
+                 std::runtime_error);
+}
+
+TEST(ParallelTest, AsyncThen)
+{
+    using namespace MathLib::Parallel;
+    Future<uint32_t> first = Async([]()
+                                   { return 20u; });
+    Future<uint64_t> second = first.Then([](uint32_t &value)
+                                         { return uint64_t(value) * 2 + 2; });
+    std::atomic<bool> called(false);
+    Future<void> third = second.Then([&](uint64_t &value)
+                                     { called = value == 42; });
+    Future<std::string> fourth = third.Then([]()
+                                            { return std::string("done"); });
+    EXPECT_EQ(fourth.Get(), "done");
+    EXPECT_TRUE(called);
+    EXPECT_TRUE(first.IsReady() && second.IsReady() && third.IsReady());
+    EXPECT_EQ(second.Get(), 42u);
+
+    std::vector<Future<uint32_t>> futures;
+    std::vector<std::atomic<uint32_t>> results(64);
+    for (uint32_t i = 0; i < 64; i++)
+        futures.push_back(Async([i]()
+                                { return i * i; })
+                              .Then([&results, i](uint32_t &value)
+                                    { results[i] = value; return value; }));
+    WhenAll(futures).Wait();
+    for (uint32_t i = 0; i < 64; i++)
+        EXPECT_EQ(results[i].load(), i * i);
+}
+
+TEST(ParallelTest, TaskGraph)
+{
+    using namespace MathLib::Parallel;
+    // diamond per lane: a -> (b, c) -> d, every lane is independent of the others
+    const uint32_t laneCount = 16;
+    std::vector<std::atomic<uint32_t>> stage(laneCount);
+    std::atomic<uint32_t> orderErrors(0);
+    TaskGraph graph;
+    for (uint32_t lane = 0; lane < laneCount; lane++)
+    {
+        TaskGraph::TaskId a = graph.AddTask([&, lane]()
+                                            { stage[lane] = 1; });
+        auto middle = [&, lane]()
+        {
+            if (stage[lane].load() == 0)
+                orderErrors++;
+            stage[lane]++;
+        };
+        TaskGraph::TaskId b = graph.AddTask(middle, {a});
+        TaskGraph::TaskId c = graph.AddTask(middle, {a});
+        graph.AddTask([&, lane]()
+                      {
+            if (stage[lane].load() != 3)
+                orderErrors++;
+            stage[lane] = 10; },
+                      {b, c});
+    }
+    EXPECT_EQ(graph.GetTaskCount(), laneCount * 4);
+
+    for (int run = 0; run < 3; run++)
+    {
+        for (std::atomic<uint32_t> &value : stage)
+            value = 0;
+        graph.RunAndWait();
+        EXPECT_TRUE(graph.IsFinished());
+        for (uint32_t lane = 0; lane < laneCount; lane++)
+            EXPECT_EQ(stage[lane].load(), 10u);
+    }
+    EXPECT_EQ(orderErrors.load(), 0u);
+}
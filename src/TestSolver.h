@@ -0,0 +1,443 @@
+#pragma once
+#include <gtest/gtest.h>
+#include <type_traits>
+#include <Math/Math.h>
+#include <Math/HSolver>
+
+namespace
+{
+	// 5-point Laplacian of an n x n grid with Dirichlet borders, symmetric positive definite
+	MathLib::HSparseMatrixRowMajor MakeLaplacian2D(const int n)
+	{
+		std::vector<Eigen::Triplet<MathLib::HReal>> triplets;
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+			{
+				const int row = y * n + x;
+				triplets.emplace_back(row, row, 4.f);
+				if (x > 0)
+					triplets.emplace_back(row, row - 1, -1.f);
+				if (x + 1 < n)
+					triplets.emplace_back(row, row + 1, -1.f);
+				if (y > 0)
+					triplets.emplace_back(row, row - n, -1.f);
+				if (y + 1 < n)
+					triplets.emplace_back(row, row + n, -1.f);
+			}
+		MathLib::HSparseMatrixRowMajor matrix(n * n, n * n);
+		matrix.setFromTriplets(triplets.begin(), triplets.end());
+		return matrix;
+	}
+
+	MathLib::HVectorX MakeRightHandSide(const int size)
+	{
+		MathLib::HVectorX b(size);
+		for (int i = 0; i < size; i++)
+			b[i] = std::sin(MathLib::HReal(i) * 0.37f) + 0.5f;
+		return b;
+	}
+}
+
+TEST(SolverTest, SparseMultiply)
+{
+	MathLib::HSparseMatrixRowMajor matrix = MakeLaplacian2D(37);
+	const MathLib::HVectorX x = MakeRightHandSide(int(matrix.cols()));
+	const MathLib::HVectorX expected = matrix * x;
+	MathLib::HVectorX y;
+	MathLib::SolverTool::SparseMultiply(matrix, x, y);
+	EXPECT_TRUE(y.isApprox(expected));
+	// uncompressed storage takes the per row non-zero counts
+	matrix.coeffRef(5, 5) += 1.f;
+	matrix.uncompress();
+	MathLib::SolverTool::SparseMultiply(matrix, x, y, MathLib::Parallel::ExecutionPolicy::Serial());
+	EXPECT_TRUE(y.isApprox(MathLib::HVectorX(matrix * x)));
+}
+
+TEST(SolverTest, ConjugateGradientOperators)
+{
+	const int n = 40;
+	const MathLib::HSparseMatrixRowMajor rowMajor = MakeLaplacian2D(n);
+	const MathLib::HSparseMatrixColMajor colMajor = rowMajor;
+	const MathLib::HMatrixX dense = MathLib::HMatrixX(rowMajor);
+	const MathLib::HVectorX b = MakeRightHandSide(n * n);
+
+	Eigen::SimplicialLDLT<MathLib::HSparseMatrixColMajor> direct(colMajor);
+	const MathLib::HVectorX expected = direct.solve(b);
+
+	auto expectSolved = [&](MathLib::SolverTool::LinearSolverBase& solver)
+	{
+		MathLib::HVectorX x;
+		ASSERT_EQ(solver.Solve(x, b), 0);
+		// the recursively updated residual drifts from the true one in float
+		EXPECT_LE((b - rowMajor * x).norm(), 1e-4f * b.norm());
+		EXPECT_LE((x - expected).cwiseAbs().maxCoeff(), 1e-3f * expected.cwiseAbs().maxCoeff());
+	};
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::HSparseMatrixRowMajor> rowMajorSolver(rowMajor);
+	expectSolved(rowMajorSolver);
+	EXPECT_LE(rowMajorSolver.GetResidual(), rowMajorSolver.GetTolerance());
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::HSparseMatrixColMajor> colMajorSolver(colMajor);
+	expectSolved(colMajorSolver);
+	MathLib::SolverTool::ConjugateGradientSolver denseSolver(dense);
+	expectSolved(denseSolver);
+	// the solver references its operator, so neither temporaries nor converted matrices may bind to it
+	static_assert(!std::is_constructible<MathLib::SolverTool::ConjugateGradientSolver<MathLib::HSparseMatrixColMajor>, const MathLib::HSparseMatrixRowMajor &>::value,
+				  "a converted operator would dangle");
+	static_assert(!std::is_constructible<MathLib::SolverTool::ConjugateGradientSolver<MathLib::HMatrixX>, MathLib::HMatrixX>::value,
+				  "a temporary operator would dangle");
+	static_assert(std::is_constructible<MathLib::SolverTool::ConjugateGradientSolver<MathLib::HMatrixX>, MathLib::HMatrixX &>::value,
+				  "an lvalue operator is referenced");
+
+	// the matrix-free operator applies the same stencil without any matrix
+	MathLib::SolverTool::LinearOperator stencil(
+		n * n, [&](const MathLib::HVectorX& x, MathLib::HVectorX& y)
+		{
+			for (int row = 0; row < n * n; row++)
+			{
+				const int i = row % n, j = row / n;
+				y[row] = 4.f * x[row] - (i > 0 ? x[row - 1] : 0.f) - (i + 1 < n ? x[row + 1] : 0.f) - (j > 0 ? x[row - n] : 0.f) -
+						 (j + 1 < n ? x[row + n] : 0.f);
+			} },
+		[&](MathLib::HVectorX& diagonal)
+		{ diagonal.setConstant(n * n, 4.f); });
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::SolverTool::LinearOperator> matrixFreeSolver(stencil);
+	expectSolved(matrixFreeSolver);
+	EXPECT_EQ(matrixFreeSolver.GetIterations(), rowMajorSolver.GetIterations());
+
+	// the block ordered reductions make the serial and the parallel run identical
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::HSparseMatrixRowMajor> serialSolver(rowMajor, MathLib::Parallel::ExecutionPolicy::Serial());
+	MathLib::HVectorX serialX, parallelX;
+	serialSolver.Solve(serialX, b);
+	rowMajorSolver.Solve(parallelX, b);
+	EXPECT_EQ(serialSolver.GetIterations(), rowMajorSolver.GetIterations());
+	EXPECT_EQ(serialX, parallelX);
+}
+
+TEST(SolverTest, ConjugateGradientLimits)
+{
+	const MathLib::HSparseMatrixRowMajor matrix = MakeLaplacian2D(30);
+	const MathLib::HVectorX b = MakeRightHandSide(900);
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::HSparseMatrixRowMajor> solver(matrix);
+	EXPECT_EQ(solver.GetMaxIterations(), 900u);
+
+	// running out of iterations is reported
+	solver.SetMaxIterations(3);
+	MathLib::HVectorX x;
+	EXPECT_EQ(solver.Solve(x, b), -1);
+	EXPECT_EQ(solver.GetIterations(), 3u);
+	EXPECT_GT(solver.GetResidual(), solver.GetTolerance());
+
+	// a solve continues from the given x
+	solver.SetMaxIterations(1000);
+	ASSERT_EQ(solver.Solve(x, b), 0);
+	const uint32_t iterations = solver.GetIterations();
+	EXPECT_EQ(solver.Solve(x, b), 0);
+	EXPECT_LT(solver.GetIterations(), iterations);
+
+	// b = 0 has the solution 0 whatever x was
+	MathLib::HVectorX zero = MathLib::HVectorX::Zero(900);
+	EXPECT_EQ(solver.Solve(x, zero), 0);
+	EXPECT_EQ(x, zero);
+	EXPECT_EQ(solver.GetIterations(), 0u);
+}
+
+TEST(SolverTest, SimpleSolvers)
+{
+	const MathLib::HSparseMatrixRowMajor rowMajor = MakeLaplacian2D(25);
+	const MathLib::HSparseMatrixColMajor colMajor = rowMajor;
+	const MathLib::HVectorX b = MakeRightHandSide(625);
+	MathLib::HVectorX x;
+	MathLib::SolverTool::SimpleLinearSolver direct(colMajor);
+	ASSERT_EQ(direct.Solve(x, b), 0);
+	EXPECT_LE((b - rowMajor * x).norm(), 1e-4f * b.norm());
+	MathLib::SolverTool::SimpleConjugateGradientSolver iterative(rowMajor);
+	ASSERT_EQ(iterative.Solve(x, b), 0);
+	EXPECT_LE((b - rowMajor * x).norm(), 1e-4f * b.norm());
+	static_assert(!std::is_constructible<MathLib::SolverTool::SimpleConjugateGradientSolver, MathLib::HSparseMatrixRowMajor>::value,
+				  "a temporary matrix would dangle");
+	static_assert(!std::is_constructible<MathLib::SolverTool::SimpleConjugateGradientSolver, const MathLib::HSparseMatrixColMajor &>::value,
+				  "a converted matrix would dangle");
+}
+
+namespace
+{
+	// the stencil assembled cell by cell, extents fastest axis first
+	MathLib::HSparseMatrixRowMajor MakeStencilMatrix(const std::vector<int>& extents, const MathLib::SolverTool::StencilSettings& settings)
+	{
+		int rows = 1;
+		for (const int extent : extents)
+			rows *= extent;
+		std::vector<Eigen::Triplet<MathLib::HReal>> triplets;
+		for (int row = 0; row < rows; row++)
+		{
+			MathLib::HReal diagonal = settings.mShift;
+			int index = row, stride = 1;
+			for (const int extent : extents)
+			{
+				const int coordinate = index % extent;
+				index /= extent;
+				for (const int step : {-1, 1})
+				{
+					if (coordinate + step >= 0 && coordinate + step < extent)
+					{
+						triplets.emplace_back(row, row + step * stride, -settings.mScale);
+						diagonal += settings.mScale;
+					}
+					else if (settings.mBoundary == MathLib::SolverTool::StencilBoundary::eDirichlet)
+						diagonal += settings.mScale;
+				}
+				stride *= extent;
+			}
+			triplets.emplace_back(row, row, diagonal);
+		}
+		MathLib::HSparseMatrixRowMajor matrix(rows, rows);
+		matrix.setFromTriplets(triplets.begin(), triplets.end());
+		return matrix;
+	}
+}
+
+TEST(SolverTest, StencilOperator)
+{
+	MathLib::SolverTool::StencilSettings neumann;
+	neumann.mBoundary = MathLib::SolverTool::StencilBoundary::eNeumann;
+	neumann.mShift = 0.5f;
+	neumann.mScale = 2.f;
+	for (const MathLib::SolverTool::StencilSettings& settings : {MathLib::SolverTool::StencilSettings(), neumann})
+	{
+		auto expectMatches = [&](const auto& op, const std::vector<int>& extents)
+		{
+			const MathLib::HSparseMatrixRowMajor matrix = MakeStencilMatrix(extents, settings);
+			ASSERT_EQ(op.Rows(), uint32_t(matrix.rows()));
+			const MathLib::HVectorX x = MakeRightHandSide(int(matrix.rows()));
+			MathLib::HVectorX y, serialY;
+			op.Multiply(x, y);
+			EXPECT_TRUE(y.isApprox(MathLib::HVectorX(matrix * x)));
+			op.Multiply(x, serialY, MathLib::Parallel::ExecutionPolicy::Serial());
+			EXPECT_EQ(y, serialY);
+			MathLib::HVectorX diagonal;
+			op.Diagonal(diagonal);
+			EXPECT_EQ(diagonal, MathLib::HVectorX(matrix.diagonal()));
+		};
+		// non square, single lines and single cells
+		for (const std::array<uint32_t, 2>& extents : {std::array<uint32_t, 2>{37, 23}, {1, 9}, {9, 1}, {1, 1}})
+			expectMatches(MathLib::SolverTool::LaplacianOperator2D(extents, settings), {int(extents[0]), int(extents[1])});
+		for (const std::array<uint32_t, 3>& extents : {std::array<uint32_t, 3>{17, 11, 6}, {3, 1200, 2}, {1, 1, 5}})
+			expectMatches(MathLib::SolverTool::LaplacianOperator3D(extents, settings), {int(extents[0]), int(extents[1]), int(extents[2])});
+	}
+
+	// the array constructors follow the array layouts
+	MathLib::Array2D<MathLib::HReal> grid2D(7, 5), result2D(7, 5);
+	grid2D(3, 2) = 1.f;
+	const MathLib::SolverTool::LaplacianOperator2D op2D(grid2D);
+	op2D.Apply(grid2D, result2D);
+	EXPECT_EQ(result2D(3, 2), 4.f);
+	EXPECT_EQ(result2D(2, 2), -1.f);
+	EXPECT_EQ(result2D(3, 1), -1.f);
+	EXPECT_EQ(result2D(2, 1), 0.f);
+	MathLib::Array3D<MathLib::HReal> grid3D(4, 5, 6), result3D(4, 5, 6);
+	grid3D(1, 2, 3) = 1.f;
+	const MathLib::SolverTool::LaplacianOperator3D op3D(grid3D);
+	op3D.Apply(grid3D, result3D);
+	EXPECT_EQ(result3D(1, 2, 3), 6.f);
+	EXPECT_EQ(result3D(1, 2, 4), -1.f);
+	EXPECT_EQ(result3D(0, 2, 3), -1.f);
+	EXPECT_EQ(result3D(0, 2, 4), 0.f);
+}
+
+TEST(SolverTest, StencilConjugateGradient)
+{
+	// the stencil replaces the assembled Laplacian without changing the iteration
+	const int n = 40;
+	const MathLib::HSparseMatrixRowMajor matrix = MakeLaplacian2D(n);
+	const MathLib::HVectorX b = MakeRightHandSide(n * n);
+	const MathLib::SolverTool::LaplacianOperator2D stencil({uint32_t(n), uint32_t(n)});
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::HSparseMatrixRowMajor> sparseSolver(matrix);
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::SolverTool::LaplacianOperator2D> stencilSolver(stencil);
+	MathLib::HVectorX sparseX, stencilX;
+	ASSERT_EQ(sparseSolver.Solve(sparseX, b), 0);
+	ASSERT_EQ(stencilSolver.Solve(stencilX, b), 0);
+	EXPECT_EQ(stencilSolver.GetIterations(), sparseSolver.GetIterations());
+	EXPECT_LE((b - matrix * stencilX).norm(), 1e-4f * b.norm());
+
+	// implicit smoothing of a heightmap, solved in place on the array
+	MathLib::SolverTool::StencilSettings smoothing;
+	smoothing.mBoundary = MathLib::SolverTool::StencilBoundary::eNeumann;
+	smoothing.mShift = 1.f;
+	smoothing.mScale = 4.f;
+	MathLib::Array2D<MathLib::HReal> heights(48, 32), smoothed(48, 32);
+	for (uint32_t x = 0; x < 48; x++)
+		for (uint32_t y = 0; y < 32; y++)
+			heights(x, y) = MathLib::HReal((x * 7 + y * 13) % 5);
+	const MathLib::SolverTool::LaplacianOperator2D smoothingOp(heights, smoothing);
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::SolverTool::LaplacianOperator2D> smoothingSolver(smoothingOp);
+	ASSERT_EQ(MathLib::SolverTool::SolveGrid(smoothingSolver, smoothed, heights), 0);
+	MathLib::Array2D<MathLib::HReal> check(48, 32);
+	smoothingOp.Apply(smoothed, check);
+	MathLib::HReal error = 0, heightSum = 0, smoothedSum = 0;
+	for (uint32_t x = 0; x < 48; x++)
+		for (uint32_t y = 0; y < 32; y++)
+		{
+			error = std::max(error, std::abs(check(x, y) - heights(x, y)));
+			heightSum += heights(x, y);
+			smoothedSum += smoothed(x, y);
+		}
+	EXPECT_LE(error, 1e-3f);
+	// zero flux borders keep the mean height
+	EXPECT_NEAR(smoothedSum, heightSum, 1e-3f * heightSum);
+
+	// Poisson on a 3D array
+	MathLib::Array3D<MathLib::HReal> density(12, 10, 8), potential(12, 10, 8), check3D(12, 10, 8);
+	density(6, 5, 4) = 1.f;
+	density(2, 7, 1) = -0.5f;
+	const MathLib::SolverTool::LaplacianOperator3D poisson(density);
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::SolverTool::LaplacianOperator3D> poissonSolver(poisson);
+	ASSERT_EQ(MathLib::SolverTool::SolveGrid(poissonSolver, potential, density), 0);
+	poisson.Apply(potential, check3D);
+	EXPECT_NEAR(check3D(6, 5, 4), 1.f, 1e-4f);
+	EXPECT_NEAR(check3D(2, 7, 1), -0.5f, 1e-4f);
+	EXPECT_NEAR(check3D(0, 0, 0), 0.f, 1e-4f);
+}
+
+TEST(SolverTest, IncompleteCholesky)
+{
+	// without fill outside the pattern IC(0) is the exact Cholesky factor: a tridiagonal system in one application
+	const int size = 50;
+	std::vector<Eigen::Triplet<MathLib::HReal>> triplets;
+	for (int i = 0; i < size; i++)
+	{
+		triplets.emplace_back(i, i, 2.5f);
+		if (i > 0)
+			triplets.emplace_back(i, i - 1, -1.f);
+		if (i + 1 < size)
+			triplets.emplace_back(i, i + 1, -1.f);
+	}
+	MathLib::HSparseMatrixColMajor tridiagonal(size, size);
+	tridiagonal.setFromTriplets(triplets.begin(), triplets.end());
+	const MathLib::HVectorX v = MakeRightHandSide(size);
+	MathLib::HVectorX w;
+	for (const MathLib::HReal modification : {0.f, 1.f})
+	{
+		MathLib::PreconditionerTool::IncompleteCholeskyPreconditioner exact(tridiagonal, modification);
+		exact.Apply(w, v);
+		EXPECT_LE((tridiagonal * w - v).norm(), 1e-5f * v.norm());
+	}
+
+	// on the grid Laplacian both beat Jacobi, MIC(0) more than IC(0)
+	const int n = 48;
+	const MathLib::HSparseMatrixRowMajor matrix = MakeLaplacian2D(n);
+	const MathLib::HVectorX b = MakeRightHandSide(n * n);
+	auto iterations = [&](MathLib::PreconditionerTool::Preconditioner* preconditioner)
+	{
+		MathLib::SolverTool::ConjugateGradientSolver<MathLib::HSparseMatrixRowMajor> solver(matrix);
+		if (preconditioner)
+			solver.SetPreconditioner(preconditioner);
+		MathLib::HVectorX x;
+		EXPECT_EQ(solver.Solve(x, b), 0);
+		EXPECT_LE((b - matrix * x).norm(), 1e-4f * b.norm());
+		return solver.GetIterations();
+	};
+	const uint32_t jacobi = iterations(nullptr);
+	const uint32_t ic = iterations(new MathLib::PreconditionerTool::IncompleteCholeskyPreconditioner(matrix));
+	const uint32_t mic = iterations(new MathLib::PreconditionerTool::IncompleteCholeskyPreconditioner(matrix, 0.97f));
+	EXPECT_LT(ic, jacobi * 2 / 3);
+	EXPECT_LT(mic, ic);
+}
+
+TEST(SolverTest, MultigridPreconditioner)
+{
+	MathLib::SolverTool::StencilSettings neumann;
+	neumann.mBoundary = MathLib::SolverTool::StencilBoundary::eNeumann;
+	neumann.mShift = 0.01f;
+	for (const MathLib::SolverTool::StencilSettings& settings : {MathLib::SolverTool::StencilSettings(), neumann})
+	{
+		// the iteration count stays low from one grid size to the next, odd extents included
+		uint32_t previous = 0;
+		for (const uint32_t n : {33u, 64u, 128u})
+		{
+			const MathLib::SolverTool::LaplacianOperator2D op({n, n + 7}, settings);
+			const MathLib::HVectorX b = MakeRightHandSide(int(op.Rows()));
+			MathLib::SolverTool::ConjugateGradientSolver<MathLib::SolverTool::LaplacianOperator2D> jacobiSolver(op), multigridSolver(op);
+			auto* multigrid = new MathLib::PreconditionerTool::MultigridPreconditioner2D(op);
+			EXPECT_GT(multigrid->GetLevelCount(), 1u);
+			multigridSolver.SetPreconditioner(multigrid);
+			MathLib::HVectorX jacobiX, x, check;
+			ASSERT_EQ(jacobiSolver.Solve(jacobiX, b), 0);
+			ASSERT_EQ(multigridSolver.Solve(x, b), 0);
+			// |x| grows with n^2, so does the float error of the true residual
+			op.Multiply(x, check);
+			EXPECT_LE((b - check).norm(), 1e-3f * b.norm());
+			EXPECT_LT(multigridSolver.GetIterations() * 4, jacobiSolver.GetIterations());
+			if (previous > 0)
+			{
+				EXPECT_LE(multigridSolver.GetIterations(), previous + 4);
+			}
+			previous = multigridSolver.GetIterations();
+
+			// the preconditioner set by the user is kept across solves
+			MathLib::HVectorX again;
+			ASSERT_EQ(multigridSolver.Solve(again, b), 0);
+			EXPECT_EQ(multigridSolver.GetIterations(), previous);
+			EXPECT_EQ(again, x);
+		}
+	}
+
+	const MathLib::SolverTool::LaplacianOperator3D op({20, 17, 24});
+	const MathLib::HVectorX b = MakeRightHandSide(int(op.Rows()));
+	MathLib::SolverTool::ConjugateGradientSolver<MathLib::SolverTool::LaplacianOperator3D> jacobiSolver(op), multigridSolver(op);
+	multigridSolver.SetPreconditioner(new MathLib::PreconditionerTool::MultigridPreconditioner3D(op));
+	MathLib::HVectorX jacobiX, x;
+	ASSERT_EQ(jacobiSolver.Solve(jacobiX, b), 0);
+	ASSERT_EQ(multigridSolver.Solve(x, b), 0);
+	EXPECT_LT(multigridSolver.GetIterations() * 2, jacobiSolver.GetIterations());
+	EXPECT_LE((x - jacobiX).cwiseAbs().maxCoeff(), 1e-3f * jacobiX.cwiseAbs().maxCoeff());
+}
+
+TEST(SolverTest, DirectSolverReuse)
+{
+	MathLib::HSparseMatrixColMajor matrix = MakeLaplacian2D(30);
+	const MathLib::HVectorX b = MakeRightHandSide(900);
+	MathLib::SolverTool::SimpleLinearSolver solver;
+	ASSERT_EQ(solver.Analyze(matrix), 0);
+	EXPECT_TRUE(solver.IsAnalyzed());
+	EXPECT_FALSE(solver.IsFactorized());
+	ASSERT_EQ(solver.Factorize(), 0);
+	MathLib::HVectorX x;
+	ASSERT_EQ(solver.Solve(x, b), 0);
+	EXPECT_LE((b - matrix * x).norm(), 1e-4f * b.norm());
+
+	// new values on the same pattern only need the numeric factorization
+	matrix *= 2.f;
+	ASSERT_EQ(solver.Factorize(), 0);
+	MathLib::HVectorX halved;
+	ASSERT_EQ(solver.Solve(halved, b), 0);
+	EXPECT_TRUE(halved.isApprox(0.5f * x));
+
+	// a block of right-hand sides, one per column, is the same as solving the columns one by one
+	const int columns = 21;
+	MathLib::HMatrixX rightHandSides(900, columns);
+	for (int column = 0; column < columns; column++)
+		rightHandSides.col(column) = MakeRightHandSide(900 + column).tail(900);
+	MathLib::HMatrixX solutions, serialSolutions;
+	ASSERT_EQ(solver.Solve(solutions, rightHandSides), 0);
+	ASSERT_EQ(solver.Solve(serialSolutions, rightHandSides, MathLib::Parallel::ExecutionPolicy::Serial()), 0);
+	EXPECT_EQ(solutions, serialSolutions);
+	for (int column = 0; column < columns; column++)
+	{
+		MathLib::HVectorX single;
+		solver.Solve(single, rightHandSides.col(column));
+		EXPECT_TRUE(solutions.col(column).isApprox(single));
+	}
+
+	// the matrix of the constructor is factorized by the first solve
+	MathLib::SolverTool::SimpleLinearSolver lazy(matrix);
+	EXPECT_FALSE(lazy.IsFactorized());
+	ASSERT_EQ(lazy.Solve(x, b), 0);
+	EXPECT_TRUE(lazy.IsFactorized());
+	EXPECT_TRUE(x.isApprox(halved));
+	// the solver references its matrix, so neither temporaries nor converted matrices may bind to it
+	static_assert(!std::is_constructible<MathLib::SolverTool::SimpleLinearSolver, const MathLib::HSparseMatrixRowMajor &>::value,
+				  "a converted matrix would dangle");
+	static_assert(!std::is_constructible<MathLib::SolverTool::SimpleLinearSolver, MathLib::HSparseMatrixColMajor>::value,
+				  "a temporary matrix would dangle");
+	static_assert(std::is_constructible<MathLib::SolverTool::SimpleLinearSolver, MathLib::HSparseMatrixColMajor &>::value,
+				  "an lvalue matrix is referenced");
+}
@@ -1,2 +1,65 @@
 #pragma once
-#include <Math/GraphicUtils/TriangleMesh.h>
\ No newline at end of file
+#include <gtest/gtest.h>
+#include <Math/GraphicUtils/TriangleMesh.h>
+
+namespace
+{
+	std::vector<std::pair<uint32_t, uint32_t>> FindScaledSelfIntersections(std::vector<MathLib::HVector3> vertices, const std::vector<uint32_t>& indices, const MathLib::HReal scale)
+	{
+		for (MathLib::HVector3& vertex : vertices)
+			vertex *= scale;
+		MathLib::MeshTool::TriangleMesh<uint32_t> mesh(vertices, indices);
+		std::vector<std::pair<uint32_t, uint32_t>> pairs;
+		mesh.FindSelfIntersections(pairs);
+		return pairs;
+	}
+}
+
+TEST(TriangleMeshTest, FindSelfIntersections)
+{
+	// a flat grid of 2 x 2 quads with one triangle piercing it, plus a separate triangle that only touches a grid vertex
+	std::vector<MathLib::HVector3> vertices;
+	std::vector<uint32_t> indices;
+	for (int y = 0; y <= 2; y++)
+		for (int x = 0; x <= 2; x++)
+			vertices.emplace_back(MathLib::HReal(x), MathLib::HReal(y), 0.f);
+	for (uint32_t y = 0; y < 2; y++)
+		for (uint32_t x = 0; x < 2; x++)
+		{
+			const uint32_t corner = y * 3 + x;
+			indices.insert(indices.end(), {corner, corner + 1, corner + 4, corner, corner + 4, corner + 3});
+		}
+	const uint32_t first = static_cast<uint32_t>(vertices.size());
+	vertices.emplace_back(0.3f, 0.2f, -1.f);
+	vertices.emplace_back(0.4f, 0.3f, 1.f);
+	vertices.emplace_back(0.35f, 0.25f + 0.4f, 1.f);
+	indices.insert(indices.end(), {first, first + 1, first + 2});
+	vertices.emplace_back(2.f, 2.f, 1.f);
+	vertices.emplace_back(2.5f, 2.f, 1.f);
+	indices.insert(indices.end(), {8u, first + 3, first + 4});
+
+	MathLib::MeshTool::TriangleMesh<uint32_t> mesh(vertices, indices);
+	std::vector<std::pair<uint32_t, uint32_t>> pairs;
+	mesh.FindSelfIntersections(pairs);
+	// the piercing triangle (8) passes through both triangles of the first quad, across their shared diagonal
+	const std::vector<std::pair<uint32_t, uint32_t>> expected = {{0u, 8u}, {1u, 8u}};
+	EXPECT_EQ(pairs, expected);
+
+	mesh.FindSelfIntersections(pairs, MathLib::Parallel::ExecutionPolicy::Serial());
+	EXPECT_EQ(pairs, expected);
+
+	// the result does not depend on the units of the mesh
+	for (const MathLib::HReal scale : {0.001f, 0.003f, 1000.f})
+		EXPECT_EQ(FindScaledSelfIntersections(vertices, indices, scale), expected);
+}
+
+TEST(TriangleMeshTest, FindSelfIntersectionsFoldedFan)
+{
+	// a fan around the origin whose third triangle folds back through the first, which it shares only the origin with
+	const std::vector<MathLib::HVector3> vertices = {{0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {0.f, 1.f, 0.f}, {-1.f, 0.f, 0.5f}, {1.4f, 0.4f, -0.5f}, {0.f, -1.f, 0.f}, {1.f, -1.f, 0.f}};
+	const std::vector<uint32_t> indices = {0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 5, 6};
+	// neighbours sharing an edge and the flat triangle touching the first one at the origin are not reported
+	const std::vector<std::pair<uint32_t, uint32_t>> expected = {{0u, 2u}};
+	for (const MathLib::HReal scale : {1.f, 0.001f})
+		EXPECT_EQ(FindScaledSelfIntersections(vertices, indices, scale), expected);
+}